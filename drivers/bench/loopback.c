@@ -0,0 +1,150 @@
+#include <linux/netdevice.h>
+#include <linux/etherdevice.h>
+#include <linux/skbuff.h>
+#include <linux/string.h>
+#include "loopback.h"
+
+#define LOOPBACK_RING_SIZE	256	/* Frames on the wire */
+
+struct loopback {
+	struct net_device*	dev;
+	struct napi_struct	napi;
+
+	struct sk_buff*		ring[LOOPBACK_RING_SIZE];
+	unsigned int		head;	/* Next frame to be received */
+	unsigned int		tail;	/* Next slot to be transmitted */
+	bool			irq;	/* Rx interrupt is unmasked */
+};
+
+static void loopback_interrupt(struct loopback* lo) {
+	if(!lo->irq)
+		return;
+
+	// Mask the interrupt until the poll completes
+	lo->irq = false;
+	napi_schedule(&lo->napi);
+}
+
+static netdev_tx_t loopback_start_xmit(struct sk_buff* skb, struct net_device* dev) {
+	struct loopback* lo = netdev_priv(dev);
+
+	if(lo->tail - lo->head >= LOOPBACK_RING_SIZE) {
+		netif_stop_queue(dev);
+		return NETDEV_TX_BUSY;
+	}
+
+	lo->ring[lo->tail++ % LOOPBACK_RING_SIZE] = skb;
+	dev->stats.tx_packets++;
+	dev->stats.tx_bytes += skb->len;
+
+	loopback_interrupt(lo);
+
+	return NETDEV_TX_OK;
+}
+
+/* DMA of the looped back frame into an rx buffer */
+static void loopback_copy(struct sk_buff* rx, struct sk_buff* tx) {
+	unsigned char* data = skb_put(rx, tx->len);
+	unsigned int len = skb_headlen(tx);
+
+	memcpy(data, tx->data, len);
+	data += len;
+
+	for(int i = 0; i < skb_shinfo(tx)->nr_frags; i++) {
+		skb_frag_t* frag = &skb_shinfo(tx)->frags[i];
+		memcpy(data, skb_frag_address(frag), skb_frag_size(frag));
+		data += skb_frag_size(frag);
+	}
+}
+
+static int loopback_poll(struct napi_struct* napi, int budget) {
+	struct loopback* lo = container_of(napi, struct loopback, napi);
+	struct net_device* dev = lo->dev;
+	int work = 0;
+
+	while(work < budget && lo->head != lo->tail) {
+		struct sk_buff* tx = lo->ring[lo->head++ % LOOPBACK_RING_SIZE];
+		struct sk_buff* rx = netdev_alloc_skb_ip_align(dev, tx->len);
+
+		if(rx) {
+			loopback_copy(rx, tx);
+			dev->stats.rx_packets++;
+			dev->stats.rx_bytes += rx->len;
+		} else {
+			dev->stats.rx_dropped++;
+		}
+
+		// Tx completion
+		dev_kfree_skb_any(tx);
+		if(netif_queue_stopped(dev))
+			netif_wake_queue(dev);
+
+		if(rx)
+			napi_gro_receive(napi, rx);
+
+		work++;
+	}
+
+	if(work < budget) {
+		napi_complete_done(napi, work);
+		lo->irq = true;
+
+		// A frame arrived after the ring is drained
+		if(lo->head != lo->tail)
+			loopback_interrupt(lo);
+	}
+
+	return work;
+}
+
+static const struct net_device_ops loopback_netdev_ops = {
+	.ndo_start_xmit		= loopback_start_xmit,
+};
+
+struct net_device* loopback_create(const char* name) {
+	struct net_device* dev = alloc_etherdev(sizeof(struct loopback));
+	if(!dev)
+		return NULL;
+
+	struct loopback* lo = netdev_priv(dev);
+	lo->dev = dev;
+	lo->irq = true;
+
+	strncpy(dev->name, name, sizeof(dev->name) - 1);
+	memcpy(dev->dev_addr, "\x02\x00\x00\x00\x00\x01", ETH_ALEN);
+	dev->netdev_ops = &loopback_netdev_ops;
+	netif_napi_add(dev, &lo->napi, loopback_poll, NAPI_POLL_WEIGHT);
+
+	if(register_netdev(dev) < 0) {
+		netif_napi_del(&lo->napi);
+		free_netdev(dev);
+		return NULL;
+	}
+
+	napi_enable(&lo->napi);
+	netif_start_queue(dev);
+
+	return dev;
+}
+
+void loopback_destroy(struct net_device* dev) {
+	struct loopback* lo = netdev_priv(dev);
+
+	netif_stop_queue(dev);
+	napi_disable(&lo->napi);
+	netif_napi_del(&lo->napi);
+	unregister_netdev(dev);
+
+	while(lo->head != lo->tail)
+		dev_kfree_skb_any(lo->ring[lo->head++ % LOOPBACK_RING_SIZE]);
+
+	free_netdev(dev);
+}
+
+void loopback_stats(struct net_device* dev, uint64_t* rx_packets, uint64_t* polls, uint64_t* budget_exhausted) {
+	struct loopback* lo = netdev_priv(dev);
+
+	*rx_packets = lo->napi.rx_packets;
+	*polls = lo->napi.polls;
+	*budget_exhausted = lo->napi.budget_exhausted;
+}
@@ -0,0 +1,18 @@
+#ifndef __LOOPBACK_H__
+#define __LOOPBACK_H__
+
+#include <stdint.h>
+
+/*
+ * Stand-in NIC driver written against the Linux compatibility layer. Frames
+ * transmitted by the device are received by itself as if the port were
+ * looped back, so the NAPI engine and the skb bridge can be measured without
+ * hardware.
+ */
+struct net_device;
+
+struct net_device* loopback_create(const char* name);
+void loopback_destroy(struct net_device* dev);
+void loopback_stats(struct net_device* dev, uint64_t* rx_packets, uint64_t* polls, uint64_t* budget_exhausted);
+
+#endif /* __LOOPBACK_H__ */
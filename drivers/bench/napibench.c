@@ -0,0 +1,259 @@
+/*
+ * NAPI engine benchmark. The Linux compatibility layer runs in user space
+ * with the kernel services it needs stubbed, and the loopback stand-in driver
+ * delivers the frames the NIC device transmits back to it. The rate of frames
+ * delivered to the NIC device by the NAPI engine is reported.
+ *
+ * Usage: napibench [-t seconds] [-s frame size]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <gmalloc.h>
+#include <lock.h>
+#include <apic.h>
+#include <util/event.h>
+#include <nicdev.h>
+#include "loopback.h"
+
+#define POOL_COUNT	4096
+#define BUFFER_SIZE	4096
+
+static struct {
+	int		seconds;
+	int		size;
+} config = {
+	.seconds = 3,
+	.size = 64,
+};
+
+static uint64_t gmalloc_calls;
+static uint64_t delivered;
+
+/*
+ * Packet pool standing for the VNIC packet pools, packets to be transmitted
+ * are allocated from it
+ */
+static Packet* pool_free;
+static uint8_t* pool_buffer;
+
+static Packet* pool_alloc(uint16_t size) {
+	Packet* packet = pool_free;
+	if(!packet || size > BUFFER_SIZE - sizeof(Packet))
+		return NULL;
+
+	pool_free = *(Packet**)packet->buffer;
+	packet->time = 0;
+	packet->start = packet->end = 0;
+	packet->size = size;
+
+	return packet;
+}
+
+static bool pool_init() {
+	if(posix_memalign((void**)&pool_buffer, 64, (size_t)POOL_COUNT * BUFFER_SIZE))
+		return false;
+
+	for(int i = 0; i < POOL_COUNT; i++) {
+		Packet* packet = (Packet*)(pool_buffer + (size_t)i * BUFFER_SIZE);
+		*(Packet**)packet->buffer = pool_free;
+		pool_free = packet;
+	}
+
+	return true;
+}
+
+bool nic_free(Packet* packet) {
+	*(Packet**)packet->buffer = pool_free;
+	pool_free = packet;
+
+	return true;
+}
+
+/*
+ * Kernel services of a single core
+ */
+void* gmalloc(size_t size) {
+	gmalloc_calls++;
+	return malloc(size);
+}
+
+void gfree(void* ptr) {
+	free(ptr);
+}
+
+void lock_lock(uint8_t volatile* lock) {
+	while(__sync_lock_test_and_set(lock, 1));
+}
+
+void lock_unlock(uint8_t volatile* lock) {
+	__sync_lock_release(lock);
+}
+
+uint8_t mp_core_id() {
+	return 0;
+}
+
+static bool interrupt = true;
+
+bool apic_enabled() {
+	return interrupt;
+}
+
+void apic_enable() {
+	interrupt = true;
+}
+
+void apic_disable() {
+	interrupt = false;
+}
+
+static EventFunc busy_func;
+static void* busy_context;
+
+uint64_t event_busy_add(EventFunc func, void* context) {
+	busy_func = func;
+	busy_context = context;
+
+	return 1;
+}
+
+/*
+ * NIC device manager. Every VNIC packet to be transmitted is a frame for the
+ * loopback, and every frame received is counted as delivered.
+ */
+static NICDevice* nic_device;
+
+int nicdev_register(NICDevice* dev) {
+	if(nic_device)
+		return -1;
+
+	nic_device = dev;
+	return 0;
+}
+
+NICDevice* nicdev_unregister(const char* name) {
+	NICDevice* dev = nicdev_get(name);
+	if(dev)
+		nic_device = NULL;
+
+	return dev;
+}
+
+NICDevice* nicdev_get(const char* name) {
+	return nic_device && !strcmp(nic_device->name, name) ? nic_device : NULL;
+}
+
+int nicdev_tx(NICDevice* dev, bool (*process)(Packet* packet, void* context), void* context) {
+	int count;
+	for(count = 0; count < NICDEV_BURST_SIZE; count++) {
+		Packet* packet = pool_alloc(config.size);
+		if(!packet)
+			break;
+
+		memset(packet->buffer, 0xff, 6);
+		memcpy(packet->buffer + 6, "\x02\x00\x00\x00\x00\x02", 6);
+		memcpy(packet->buffer + 12, "\x08\x00", 2);
+		packet->end = config.size;
+
+		if(!process(packet, context)) {
+			nic_free(packet);
+			break;
+		}
+	}
+
+	return count;
+}
+
+int nicdev_rx(NICDevice* dev, void* data, size_t size) {
+	delivered++;
+
+	return NICDEV_PROCESS_COMPLETE;
+}
+
+int nicdev_rx_vlan(NICDevice* dev, uint16_t tci, void* data, size_t size) {
+	delivered++;
+
+	return NICDEV_PROCESS_COMPLETE;
+}
+
+static double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// An event loop turn of the core
+static void loop(NICDriver* driver) {
+	driver->poll(0);
+	busy_func(busy_context);
+}
+
+int main(int argc, char** argv) {
+	int opt;
+	while((opt = getopt(argc, argv, "t:s:")) != -1) {
+		switch(opt) {
+			case 't':
+				config.seconds = atoi(optarg);
+				break;
+			case 's':
+				config.size = atoi(optarg);
+				break;
+			default:
+				fprintf(stderr, "Usage: %s [-t seconds] [-s frame size]\n", argv[0]);
+				return 1;
+		}
+	}
+
+	if(config.seconds < 1 || config.size < 60 || config.size > 1514) {
+		fprintf(stderr, "Invalid arguments\n");
+		return 1;
+	}
+
+	if(!pool_init())
+		return 1;
+
+	struct net_device* dev = loopback_create("lo0");
+	if(!dev || !nic_device || !busy_func) {
+		fprintf(stderr, "Cannot create the loopback device\n");
+		return 1;
+	}
+
+	NICDriver* driver = nic_device->driver;
+
+	// Warm up the skb cache
+	for(int i = 0; i < 1000; i++)
+		loop(driver);
+
+	uint64_t calls = gmalloc_calls;
+	uint64_t count = delivered;
+	uint64_t turns = 0;
+	double start = now();
+	double end = start + config.seconds;
+	double current;
+	do {
+		for(int i = 0; i < 1000; i++)
+			loop(driver);
+
+		turns += 1000;
+	} while((current = now()) < end);
+
+	count = delivered - count;
+	calls = gmalloc_calls - calls;
+
+	uint64_t rx_packets, polls, budget_exhausted;
+	loopback_stats(dev, &rx_packets, &polls, &budget_exhausted);
+
+	printf("%d bytes: %.2f Mpps delivered (%lu frames in %.2f s)\n",
+			config.size,
+			count / (current - start) / 1e6, count, current - start);
+	printf("turns %lu, polls %lu, budget exhausted %lu, gmalloc calls %lu\n",
+			turns, polls, budget_exhausted, calls);
+
+	loopback_destroy(dev);
+
+	return 0;
+}
@@ -6,7 +6,7 @@ workspace "Kernel"
         location "linux/build"
         targetname "linux.ko"
         targetdir "."
-        includedirs { "../kernel/src", "../lib/core/include", "./linux" }
+        includedirs { "../kernel/src", "../lib/core/include", "../lib/vnic/include", "./linux" }
         linkoptions { "-r" }
         files { "linux/**.h", "linux/**.c" }
         removefiles { "linux/packetngin/**.h", "linux/packetngin/**.c" }
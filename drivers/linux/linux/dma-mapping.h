@@ -12,7 +12,7 @@
 #define DEFINE_DMA_UNMAP_ADDR(ADDR_NAME)        	dma_addr_t ADDR_NAME
 #define DEFINE_DMA_UNMAP_LEN(LEN_NAME)        		__u32 LEN_NAME
 #define dma_map_single(dev, cpu_addr, size, dir)	(cpu_addr)
-#define dma_map_page(dev, page, offset, size, dir)	(page + offset)
+#define dma_map_page(dev, page, offset, size, dir)	((void*)(page) + (offset))
 #define dma_unmap_addr(PTR, ADDR_NAME)  	        ((PTR)->ADDR_NAME)
 #define dma_unmap_addr_set(PTR, ADDR_NAME, VAL)  (((PTR)->ADDR_NAME) = (VAL))
 #define dma_unmap_len(PTR, LEN_NAME)			((PTR)->LEN_NAME)
@@ -8,6 +8,8 @@
 bool is_valid_ether_addr(const u8 *addr);
 __be16 eth_type_trans(struct sk_buff *skb, struct net_device *dev);
 struct net_device* alloc_etherdev(int sizeof_priv); 
+struct net_device* alloc_etherdev_mqs(int sizeof_priv, unsigned int txqs, unsigned int rxqs);
+#define alloc_etherdev_mq(sizeof_priv, count)	alloc_etherdev_mqs(sizeof_priv, count, count)
 int eth_validate_addr(struct net_device *dev);
 
 static inline bool is_multicast_ether_addr(const u8 *addr)
@@ -10,11 +10,14 @@
 #include <linux/list.h>
 #include <linux/bitops.h>
 #include <asm/barrier.h>
+#include <lock.h>
 
 #define MAX_ADDR_LEN	32
 
 #define alloc_netdev(sizeof_priv, name, setup) \
 	alloc_netdev_mqs(sizeof_priv, name, setup, 1, 1)
+#define alloc_netdev_mq(sizeof_priv, name, setup, count) \
+	alloc_netdev_mqs(sizeof_priv, name, setup, count, count)
 
 #define netif_err(priv, type, dev, fmt, args...)	printf("netif_err: " fmt, ##args)
 #define netif_warn(priv, type, dev, fmt, args...)	printf("netif_warn: " fmt, ##args)
@@ -61,6 +64,10 @@
 #define SET_NETDEV_DEV(net, pdev)	((net)->dev = (pdev))
 
 #define NAPI_POLL_WEIGHT	64
+#define NAPI_POLL_BUDGET	300	/* Packets per event loop turn of a core, as netdev_budget */
+
+#define NET_RX_SUCCESS		0	/* keep 'em coming, baby */
+#define NET_RX_DROP		1	/* packet dropped */
 
 enum {
 	NETIF_MSG_DRV           = 0x0001,
@@ -123,7 +130,17 @@ struct net_device_stats {
 };
 
 typedef enum netdev_tx netdev_tx_t;
+
+enum rx_handler_result {
+	RX_HANDLER_CONSUMED,
+	RX_HANDLER_ANOTHER,
+	RX_HANDLER_EXACT,
+	RX_HANDLER_PASS,
+};
+typedef enum rx_handler_result rx_handler_result_t;
+typedef rx_handler_result_t rx_handler_func_t(struct sk_buff **pskb);
 typedef u64 netdev_features_t;
+typedef u16 (*select_queue_fallback_t)(struct net_device *dev, struct sk_buff *skb);
 
 struct net_device_ops {
 	struct net_device_stats*	(*ndo_get_stats)(struct net_device *dev);
@@ -132,6 +149,8 @@ struct net_device_ops {
 	int				(*ndo_stop)(struct net_device *dev);
 	struct rtnl_link_stats64*	(*ndo_get_stats64)(struct net_device *dev, struct rtnl_link_stats64 *storage);
 	netdev_tx_t			(*ndo_start_xmit) (struct sk_buff *skb, struct net_device *dev);
+	u16				(*ndo_select_queue)(struct net_device *dev, struct sk_buff *skb,
+							void *accel_priv, select_queue_fallback_t fallback);
 	void				(*ndo_tx_timeout) (struct net_device *dev);
 	int				(*ndo_validate_addr)(struct net_device *dev);
 	int				(*ndo_change_mtu)(struct net_device *dev, int new_mtu);
@@ -202,6 +221,12 @@ End of GurumNetworks modification */
 
 	unsigned long		state;
 
+	/* PacketNgin: the queue is transmitted by a core under its own lock */
+	struct net_device	*dev;
+	volatile uint8_t	xmit_lock;
+	u16			index;
+	int			core;		/* Transmitting core, -1 for any */
+
 /* Start of GurumNetworks modification
 #ifdef CONFIG_BQL
 	struct dql		dql;
@@ -221,7 +246,6 @@ struct net_device {
 	void* 				dev;
 
 	char				name[16]; 
-	int 				tx_queue; 
 	int				irq; 
 
 	struct net_device_stats		stats;
@@ -248,15 +272,39 @@ struct net_device {
 	void* 				priv; 
 
 	unsigned int			num_rx_queues;
+	unsigned int			real_num_rx_queues;
 	unsigned int			num_tx_queues;
+	unsigned int			real_num_tx_queues;
 	struct netdev_queue		*_tx;
 
 	struct netdev_hw_addr_list	mc;
 	struct netdev_hw_addr_list	uc;
+
+	rx_handler_func_t*		rx_handler;
+	void*				rx_handler_data;
+
+	struct skb_cache*		skb_cache;	/* Recycling rx/tx skbs */
+};
+
+enum {
+	NAPI_STATE_SCHED,	/* Poll is scheduled */
+	NAPI_STATE_DISABLE,	/* Disable pending */
 };
 
 struct napi_struct {
-	bool	enabled;
+	struct napi_struct*	poll_next;	/* Poll list of the core */
+	void*			poll_list;	/* The list holding the context, NULL if not scheduled */
+	unsigned long		state;
+	int			weight;
+	int			(*poll)(struct napi_struct *, int);
+	struct net_device*	dev;
+	bool			enabled;
+	int			core;		/* Polling core, -1 for the scheduling core */
+
+	/* Statistics to measure delivery rate */
+	u64			rx_packets;
+	u64			polls;
+	u64			budget_exhausted;
 };
 
 struct net_device *alloc_netdev_mqs(int sizeof_priv, const char *name,
@@ -291,12 +339,24 @@ int netif_queue_stopped(const struct net_device *dev);
 void netif_wake_queue(struct net_device *dev);
 void netif_wake_subqueue(struct net_device *dev, u16 queue_index);
 int netif_running(const struct net_device *dev);
+void netif_napi_add(struct net_device *dev, struct napi_struct *napi,
+		int (*poll)(struct napi_struct *, int), int weight);
+void netif_napi_del(struct napi_struct *napi);
 void napi_enable(struct napi_struct* n);
 void napi_disable(struct napi_struct* n);
 void napi_gro_receive(struct napi_struct* n, struct sk_buff* buf);
+bool napi_schedule_prep(struct napi_struct *n);
+void __napi_schedule(struct napi_struct *n);
+void napi_complete_done(struct napi_struct *n, int work_done);
 void napi_complete(struct napi_struct *n);
 void napi_schedule(struct napi_struct* n);
 void napi_synchronize(const struct napi_struct *n);
+void napi_set_core(struct napi_struct *n, int core);
+void netif_set_queue_core(struct net_device *dev, u16 queue_index, int core);
+struct netdev_queue *netdev_pick_tx(struct net_device *dev, struct sk_buff *skb, void *accel_priv);
+u16 __netdev_pick_tx(struct net_device *dev, struct sk_buff *skb);
+int netdev_rx_handler_register(struct net_device *dev, rx_handler_func_t *rx_handler, void *rx_handler_data);
+void netdev_rx_handler_unregister(struct net_device *dev);
 
 enum netdev_priv_flags {
 	IFF_802_1Q_VLAN			= 1<<0,
@@ -388,9 +448,90 @@ static inline void netif_tx_stop_queue(struct netdev_queue *dev_queue)
 
 static inline void netif_stop_subqueue(struct net_device *dev, u16 queue_index)
 {
-	struct netdev_queue *txq = netdev_get_tx_queue(dev, queue_index);
-	txq->state = 1;
-	netif_tx_stop_queue(txq);
+	netif_tx_stop_queue(netdev_get_tx_queue(dev, queue_index));
+}
+
+static inline void netif_start_subqueue(struct net_device *dev, u16 queue_index)
+{
+	netif_tx_start_queue(netdev_get_tx_queue(dev, queue_index));
+}
+
+static inline void netif_tx_wake_queue(struct netdev_queue *dev_queue)
+{
+	clear_bit(__QUEUE_STATE_DRV_XOFF, &dev_queue->state);
+}
+
+static inline bool netif_tx_queue_stopped(const struct netdev_queue *dev_queue)
+{
+	return test_bit(__QUEUE_STATE_DRV_XOFF, &dev_queue->state);
+}
+
+static inline bool __netif_subqueue_stopped(const struct net_device *dev, u16 queue_index)
+{
+	return netif_tx_queue_stopped(netdev_get_tx_queue(dev, queue_index));
+}
+
+static inline bool netif_is_multiqueue(const struct net_device *dev)
+{
+	return dev->num_tx_queues > 1;
+}
+
+static inline void __netif_tx_lock(struct netdev_queue *txq, int cpu)
+{
+	lock_lock(&txq->xmit_lock);
+}
+
+static inline bool __netif_tx_trylock(struct netdev_queue *txq)
+{
+	return lock_trylock(&txq->xmit_lock);
+}
+
+static inline void __netif_tx_unlock(struct netdev_queue *txq)
+{
+	lock_unlock(&txq->xmit_lock);
+}
+
+#define __netif_tx_lock_bh(txq)		__netif_tx_lock(txq, 0)
+#define __netif_tx_unlock_bh(txq)	__netif_tx_unlock(txq)
+
+static inline void netif_tx_lock(struct net_device *dev)
+{
+	for (unsigned int i = 0; i < dev->num_tx_queues; i++)
+		__netif_tx_lock(netdev_get_tx_queue(dev, i), 0);
+}
+
+static inline void netif_tx_unlock(struct net_device *dev)
+{
+	for (unsigned int i = 0; i < dev->num_tx_queues; i++)
+		__netif_tx_unlock(netdev_get_tx_queue(dev, i));
+}
+
+#define netif_tx_lock_bh(dev)		netif_tx_lock(dev)
+#define netif_tx_unlock_bh(dev)		netif_tx_unlock(dev)
+
+static inline u16 skb_get_queue_mapping(const struct sk_buff *skb)
+{
+	return skb->queue_mapping;
+}
+
+static inline void skb_set_queue_mapping(struct sk_buff *skb, u16 queue_mapping)
+{
+	skb->queue_mapping = queue_mapping;
+}
+
+static inline void skb_record_rx_queue(struct sk_buff *skb, u16 rx_queue)
+{
+	skb->queue_mapping = rx_queue + 1;
+}
+
+static inline bool skb_rx_queue_recorded(const struct sk_buff *skb)
+{
+	return skb->queue_mapping != 0;
+}
+
+static inline u16 skb_get_rx_queue(const struct sk_buff *skb)
+{
+	return skb->queue_mapping - 1;
 }
 
 static inline bool netif_xmit_stopped(const struct netdev_queue *dev_queue)
@@ -405,7 +546,7 @@ static inline void netdev_tx_reset_queue(struct netdev_queue *dev_queue)
 
 static inline void netdev_tx_sent_queue(struct netdev_queue *dev_queue, unsigned int bytes)
 {
-	set_bit(__QUEUE_STATE_STACK_XOFF, &dev_queue->state);
+	/* Byte queue limits are not supported, the queue is never stopped by the stack */
 }
 
 static inline void netdev_tx_completed_queue(struct netdev_queue *dev_queue, unsigned int pkts, unsigned int bytes)
@@ -6,11 +6,15 @@
 #include <linux/dma-mapping.h>
 #include <linux/scatterlist.h>
 #include <linux/atomic.h>
+#include <packet.h>
 
 #define MAX_SKB_FRAGS			1
 #define NET_SKB_PAD			32 
 #define NET_IP_ALIGN			2
 
+#define SKB_CACHE_BUF_SIZE		2048	/* Data size of cached skb, enough for a VLAN tagged frame */
+#define SKB_CACHE_SLAB			256	/* Number of skbs allocated at once */
+
 #define CHECKSUM_NONE			0
 #define CHECKSUM_UNNECESSARY		1
 #define CHECKSUM_COMPLETE		2
@@ -69,6 +73,8 @@ struct sk_buff {
 	struct net_device*	dev;
 
 	__be16			protocol;
+	__be16			vlan_proto;
+	__u16			vlan_tci;
 
 	unsigned int		len;
 	unsigned int 		tail;
@@ -89,6 +95,23 @@ struct sk_buff {
 				head_frag:1,
 				xmit_more:1;
 	atomic64_t		users;
+	struct skb_cache*	cache;		/* Cache to recycle, NULL if allocated alone */
+	Packet*			packet;		/* VNIC packet holding the data, freed with the skb */
+};
+
+/*
+ * Recycling cache of skbs. sk_buff, data and skb_shared_info of an skb are
+ * colocated in a cache aligned block of slabs. Freed skbs return to the free
+ * list and are reused by rx refill, so allocation calls gmalloc only when the
+ * cache grows.
+ */
+struct skb_cache {
+	volatile uint8_t	lock;
+	struct sk_buff*		free;		/* Free list linked by skb->next */
+	unsigned int		free_count;
+	unsigned int		count;		/* Number of skbs of the cache */
+	unsigned int		stride;		/* Block size of an skb */
+	void*			slabs;		/* Slab list, linked by the first word */
 };
 
 typedef struct skb_frag_struct skb_frag_t;
@@ -125,14 +148,22 @@ struct skb_shared_info {
 	skb_frag_t		frags[MAX_SKB_FRAGS];
 };
 
+struct skb_cache* skb_cache_create(unsigned int count);
+void skb_cache_destroy(struct skb_cache* cache);
+
 unsigned int skb_headlen(const struct sk_buff *skb);
 struct sk_buff *netdev_alloc_skb_ip_align(struct net_device* dev, int size);
 void consume_skb(struct sk_buff *skb);
 int skb_padto(struct sk_buff *skb, unsigned int len);
 struct sk_buff* __vlan_hwaccel_put_tag(struct sk_buff* skb, __be16 vlan_proto, u16 vlan_tci);
+struct sk_buff* __vlan_hwaccel_push_inside(struct sk_buff* skb);
 struct sk_buff *dev_alloc_skb(unsigned int length);
 int skb_pad(struct sk_buff *skb, int pad);
 unsigned char *skb_put(struct sk_buff *skb, unsigned int len);
+struct sk_buff *netdev_alloc_skb_packet(struct net_device *dev, Packet *packet);
+Packet *skb_detach_packet(struct sk_buff *skb);
+unsigned char *skb_push(struct sk_buff *skb, unsigned int len);
+unsigned char *skb_pull(struct sk_buff *skb, unsigned int len);
 void skb_reserve(struct sk_buff *skb, int len);
 
 #define skb_shinfo(SKB)	((struct skb_shared_info *)(skb_end_pointer(SKB)))
@@ -144,13 +175,17 @@ static inline unsigned char *skb_network_header(const struct sk_buff *skb)
 
 static inline unsigned char *skb_end_pointer(const struct sk_buff *skb)
 {
-	return NULL;
-	//	return skb->head + skb->end;
+	return skb->end;
+}
+
+static inline unsigned char *skb_tail_pointer(const struct sk_buff *skb)
+{
+	return skb->head + skb->tail;
 }
 
 static inline int skb_tailroom(const struct sk_buff *skb)
 {
-	return 0; //skb_is_nonlinear(skb) ? 0 : skb->end - skb->tail;
+	return skb->data_len ? 0 : skb->end - skb_tail_pointer(skb);
 }
 
 static inline bool skb_is_gso(const struct sk_buff *skb)
@@ -195,6 +230,11 @@ static inline unsigned int skb_frag_size(const skb_frag_t *frag)
 	return frag->size;
 }
 
+static inline void *skb_frag_address(const skb_frag_t *frag)
+{
+	return (void *)frag->page.p + frag->page_offset;
+}
+
 static inline dma_addr_t skb_frag_dma_map(struct device *dev,
 					  const skb_frag_t *frag,
 					  size_t offset, size_t size,
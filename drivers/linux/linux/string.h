@@ -5,6 +5,7 @@
 
 void* memset(void *, int, size_t);
 void* memcpy(void *,const void *,__kernel_size_t);
+void* memmove(void *,const void *,__kernel_size_t);
 size_t strlen(const char *);
 char* strcpy(char *, const char *);
 char* strncpy(char *, const char *, size_t);
@@ -29,14 +29,10 @@ int eth_validate_addr(struct net_device *dev) {
 
 __be16 eth_type_trans(struct sk_buff *skb, struct net_device *dev){ return 0; }
 
+struct net_device* alloc_etherdev_mqs(int sizeof_priv, unsigned int txqs, unsigned int rxqs) {
+	return alloc_netdev_mqs(sizeof_priv, "eth%d", ether_setup, txqs, rxqs);
+}
+
 struct net_device* alloc_etherdev(int sizeof_priv) {
-	struct net_device* dev = gmalloc(sizeof(struct net_device));
-	bzero(dev, sizeof(struct net_device));
-//	memcpy(dev->name, "eth0", 5);
-	dev->mtu = 1500;
-	dev->addr_len = ETH_ALEN;
-	dev->priv = gmalloc(sizeof_priv);
-	bzero(dev->priv, sizeof_priv);
-	
-	return dev;
+	return alloc_etherdev_mqs(sizeof_priv, 1, 1);
 }
@@ -4,16 +4,61 @@
 #include <linux/if_arp.h> 
 #include <linux/printk.h>
 #include <linux/string.h>
+#include <linux/if_vlan.h>
+#include <util/event.h>
 #include <gmalloc.h>
+#include <mp.h>
+#include <apic.h>
+#include <driver/nicdev.h>
+
+extern int sprintf(char* str, const char* format, ...);
 
 struct net_device *alloc_netdev_mqs(int sizeof_priv, const char *name,
 				void (*setup)(struct net_device *),
 						unsigned int txqs, unsigned int rxqs) { 
-	return NULL; 
+	if(txqs < 1 || rxqs < 1)
+		return NULL;
+
+	struct net_device* dev = gmalloc(sizeof(struct net_device));
+	if(!dev)
+		return NULL;
+
+	memset(dev, 0, sizeof(struct net_device));
+
+	dev->priv = sizeof_priv > 0 ? gmalloc(sizeof_priv) : NULL;
+	dev->_tx = gmalloc(sizeof(struct netdev_queue) * txqs);
+	if((sizeof_priv > 0 && !dev->priv) || !dev->_tx) {
+		gfree(dev->priv);
+		gfree(dev->_tx);
+		gfree(dev);
+		return NULL;
+	}
+
+	if(dev->priv)
+		memset(dev->priv, 0, sizeof_priv);
+	memset(dev->_tx, 0, sizeof(struct netdev_queue) * txqs);
+	for(unsigned int i = 0; i < txqs; i++) {
+		dev->_tx[i].dev = dev;
+		dev->_tx[i].index = i;
+		dev->_tx[i].core = -1;
+	}
+
+	dev->num_tx_queues = dev->real_num_tx_queues = txqs;
+	dev->num_rx_queues = dev->real_num_rx_queues = rxqs;
+
+	strncpy(dev->name, name, sizeof(dev->name) - 1);
+	if(setup)
+		setup(dev);
+
+	return dev;
 }
 
 void free_netdev(struct net_device *dev) {
 	if(dev) {
+		if(dev->skb_cache)
+			skb_cache_destroy(dev->skb_cache);
+
+		gfree(dev->_tx);
 		gfree(dev->priv);
 		gfree(dev);
 	}
@@ -40,7 +85,6 @@ void netif_tx_start_all_queues(struct net_device *dev) {
 
 	for (i = 0; i < dev->num_tx_queues; i++) {
 		struct netdev_queue *txq = netdev_get_tx_queue(dev, i);
-		txq->state = 1;
 		netif_tx_start_queue(txq);
 	}
 }
@@ -49,7 +93,6 @@ void netif_tx_stop_all_queues(struct net_device *dev) {
 	uint32_t i;
 	for(i = 0; i < dev->num_tx_queues; i++) {
 		struct netdev_queue *txq = netdev_get_tx_queue(dev, i);
-		txq->state = 0;
 		netif_tx_stop_queue(txq);
 	}
 }
@@ -183,74 +226,449 @@ void netdev_change_features(struct net_device *dev) {
 }
 
 void dev_kfree_skb_any(struct sk_buff *skb) {
-	gfree(skb->data);
-	gfree(skb);
+	consume_skb(skb);
+}
+
+/*
+ * PacketNgin NIC device glue. Received skbs are delivered to the NIC device
+ * by its rx_handler, and packets of its VNICs are transmitted by NIC driver's poll.
+ */
+static struct net_device* netdevs[MAX_NIC_DEVICE_COUNT];
+
+static void poll_event_init();
+
+static rx_handler_result_t nicdev_rx_handler(struct sk_buff** pskb) {
+	struct sk_buff* skb = *pskb;
+	NICDevice* nic_device = skb->dev->rx_handler_data;
+
+	// Compat drivers keep skb->data at the Ethernet header
+	if(skb_vlan_tag_present(skb))
+		nicdev_rx_vlan(nic_device, skb_vlan_tag_get(skb), skb->data, skb->len);
+	else
+		nicdev_rx(nic_device, skb->data, skb->len);
+
+	// VNICs have copied the packet and there is no upper stack
+	dev_kfree_skb_any(skb);
+	return RX_HANDLER_CONSUMED;
+}
+
+static bool nicdev_xmit(Packet* packet, void* context) {
+	struct net_device* dev = context;
+
+	// The packet is freed by the skb on tx completion
+	struct sk_buff* skb = netdev_alloc_skb_packet(dev, packet);
+	if(!skb)
+		return false;
+
+	struct netdev_queue* txq = netdev_pick_tx(dev, skb, NULL);
+	netdev_tx_t result = NETDEV_TX_BUSY;
+
+	__netif_tx_lock(txq, mp_core_id());
+	if(!netif_xmit_stopped(txq))
+		result = dev->netdev_ops->ndo_start_xmit(skb, dev);
+	__netif_tx_unlock(txq);
+
+	if(result != NETDEV_TX_OK) {
+		dev->stats.tx_dropped++;
+		skb_detach_packet(skb);
+		dev_kfree_skb_any(skb);
+		return false;
+	}
+
+	return true;
 }
 
+/*
+ * Called by every core polling NIC devices. VNICs are drained concurrently,
+ * and each core transmits on its own queue picked by netdev_pick_tx.
+ */
+static int nicdev_poll_netdevs(int id) {
+	poll_event_init();
+
+	for(int i = 0; i < MAX_NIC_DEVICE_COUNT; i++) {
+		struct net_device* dev = netdevs[i];
+		if(!dev || !dev->rx_handler_data)
+			continue;
+
+		if(netif_xmit_stopped(netdev_get_tx_queue(dev, __netdev_pick_tx(dev, NULL))))
+			continue;
+
+		nicdev_tx(dev->rx_handler_data, nicdev_xmit, dev);
+	}
+
+	return 0;
+}
+
+static NICDriver netdev_nic_driver = {
+	.poll = nicdev_poll_netdevs,
+};
+
 int register_netdev(struct net_device *dev) { 
-	printf("register netdev\n");
+	int index = -1;
+	for(int i = 0; i < MAX_NIC_DEVICE_COUNT; i++) {
+		if(!netdevs[i]) {
+			index = i;
+			break;
+		}
+	}
+
+	if(index < 0)
+		return -1;
+
+	NICDevice* nic_device = gmalloc(sizeof(NICDevice));
+	if(!nic_device)
+		return -1;
+
+	memset(nic_device, 0, sizeof(NICDevice));
+
+	if(dev->name[0] == '\0' || !strcmp(dev->name, "eth%d")) {
+		for(int i = 0; ; i++) {
+			sprintf(dev->name, "eth%d", i);
+			if(!nicdev_get(dev->name))
+				break;
+		}
+	}
+
+	strcpy(nic_device->name, dev->name);
+	for(int i = 0; i < ETH_ALEN; i++)
+		nic_device->mac = nic_device->mac << 8 | dev->dev_addr[i];
+	nic_device->driver = &netdev_nic_driver;
+
+	if(nicdev_register(nic_device) < 0) {
+		gfree(nic_device);
+		return -1;
+	}
+
+	netdevs[index] = dev;
+	netdev_rx_handler_register(dev, nicdev_rx_handler, nic_device);
+
+	printf("register netdev: %s\n", dev->name);
 	return 0;
 }
 
 void unregister_netdev(struct net_device *dev) {
-	printf("unregister netdev\n");
+	for(int i = 0; i < MAX_NIC_DEVICE_COUNT; i++) {
+		if(netdevs[i] == dev)
+			netdevs[i] = NULL;
+	}
+
+	NICDevice* nic_device = dev->rx_handler_data;
+	netdev_rx_handler_unregister(dev);
+	if(nic_device) {
+		nicdev_unregister(nic_device->name);
+		gfree(nic_device);
+	}
+
+	printf("unregister netdev: %s\n", dev->name);
+}
+
+int netdev_rx_handler_register(struct net_device *dev, rx_handler_func_t *rx_handler, void *rx_handler_data) {
+	if(dev->rx_handler)
+		return -1;
+
+	dev->rx_handler_data = rx_handler_data;
+	dev->rx_handler = rx_handler;
+	return 0;
+}
+
+void netdev_rx_handler_unregister(struct net_device *dev) {
+	dev->rx_handler = NULL;
+	dev->rx_handler_data = NULL;
 }
 
 void netif_start_queue(struct net_device *dev) {
 	printf("netif: start queue\n");
-	dev->tx_queue = 1;
+	netif_tx_start_queue(netdev_get_tx_queue(dev, 0));
 }
 
 void netif_stop_queue(struct net_device *dev) {
 	//printf("netif: stop queue\n");
-	dev->tx_queue = 0;
+	netif_tx_stop_queue(netdev_get_tx_queue(dev, 0));
 }
 
 int netif_queue_stopped(const struct net_device *dev) {
-	return dev->tx_queue == 0;
+	return netif_tx_queue_stopped(netdev_get_tx_queue(dev, 0));
 }
 
 int netif_receive_skb(struct sk_buff *skb) { 
-	return 0;
+	struct net_device* dev = skb->dev;
+	if(!dev || !dev->rx_handler) {
+		dev_kfree_skb_any(skb);
+		return NET_RX_DROP;
+	}
+
+	switch(dev->rx_handler(&skb)) {
+		case RX_HANDLER_CONSUMED:
+			return NET_RX_SUCCESS;
+		default:
+			// There is no upper stack to pass to
+			dev_kfree_skb_any(skb);
+			return NET_RX_DROP;
+	}
 }
 
 void netif_wake_queue(struct net_device *dev) {
-	dev->tx_queue = 1;
+	netif_tx_wake_queue(netdev_get_tx_queue(dev, 0));
 }
 
 void netif_wake_subqueue(struct net_device *dev, u16 queue_index) {
-	(&dev->_tx[queue_index])->state = 1;
+	netif_tx_wake_queue(netdev_get_tx_queue(dev, queue_index));
 }
 
 int netif_set_real_num_tx_queues(struct net_device *dev, unsigned int txq) {
+	if(txq < 1 || txq > dev->num_tx_queues)
+		return -1;
+
+	dev->real_num_tx_queues = txq;
 	return 0;
 }
 
 int netif_set_real_num_rx_queues(struct net_device *dev, unsigned int rxq) {
+	if(rxq < 1 || rxq > dev->num_rx_queues)
+		return -1;
+
+	dev->real_num_rx_queues = rxq;
 	return 0;
 }
 
+void netif_set_queue_core(struct net_device *dev, u16 queue_index, int core) {
+	netdev_get_tx_queue(dev, queue_index)->core = core;
+}
+
+/*
+ * Default tx queue: the queue pinned to the current core, otherwise one
+ * spread by core ID. Forwarded frames keep their rx queue.
+ */
+u16 __netdev_pick_tx(struct net_device *dev, struct sk_buff *skb) {
+	int core = mp_core_id();
+
+	if(skb && skb_rx_queue_recorded(skb))
+		return skb_get_rx_queue(skb) % dev->real_num_tx_queues;
+
+	for(unsigned int i = 0; i < dev->real_num_tx_queues; i++) {
+		if(dev->_tx[i].core == core)
+			return i;
+	}
+
+	return core % dev->real_num_tx_queues;
+}
+
+struct netdev_queue *netdev_pick_tx(struct net_device *dev, struct sk_buff *skb, void *accel_priv) {
+	u16 index = 0;
+
+	if(dev->real_num_tx_queues > 1) {
+		if(dev->netdev_ops->ndo_select_queue)
+			index = dev->netdev_ops->ndo_select_queue(dev, skb, accel_priv, __netdev_pick_tx);
+		else
+			index = __netdev_pick_tx(dev, skb);
+
+		if(index >= dev->real_num_tx_queues)
+			index = 0;
+	}
+
+	skb_set_queue_mapping(skb, index);
+	return netdev_get_tx_queue(dev, index);
+}
+
+/*
+ * NAPI engine. Every core has its own poll list which is processed by a busy
+ * event of the core's event loop. A context is polled by the core it is pinned
+ * to by napi_set_core, or by the core which schedules it. Scheduled contexts
+ * are polled round robin with their weight, NAPI_POLL_BUDGET packets at most
+ * per turn. A context stays in the list until the driver completes it, then
+ * the driver re-enables its interrupt.
+ *
+ * The module is shared by cores, so the lists are locked. Interrupt handlers
+ * schedule contexts, so interrupts are disabled while a list is locked, or an
+ * interrupt on the core holding the lock would spin forever. The busy event of
+ * a core is added when the core enables a context, pins one to itself or polls
+ * the NIC devices; contexts pinned to a core are not polled before that.
+ */
+typedef struct {
+	volatile uint8_t	lock;
+	struct napi_struct*	head;
+	struct napi_struct*	tail;
+	uint64_t		event;
+} PollList;
+
+static PollList poll_lists[MP_MAX_CORE_COUNT];
+
+static bool poll_list_lock(PollList* list) {
+	bool enabled = apic_enabled();
+	if(enabled)
+		apic_disable();
+
+	lock_lock(&list->lock);
+	return enabled;
+}
+
+static void poll_list_unlock(PollList* list, bool enabled) {
+	lock_unlock(&list->lock);
+
+	if(enabled)
+		apic_enable();
+}
+
+static void poll_list_add(PollList* list, struct napi_struct* n) {
+	if(n->poll_list)
+		return;
+
+	n->poll_next = NULL;
+	n->poll_list = list;
+	if(list->tail)
+		list->tail->poll_next = n;
+	else
+		list->head = n;
+	list->tail = n;
+}
+
+static void poll_list_remove(struct napi_struct* n) {
+	PollList* list = n->poll_list;
+	if(!list)
+		return;
+
+	bool enabled = poll_list_lock(list);
+	struct napi_struct** p = &list->head;
+	struct napi_struct* prev = NULL;
+	while(*p) {
+		if(*p == n) {
+			*p = n->poll_next;
+			if(list->tail == n)
+				list->tail = prev;
+			n->poll_next = NULL;
+			n->poll_list = NULL;
+			break;
+		}
+
+		prev = *p;
+		p = &(*p)->poll_next;
+	}
+	poll_list_unlock(list, enabled);
+}
+
+static bool napi_poll_event(void* context) {
+	PollList* list = context;
+	int budget = NAPI_POLL_BUDGET;
+
+	bool enabled = poll_list_lock(list);
+
+	// Contexts which are scheduled while polling are processed in the next turn
+	struct napi_struct* end = list->tail;
+	while(list->head && budget > 0) {
+		struct napi_struct* n = list->head;
+		list->head = n->poll_next;
+		if(!list->head)
+			list->tail = NULL;
+		n->poll_next = NULL;
+		n->poll_list = NULL;
+
+		// Driver may schedule contexts while polling
+		poll_list_unlock(list, enabled);
+
+		int weight = n->weight < budget ? n->weight : budget;
+		int work = n->poll(n, weight);
+		n->polls++;
+		budget -= work;
+
+		enabled = poll_list_lock(list);
+
+		// Driver didn't complete, the ring has more packets
+		if(test_bit(NAPI_STATE_SCHED, &n->state)) {
+			if(work >= weight)
+				n->budget_exhausted++;
+
+			if(test_bit(NAPI_STATE_DISABLE, &n->state))
+				clear_bit(NAPI_STATE_SCHED, &n->state);
+			else
+				poll_list_add(list, n);
+		}
+
+		if(n == end)
+			break;
+	}
+
+	poll_list_unlock(list, enabled);
+
+	return true;
+}
+
+static void poll_event_init() {
+	PollList* list = &poll_lists[mp_core_id()];
+	if(!list->event)
+		list->event = event_busy_add(napi_poll_event, list);
+}
+
+void netif_napi_add(struct net_device *dev, struct napi_struct *napi,
+		int (*poll)(struct napi_struct *, int), int weight) {
+	memset(napi, 0, sizeof(struct napi_struct));
+	napi->dev = dev;
+	napi->poll = poll;
+	napi->weight = weight > 0 ? weight : NAPI_POLL_WEIGHT;
+	napi->core = -1;
+	set_bit(NAPI_STATE_SCHED, &napi->state);	// Disabled until napi_enable
+}
+
+void napi_set_core(struct napi_struct *n, int core) {
+	n->core = core >= 0 && core < MP_MAX_CORE_COUNT ? core : -1;
+
+	if(n->core == mp_core_id())
+		poll_event_init();
+}
+
+void netif_napi_del(struct napi_struct *napi) {
+	poll_list_remove(napi);
+	napi->poll = NULL;
+}
+
 void napi_enable(struct napi_struct* n) {
-//	printf("napi: enable\n");
 	n->enabled = true;
+	clear_bit(NAPI_STATE_DISABLE, &n->state);
+	clear_bit(NAPI_STATE_SCHED, &n->state);
+
+	poll_event_init();
 }
 
 void napi_disable(struct napi_struct* n) {
-	printf("napi: disable\n");
+	set_bit(NAPI_STATE_DISABLE, &n->state);
+	poll_list_remove(n);
+	set_bit(NAPI_STATE_SCHED, &n->state);
 	n->enabled = false;
 }
 
+void napi_synchronize(const struct napi_struct *n) {
+	// Polls run in the event loop of the polling core, nothing is in progress on this core
+}
+
 void napi_gro_receive(struct napi_struct* n, struct sk_buff* buf) {
-	printf("napi: gro receive: %d\n", buf->len);
-	for(unsigned int i = 0; i < buf->len; i++)
-		printf("%02x", buf->data[i]);
-	// TODO: Received
+	n->rx_packets++;
+	netif_receive_skb(buf);
+}
+
+bool napi_schedule_prep(struct napi_struct *n) {
+	if(test_bit(NAPI_STATE_DISABLE, &n->state))
+		return false;
+
+	return !test_and_set_bit(NAPI_STATE_SCHED, &n->state);
+}
+
+void __napi_schedule(struct napi_struct *n) {
+	PollList* list = &poll_lists[n->core >= 0 ? n->core : mp_core_id()];
+
+	bool enabled = poll_list_lock(list);
+	poll_list_add(list, n);
+	poll_list_unlock(list, enabled);
+}
+
+void napi_complete_done(struct napi_struct *n, int work_done) {
+	clear_bit(NAPI_STATE_SCHED, &n->state);
 }
 
 void napi_complete(struct napi_struct *n) {
+	napi_complete_done(n, 0);
 }
 
 void napi_schedule(struct napi_struct* n) {
-	printf("napi: schedule\n");
+	// Called by interrupt handler, the driver has masked its interrupt
+	if(napi_schedule_prep(n))
+		__napi_schedule(n);
 }
-
@@ -1,31 +1,207 @@
 #include <linux/skbuff.h>
+#include <linux/netdevice.h>
+#include <linux/if_vlan.h>
+#include <linux/string.h>
 #include <linux/kernel.h>
 #include <linux/compiler.h>
 #include <stddef.h>
 #include <gmalloc.h>
+#include <lock.h>
+#include <nic.h>
 
 #define dev_kfree_skb(a)        consume_skb(a)
 
-struct sk_buff *netdev_alloc_skb_ip_align(struct net_device* dev, int size) {
-	struct sk_buff* skb = gmalloc(sizeof(struct sk_buff) + size);
+#define ROUNDUP64(x)	(((x) + 63) & ~63)
+
+#define SKB_HEAD_SIZE	ROUNDUP64(sizeof(struct sk_buff))
+#define SKB_DATA_SIZE	ROUNDUP64(NET_SKB_PAD + SKB_CACHE_BUF_SIZE)
+#define SKB_INFO_SIZE	ROUNDUP64(sizeof(struct skb_shared_info))
+
+static struct skb_cache* default_cache;
+
+/*
+ * Block layout: [struct sk_buff][head room + data][struct skb_shared_info]
+ */
+static void skb_init(struct sk_buff* skb, struct net_device* dev, unsigned char* head, unsigned int size, struct skb_cache* cache) {
+	memset(skb, 0, sizeof(struct sk_buff));
 	skb->dev = dev;
-	skb->len = size;
-	skb->head = skb->data;
+	skb->head = skb->data = head;
+	skb->end = head + size;
+	skb->cache = cache;
+	atomic64_set(&skb->users, 1);
+	memset(skb_shinfo(skb), 0, sizeof(struct skb_shared_info));
+}
+
+static bool skb_cache_grow(struct skb_cache* cache, unsigned int count) {
+	// The first cache line of a slab links slabs
+	void* slab = gmalloc(64 + (size_t)cache->stride * count + 63);
+	if(!slab)
+		return false;
+
+	*(void**)slab = cache->slabs;
+	cache->slabs = slab;
+
+	uint8_t* block = (uint8_t*)ROUNDUP64((uintptr_t)slab + 64);
+	for(unsigned int i = 0; i < count; i++) {
+		struct sk_buff* skb = (struct sk_buff*)(block + (size_t)cache->stride * i);
+		skb->next = cache->free;
+		cache->free = skb;
+	}
+
+	cache->count += count;
+	cache->free_count += count;
+
+	return true;
+}
+
+struct skb_cache* skb_cache_create(unsigned int count) {
+	struct skb_cache* cache = gmalloc(sizeof(struct skb_cache));
+	if(!cache)
+		return NULL;
+
+	memset(cache, 0, sizeof(struct skb_cache));
+	cache->stride = SKB_HEAD_SIZE + SKB_DATA_SIZE + SKB_INFO_SIZE;
+
+	if(!skb_cache_grow(cache, count)) {
+		gfree(cache);
+		return NULL;
+	}
+
+	return cache;
+}
+
+void skb_cache_destroy(struct skb_cache* cache) {
+	void* slab = cache->slabs;
+	while(slab) {
+		void* next = *(void**)slab;
+		gfree(slab);
+		slab = next;
+	}
+
+	gfree(cache);
+}
+
+static struct sk_buff* skb_cache_alloc(struct skb_cache* cache) {
+	lock_lock(&cache->lock);
+	if(!cache->free && !skb_cache_grow(cache, SKB_CACHE_SLAB)) {
+		lock_unlock(&cache->lock);
+		return NULL;
+	}
+
+	struct sk_buff* skb = cache->free;
+	cache->free = skb->next;
+	cache->free_count--;
+	lock_unlock(&cache->lock);
+
+	return skb;
+}
+
+static void skb_cache_free(struct skb_cache* cache, struct sk_buff* skb) {
+	lock_lock(&cache->lock);
+	skb->next = cache->free;
+	cache->free = skb;
+	cache->free_count++;
+	lock_unlock(&cache->lock);
+}
+
+static struct skb_cache* skb_cache_get(struct net_device* dev) {
+	if(!dev) {
+		if(!default_cache)
+			default_cache = skb_cache_create(SKB_CACHE_SLAB);
+
+		return default_cache;
+	}
+
+	if(!dev->skb_cache)
+		dev->skb_cache = skb_cache_create(SKB_CACHE_SLAB);
+
+	return dev->skb_cache;
+}
+
+static struct sk_buff* __alloc_skb(struct net_device* dev, unsigned int size) {
+	unsigned int total = NET_SKB_PAD + size;
+	struct skb_cache* cache = NULL;
+	struct sk_buff* skb;
+
+	if(total <= SKB_DATA_SIZE)
+		cache = skb_cache_get(dev);
+
+	if(cache) {
+		skb = skb_cache_alloc(cache);
+		if(!skb)
+			return NULL;
+
+		total = SKB_DATA_SIZE;
+	} else {
+		// Too big to be cached, allocated alone but still colocated
+		total = ROUNDUP64(total);
+		skb = gmalloc(SKB_HEAD_SIZE + total + SKB_INFO_SIZE);
+		if(!skb)
+			return NULL;
+	}
+
+	skb_init(skb, dev, (unsigned char*)skb + SKB_HEAD_SIZE, total, cache);
+	skb_reserve(skb, NET_SKB_PAD);
 
-	skb->data = gmalloc(size);
 	return skb;
 }
 
+/*
+ * Rx buffers are owned by the device's skb cache, not carved from VNIC packet
+ * pools, so a buffer posted to a driver's ring never points into the memory of
+ * a VNIC which is unregistered meanwhile. Frames are copied to VNICs on rx.
+ */
+struct sk_buff *netdev_alloc_skb_ip_align(struct net_device* dev, int size) {
+	struct sk_buff* skb = __alloc_skb(dev, size + NET_IP_ALIGN);
+	if(skb)
+		skb_reserve(skb, NET_IP_ALIGN);
+
+	return skb;
+}
+
+struct sk_buff *netdev_alloc_skb_packet(struct net_device *dev, Packet *packet) {
+	struct sk_buff* skb = __alloc_skb(dev, 0);
+	if(!skb)
+		return NULL;
+
+	// Whole frame is a fragment, the linear part is empty
+	skb_frag_t* frag = &skb_shinfo(skb)->frags[0];
+	frag->page.p = (struct page*)packet;
+	frag->page_offset = packet->buffer + packet->start - (uint8_t*)packet;
+	frag->size = packet->end - packet->start;
+	skb_shinfo(skb)->nr_frags = 1;
+
+	skb->len = skb->data_len = frag->size;
+	skb->packet = packet;
+
+	return skb;
+}
+
+Packet *skb_detach_packet(struct sk_buff *skb) {
+	Packet* packet = skb->packet;
+
+	skb->packet = NULL;
+	return packet;
+}
+
+struct sk_buff *__netdev_alloc_skb_ip_align(struct net_device *dev, unsigned int length, gfp_t gfp) {
+	return netdev_alloc_skb_ip_align(dev, length);
+}
+
 struct sk_buff *dev_alloc_skb(unsigned int length) {
-	return netdev_alloc_skb_ip_align(NULL, length);
+	return __alloc_skb(NULL, length);
 }
 
 int skb_pad(struct sk_buff *skb, int pad) {
+	if(skb_tailroom(skb) < pad)
+		return -1;
+
+	memset(skb_tail_pointer(skb), 0, pad);
 	return 0;
 }
 
 unsigned char *skb_put(struct sk_buff *skb, unsigned int len) {
-	unsigned char* tmp = skb->head + skb->tail;
+	unsigned char* tmp = skb_tail_pointer(skb);
 	
 	skb->tail += len;
 	skb->len += len;
@@ -33,17 +209,72 @@ unsigned char *skb_put(struct sk_buff *skb, unsigned int len) {
 	return tmp;
 }
 
+unsigned char *skb_push(struct sk_buff *skb, unsigned int len) {
+	skb->data -= len;
+	skb->len += len;
+
+	return skb->data;
+}
+
+unsigned char *skb_pull(struct sk_buff *skb, unsigned int len) {
+	if(len > skb->len)
+		return NULL;
+
+	skb->len -= len;
+	return skb->data += len;
+}
+
 void skb_reserve(struct sk_buff *skb, int len) {
 	skb->data += len;
 	skb->tail += len;
 }
 
+void skb_trim(struct sk_buff *skb, unsigned int len) {
+	if(skb->len > len) {
+		skb->len = len;
+		skb->tail = skb->data - skb->head + len;
+	}
+}
+
 void consume_skb(struct sk_buff *skb) {
-	gfree(skb);
+	if(!skb)
+		return;
+
+	if(!atomic64_dec_and_test(&skb->users))
+		return;
+
+	if(skb->packet)
+		nic_free(skb->packet);
+
+	if(skb->cache)
+		skb_cache_free(skb->cache, skb);
+	else
+		gfree(skb);
 }
 
 struct sk_buff* __vlan_hwaccel_put_tag(struct sk_buff* skb, __be16 vlan_proto, u16 vlan_tci) {
-	// TODO: Implement it
+	// Tag is kept out of band, PacketNgin gets it by skb_vlan_tag_get()
+	skb->vlan_proto = vlan_proto;
+	skb->vlan_tci = VLAN_TAG_PRESENT | vlan_tci;
+	return skb;
+}
+
+struct sk_buff* __vlan_hwaccel_push_inside(struct sk_buff* skb) {
+	if(skb_headroom(skb) < VLAN_HLEN) {
+		consume_skb(skb);
+		return NULL;
+	}
+
+	// Move MAC addresses only, the payload stays in place
+	skb_push(skb, VLAN_HLEN);
+	memmove(skb->data, skb->data + VLAN_HLEN, 2 * ETH_ALEN);
+
+	struct vlan_ethhdr* veth = (struct vlan_ethhdr*)skb->data;
+	veth->h_vlan_proto = skb->vlan_proto;
+	// cpu_to_be16() refers __fswab16 which has no out of line definition
+	veth->h_vlan_TCI = (__be16)__builtin_bswap16(skb_vlan_tag_get(skb));
+	__vlan_hwaccel_clear_tag(skb);
+
 	return skb;
 }
 
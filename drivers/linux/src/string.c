@@ -17,6 +17,24 @@ void *memcpy(void *dest, const void *src, size_t count) {
 	return dest;
 }
 
+void *memmove(void *dest, const void *src, size_t count) {
+	char *tmp;
+	const char *s;
+
+	if (dest <= src) {
+		tmp = dest;
+		s = src;
+		while (count--)
+			*tmp++ = *s++;
+	} else {
+		tmp = dest + count;
+		s = src + count;
+		while (count--)
+			*--tmp = *--s;
+	}
+	return dest;
+}
+
 size_t strlen(const char *s) {
 	int i = 0;
 	while(s[i] != '\0')
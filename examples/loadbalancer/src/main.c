@@ -15,6 +15,7 @@
 #include <util/map.h>
 #include <util/event.h>
 #include <util/cmd.h>
+#include <util/log.h>
 
 #define NAT 1
 #define DNAT 2
@@ -397,8 +398,15 @@ int ginit(int argc, char** argv) {
 	return 0;
 }
 
+// Per packet logs are written to the binary log ring, not formatted here
+static int log_incoming;
+static int log_outgoing;
+
 void init(int argc, char** argv) {
 	sessions = map_create(4096, NULL, NULL, NULL);
+
+	log_incoming = log_format("Incoming: %lx %lx %d.%d.%d.%d:%d %d %d.%d.%d.%d:%d\n");
+	log_outgoing = log_format("Outgoing: %lx %lx %d.%d.%d.%d:%d %d %d.%d.%d.%d:%d\n");
 }
 
 static NIC* ni_inter;
@@ -503,7 +511,7 @@ void process_inter() {
 	if(!packet)
 		return;
 	
-	if(arp_process(packet))
+	if(arp_process(ni, packet))
 		return;
 	
 	if(icmp_process(packet))
@@ -555,7 +563,7 @@ void process_inter() {
 				}
 				tcp_pack(packet, endian16(ip->length) - ip->ihl * 4 - TCP_LEN);
 				
-				printf("Incoming: %lx %lx %d.%d.%d.%d:%d %d %d.%d.%d.%d:%d\n", 
+				LOG(log_incoming, 
 					endian48(ether->dmac), 
 					endian48(ether->smac),
 					(endian32(ip->source)) >> 24 & 0xff,
@@ -594,7 +602,7 @@ void process_intra() {
 	if(!packet)
 		return;
 	
-	if(arp_process(packet))
+	if(arp_process(ni, packet))
 		return;
 	
 	if(icmp_process(packet))
@@ -657,7 +665,7 @@ void process_intra() {
 				}
 				tcp_pack(packet, endian16(ip->length) - ip->ihl * 4 - TCP_LEN);
 				
-				printf("Outgoing: %lx %lx %d.%d.%d.%d:%d %d %d.%d.%d.%d:%d\n", 
+				LOG(log_outgoing, 
 					endian48(ether->dmac), 
 					endian48(ether->smac),
 					(endian32(ip->source)) >> 24 & 0xff,
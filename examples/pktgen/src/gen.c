@@ -0,0 +1,202 @@
+#include <string.h>
+#include <timer.h>
+#include <net/ether.h>
+#include <net/vlan.h>
+#include <net/ip.h>
+#include <net/udp.h>
+#include "pktgen.h"
+
+/*
+ * Headers of a flow are built once in a template. A frame is an nic_alloc
+ * buffer which headers are copied from the template, then only lengths,
+ * the IP checksum and the probe are written. The payload is not written,
+ * the buffer keeps whatever the pool had.
+ */
+typedef struct {
+	uint8_t		head[ETHER_LEN + VLAN_LEN + IP_LEN + UDP_LEN];
+	uint16_t	head_len;
+	uint16_t	ip_offset;
+	uint32_t	ip_sum;		///< Sum of the IP header without the length
+	uint64_t	seq;		///< Sequence number of the next frame
+} Template;
+
+static Template templates[PKTGEN_MAX_FLOWS];
+static uint32_t flow;
+static int mix_index;
+static uint64_t sent;
+static uint64_t interval;	///< TSC between frames
+static uint64_t next;		///< TSC when the next frame is due
+
+static uint32_t sum16(void* data, int size) {
+	uint8_t* p = data;
+	uint32_t sum = 0;
+	for(int i = 0; i < size; i += 2)
+		sum += p[i] << 8 | p[i + 1];
+
+	return sum;
+}
+
+static void template_init(Template* t, uint32_t index) {
+	memset(t, 0, sizeof(Template));
+
+	uint32_t src_ip = config.src_ip + (config.increment & PKTGEN_INC_SRC_IP ? index : 0);
+	uint32_t dst_ip = config.dst_ip + (config.increment & PKTGEN_INC_DST_IP ? index : 0);
+	uint16_t src_port = config.src_port + (config.increment & PKTGEN_INC_SRC_PORT ? index : 0);
+	uint16_t dst_port = config.dst_port + (config.increment & PKTGEN_INC_DST_PORT ? index : 0);
+	uint16_t vlan = config.vlan ? config.vlan + (config.increment & PKTGEN_INC_VLAN ? index : 0) : 0;
+
+	Ether* ether = (Ether*)t->head;
+	ether->dmac = endian48(config.dmac);
+	ether->smac = endian48(config.smac);
+	t->ip_offset = ETHER_LEN;
+
+	if(vlan) {
+		ether->type = endian16(ETHER_TYPE_8021Q);
+		VLAN* tag = (VLAN*)ether->payload;
+		tag->tci = endian16(VLAN_TCI(0, 0, (vlan - 1) % 4094 + 1));
+		tag->type = endian16(ETHER_TYPE_IPv4);
+		t->ip_offset += VLAN_LEN;
+	} else {
+		ether->type = endian16(ETHER_TYPE_IPv4);
+	}
+
+	IP* ip = (IP*)(t->head + t->ip_offset);
+	ip->version = 4;
+	ip->ihl = IP_LEN / 4;
+	ip->ttl = 64;
+	ip->protocol = IP_PROTOCOL_UDP;
+	ip->source = endian32(src_ip);
+	ip->destination = endian32(dst_ip);
+	t->ip_sum = sum16(ip, IP_LEN);
+
+	UDP* udp = (UDP*)ip->body;
+	udp->source = endian16(src_port);
+	udp->destination = endian16(dst_port);
+
+	t->head_len = t->ip_offset + IP_LEN + UDP_LEN;
+}
+
+bool gen_init() {
+	if(config.flows == 0 || config.flows > PKTGEN_MAX_FLOWS || config.mix_count == 0)
+		return false;
+
+	uint16_t min_size = PKTGEN_MIN_SIZE + (config.vlan ? VLAN_LEN : 0);
+	for(int i = 0; i < config.mix_count; i++) {
+		// The smallest frame which carries the probe
+		if(config.mix[i] == 0)
+			config.mix[i] = min_size;
+
+		if(config.mix[i] < min_size || config.mix[i] > PKTGEN_MAX_SIZE)
+			return false;
+	}
+
+	for(uint32_t i = 0; i < config.flows; i++)
+		template_init(&templates[i], i);
+
+	gen_reset();
+
+	return true;
+}
+
+void gen_reset() {
+	for(uint32_t i = 0; i < config.flows; i++)
+		templates[i].seq = 0;
+
+	flow = 0;
+	mix_index = 0;
+	sent = 0;
+	interval = config.rate ? TIMER_FREQUENCY_PER_SEC / config.rate : 0;
+	next = timer_frequency();
+}
+
+static void build(Packet* packet, Template* t, uint16_t size, uint64_t time) {
+	uint8_t* frame = packet->buffer + packet->start;
+	memcpy(frame, t->head, t->head_len);
+
+	uint16_t ip_len = size - t->ip_offset;
+	IP* ip = (IP*)(frame + t->ip_offset);
+	ip->length = endian16(ip_len);
+
+	uint32_t sum = t->ip_sum + ip_len;
+	sum = (sum & 0xffff) + (sum >> 16);
+	sum = (sum & 0xffff) + (sum >> 16);
+	ip->checksum = endian16(~sum & 0xffff);
+
+	UDP* udp = (UDP*)ip->body;
+	udp->length = endian16(ip_len - IP_LEN);
+
+	Probe* probe = (Probe*)udp->body;
+	probe->magic = PKTGEN_MAGIC;
+	probe->flow = t - templates;
+	probe->reserved = 0;
+	probe->seq = t->seq++;
+	probe->time = time;
+
+	packet->end = packet->start + size;
+}
+
+int gen_tx() {
+	Packet* packets[PKTGEN_BURST];
+	uint32_t flows[PKTGEN_BURST];
+	uint16_t sizes[PKTGEN_BURST];
+	int burst = PKTGEN_BURST;
+
+	if(config.count) {
+		if(sent >= config.count)
+			return 0;
+
+		if(config.count - sent < (uint64_t)burst)
+			burst = config.count - sent;
+	}
+
+	uint64_t time = timer_frequency();
+	if(interval) {
+		if(time < next)
+			return 0;
+
+		// Catch up a burst at most after a stall, not to burst long
+		if(time - next > interval * PKTGEN_BURST)
+			next = time - interval * PKTGEN_BURST;
+
+		uint64_t due = (time - next) / interval + 1;
+		if(due < (uint64_t)burst)
+			burst = due;
+
+		next += interval * burst;
+	}
+
+	int count = 0;
+	for(; count < burst; count++) {
+		uint16_t size = config.mix[mix_index];
+		Packet* packet = nic_alloc(config.tx_nic, size);
+		if(!packet)
+			break;
+
+		mix_index = (mix_index + 1) % config.mix_count;
+		flows[count] = flow;
+		sizes[count] = size;
+		build(packet, &templates[flow], size, time);
+		flow = (flow + 1) % config.flows;
+		packets[count] = packet;
+	}
+
+	uint32_t queued = nic_tx_burst(config.tx_nic, packets, count);
+
+	// Frames not queued are not sent, so their sequence numbers are reused
+	for(int i = count - 1; i >= (int)queued; i--) {
+		templates[flows[i]].seq--;
+		nic_free(packets[i]);
+	}
+	if(queued < (uint32_t)count)
+		flow = flows[queued];
+
+	// Queued frames belong to the host, sizes are not read from them
+	for(uint32_t i = 0; i < queued; i++)
+		stats.tx_bytes += sizes[i];
+
+	sent += queued;
+	stats.tx_packets += queued;
+	stats.tx_drops += burst - queued;
+
+	return queued;
+}
@@ -0,0 +1,350 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread.h>
+#include <timer.h>
+#include <readline.h>
+#include <util/cmd.h>
+#include <util/types.h>
+#include <net/ether.h>
+#include "pktgen.h"
+
+/*
+ * Usage: pktgen [-t tx nic] [-x rx nic] [-d dmac] [-s src ip] [-D dst ip]
+ *               [-p src port] [-P dst port] [-v vlan] [-f flows]
+ *               [-i sip,dip,sport,dport,vlan] [-R pps] [-l size|imix|size,size,...]
+ *               [-c count]
+ *
+ * Thread 0 sends frames and takes commands, the last thread analyzes
+ * received frames. With one thread, it does both. Frames are sent to the MAC
+ * of the rx NIC by default so they come back through the dispatcher.
+ */
+
+Config config;
+Stats stats;
+volatile bool is_running;
+
+static volatile bool is_continue = true;
+
+// Simple IMIX 7:4:1 of 594 and 1518 bytes frames without FCS and the smallest
+// frames carrying a probe, which are a few bytes larger than 64 bytes
+static const uint16_t imix[] = { 0, 0, 590, 0, 0, 590, 0, 1514, 0, 590, 0, 590 };
+
+static uint32_t str_to_adr(char* argv) {
+	char* str = argv;
+	uint32_t address = (strtol(str, &str, 0) & 0xff) << 24; str++;
+	address |= (strtol(str, &str, 0) & 0xff) << 16; str++;
+	address |= (strtol(str, &str, 0) & 0xff) << 8; str++;
+	address |= strtol(str, NULL, 0) & 0xff;
+
+	return address;
+}
+
+static uint64_t str_to_mac(char* argv) {
+	char* str = argv;
+	uint64_t mac = 0;
+	for(int i = 0; i < 6; i++) {
+		mac = mac << 8 | (strtol(str, &str, 16) & 0xff);
+		if(*str == ':')
+			str++;
+	}
+
+	return mac;
+}
+
+static bool parse_mix(char* argv) {
+	if(!strcmp(argv, "imix")) {
+		memcpy(config.mix, imix, sizeof(imix));
+		config.mix_count = sizeof(imix) / sizeof(imix[0]);
+		return true;
+	}
+
+	char* str = argv;
+	config.mix_count = 0;
+	while(*str && config.mix_count < PKTGEN_MAX_MIX) {
+		config.mix[config.mix_count++] = strtol(str, &str, 0);
+		if(*str == ',')
+			str++;
+		else if(*str)
+			return false;
+	}
+
+	return config.mix_count > 0;
+}
+
+static uint8_t parse_increment(char* argv) {
+	static const struct {
+		const char*	name;
+		uint8_t		flag;
+	} fields[] = {
+		{ "sip", PKTGEN_INC_SRC_IP },
+		{ "dip", PKTGEN_INC_DST_IP },
+		{ "sport", PKTGEN_INC_SRC_PORT },
+		{ "dport", PKTGEN_INC_DST_PORT },
+		{ "vlan", PKTGEN_INC_VLAN },
+	};
+
+	uint8_t increment = 0;
+	for(char* field = strtok(argv, ","); field; field = strtok(NULL, ",")) {
+		for(size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+			if(!strcmp(field, fields[i].name))
+				increment |= fields[i].flag;
+		}
+	}
+
+	return increment;
+}
+
+static bool parse_args(int argc, char** argv) {
+	int tx = 0;
+	int rx = nic_count() > 1 ? 1 : 0;
+	uint64_t dmac = 0;
+
+	config.src_ip = 0xc0a86402;	// 192.168.100.2
+	config.dst_ip = 0xc0a86403;	// 192.168.100.3
+	config.src_port = 1024;
+	config.dst_port = 9;		// Discard
+	config.flows = 1;
+	config.mix[0] = 0;		// The smallest
+	config.mix_count = 1;
+
+	for(int i = 1; i + 1 < argc; i += 2) {
+		char* value = argv[i + 1];
+
+		if(!strcmp(argv[i], "-t")) {
+			tx = strtol(value, NULL, 0);
+		} else if(!strcmp(argv[i], "-x")) {
+			rx = strtol(value, NULL, 0);
+		} else if(!strcmp(argv[i], "-d")) {
+			dmac = str_to_mac(value);
+		} else if(!strcmp(argv[i], "-s")) {
+			config.src_ip = str_to_adr(value);
+		} else if(!strcmp(argv[i], "-D")) {
+			config.dst_ip = str_to_adr(value);
+		} else if(!strcmp(argv[i], "-p")) {
+			config.src_port = strtol(value, NULL, 0);
+		} else if(!strcmp(argv[i], "-P")) {
+			config.dst_port = strtol(value, NULL, 0);
+		} else if(!strcmp(argv[i], "-v")) {
+			config.vlan = strtol(value, NULL, 0) & 0xfff;
+		} else if(!strcmp(argv[i], "-f")) {
+			config.flows = strtol(value, NULL, 0);
+		} else if(!strcmp(argv[i], "-i")) {
+			config.increment = parse_increment(value);
+		} else if(!strcmp(argv[i], "-R")) {
+			config.rate = strtol(value, NULL, 0);
+		} else if(!strcmp(argv[i], "-l")) {
+			if(!parse_mix(value))
+				return false;
+		} else if(!strcmp(argv[i], "-c")) {
+			config.count = strtol(value, NULL, 0);
+		} else {
+			printf("Unknown option: %s\n", argv[i]);
+			return false;
+		}
+	}
+
+	config.tx_nic = nic_get(tx);
+	config.rx_nic = rx >= 0 ? nic_get(rx) : NULL;
+	if(!config.tx_nic)
+		return false;
+
+	config.smac = config.tx_nic->mac;
+	if(dmac)
+		config.dmac = dmac;
+	else if(config.rx_nic && config.rx_nic != config.tx_nic)
+		config.dmac = config.rx_nic->mac;
+	else
+		config.dmac = 0xffffffffffff;
+
+	return gen_init();
+}
+
+static int cmd_exit(int argc, char** argv, void(*callback)(char* result, int exit_status)) {
+	is_running = false;
+	is_continue = false;
+
+	return 0;
+}
+
+static int cmd_start(int argc, char** argv, void(*callback)(char* result, int exit_status)) {
+	gen_reset();
+	is_running = true;
+
+	return 0;
+}
+
+static int cmd_stop(int argc, char** argv, void(*callback)(char* result, int exit_status)) {
+	is_running = false;
+	stats_print();
+
+	return 0;
+}
+
+static int cmd_stats(int argc, char** argv, void(*callback)(char* result, int exit_status)) {
+	stats_print();
+
+	return 0;
+}
+
+static int cmd_reset(int argc, char** argv, void(*callback)(char* result, int exit_status)) {
+	stats_reset();
+
+	return 0;
+}
+
+static int cmd_rate(int argc, char** argv, void(*callback)(char* result, int exit_status)) {
+	if(argc != 2 || !is_uint64(argv[1]))
+		return -1;
+
+	config.rate = parse_uint64(argv[1]);
+	gen_reset();
+
+	return 0;
+}
+
+static int cmd_size(int argc, char** argv, void(*callback)(char* result, int exit_status)) {
+	if(argc != 2 || is_running)
+		return -1;
+
+	if(!parse_mix(argv[1]) || !gen_init()) {
+		printf("Frame size must be %lu ~ %d\n", PKTGEN_MIN_SIZE + (config.vlan ? 4 : 0), PKTGEN_MAX_SIZE);
+		return -2;
+	}
+
+	return 0;
+}
+
+static int cmd_flows(int argc, char** argv, void(*callback)(char* result, int exit_status)) {
+	if(argc != 2 || is_running || !is_uint32(argv[1]))
+		return -1;
+
+	config.flows = parse_uint32(argv[1]);
+	if(!gen_init()) {
+		printf("Number of flows must be 1 ~ %d\n", PKTGEN_MAX_FLOWS);
+		return -2;
+	}
+
+	return 0;
+}
+
+Command commands[] = {
+	{
+		.name = "help",
+		.desc = "Show this message",
+		.func = cmd_help
+	},
+	{
+		.name = "exit",
+		.desc = "Exit application",
+		.func = cmd_exit
+	},
+	{
+		.name = "start",
+		.desc = "Start to send frames",
+		.func = cmd_start
+	},
+	{
+		.name = "stop",
+		.desc = "Stop to send frames",
+		.func = cmd_stop
+	},
+	{
+		.name = "stats",
+		.desc = "Print statistics and latency percentiles",
+		.func = cmd_stats
+	},
+	{
+		.name = "reset",
+		.desc = "Reset statistics",
+		.func = cmd_reset
+	},
+	{
+		.name = "rate",
+		.desc = "Set frames per second, 0 for as fast as possible",
+		.args = "uint64_t pps",
+		.func = cmd_rate
+	},
+	{
+		.name = "size",
+		.desc = "Set frame size or size mix when stopped",
+		.args = "size | imix | size,size,...",
+		.func = cmd_size
+	},
+	{
+		.name = "flows",
+		.desc = "Set number of flows when stopped",
+		.args = "uint32_t flows",
+		.func = cmd_flows
+	},
+	{
+		.name = NULL,
+		.desc = NULL,
+		.args = NULL,
+		.func = NULL
+	},
+};
+
+static void report() {
+	static uint64_t last_time;
+	static uint64_t last_tx;
+	static uint64_t last_rx;
+
+	uint64_t time = timer_frequency();
+	if(time - last_time < TIMER_FREQUENCY_PER_SEC)
+		return;
+
+	if(is_running) {
+		printf("TX %lu pps  RX %lu pps  lost %lu\n",
+				(stats.tx_packets - last_tx) * TIMER_FREQUENCY_PER_SEC / (time - last_time),
+				(stats.rx_packets - last_rx) * TIMER_FREQUENCY_PER_SEC / (time - last_time),
+				stats.rx_lost);
+	}
+
+	last_time = time;
+	last_tx = stats.tx_packets;
+	last_rx = stats.rx_packets;
+}
+
+int main(int argc, char** argv) {
+	bool is_tx = thread_id() == 0;
+	bool is_rx = thread_id() == thread_count() - 1;
+
+	if(thread_id() == 0) {
+		cmd_init();
+		stats_reset();
+		if(!parse_args(argc, argv)) {
+			printf("Wrong arguments, see the usage in main.c\n");
+			is_continue = false;
+		} else {
+			printf("pktgen: %u flows, %lu pps, %d sizes, start to send\n",
+					config.flows, config.rate, config.mix_count);
+			is_running = true;
+		}
+	}
+
+	thread_barrior();
+
+	while(is_continue) {
+		if(is_tx) {
+			if(is_running)
+				gen_tx();
+
+			report();
+
+			char* line = readline();
+			if(line)
+				cmd_exec(line, NULL);
+		}
+
+		if(is_rx && config.rx_nic)
+			stats_rx();
+	}
+
+	thread_barrior();
+
+	if(thread_id() == 0)
+		stats_print();
+
+	return 0;
+}
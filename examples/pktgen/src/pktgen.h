@@ -0,0 +1,124 @@
+#ifndef __PKTGEN_H__
+#define __PKTGEN_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <nic.h>
+
+/**
+ * @file
+ * Synthetic traffic generator. UDP frames are built from templates and sent
+ * in bursts, each frame carries a probe with the flow's sequence number and
+ * the TSC when it was sent. The receiver counts lost and reordered frames
+ * and records the latency of each frame in a histogram.
+ */
+
+#define PKTGEN_BURST		32	///< Frames queued at once
+#define PKTGEN_MAX_FLOWS	1024
+#define PKTGEN_MAX_MIX		16	///< Frame sizes in a size mix
+#define PKTGEN_MAGIC		0x50474e31	///< "PGN1"
+
+#define PKTGEN_INC_SRC_IP	0x01	///< Fields which are incremented per flow
+#define PKTGEN_INC_DST_IP	0x02
+#define PKTGEN_INC_SRC_PORT	0x04
+#define PKTGEN_INC_DST_PORT	0x08
+#define PKTGEN_INC_VLAN		0x10
+
+#define PKTGEN_MIN_SIZE		(14 + 20 + 8 + sizeof(Probe))	///< Ethernet, IP, UDP and probe
+#define PKTGEN_MAX_SIZE		1514
+
+/**
+ * Latency histogram buckets. Values under 8 ns have their own buckets, the
+ * others are in 8 buckets per power of 2, so a bucket is within 12.5%.
+ */
+#define PKTGEN_LATENCY_SUB	8
+#define PKTGEN_LATENCY_BUCKETS	(PKTGEN_LATENCY_SUB * 40)
+
+/**
+ * Probe in the UDP payload
+ */
+typedef struct {
+	uint32_t	magic;
+	uint16_t	flow;
+	uint16_t	reserved;
+	uint64_t	seq;		///< Sequence number in the flow
+	uint64_t	time;		///< TSC when the frame is sent
+} __attribute__ ((packed)) Probe;
+
+typedef struct {
+	NIC*		tx_nic;
+	NIC*		rx_nic;		///< NULL not to analyze
+
+	uint64_t	dmac;
+	uint64_t	smac;
+	uint32_t	src_ip;
+	uint32_t	dst_ip;
+	uint16_t	src_port;
+	uint16_t	dst_port;
+	uint16_t	vlan;		///< 0 for untagged frames
+	uint32_t	flows;		///< Number of flows (1 ~ PKTGEN_MAX_FLOWS)
+	uint8_t		increment;	///< PKTGEN_INC_* fields to be different per flow
+
+	uint64_t	rate;		///< Frames per second, 0 for as fast as possible
+	uint64_t	count;		///< Frames to send, 0 for no limit
+	uint16_t	mix[PKTGEN_MAX_MIX];	///< Frame sizes sent in turn (without FCS), 0 for the smallest
+	int		mix_count;
+} Config;
+
+typedef struct {
+	uint64_t	tx_packets;
+	uint64_t	tx_bytes;
+	uint64_t	tx_drops;	///< Frames not allocated or not queued
+
+	uint64_t	rx_packets;
+	uint64_t	rx_bytes;
+	uint64_t	rx_others;	///< Frames without a probe
+	uint64_t	rx_lost;	///< Gaps in sequence numbers
+	uint64_t	rx_reordered;	///< Frames older than the last one of the flow
+
+	uint64_t	latency_min;	///< in nanoseconds
+	uint64_t	latency_max;
+	uint64_t	latency_sum;
+	uint64_t	latency[PKTGEN_LATENCY_BUCKETS];
+} Stats;
+
+extern Config config;
+extern Stats stats;
+extern volatile bool is_running;
+
+/**
+ * Build templates of the configuration, it must be called when the
+ * configuration changes.
+ */
+bool gen_init();
+
+/**
+ * Send frames which are due by the rate.
+ *
+ * @return number of frames sent
+ */
+int gen_tx();
+
+/**
+ * Reset sequence numbers and the rate to start again.
+ */
+void gen_reset();
+
+/**
+ * Analyze received frames.
+ *
+ * @return number of frames received
+ */
+int stats_rx();
+
+void stats_reset();
+void stats_print();
+
+/**
+ * Latency in nanoseconds of a percentile from the histogram.
+ *
+ * @param percentile in per mille, e.g. 990 for p99
+ */
+uint64_t stats_percentile(uint32_t percentile);
+
+#endif /* __PKTGEN_H__ */
@@ -0,0 +1,133 @@
+#include <stdio.h>
+#include <string.h>
+#include <timer.h>
+#include <net/ether.h>
+#include <net/vlan.h>
+#include <net/ip.h>
+#include <net/udp.h>
+#include "pktgen.h"
+
+static uint64_t expected[PKTGEN_MAX_FLOWS];	///< Next sequence number of each flow
+
+static int latency_bucket(uint64_t ns) {
+	if(ns < PKTGEN_LATENCY_SUB)
+		return ns;
+
+	int msb = 63 - __builtin_clzl(ns);
+	int bucket = (msb - 2) * PKTGEN_LATENCY_SUB + ((ns >> (msb - 3)) & (PKTGEN_LATENCY_SUB - 1));
+
+	return bucket < PKTGEN_LATENCY_BUCKETS ? bucket : PKTGEN_LATENCY_BUCKETS - 1;
+}
+
+/*
+ * The smallest value of a bucket
+ */
+static uint64_t latency_value(int bucket) {
+	if(bucket < PKTGEN_LATENCY_SUB)
+		return bucket;
+
+	int msb = bucket / PKTGEN_LATENCY_SUB + 2;
+	uint64_t sub = bucket % PKTGEN_LATENCY_SUB;
+
+	return (PKTGEN_LATENCY_SUB + sub) << (msb - 3);
+}
+
+static void analyze(Packet* packet, uint64_t time) {
+	Ether* ether = (Ether*)(packet->buffer + packet->start);
+	IP* ip;
+	uint32_t len = packet->end - packet->start;
+
+	stats.rx_packets++;
+	stats.rx_bytes += len;
+
+	if(vlan_ether_type(ether, (void**)&ip) != ETHER_TYPE_IPv4 || ip->protocol != IP_PROTOCOL_UDP ||
+			(uint8_t*)ip + IP_LEN + UDP_LEN + sizeof(Probe) > (uint8_t*)ether + len) {
+		stats.rx_others++;
+		return;
+	}
+
+	Probe* probe = (Probe*)((UDP*)ip->body)->body;
+	if(probe->magic != PKTGEN_MAGIC || probe->flow >= PKTGEN_MAX_FLOWS) {
+		stats.rx_others++;
+		return;
+	}
+
+	uint64_t* next = &expected[probe->flow];
+	if(probe->seq >= *next) {
+		stats.rx_lost += probe->seq - *next;
+		*next = probe->seq + 1;
+	} else {
+		// It was counted as lost when a later one arrived
+		stats.rx_reordered++;
+		if(stats.rx_lost)
+			stats.rx_lost--;
+	}
+
+	// The sender and the receiver share the TSC of the host
+	uint64_t tsc = time > probe->time ? time - probe->time : 0;
+	uint64_t ns = tsc / TIMER_FREQUENCY_PER_SEC * 1000000000UL +
+		tsc % TIMER_FREQUENCY_PER_SEC * 1000000000UL / TIMER_FREQUENCY_PER_SEC;
+
+	if(ns < stats.latency_min)
+		stats.latency_min = ns;
+	if(ns > stats.latency_max)
+		stats.latency_max = ns;
+	stats.latency_sum += ns;
+	stats.latency[latency_bucket(ns)]++;
+}
+
+int stats_rx() {
+	Packet* packets[PKTGEN_BURST];
+
+	uint32_t count = nic_rx_burst(config.rx_nic, packets, PKTGEN_BURST);
+	if(!count)
+		return 0;
+
+	uint64_t time = timer_frequency();
+	for(uint32_t i = 0; i < count; i++) {
+		analyze(packets[i], time);
+		nic_free(packets[i]);
+	}
+
+	return count;
+}
+
+void stats_reset() {
+	memset(&stats, 0, sizeof(Stats));
+	memset(expected, 0, sizeof(expected));
+	stats.latency_min = (uint64_t)-1;
+}
+
+uint64_t stats_percentile(uint32_t percentile) {
+	uint64_t total = 0;
+	for(int i = 0; i < PKTGEN_LATENCY_BUCKETS; i++)
+		total += stats.latency[i];
+
+	if(!total)
+		return 0;
+
+	uint64_t rank = (total * percentile + 999) / 1000;
+	uint64_t count = 0;
+	for(int i = 0; i < PKTGEN_LATENCY_BUCKETS; i++) {
+		count += stats.latency[i];
+		if(count >= rank)
+			return latency_value(i);
+	}
+
+	return stats.latency_max;
+}
+
+void stats_print() {
+	uint64_t latencies = stats.rx_packets - stats.rx_others;
+
+	printf("TX packets:%lu bytes:%lu dropped:%lu\n", stats.tx_packets, stats.tx_bytes, stats.tx_drops);
+	printf("RX packets:%lu bytes:%lu lost:%lu reordered:%lu others:%lu\n",
+			stats.rx_packets, stats.rx_bytes, stats.rx_lost, stats.rx_reordered, stats.rx_others);
+
+	if(!latencies)
+		return;
+
+	printf("Latency(ns) min:%lu avg:%lu max:%lu p50:%lu p99:%lu p99.9:%lu\n",
+			stats.latency_min, stats.latency_sum / latencies, stats.latency_max,
+			stats_percentile(500), stats_percentile(990), stats_percentile(999));
+}
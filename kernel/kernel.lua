@@ -35,11 +35,11 @@ workspace "Kernel"
         removefiles { "src/test.c", "src/test/**.c", "src/test/**.h" }
        
         -- Find headers in there 
-        includedirs { "../lib/core/include", "../lib/TLSF/src", "../lib/lwip/src/include", "../lib/lwip/src/include/ipv4", "../lib/vnic/include" }
+        includedirs { "../lib/core/include", "../lib/TLSF/src", "../lib/lwip/src/include", "../lib/lwip/src/include/ipv4", "../lib/vnic/include", "../lib/zlib" }
         -- Link directory
         libdirs { "../lib" }
         -- Link external libaries named 
-        links { "lwip", "core", "vnic", "tlsf" }
+        links { "lwip", "core", "vnic", "tlsf", "z" }
 
         -- Penguingin
         defines { "__PENGUIN__" }
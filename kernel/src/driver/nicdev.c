@@ -1,11 +1,18 @@
 #include "nicdev.h"
 
+#define endian16(v)		__builtin_bswap16((v))		///< Change endianness for 16 bits
 #define endian48(v)		(__builtin_bswap64((v)) >> 16)	///< Change endianness for 48 bits
 
 #define ETHER_MULTICAST		((uint64_t)1 << 40)	///< MAC address is multicast
+#define ETHER_TYPE_8021Q	0x8100			///< Ether type of 802.1q
+#define ETHER_TYPE_8021AD	0x88a8			///< Ether type of 802.1ad
+#define ETHER_ADDR_LEN		12			///< Destination and source MAC addresses
+#define VLAN_LEN		4			///< VLAN tag length
 #define ID_BUFFER_SIZE		(MAX_NIC_DEVICE_COUNT * MAX_VNIC_COUNT / 8)
 
 extern int strncmp(const char* s, const char* d, size_t size);
+extern void* memcpy(void* d, const void* s, size_t size);
+extern void* memmove(void* d, const void* s, size_t size);
 
 typedef struct _Ether {
 	uint64_t dmac: 48;			///< Destination address (endian48)
@@ -14,6 +21,21 @@ typedef struct _Ether {
 	uint8_t payload[0];			///< Ehternet payload
 } __attribute__ ((packed)) Ether;
 
+typedef struct _VLAN {
+	uint16_t	tci;			///< pcp(3) + dei(1) + vid(12) (endian16)
+	uint16_t	type;			///< Ether type of the body (endian16)
+} __attribute__ ((packed)) VLAN;
+
+/**
+ * A frame as at most two buffers to be passed to vnic_rx without copying
+ */
+typedef struct {
+	uint8_t*	buf1;
+	size_t		size1;
+	uint8_t*	buf2;
+	size_t		size2;
+} Frame;
+
 static NICDevice* nic_devices[MAX_NIC_DEVICE_COUNT]; //key string
 static uint8_t id_map[ID_BUFFER_SIZE];
 
@@ -203,34 +225,35 @@ VNIC* nicdev_update_vnic(NICDevice* dev, VNIC* src_vnic) {
 
 	return dst_vnic;
 }
-/**
- * @param dev NIC device
- * @param data data to be sent
- * @param size data size
- *
- * @return result of process
- */
 
-int nicdev_rx(NICDevice* dev, void* data, size_t size) {
-	Ether* eth = data;
-	int i;
+/*
+ * VNICs of VLAN ID 0 are trunk, they get frames as they are on the wire.
+ * VNICs of other VLAN ID get frames of the VLAN only, and the tag is stripped.
+ */
+static int nicdev_dispatch(NICDevice* dev, uint64_t dmac, uint16_t vid, Frame* tagged, Frame* untagged, uint64_t time) {
 	VNIC* vnic;
-	unsigned char* ptr = eth;
-	uint64_t dmac = endian48(eth->dmac);
+	int i;
 
 	//TODO lock
 	if(dmac & ETHER_MULTICAST) {
 		for(i = 0; i < MAX_VNIC_COUNT; i++) {
-			if(!dev->vnics[i])
+			vnic = dev->vnics[i];
+			if(!vnic)
 				break;
 
-			vnic_rx(dev->vnics[i], (uint8_t*)eth, size, NULL, 0);
+			if(vnic->vlan == 0)
+				vnic_rx_stamped(vnic, time, tagged->buf1, tagged->size1, tagged->buf2, tagged->size2);
+			else if(vnic->vlan == vid)
+				vnic_rx_stamped(vnic, time, untagged->buf1, untagged->size1, untagged->buf2, untagged->size2);
 		}
 		return NICDEV_PROCESS_PASS;
 	} else {
 		vnic = nicdev_get_vnic_mac(dev, dmac);
-		if(vnic) {
-			vnic_rx(vnic, (uint8_t*)eth, size, NULL, 0);
+		if(vnic && vnic->vlan == 0) {
+			vnic_rx_stamped(vnic, time, tagged->buf1, tagged->size1, tagged->buf2, tagged->size2);
+			return NICDEV_PROCESS_COMPLETE;
+		} else if(vnic && vnic->vlan == vid) {
+			vnic_rx_stamped(vnic, time, untagged->buf1, untagged->size1, untagged->buf2, untagged->size2);
 			return NICDEV_PROCESS_COMPLETE;
 		}
 	}
@@ -238,6 +261,152 @@ int nicdev_rx(NICDevice* dev, void* data, size_t size) {
 	return NICDEV_PROCESS_PASS;
 }
 
+/*
+ * Make tagged and untagged views of a frame. A tag stripped by hardware is
+ * inserted back into head for trunk VNICs.
+ *
+ * @return VLAN ID of the frame
+ */
+static uint16_t nicdev_frame(uint8_t* ptr, size_t size, uint16_t tci, uint8_t* head,
+		Frame* tagged, Frame* untagged) {
+	Ether* eth = (Ether*)ptr;
+	uint16_t type = endian16(eth->type);
+	uint16_t vid = tci & 0xfff;
+
+	*tagged = (Frame){ ptr, size, NULL, 0 };
+	*untagged = *tagged;
+
+	if(vid) {
+		if(size < ETHER_ADDR_LEN)
+			return 0;
+
+		memcpy(head, ptr, ETHER_ADDR_LEN);
+		*(uint16_t*)(head + ETHER_ADDR_LEN) = endian16(ETHER_TYPE_8021Q);
+		*(uint16_t*)(head + ETHER_ADDR_LEN + 2) = endian16(tci);
+		*tagged = (Frame){ head, ETHER_ADDR_LEN + VLAN_LEN, ptr + ETHER_ADDR_LEN, size - ETHER_ADDR_LEN };
+
+		return vid;
+	}
+
+	if((type != ETHER_TYPE_8021Q && type != ETHER_TYPE_8021AD) || size < ETHER_ADDR_LEN + VLAN_LEN + 2)
+		return 0;
+
+	// Strip the outermost tag by skipping it
+	VLAN* vlan = (VLAN*)eth->payload;
+	*untagged = (Frame){ ptr, ETHER_ADDR_LEN, ptr + ETHER_ADDR_LEN + VLAN_LEN, size - ETHER_ADDR_LEN - VLAN_LEN };
+
+	return endian16(vlan->tci) & 0xfff;
+}
+
+int nicdev_rx(NICDevice* dev, void* data, size_t size) {
+	return nicdev_rx_vlan(dev, 0, data, size);
+}
+
+static int nicdev_rx_frame(NICDevice* dev, uint16_t tci, void* data, size_t size, uint64_t time) {
+	uint8_t head[ETHER_ADDR_LEN + VLAN_LEN];
+	Frame tagged, untagged;
+	uint16_t vid = nicdev_frame(data, size, tci, head, &tagged, &untagged);
+
+	return nicdev_dispatch(dev, endian48(((Ether*)data)->dmac), vid, &tagged, &untagged, time);
+}
+
+int nicdev_rx_vlan(NICDevice* dev, uint16_t tci, void* data, size_t size) {
+	uint64_t time = latency_now();
+
+	if(dev->rx_capture)
+		capture_frame(dev->rx_capture, data, size);
+
+	return nicdev_rx_frame(dev, tci, data, size, time);
+}
+
+VNIC* nicdev_rx_classify(NICDevice* dev, NICDevFrame* frame) {
+	uint8_t head[ETHER_ADDR_LEN + VLAN_LEN];
+	Frame tagged, untagged;
+	uint64_t dmac = endian48(((Ether*)frame->data)->dmac);
+
+	frame->vnic = NULL;
+	if(dmac & ETHER_MULTICAST)
+		return NULL;
+
+	VNIC* vnic = nicdev_get_vnic_mac(dev, dmac);
+	if(!vnic)
+		return NULL;
+
+	uint16_t vid = nicdev_frame(frame->data, frame->size, frame->tci, head, &tagged, &untagged);
+	if(vnic->vlan == 0 || vnic->vlan == vid)
+		frame->vnic = vnic;
+
+	return frame->vnic;
+}
+
+int nicdev_rx_burst(NICDevice* dev, NICDevFrame* frames, int count) {
+	Packet* packets[NICDEV_BURST_SIZE];
+	uint8_t head[ETHER_ADDR_LEN + VLAN_LEN];
+	Frame tagged, untagged;
+	int delivered = 0;
+
+	// Every frame is captured as it's on the wire, before frames are grouped
+	// by VNIC and the ones without a destination are dropped
+	if(dev->rx_capture) {
+		for(int j = 0; j < count; j++)
+			capture_frame(dev->rx_capture, frames[j].data, frames[j].size);
+	}
+
+	//TODO lock
+	for(int i = 0; i < MAX_VNIC_COUNT; i++) {
+		VNIC* vnic = dev->vnics[i];
+		if(!vnic)
+			break;
+
+		uint32_t n = 0;
+		for(int j = 0; j < count; j++) {
+			NICDevFrame* f = &frames[j];
+			if(f->vnic != vnic)
+				continue;
+
+			nicdev_frame(f->data, f->size, f->tci, head, &tagged, &untagged);
+			Frame* frame = vnic->vlan ? &untagged : &tagged;
+
+			Packet* packet = nic_alloc(vnic->nic, frame->size1 + frame->size2);
+			if(!packet)
+				continue;
+
+			memcpy(packet->buffer + packet->start, frame->buf1, frame->size1);
+			memcpy(packet->buffer + packet->start + frame->size1, frame->buf2, frame->size2);
+			packet->end = packet->start + frame->size1 + frame->size2;
+			packet->time = f->time;
+
+			packets[n++] = packet;
+			if(n == NICDEV_BURST_SIZE) {
+				delivered += vnic_rx_burst(vnic, packets, n);
+				n = 0;
+			}
+		}
+
+		if(n)
+			delivered += vnic_rx_burst(vnic, packets, n);
+	}
+
+	return delivered;
+}
+
+/*
+ * Insert the VNIC's tag by moving MAC addresses into the padding head.
+ */
+static bool nicdev_tag(VNIC* vnic, Packet* packet) {
+	if(packet->start < VLAN_LEN)
+		return false;
+
+	uint8_t* src = packet->buffer + packet->start;
+	packet->start -= VLAN_LEN;
+	uint8_t* dst = packet->buffer + packet->start;
+	memmove(dst, src, ETHER_ADDR_LEN);
+	*(uint16_t*)(dst + ETHER_ADDR_LEN) = endian16(ETHER_TYPE_8021Q);
+	*(uint16_t*)(dst + ETHER_ADDR_LEN + 2) = endian16(vnic->vlan);
+
+	return true;
+}
+
 /**
  * @param dev NIC device
  * @param process function to process packets in NIC device
@@ -264,7 +433,19 @@ int nicdev_tx(NICDevice* dev,
 			if(!packet)
 				break;
 
+			if(vnic->vlan && !nicdev_tag(vnic, packet)) {
+				vnic->tx_drops++;
+				nic_free(packet);
+				continue;
+			}
+
+			latency_stamp(&vnic->nic->latency[LATENCY_TX_DRIVER], packet, latency_now());
+
+			if(dev->tx_capture)
+				capture_packet(dev->tx_capture, packet);
+
 			if(!process(packet, context)) {
+				vnic->tx_drops++;
 				nic_free(packet);
 				return 0;
 			}
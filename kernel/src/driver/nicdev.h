@@ -5,6 +5,7 @@
 
 #define MAX_NIC_DEVICE_COUNT	128
 #define MAX_NIC_NAME_LEN	16
+#define NICDEV_BURST_SIZE	64	///< Maximum number of frames in a burst
 
 typedef struct {
 	char		name[MAX_NIC_NAME_LEN];
@@ -12,6 +13,9 @@ typedef struct {
 	void*		driver;
 
 	VNIC*		vnics[MAX_VNIC_COUNT];
+
+	Capture*	rx_capture;	///< Mirror of frames from the wire, NULL if not captured
+	Capture*	tx_capture;	///< Mirror of frames to the wire, NULL if not captured
 } NICDevice;
 
 typedef struct {
@@ -19,6 +23,18 @@ typedef struct {
 	uint64_t	mac;
 } NICInfo;
 
+/**
+ * A received frame in a burst, it stays in the receiver's buffer until the
+ * burst is delivered.
+ */
+typedef struct {
+	void*		data;		///< Ethernet frame
+	size_t		size;		///< Frame size
+	uint16_t	tci;		///< Tag stripped by hardware (host endian), 0 if none
+	uint64_t	time;		///< TSC when the frame is received, 0 if unknown
+	VNIC*		vnic;		///< Destination set by nicdev_rx_classify
+} NICDevFrame;
+
 typedef struct {
 	int		mtu;
 } NICStatus;
@@ -50,6 +66,9 @@ enum NICDEV_PROCESS_RESULT {
 };
 
 /**
+ * Dispatch a frame to VNICs by destination MAC address and VLAN ID.
+ * VNICs which VLAN ID is not 0 get untagged frames of the VLAN only.
+ *
  * @param dev NIC device
  * @param data data to be sent
  * @param size data size
@@ -58,10 +77,50 @@ enum NICDEV_PROCESS_RESULT {
  */
 int nicdev_rx(NICDevice* dev, void* data, size_t size);
 
+/**
+ * Receive a frame which VLAN tag is stripped by hardware.
+ *
+ * @param dev NIC device
+ * @param tci the stripped tag control information (host endian)
+ * @param data untagged frame
+ * @param size data size
+ *
+ * @return result of process
+ */
+int nicdev_rx_vlan(NICDevice* dev, uint16_t tci, void* data, size_t size);
+
+/**
+ * Find the destination of a unicast frame to be delivered in a burst.
+ * Multicast frames and frames which no VNIC takes are not classified and
+ * should be passed to nicdev_rx or nicdev_rx_vlan.
+ *
+ * @param dev NIC device
+ * @param frame received frame, frame->vnic is set to the destination
+ *
+ * @return destination VNIC or NULL
+ */
+VNIC* nicdev_rx_classify(NICDevice* dev, NICDevFrame* frame);
+
+/**
+ * Deliver classified frames. Frames of each VNIC are queued and published to
+ * the VM at once, instead of taking the queue lock frame by frame.
+ * Frames which destination is not registered anymore are dropped.
+ * All the frames are captured by the device's rx capture.
+ *
+ * @param dev NIC device
+ * @param frames frames classified by nicdev_rx_classify, the buffers are not freed
+ * @param count number of frames
+ *
+ * @return number of frames delivered
+ */
+int nicdev_rx_burst(NICDevice* dev, NICDevFrame* frames, int count);
+
 /**
  * @param dev NIC device
  * @param process function to process packets in NIC device
  * @param context context to be passed to process function
+ *        Packets of VNICs which have VLAN ID are tagged before processed.
+ *        The process function takes ownership of the packet when it returns true.
  *
  * @return number of packets proccessed
  */
@@ -13,6 +13,10 @@ typedef enum {
 	ICC_TYPE_RESUMED,
 	ICC_TYPE_STOP,
 	ICC_TYPE_STOPPED,
+	ICC_TYPE_STORAGE_INFLATE,
+	ICC_TYPE_STORAGE_INFLATED,
+	ICC_TYPE_STORAGE_DIGEST,
+	ICC_TYPE_STORAGE_DIGESTED,
 } ICCType;
 
 #define ICC_STATUS_DONE		0
@@ -43,6 +47,10 @@ typedef struct _ICC_Message {
 			size_t*	stderr_head;
 			size_t*	stderr_tail;
 			size_t	stderr_size;
+			char*	log;		// NULL if the application doesn't log
+			size_t*	log_head;
+			size_t*	log_tail;
+			size_t	log_size;
 
 			uint32_t	global_heap_idx;
 		} started;
@@ -50,6 +58,21 @@ typedef struct _ICC_Message {
 		struct {
 			int return_code;
 		} stopped;
+
+		struct {
+			void*	block;		// Storage block to be filled
+			size_t	block_size;
+			void*	buf;		// Compressed data, freed by the core which inflates it
+			size_t	size;
+			void*	context;
+		} inflate;
+
+		struct {
+			void**		blocks;		// Storage blocks to be digested
+			int		count;
+			uint32_t	(*digests)[4];	// Global memory for the digests
+			void*		context;
+		} digest;
 	} data;
 } ICC_Message;
 
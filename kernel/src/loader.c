@@ -8,6 +8,7 @@
 #include <timer.h>
 #include <fio.h>
 #include <file.h>
+#include <util/log.h>
 #include "page.h"
 //#include "vfio.h"
 #include "task.h"
@@ -391,6 +392,18 @@ static bool relocate(VM* vm, void* malloc_pool, void* gmalloc_pool, uint32_t tas
 			return false;
 		}
 
+		// Only if the application logs
+		if(task_addr(task_id, SYM_LOG)) {
+			void* __log = __malloc(LOG_RING_SIZE, malloc_pool);
+			if(__log) {
+				*(uint64_t*)task_addr(task_id, SYM_LOG) = (uint64_t)__log;
+				*(size_t*)task_addr(task_id, SYM_LOG_SIZE) = LOG_RING_SIZE;
+			} else {
+				errno = 0x34;
+				return false;
+			}
+		}
+
 		// TODO: implement FIO
 		// FIO allocation : Only one FIO is needed in a VM
 /*
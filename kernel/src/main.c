@@ -158,17 +158,46 @@ static bool idle0_event(void* data) {
 	return true;
 }
 
+/*
+ * Counters of the core, NULL until the manager allocates them
+ */
+static CoreCounters* core_counters() {
+	if(!shared->core_counters)
+		return NULL;
+
+	return &shared->core_counters[mp_apic_id()];
+}
+
+static void idle_begin(CoreCounters* counters) {
+	if(counters)
+		counters->idle_since = rdtsc();
+}
+
+static void idle_end(CoreCounters* counters) {
+	if(counters) {
+		counters->idle += rdtsc() - counters->idle_since;
+		counters->idle_since = 0;
+	}
+}
+
 static bool idle_monitor_event(void* data) {
 	static uint8_t trigger;
+	CoreCounters* counters = core_counters();
 
+	idle_begin(counters);
 	monitor(&trigger);
 	mwait(1, 0x21);
+	idle_end(counters);
 
 	return true;
 }
 
 static bool idle_hlt_event(void* data) {
+	CoreCounters* counters = core_counters();
+
+	idle_begin(counters);
 	hlt();
+	idle_end(counters);
 
 	return true;
 }
@@ -267,6 +296,15 @@ static void icc_start(ICC_Message* msg) {
 	msg2->data.started.stderr_tail = (void*)TRANSLATE_TO_PHYSICAL((uint64_t)task_addr(id, SYM_STDERR_TAIL));
 	msg2->data.started.stderr_size = *(int*)task_addr(id, SYM_STDERR_SIZE);
 
+	if(task_addr(id, SYM_LOG)) {
+		msg2->data.started.log = (void*)TRANSLATE_TO_PHYSICAL((uint64_t)*(char**)task_addr(id, SYM_LOG));
+		msg2->data.started.log_head = (void*)TRANSLATE_TO_PHYSICAL((uint64_t)task_addr(id, SYM_LOG_HEAD));
+		msg2->data.started.log_tail = (void*)TRANSLATE_TO_PHYSICAL((uint64_t)task_addr(id, SYM_LOG_TAIL));
+		msg2->data.started.log_size = *(size_t*)task_addr(id, SYM_LOG_SIZE);
+	} else {
+		msg2->data.started.log = NULL;
+	}
+
 	msg2->data.started.global_heap_idx = TRANSLATE_TO_PHYSICAL((uint64_t)*(uint64_t*)task_addr(id, SYM_GMALLOC_POOL)) >> 21;
 	
 	icc_send(msg2, msg->apic_id);
@@ -313,6 +351,29 @@ static void icc_stop(ICC_Message* msg) {
 	task_destroy(1);
 }
 
+static void icc_storage_inflate(ICC_Message* msg) {
+	ICC_Message* msg2 = icc_alloc(ICC_TYPE_STORAGE_INFLATED);
+	msg2->data.inflate = msg->data.inflate;
+	msg2->result = vm_storage_inflate(msg->data.inflate.block, msg->data.inflate.block_size,
+			msg->data.inflate.buf, msg->data.inflate.size) < 0 ? -1 : 0;
+
+	gfree(msg->data.inflate.buf);
+	msg2->data.inflate.buf = NULL;
+
+	icc_send(msg2, msg->apic_id);
+	icc_free(msg);
+}
+
+static void icc_storage_digest(ICC_Message* msg) {
+	vm_storage_digest_blocks(msg->data.digest.blocks, msg->data.digest.count, msg->data.digest.digests);
+
+	ICC_Message* msg2 = icc_alloc(ICC_TYPE_STORAGE_DIGESTED);
+	msg2->data.digest = msg->data.digest;
+
+	icc_send(msg2, msg->apic_id);
+	icc_free(msg);
+}
+
 #define EXEC_NOT_FOUND_FILE	-1
 #define EXEC_ERROR		-2
 #define EXEC_NOT_ENOUGH_BUFFER	1
@@ -550,6 +611,8 @@ void main() {
 		icc_register(ICC_TYPE_START, icc_start);
 		icc_register(ICC_TYPE_RESUME, icc_resume);
 		icc_register(ICC_TYPE_STOP, icc_stop);
+		icc_register(ICC_TYPE_STORAGE_INFLATE, icc_storage_inflate);
+		icc_register(ICC_TYPE_STORAGE_DIGEST, icc_storage_digest);
 		apic_register(49, icc_pause);
 
 		if(cpu_has_feature(CPU_FEATURE_MONITOR_MWAIT) && cpu_has_feature(CPU_FEATURE_MWAIT_INTERRUPT))
@@ -576,6 +639,8 @@ void main() {
 		icc_register(ICC_TYPE_START, icc_start);
 		icc_register(ICC_TYPE_RESUME, icc_resume);
 		icc_register(ICC_TYPE_STOP, icc_stop);
+		icc_register(ICC_TYPE_STORAGE_INFLATE, icc_storage_inflate);
+		icc_register(ICC_TYPE_STORAGE_DIGEST, icc_storage_digest);
 		apic_register(49, icc_pause);
 
 		if(cpu_has_feature(CPU_FEATURE_MONITOR_MWAIT) && cpu_has_feature(CPU_FEATURE_MWAIT_INTERRUPT))
@@ -596,6 +661,10 @@ void main() {
 	 */
 
 	while(1) {
-		event_loop();
+		int count = event_loop();
+
+		CoreCounters* counters = core_counters();
+		if(counters)
+			counters->events += count;
 	}
 }
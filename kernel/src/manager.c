@@ -15,15 +15,21 @@
 #include <net/tftp.h>
 #include <net/interface.h>
 #include <util/list.h>
+#include <util/map.h>
 #include <util/ring.h>
 #include <util/event.h>
+#include <util/log.h>
+#include <timer.h>
 #undef BYTE_ORDER
 #include <lwip/tcp.h>
 #include <control/rpc.h>
+#include <net/md5.h>
 #include "malloc.h"
 #include "mp.h"
 #include "shell.h"
 #include "vm.h"
+#include "icc.h"
+#include "gmalloc.h"
 #include "stdio.h"
 
 #include "manager.h"
@@ -42,30 +48,30 @@ static uint16_t manager_port;
 // LwIP TCP callbacks
 typedef struct {
 	struct tcp_pcb*	pcb;
-	List*		pbufs;
+	struct pbuf*	pbuf;		// Received chain, which is read in place
+	uint16_t	offset;		// Bytes read of the first pbuf
 	int		poll_count;
 } RPCData;
 
 static List* clients;	/* pcb */
 static List* actives;	/* rpc */
+static List* log_clients;	/* pcb which is sent the log formats */
+static Map* stdio_droppeds;	/* pcb: StdioDropped[VM_STDIO_MAX_BATCH] */
 
 static err_t manager_poll(void* arg, struct tcp_pcb* pcb);
 
 static void rpc_free(RPC* rpc) {
 	RPCData* data = (RPCData*)rpc->data;
 	
-	ListIterator iter;
-	list_iterator_init(&iter, data->pbufs);
-	while(list_iterator_has_next(&iter)) {
-		struct pbuf* pbuf = list_iterator_next(&iter);
-		list_iterator_remove(&iter);
-		pbuf_free(pbuf);
-	}
-	list_destroy(data->pbufs);
+	if(data->pbuf)
+		pbuf_free(data->pbuf);
 	list_remove_data(actives, rpc);
+	free(rpc->storage_block_recv);
 	free(rpc);
 	
 	list_remove_data(clients, data->pcb);
+	list_remove_data(log_clients, data->pcb);
+	free(map_remove(stdio_droppeds, data->pcb));
 }
 
 static void manager_close(struct tcp_pcb* pcb, RPC* rpc, bool is_force) {
@@ -80,6 +86,8 @@ static void manager_close(struct tcp_pcb* pcb, RPC* rpc, bool is_force) {
 		rpc_free(rpc);
 	} else {
 		list_remove_data(clients, pcb);
+		list_remove_data(log_clients, pcb);
+		free(map_remove(stdio_droppeds, pcb));
 	}
 	
 	if(is_force) {
@@ -98,11 +106,14 @@ static err_t manager_recv(void* arg, struct tcp_pcb* pcb, struct pbuf* p, err_t
 	} else if(err != ERR_OK) {
 		pbuf_free(p);
 	} else {
+		// The window is opened as the data is read by pcb_read
 		RPCData* data = (RPCData*)rpc->data;
-		list_add(data->pbufs, p);
+		if(data->pbuf)
+			pbuf_cat(data->pbuf, p);
+		else
+			data->pbuf = p;
 
 		rpc_loop(rpc);
-		tcp_recved(pcb, p->len);
 		if(rpc_is_active(rpc)) {
 			if(list_index_of(actives, rpc, NULL) < 0) {
 				list_add(actives, rpc);
@@ -172,9 +183,120 @@ static void status_get_handler(RPC* rpc, uint32_t vmid, void* context, void(*cal
 	callback(rpc, status);
 }
 
+static void latency_get_handler(RPC* rpc, uint32_t vmid, int size, void* context, void(*callback)(RPC* rpc, VMLatency* latencies, int size)) {
+	VMLatency* latencies = malloc(sizeof(VMLatency) * size);
+	if(!latencies) {
+		callback(rpc, NULL, 0);
+		return;
+	}
+
+	size = vm_latency(vmid, latencies, size);
+	callback(rpc, latencies, size < 0 ? 0 : size);
+	free(latencies);
+}
+
+#define TELEMETRY_TICK	100000	// Subscriptions are checked every 100ms
+
+typedef struct {
+	RPC*		rpc;
+	struct tcp_pcb*	pcb;
+	uint32_t	request_id;
+	uint32_t	interval;	// ms
+	uint64_t	next;		// us
+	int		nic_size;
+	void(*callback)(RPC* rpc, VMTelemetry* telemetry, VMCoreTelemetry* cores, int core_count, VMNICTelemetry* nics, int nic_count);
+} Subscription;
+
+static List* subscriptions;
+
+static void telemetry_handler(RPC* rpc, uint32_t interval, int nic_size, void* context, void(*callback)(RPC* rpc, VMTelemetry* telemetry, VMCoreTelemetry* cores, int core_count, VMNICTelemetry* nics, int nic_count)) {
+	// A subscription is cancelled by its ID
+	ListIterator iter;
+	list_iterator_init(&iter, subscriptions);
+	while(list_iterator_has_next(&iter)) {
+		Subscription* s = list_iterator_next(&iter);
+		if(s->rpc == rpc && s->request_id == rpc->request_id) {
+			list_iterator_remove(&iter);
+			free(s);
+		}
+	}
+
+	if(interval == 0)
+		return;
+
+	Subscription* s = malloc(sizeof(Subscription));
+	if(!s)
+		return;
+
+	s->rpc = rpc;
+	s->pcb = context;
+	s->request_id = rpc->request_id;
+	s->interval = interval;
+	s->next = 0;
+	s->nic_size = nic_size;
+	s->callback = callback;
+
+	if(!list_add(subscriptions, s))
+		free(s);
+}
+
+static bool telemetry_timer(void* context) {
+	if(list_is_empty(subscriptions))
+		return true;
+
+	VMTelemetry telemetry;
+	VMCoreTelemetry cores[RPC_TELEMETRY_MAX_CORES];
+	VMNICTelemetry* nics = NULL;
+	int core_count = 0;
+	int nic_count = 0;
+	int nic_size = -1;
+
+	// Sampled once for every subscriber of the tick, as many NICs as the
+	// largest request
+	uint64_t time = timer_us();
+	ListIterator iter;
+	list_iterator_init(&iter, subscriptions);
+	while(list_iterator_has_next(&iter)) {
+		Subscription* s = list_iterator_next(&iter);
+		if(list_index_of(clients, s->pcb, NULL) < 0) {
+			list_iterator_remove(&iter);
+			free(s);
+			continue;
+		}
+
+		if(s->next <= time && s->nic_size > nic_size)
+			nic_size = s->nic_size;
+	}
+
+	if(nic_size < 0)
+		return true;
+
+	vm_telemetry(&telemetry);
+	core_count = vm_telemetry_cores(cores, RPC_TELEMETRY_MAX_CORES);
+	nics = nic_size > 0 ? malloc(sizeof(VMNICTelemetry) * nic_size) : NULL;
+	if(nics)
+		nic_count = vm_telemetry_nics(nics, nic_size);
+
+	list_iterator_init(&iter, subscriptions);
+	while(list_iterator_has_next(&iter)) {
+		Subscription* s = list_iterator_next(&iter);
+		if(s->next > time)
+			continue;
+		s->next = time + (uint64_t)s->interval * 1000;
+
+		s->rpc->request_id = s->request_id;
+		s->callback(s->rpc, &telemetry, cores, core_count, nics, nic_count < s->nic_size ? nic_count : s->nic_size);
+	}
+
+	free(nics);
+
+	return true;
+}
+
 typedef struct {
 	RPC* rpc;
 	struct tcp_pcb*	pcb;
+	uint32_t request_id;
 	void(*callback)(RPC* rpc, bool result);
 } Data;
 
@@ -182,6 +304,7 @@ static void status_setted(bool result, void* context) {
 	Data* data = context;
 	
 	if(list_index_of(clients, data->pcb, NULL) >= 0) {
+		data->rpc->request_id = data->request_id;
 		data->callback(data->rpc, result);
 	}
 	free(data);
@@ -191,11 +314,89 @@ static void status_set_handler(RPC* rpc, uint32_t vmid, VMStatus status, void* c
 	Data* data = malloc(sizeof(Data));
 	data->rpc = rpc;
 	data->pcb = context;
+	data->request_id = rpc->request_id;
 	data->callback = callback;
 	
 	vm_status_set(vmid, status, status_setted, data);
 }
 
+static void vm_create_batch_handler(RPC* rpc, VMSpec** vms, int count, void* context, void(*callback)(RPC* rpc, uint32_t* ids, int count)) {
+	uint32_t ids[RPC_MAX_BATCH];
+	for(int i = 0; i < count; i++)
+		ids[i] = vms[i] ? vm_create(vms[i]) : 0;
+
+	callback(rpc, ids, count);
+}
+
+typedef struct _BatchData BatchData;
+
+typedef struct {
+	BatchData*	batch;
+	int		index;
+} BatchItem;
+
+struct _BatchData {
+	RPC*		rpc;
+	struct tcp_pcb*	pcb;
+	uint32_t	request_id;
+	void(*callback)(RPC* rpc, bool* results, int count);
+	int		count;
+	int		pending;	// VMs which have not changed their status yet, and the batch itself
+	bool		results[RPC_MAX_BATCH];
+	BatchItem	items[RPC_MAX_BATCH];
+};
+
+static void batch_done(BatchData* data) {
+	if(--data->pending > 0)
+		return;
+
+	if(list_index_of(clients, data->pcb, NULL) >= 0) {
+		data->rpc->request_id = data->request_id;
+		data->callback(data->rpc, data->results, data->count);
+	}
+	free(data);
+}
+
+static void status_batch_setted(bool result, void* context) {
+	BatchItem* item = context;
+	item->batch->results[item->index] = result;
+
+	batch_done(item->batch);
+}
+
+static void status_set_batch_handler(RPC* rpc, uint32_t* vmids, int count, VMStatus status, void* context, void(*callback)(RPC* rpc, bool* results, int count)) {
+	BatchData* data = malloc(sizeof(BatchData));
+	if(!data) {
+		bool results[RPC_MAX_BATCH] = { false, };
+		callback(rpc, results, count);
+		return;
+	}
+
+	data->rpc = rpc;
+	data->pcb = context;
+	data->request_id = rpc->request_id;
+	data->callback = callback;
+	data->count = count;
+	data->pending = count + 1;
+
+	// Every VM is changed at once, the batch is answered when the slowest is done
+	for(int i = 0; i < count; i++) {
+		data->items[i].batch = data;
+		data->items[i].index = i;
+		vm_status_set(vmids[i], status, status_batch_setted, &data->items[i]);
+	}
+
+	batch_done(data);
+}
+
+static void vm_destroy_batch_handler(RPC* rpc, uint32_t* vmids, int count, void* context, void(*callback)(RPC* rpc, bool* results, int count)) {
+	bool results[RPC_MAX_BATCH];
+	for(int i = 0; i < count; i++)
+		results[i] = vm_destroy(vmids[i]);
+
+	callback(rpc, results, count);
+}
+
 static void storage_download_handler(RPC* rpc, uint32_t vmid, uint64_t download_size, uint32_t offset, int32_t size, void* context, void(*callback)(RPC* rpc, void* buf, int32_t size)) {
 	if(size < 0) {
 		callback(rpc, NULL, size);
@@ -239,6 +440,11 @@ static void storage_upload_handler(RPC* rpc, uint32_t vmid, uint32_t offset, voi
 	}
 }
 
+static int32_t storage_bulk_handler(RPC* rpc, uint32_t vmid, uint64_t offset, void** buf, int32_t size, void* context) {
+	// Frames are sent from and received into the storage blocks
+	return vm_storage_read(vmid, buf, offset, size);
+}
+
 static void stdio_handler(RPC* rpc, uint32_t id, uint8_t thread_id, int fd, char* str, uint16_t size, void* context, void(*callback)(RPC* rpc, uint16_t size)) {
 	ssize_t len = vm_stdio(id, thread_id, fd, str, size);
 	callback(rpc, len >= 0 ? len : 0);
@@ -251,26 +457,206 @@ static void storage_md5_handler(RPC* rpc, uint32_t id, uint64_t size, void* cont
 	callback(rpc, ret, md5sum);
 }
 
+typedef struct {
+	RPC* rpc;
+	struct tcp_pcb*	pcb;
+	VM* vm;
+	uint32_t request_id;
+	uint32_t index;
+	int count;
+	int pending;
+	uint32_t (*digests)[4];
+	void(*callback)(RPC* rpc, uint32_t index, uint32_t* digests, int count);
+} DigestData;
+
+static void icc_storage_digested(ICC_Message* msg) {
+	DigestData* data = msg->data.digest.context;
+	icc_free(msg);
+
+	if(--data->pending > 0)
+		return;
+
+	if(list_index_of(clients, data->pcb, NULL) >= 0) {
+		data->rpc->request_id = data->request_id;
+		data->callback(data->rpc, data->index, (uint32_t*)data->digests, data->count);
+	}
+	vm_storage_unref(data->vm);
+	gfree(data->digests);
+	free(data);
+}
+
+static void storage_digest_handler(RPC* rpc, uint32_t id, uint32_t index, int count, void* context, void(*callback)(RPC* rpc, uint32_t index, uint32_t* digests, int count)) {
+	VM* vm = vm_get(id);
+	if(!vm || count <= 0) {
+		callback(rpc, index, NULL, -1);
+		return;
+	}
+
+	if(index >= vm->storage.count) {
+		callback(rpc, index, NULL, 0);
+		return;
+	}
+
+	if((uint32_t)count > vm->storage.count - index)
+		count = vm->storage.count - index;
+
+	// Blocks are split among idle cores so that the manager is not blocked
+	uint8_t apic_ids[MP_MAX_CORE_COUNT];
+	int core_count = vm_idle_cores(apic_ids, MP_MAX_CORE_COUNT);
+	DigestData* data = core_count > 0 ? malloc(sizeof(DigestData)) : NULL;
+	uint32_t (*digests)[4] = data ? gmalloc(sizeof(uint32_t) * 4 * count) : NULL;
+	if(!digests) {
+		free(data);
+
+		digests = malloc(sizeof(uint32_t) * 4 * count);
+		if(!digests) {
+			callback(rpc, index, NULL, -1);
+			return;
+		}
+
+		vm_storage_digest_blocks(vm->storage.blocks + index, count, digests);
+		callback(rpc, index, (uint32_t*)digests, count);
+		free(digests);
+		return;
+	}
+
+	// Each core gets whole lanes of MD5
+	int lanes = (count + MD5_LANES - 1) / MD5_LANES;
+	if(core_count > lanes)
+		core_count = lanes;
+
+	data->rpc = rpc;
+	data->pcb = context;
+	data->vm = vm;
+	data->request_id = rpc->request_id;
+	data->index = index;
+	data->count = count;
+	data->pending = core_count;
+	data->digests = digests;
+	data->callback = callback;
+
+	// The blocks are kept until every core is done even if the VM is destroyed
+	vm_storage_ref(vm);
+
+	int offset = 0;
+	for(int i = 0; i < core_count; i++) {
+		int size = (lanes / core_count + (i < lanes % core_count ? 1 : 0)) * MD5_LANES;
+		if(size > count - offset)
+			size = count - offset;
+
+		ICC_Message* msg = icc_alloc(ICC_TYPE_STORAGE_DIGEST);
+		msg->data.digest.blocks = vm->storage.blocks + index + offset;
+		msg->data.digest.count = size;
+		msg->data.digest.digests = digests + offset;
+		msg->data.digest.context = data;
+		icc_send(msg, apic_ids[i]);
+
+		offset += size;
+	}
+}
+
+typedef struct {
+	RPC* rpc;
+	struct tcp_pcb*	pcb;
+	VM* vm;
+	uint32_t request_id;
+	uint32_t index;
+	void(*callback)(RPC* rpc, uint32_t index, int32_t status);
+} BlockData;
+
+static void icc_storage_inflated(ICC_Message* msg) {
+	BlockData* data = msg->data.inflate.context;
+
+	if(list_index_of(clients, data->pcb, NULL) >= 0) {
+		data->rpc->request_id = data->request_id;
+		data->callback(data->rpc, data->index, msg->result);
+	}
+	vm_storage_unref(data->vm);
+	free(data);
+	icc_free(msg);
+}
+
+static void storage_block_handler(RPC* rpc, uint32_t id, uint32_t index, uint8_t encoding, void* buf, int32_t size, void* context, void(*callback)(RPC* rpc, uint32_t index, int32_t status)) {
+	void* block;
+	if(vm_storage_read(id, &block, (size_t)index * VM_STORAGE_SIZE_ALIGN, VM_STORAGE_SIZE_ALIGN) != VM_STORAGE_SIZE_ALIGN) {
+		callback(rpc, index, -1);
+		return;
+	}
+
+	if(encoding == RPC_STORAGE_BLOCK_RAW) {
+		if(size > VM_STORAGE_SIZE_ALIGN) {
+			callback(rpc, index, -1);
+			return;
+		}
+
+		memcpy(block, buf, size);
+		bzero(block + size, VM_STORAGE_SIZE_ALIGN - size);
+		callback(rpc, index, 0);
+		return;
+	} else if(encoding != RPC_STORAGE_BLOCK_DEFLATE) {
+		callback(rpc, index, -1);
+		return;
+	}
+
+	// Blocks are inflated by idle cores while the manager receives the next one
+	int apic_id = vm_idle_core();
+	BlockData* data = apic_id >= 0 ? malloc(sizeof(BlockData)) : NULL;
+	void* buf2 = data ? gmalloc(size) : NULL;
+	if(!buf2) {
+		free(data);
+		callback(rpc, index, vm_storage_inflate(block, VM_STORAGE_SIZE_ALIGN, buf, size) < 0 ? -1 : 0);
+		return;
+	}
+
+	memcpy(buf2, buf, size);
+	data->rpc = rpc;
+	data->pcb = context;
+	data->vm = vm_get(id);
+	data->request_id = rpc->request_id;
+	data->index = index;
+	data->callback = callback;
+
+	ICC_Message* msg = icc_alloc(ICC_TYPE_STORAGE_INFLATE);
+	msg->data.inflate.block = block;
+	msg->data.inflate.block_size = VM_STORAGE_SIZE_ALIGN;
+	msg->data.inflate.buf = buf2;
+	msg->data.inflate.size = size;
+	msg->data.inflate.context = data;
+	vm_storage_ref(data->vm);
+	icc_send(msg, apic_id);
+}
+
 // PCB utility
 static int pcb_read(RPC* rpc, void* buf, int size) {
 	RPCData* data = (RPCData*)rpc->data;
 	
+	// Copied straight from the received packets, a pbuf may be read partially
 	int idx = 0;
-	ListIterator iter;
-	list_iterator_init(&iter, data->pbufs);
-	while(list_iterator_has_next(&iter)) {
-		struct pbuf* pbuf = list_iterator_next(&iter);
-		if(idx + pbuf->len <= size) {
-			memcpy(buf + idx, pbuf->payload, pbuf->len);
-			idx += pbuf->len;
-			size -= pbuf->len;
+	while(data->pbuf && idx < size) {
+		struct pbuf* pbuf = data->pbuf;
+		int len = pbuf->len - data->offset;
+		len = len > size - idx ? size - idx : len;
+		memcpy(buf + idx, pbuf->payload + data->offset, len);
+		idx += len;
+		data->offset += len;
+
+		if(data->offset >= pbuf->len) {
+			struct pbuf* next = pbuf->next;
+			if(next) {
+				pbuf_ref(next);
+				pbuf_dechain(pbuf);
+			}
 			pbuf_free(pbuf);
-			list_iterator_remove(&iter);
-		} else {
-			break;
+
+			data->pbuf = next;
+			data->offset = 0;
 		}
 	}
 
+	// Not more than the window is buffered
+	if(idx > 0)
+		tcp_recved(data->pcb, idx);
+
 	return idx;
 }
 
@@ -316,14 +702,21 @@ static err_t manager_accept(void* arg, struct tcp_pcb* pcb, err_t err) {
 	rpc_vm_list_handler(rpc, vm_list_handler, NULL);
 	rpc_status_get_handler(rpc, status_get_handler, NULL);
 	rpc_status_set_handler(rpc, status_set_handler, pcb);
+	rpc_vm_create_batch_handler(rpc, vm_create_batch_handler, NULL);
+	rpc_status_set_batch_handler(rpc, status_set_batch_handler, pcb);
+	rpc_vm_destroy_batch_handler(rpc, vm_destroy_batch_handler, NULL);
+	rpc_telemetry_handler(rpc, telemetry_handler, pcb);
 	rpc_storage_download_handler(rpc, storage_download_handler, NULL);
 	rpc_storage_upload_handler(rpc, storage_upload_handler, NULL);
+	rpc_storage_bulk_handler(rpc, storage_bulk_handler, NULL);
 	rpc_stdio_handler(rpc, stdio_handler, NULL);
 	rpc_storage_md5_handler(rpc, storage_md5_handler, NULL);
+	rpc_storage_digest_handler(rpc, storage_digest_handler, pcb);
+	rpc_storage_block_handler(rpc, storage_block_handler, pcb);
+	rpc_latency_get_handler(rpc, latency_get_handler, NULL);
 	
 	RPCData* data = (RPCData*)rpc->data;
 	data->pcb = pcb;
-	data->pbufs = list_create(NULL);
 	
 	tcp_arg(pcb, rpc);
 	tcp_recv(pcb, manager_recv);
@@ -347,42 +740,153 @@ static Packet* manage(Packet* packet) {
 	return packet;
 }
 
-static void stdio_callback(uint32_t vmid, int thread_id, int fd, char* buffer, volatile size_t* head, volatile size_t* tail, size_t size) {
-	ListIterator iter;
-	list_iterator_init(&iter, clients);
-	size_t len0, len1, len2;
-	bool wrapped;
+/*
+ * Log formats registered before the client is connected, in messages of
+ * whole registrations
+ */
+static void log_formats_send(RPC* rpc) {
+	VMStdio formats[MP_MAX_CORE_COUNT];
+	int count = vm_log_formats(formats, MP_MAX_CORE_COUNT);
+	for(int i = 0; i < count; i++) {
+		size_t offset = 0;
+		while(offset < formats[i].size) {
+			size_t len = 0;
+			while(offset + len < formats[i].size) {
+				LogRecord* record = (LogRecord*)(formats[i].str + offset + len);
+				if(len + record->size > VM_STDIO_BATCH_SIZE)
+					break;
+				len += record->size;
+			}
 
-	if(*head <= *tail) {
-		wrapped = false;
+			VMStdio piece = formats[i];
+			piece.str = formats[i].str + offset;
+			piece.size = len;
+			if(rpc_stdio_batch(rpc, &piece, 1) <= 0) {
+				rpc_loop(rpc);
+				if(rpc_stdio_batch(rpc, &piece, 1) <= 0)
+					return;
+			}
 
-		len0 = *tail - *head;
-	} else {
-		wrapped = true;
+			if(piece.size != len)
+				return;
+
+			rpc_loop(rpc);
+			offset += len;
+		}
+	}
+}
+
+/*
+ * Bytes of a stream which a client could not take, reported in dropped of the
+ * next chunk of the stream sent to the client
+ */
+typedef struct {
+	uint32_t	vmid;
+	uint8_t		thread_id;
+	uint8_t		fd;
+	uint32_t	dropped;
+} StdioDropped;
+
+static StdioDropped* stdio_dropped_find(StdioDropped* droppeds, VMStdio* record) {
+	for(int i = 0; i < VM_STDIO_MAX_BATCH; i++) {
+		StdioDropped* dropped = &droppeds[i];
+		if(dropped->dropped && dropped->vmid == record->vmid &&
+				dropped->thread_id == record->thread_id && dropped->fd == record->fd)
+			return dropped;
+	}
+
+	return NULL;
+}
+
+static void stdio_dropped_add(StdioDropped* droppeds, VMStdio* record, uint32_t size) {
+	if(!droppeds || !size)
+		return;
+
+	StdioDropped* dropped = stdio_dropped_find(droppeds, record);
+	for(int i = 0; !dropped && i < VM_STDIO_MAX_BATCH; i++) {
+		if(!droppeds[i].dropped) {
+			dropped = &droppeds[i];
+			dropped->vmid = record->vmid;
+			dropped->thread_id = record->thread_id;
+			dropped->fd = record->fd;
+		}
+	}
+
+	if(dropped)
+		dropped->dropped += size;
+}
+
+static void stdio_dropped_take(StdioDropped* droppeds, VMStdio* record) {
+	if(!droppeds)
+		return;
+
+	StdioDropped* dropped = stdio_dropped_find(droppeds, record);
+	if(dropped) {
+		record->dropped += dropped->dropped;
+		dropped->dropped = 0;
+	}
+}
 
-		len1 = size - *head;
-		len2 = *tail;
+static void stdio_callback(VMStdio* records, int count) {
+	ListIterator iter;
+	list_iterator_init(&iter, clients);
+
+	bool is_log = false;
+	for(int i = 0; i < count; i++) {
+		if(records[i].fd == VM_STDIO_LOG)
+			is_log = true;
 	}
 
 	while(list_iterator_has_next(&iter)) {
 		struct tcp_pcb* pcb = list_iterator_next(&iter);
 		RPC* rpc = pcb->callback_arg;
-	
-		if(wrapped) {
-			rpc_stdio(rpc, vmid, thread_id, fd, buffer + *head, len1, NULL, NULL);
-			rpc_stdio(rpc, vmid, thread_id, fd, buffer, len2, NULL, NULL);
 
-		} else {
-			rpc_stdio(rpc, vmid, thread_id, fd, buffer + *head, len0, NULL, NULL);
-		}	
-		
-		rpc_loop(rpc);
-	}
-	
-	if(wrapped) {
-		*head = (*head + len1 + len2) % size;
-	} else {
-		*head += len0;
+		// Log records are not readable without their formats
+		if(is_log && list_index_of(log_clients, pcb, NULL) < 0) {
+			log_formats_send(rpc);
+			list_add(log_clients, pcb);
+		}
+
+		StdioDropped* droppeds = map_get(stdio_droppeds, pcb);
+		if(!droppeds) {
+			droppeds = calloc(VM_STDIO_MAX_BATCH, sizeof(StdioDropped));
+			if(droppeds && !map_put(stdio_droppeds, pcb, droppeds)) {
+				free(droppeds);
+				droppeds = NULL;
+			}
+		}
+
+		// Cut chunks are not shared with the other clients
+		VMStdio batch[VM_STDIO_MAX_BATCH];
+		memcpy(batch, records, sizeof(VMStdio) * count);
+		for(int i = 0; i < count; i++)
+			stdio_dropped_take(droppeds, &batch[i]);
+
+		// The rest is sent once flushed, or dropped if the client is still busy
+		int sent = 0;
+		for(int retry = 0; retry < 2 && sent < count; retry++) {
+			int written = rpc_stdio_batch(rpc, batch + sent, count - sent);
+			if(written < 0)
+				break;
+
+			rpc_loop(rpc);
+			sent += written;
+			if(written == 0)
+				continue;
+
+			// The rest of a cut chunk is sent as a chunk of its own
+			VMStdio* last = &batch[sent - 1];
+			char* end = records[sent - 1].str + records[sent - 1].size;
+			if(last->str + last->size < end) {
+				last->str += last->size;
+				last->size = end - last->str;
+				last->dropped = 0;
+				sent--;
+			}
+		}
+
+		for(int i = sent; i < count; i++)
+			stdio_dropped_add(droppeds, &batch[i], batch[i].size + batch[i].dropped);
 	}
 }
 
@@ -413,6 +917,20 @@ static bool manager_server_open() {
 	if(actives == NULL)
 		actives = list_create(NULL);
 
+	if(log_clients == NULL)
+		log_clients = list_create(NULL);
+
+	if(stdio_droppeds == NULL)
+		stdio_droppeds = map_create(4, map_uint64_hash, map_uint64_equals, NULL);
+
+	if(subscriptions == NULL) {
+		subscriptions = list_create(NULL);
+		event_timer_add(telemetry_timer, NULL, TELEMETRY_TICK, TELEMETRY_TICK);
+	}
+
+	icc_register(ICC_TYPE_STORAGE_INFLATED, icc_storage_inflated);
+	icc_register(ICC_TYPE_STORAGE_DIGESTED, icc_storage_digested);
+
 	return true;
 }
 
@@ -13,6 +13,16 @@ typedef struct {
 	volatile uint8_t 	icc_queue_lock;
 } ICC;
 
+/**
+ * Counters of a core, written only by the core and read by the manager
+ * without locking.
+ */
+typedef struct {
+	volatile uint64_t	idle;		///< TSC spent waiting for events
+	volatile uint64_t	idle_since;	///< TSC since when the core is waiting, 0 if busy
+	volatile uint64_t	events;		///< Events handled by the event loop
+} __attribute__((__aligned__(64))) CoreCounters;
+
 typedef struct {
 	volatile uint8_t	mp_cores[MP_MAX_CORE_COUNT];
 		
@@ -22,6 +32,7 @@ typedef struct {
 	volatile uint8_t	icc_lock_alloc;
 	volatile uint8_t	icc_lock_free;
 	ICC*			    icc_queues;
+	CoreCounters*		core_counters;	///< Per APIC ID, allocated by the manager
 
 	uint64_t		    magic;
 } Shared;
@@ -25,6 +25,7 @@
 #include "port.h"
 #include "acpi.h"
 #include "vm.h"
+#include "trace.h"
 #include "asm.h"
 #include "file.h"
 #include "driver/charout.h"
@@ -705,6 +706,7 @@ static int cmd_create(int argc, char** argv, void(*callback)(char* result, int e
 	nic->input_bandwidth = 1000000000;	/* 1 GB */
 	nic->output_bandwidth = 1000000000;	/* 1 GB */
 	nic->pool_size = 0x400000;		/* 4 MB */
+	nic->vlan = 0;
 
 	for(int i = 1; i < argc; i++) {
 		if(strcmp(argv[i], "core:") == 0) {
@@ -745,6 +747,7 @@ static int cmd_create(int argc, char** argv, void(*callback)(char* result, int e
 			nic->input_bandwidth = 1000000000; /* 1 GB */
 			nic->output_bandwidth = 1000000000; /* 1 GB */
 			nic->pool_size = 0x400000; /* 4 MB */
+			nic->vlan = 0;
 
 			for( ; i < argc; i++) {
 				if(strcmp(argv[i], "mac:") == 0) {
@@ -807,6 +810,13 @@ static int cmd_create(int argc, char** argv, void(*callback)(char* result, int e
 						return -1;
 					}
 					nic->pool_size = parse_uint32(argv[i]);
+				} else if(strcmp(argv[i], "vlan:") == 0) {
+					i++;
+					if(!is_uint16(argv[i]) || parse_uint16(argv[i]) > 0xfff) {
+						printf("VLAN must be 0 ~ 4095\n");
+						return -1;
+					}
+					nic->vlan = parse_uint16(argv[i]);
 				} else {
 					i--;
 					break;
@@ -1047,6 +1057,144 @@ static int cmd_stdio(int argc, char** argv, void(*callback)(char* result, int ex
 	return 0;
 }
 
+static int cmd_capture(int argc, char** argv, void(*callback)(char* result, int exit_status)) {
+	if(argc < 3)
+		return CMD_STATUS_WRONG_NUMBER;
+
+	if(!strcmp(argv[1], "start")) {
+		if(argc < 4)
+			return CMD_STATUS_WRONG_NUMBER;
+
+		if(!is_uint32(argv[3]))
+			return -1;
+
+		uint16_t snaplen = 0;
+		if(argc > 4) {
+			if(!is_uint16(argv[4]))
+				return -2;
+
+			snaplen = parse_uint16(argv[4]);
+		}
+
+		if(!trace_capture_start(argv[2], parse_uint32(argv[3]), snaplen)) {
+			printf("Cannot capture %s\n", argv[2]);
+			callback("false", -1);
+			return -3;
+		}
+
+		callback("true", 0);
+		return 0;
+	} else if(!strcmp(argv[1], "stop")) {
+		uint64_t packets;
+		uint64_t drops;
+		ssize_t size = trace_capture_stop(argv[2], &packets, &drops);
+		if(size < 0) {
+			printf("%s is not captured\n", argv[2]);
+			callback("0", -1);
+			return -3;
+		}
+
+		printf("Captured %lu packets (%lu dropped), %ld bytes\n", packets, drops, size);
+		sprintf(cmd_result, "%ld", size);
+		callback(cmd_result, 0);
+		return 0;
+	}
+
+	return CMD_STATUS_NOT_FOUND;
+}
+
+static int cmd_replay(int argc, char** argv, void(*callback)(char* result, int exit_status)) {
+	if(argc < 3)
+		return CMD_STATUS_WRONG_NUMBER;
+
+	if(!strcmp(argv[1], "stop")) {
+		uint64_t packets;
+		uint64_t drops;
+		if(!trace_replay_stop(argv[2], &packets, &drops)) {
+			printf("%s is not replayed\n", argv[2]);
+			callback("false", -1);
+			return -3;
+		}
+
+		printf("Replayed %lu packets (%lu dropped)\n", packets, drops);
+		callback("true", 0);
+		return 0;
+	}
+
+	if(argc < 4)
+		return CMD_STATUS_WRONG_NUMBER;
+
+	if(!is_uint32(argv[2]))
+		return -1;
+
+	if(!is_uint64(argv[3]))
+		return -2;
+
+	uint32_t speed = 1;
+	if(argc > 4) {
+		if(!is_uint32(argv[4]))
+			return -3;
+
+		speed = parse_uint32(argv[4]);
+	}
+
+	if(!trace_replay_start(argv[1], parse_uint32(argv[2]), parse_uint64(argv[3]), speed)) {
+		printf("Cannot replay to %s\n", argv[1]);
+		callback("false", -1);
+		return -4;
+	}
+
+	callback("true", 0);
+	return 0;
+}
+
+static int cmd_latency(int argc, char** argv, void(*callback)(char* result, int exit_status)) {
+	static const char* stages[LATENCY_STAGE_COUNT] = {
+		"rx dispatch", "rx queue", "vm", "tx queue", "tx driver"
+	};
+	static VMLatency latencies[VM_MAX_NIC_COUNT * LATENCY_STAGE_COUNT];
+
+	if(argc < 2)
+		return CMD_STATUS_WRONG_NUMBER;
+
+	if(!is_uint32(argv[1]))
+		return -1;
+
+	uint32_t vmid = parse_uint32(argv[1]);
+	if(argc > 2) {
+		if(strcmp(argv[2], "reset"))
+			return CMD_STATUS_NOT_FOUND;
+
+		if(!vm_latency_reset(vmid)) {
+			printf("VM not found\n");
+			callback("false", -1);
+			return -2;
+		}
+
+		callback("true", 0);
+		return 0;
+	}
+
+	int count = vm_latency(vmid, latencies, VM_MAX_NIC_COUNT * LATENCY_STAGE_COUNT);
+	if(count < 0) {
+		printf("VM not found\n");
+		callback("false", -1);
+		return -2;
+	}
+
+	printf("%3s %-12s %12s %10s %10s %10s %10s %10s %10s\n",
+			"NIC", "Stage", "Count", "Min(ns)", "Avg", "p50", "p99", "p99.9", "Max");
+	for(int i = 0; i < count; i++) {
+		VMLatency* l = &latencies[i];
+		printf("%3d %-12s %12lu %10lu %10lu %10lu %10lu %10lu %10lu\n",
+				l->nic, stages[l->stage], l->count, l->min, l->avg,
+				l->p50, l->p99, l->p999, l->max);
+	}
+
+	callback("true", 0);
+	return 0;
+}
+
 static int cmd_mount(int argc, char** argv, void(*callback)(char* result, int exit_status)) {
 	if(argc < 5) {
 		printf("Argument is not enough\n");
@@ -1256,6 +1404,24 @@ Command commands[] = {
 		.args = "result: bool, vmid: uint32 thread_id: uint8 msg: string",
 		.func = cmd_stdio
 	},
+	{
+		.name = "capture",
+		.desc = "Capture a VNIC or a NIC device to VM's storage as pcapng",
+		.args = "result: bool or uint64 size, \"start\" target: string vmid: uint32 [snaplen: uint16] | \"stop\" target: string",
+		.func = cmd_capture
+	},
+	{
+		.name = "replay",
+		.desc = "Replay pcap in VM's storage to a VNIC, speed 0 is as fast as possible",
+		.args = "result: bool, target: string vmid: uint32 size: uint64 [speed: uint32] | \"stop\" target: string",
+		.func = cmd_replay
+	},
+	{
+		.name = "latency",
+		.desc = "Print latency of packets in each stage of VM's NICs, or clear it",
+		.args = "result: bool, vmid: uint32 [\"reset\"]",
+		.func = cmd_latency
+	},
 	{
 		.name = "mount",
 		.desc = "Mount file system",
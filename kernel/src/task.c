@@ -71,6 +71,10 @@ char* task_symbols[] = {
 	"__timer_ms",
 	"__timer_us",
 	"__timer_ns",
+	"__log",
+	"__log_head",
+	"__log_tail",
+	"__log_size",
 };
 
 typedef struct {
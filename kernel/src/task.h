@@ -37,6 +37,10 @@ enum {
 	SYM_TIMER_MS,
 	SYM_TIMER_US,
 	SYM_TIMER_NS,
+	SYM_LOG,
+	SYM_LOG_HEAD,
+	SYM_LOG_TAIL,
+	SYM_LOG_SIZE,
 	SYM_END
 };
 
@@ -0,0 +1,434 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <timer.h>
+#include <util/event.h>
+#include <net/pcap.h>
+#include <vnic.h>
+#include "trace.h"
+#include "vm.h"
+#include "gmalloc.h"
+#include "manager.h"
+#include "driver/nicdev.h"
+
+typedef struct {
+	char		target[MAX_NIC_NAME_LEN];
+	Capture**	slots[2];	///< Where the rings are attached, rx and tx of the target
+	Capture*	captures[2];
+	VNIC*		vnic;		///< Target if it's a VNIC, NULL for a NIC device
+
+	uint32_t	vmid;		///< Storage of the pcapng file
+	size_t		offset;		///< Size of the pcapng file
+	uint64_t	base;		///< TSC when started, timestamps are from it
+	uint64_t	packets;
+	uint64_t	drops;		///< Packets not written because the storage is full
+} TraceCapture;
+
+typedef struct {
+	char		target[MAX_NIC_NAME_LEN];
+	VNIC*		vnic;
+	uint8_t*	file;		///< gmalloc, NULL when it's done
+	PcapReader	reader;
+	PcapPacket	packet;		///< Next packet to be injected
+	bool		has_packet;
+
+	uint32_t	speed;
+	uint64_t	base;		///< TSC when the first packet is injected
+	uint64_t	base_time;	///< Timestamp of the first packet in nanoseconds
+	uint64_t	packets;
+	uint64_t	drops;
+} TraceReplay;
+
+static TraceCapture* captures[TRACE_MAX_COUNT];
+static TraceReplay* replays[TRACE_MAX_COUNT];
+static bool is_running;
+
+/*
+ * Split not to overflow 64 bits, TIMER_FREQUENCY_PER_SEC is a few billions.
+ */
+static uint64_t tsc_to_ns(uint64_t tsc) {
+	return tsc / TIMER_FREQUENCY_PER_SEC * 1000000000UL +
+		tsc % TIMER_FREQUENCY_PER_SEC * 1000000000UL / TIMER_FREQUENCY_PER_SEC;
+}
+
+static uint64_t ns_to_tsc(uint64_t ns) {
+	return ns / 1000000000UL * TIMER_FREQUENCY_PER_SEC +
+		ns % 1000000000UL * TIMER_FREQUENCY_PER_SEC / 1000000000UL;
+}
+
+static VNIC* trace_vnic(const char* target) {
+	if(strncmp(target, "veth", 4))
+		return NULL;
+
+	char* next;
+	uint32_t vmid = strtol(target + 4, &next, 10);
+	if(next == target + 4)
+		return NULL;
+
+	if(vmid == 0)
+		return *next == '\0' ? manager_nic : NULL;
+
+	if(*next != '.')
+		return NULL;
+
+	char* end;
+	int index = strtol(next + 1, &end, 10);
+	if(end == next + 1 || *end != '\0')
+		return NULL;
+
+	VM* vm = vm_get(vmid);
+	if(!vm || index < 0 || index >= vm->nic_count)
+		return NULL;
+
+	return vm->nics[index];
+}
+
+static bool capture_drain(TraceCapture* trace, int budget) {
+	static uint8_t data[CAPTURE_SNAPLEN];
+	static uint8_t block[PCAPNG_PACKET_SIZE(CAPTURE_SNAPLEN)];
+	Capture* rx = trace->captures[CAPTURE_RX];
+	Capture* tx = trace->captures[CAPTURE_TX];
+	CaptureRecord rx_record;
+	CaptureRecord tx_record;
+	CaptureRecord record;
+
+	while(budget--) {
+		bool has_rx = capture_peek(rx, &rx_record);
+		bool has_tx = capture_peek(tx, &tx_record);
+		if(!has_rx && !has_tx)
+			return false;
+
+		// Directions are merged in the order of time
+		Capture* capture = has_rx && (!has_tx || rx_record.time <= tx_record.time) ? rx : tx;
+		capture_read(capture, &record, data);
+
+		uint64_t time = record.time > trace->base ? tsc_to_ns(record.time - trace->base) : 0;
+		size_t len = pcapng_packet(block, sizeof(block), time,
+				record.direction == CAPTURE_RX ? PCAP_DIRECTION_INBOUND : PCAP_DIRECTION_OUTBOUND,
+				data, record.caplen, record.len);
+
+		if(vm_storage_write(trace->vmid, block, trace->offset, len) != (ssize_t)len) {
+			trace->drops++;
+			continue;
+		}
+
+		trace->offset += len;
+		trace->packets++;
+	}
+
+	return true;
+}
+
+static void replay_done(TraceReplay* replay) {
+	gfree(replay->file);
+	replay->file = NULL;
+	replay->has_packet = false;
+}
+
+static void replay_inject(TraceReplay* replay, int budget) {
+	uint64_t time = timer_frequency();
+
+	while(budget-- && replay->has_packet) {
+		PcapPacket* packet = &replay->packet;
+
+		if(replay->speed && packet->time > replay->base_time) {
+			uint64_t due = replay->base + ns_to_tsc((packet->time - replay->base_time) / replay->speed);
+			if(due > time)
+				return;
+		}
+
+		if(vnic_rx(replay->vnic, (uint8_t*)packet->data, packet->caplen, NULL, 0))
+			replay->packets++;
+		else
+			replay->drops++;
+
+		replay->has_packet = pcap_reader_next(&replay->reader, packet);
+	}
+
+	if(!replay->has_packet)
+		replay_done(replay);
+}
+
+static bool trace_loop(void* context) {
+	for(int i = 0; i < TRACE_MAX_COUNT; i++) {
+		if(captures[i])
+			capture_drain(captures[i], TRACE_BUDGET);
+
+		if(replays[i] && replays[i]->file)
+			replay_inject(replays[i], TRACE_BUDGET);
+	}
+
+	return true;
+}
+
+static void trace_run() {
+	if(is_running)
+		return;
+
+	event_idle_add(trace_loop, NULL);
+	is_running = true;
+}
+
+static TraceCapture** capture_find(const char* target) {
+	for(int i = 0; i < TRACE_MAX_COUNT; i++) {
+		if(captures[i] && !strncmp(captures[i]->target, target, MAX_NIC_NAME_LEN))
+			return &captures[i];
+	}
+
+	return NULL;
+}
+
+static TraceReplay** replay_find(const char* target) {
+	for(int i = 0; i < TRACE_MAX_COUNT; i++) {
+		if(replays[i] && !strncmp(replays[i]->target, target, MAX_NIC_NAME_LEN))
+			return &replays[i];
+	}
+
+	return NULL;
+}
+
+static void capture_free(TraceCapture* trace) {
+	gfree(trace->captures[CAPTURE_RX]);
+	gfree(trace->captures[CAPTURE_TX]);
+	gfree(trace);
+}
+
+static void capture_detach(TraceCapture** slot) {
+	TraceCapture* trace = *slot;
+	*trace->slots[CAPTURE_RX] = NULL;
+	*trace->slots[CAPTURE_TX] = NULL;
+	*slot = NULL;
+}
+
+/*
+ * Dispatcher cores copy a packet into the ring they loaded before it's
+ * detached, so the rings are kept until those copies are done.
+ */
+static void capture_quiesce() {
+	__sync_synchronize();
+	timer_uwait(TRACE_GRACE);
+}
+
+bool trace_capture_start(const char* target, uint32_t vmid, uint16_t snaplen) {
+	Capture** slots[2];
+
+	if(strlen(target) >= MAX_NIC_NAME_LEN || capture_find(target) || !vm_get(vmid))
+		return false;
+
+	VNIC* vnic = trace_vnic(target);
+	if(vnic) {
+		slots[CAPTURE_RX] = &vnic->rx_capture;
+		slots[CAPTURE_TX] = &vnic->tx_capture;
+	} else {
+		NICDevice* dev = nicdev_get(target);
+		if(!dev)
+			return false;
+
+		slots[CAPTURE_RX] = &dev->rx_capture;
+		slots[CAPTURE_TX] = &dev->tx_capture;
+	}
+
+	TraceCapture** slot = NULL;
+	for(int i = 0; i < TRACE_MAX_COUNT; i++) {
+		if(!captures[i]) {
+			slot = &captures[i];
+			break;
+		}
+	}
+	if(!slot)
+		return false;
+
+	if(snaplen == 0 || snaplen > CAPTURE_SNAPLEN)
+		snaplen = CAPTURE_SNAPLEN;
+
+	TraceCapture* trace = gmalloc(sizeof(TraceCapture));
+	if(!trace)
+		return false;
+
+	memset(trace, 0, sizeof(TraceCapture));
+	strcpy(trace->target, target);
+	trace->vnic = vnic;
+	trace->vmid = vmid;
+
+	for(int i = 0; i < 2; i++) {
+		trace->slots[i] = slots[i];
+		trace->captures[i] = gmalloc(CAPTURE_MEMORY_SIZE(TRACE_RING_SIZE));
+		if(!trace->captures[i]) {
+			capture_free(trace);
+			return false;
+		}
+
+		capture_init(trace->captures[i], TRACE_RING_SIZE, snaplen, i);
+	}
+
+	uint8_t header[PCAPNG_HEADER_SIZE];
+	trace->offset = pcapng_header(header, sizeof(header), snaplen);
+	if(vm_storage_write(vmid, header, 0, trace->offset) != (ssize_t)trace->offset) {
+		capture_free(trace);
+		return false;
+	}
+
+	// Packets are dispatched by the manager core as well, the rings are
+	// attached and detached between packets
+	trace->base = timer_frequency();
+	*slot = trace;
+	*slots[CAPTURE_RX] = trace->captures[CAPTURE_RX];
+	*slots[CAPTURE_TX] = trace->captures[CAPTURE_TX];
+
+	trace_run();
+
+	return true;
+}
+
+ssize_t trace_capture_stop(const char* target, uint64_t* packets, uint64_t* drops) {
+	TraceCapture** slot = capture_find(target);
+	if(!slot)
+		return -1;
+
+	TraceCapture* trace = *slot;
+	capture_detach(slot);
+	capture_quiesce();
+
+	while(capture_drain(trace, TRACE_BUDGET));
+
+	if(packets)
+		*packets = trace->packets;
+	if(drops)
+		*drops = trace->drops + trace->captures[CAPTURE_RX]->drops + trace->captures[CAPTURE_TX]->drops;
+
+	ssize_t size = trace->offset;
+	capture_free(trace);
+
+	return size;
+}
+
+bool trace_replay_start(const char* target, uint32_t vmid, size_t size, uint32_t speed) {
+	if(strlen(target) >= MAX_NIC_NAME_LEN || !size)
+		return false;
+
+	VNIC* vnic = trace_vnic(target);
+	if(!vnic)
+		return false;
+
+	// A replay which is done is replaced
+	TraceReplay** slot = replay_find(target);
+	if(slot && (*slot)->file)
+		return false;
+
+	if(!slot) {
+		for(int i = 0; i < TRACE_MAX_COUNT; i++) {
+			if(!replays[i]) {
+				slot = &replays[i];
+				break;
+			}
+		}
+		if(!slot)
+			return false;
+	}
+
+	// The storage is not contiguous, the file is copied to be read at once
+	uint8_t* file = gmalloc(size);
+	if(!file)
+		return false;
+
+	for(size_t offset = 0; offset < size;) {
+		void* buf;
+		ssize_t len = vm_storage_read(vmid, &buf, offset, size - offset);
+		if(len <= 0 || !buf) {
+			gfree(file);
+			return false;
+		}
+
+		memcpy(file + offset, buf, len);
+		offset += len;
+	}
+
+	TraceReplay* replay = *slot ? *slot : gmalloc(sizeof(TraceReplay));
+	if(!replay) {
+		gfree(file);
+		return false;
+	}
+
+	memset(replay, 0, sizeof(TraceReplay));
+	strcpy(replay->target, target);
+	replay->vnic = vnic;
+	replay->file = file;
+	replay->speed = speed;
+
+	if(!pcap_reader_init(&replay->reader, file, size)) {
+		gfree(file);
+		gfree(replay);
+		*slot = NULL;
+		return false;
+	}
+
+	replay->has_packet = pcap_reader_next(&replay->reader, &replay->packet);
+	replay->base = timer_frequency();
+	replay->base_time = replay->packet.time;
+	*slot = replay;
+
+	trace_run();
+
+	return true;
+}
+
+bool trace_replay_stop(const char* target, uint64_t* packets, uint64_t* drops) {
+	TraceReplay** slot = replay_find(target);
+	if(!slot)
+		return false;
+
+	TraceReplay* replay = *slot;
+	if(packets)
+		*packets = replay->packets;
+	if(drops)
+		*drops = replay->drops;
+
+	gfree(replay->file);
+	gfree(replay);
+	*slot = NULL;
+
+	return true;
+}
+
+static bool vm_has_vnic(VM* vm, VNIC* vnic) {
+	for(int i = 0; i < vm->nic_count; i++) {
+		if(vm->nics[i] == vnic)
+			return true;
+	}
+
+	return false;
+}
+
+void trace_vm_destroy(uint32_t vmid) {
+	VM* vm = vm_get(vmid);
+	if(!vm)
+		return;
+
+	TraceCapture* stopped[TRACE_MAX_COUNT];
+	int stopped_count = 0;
+
+	for(int i = 0; i < TRACE_MAX_COUNT; i++) {
+		// The storage is freed with the VM, the rings are not drained
+		TraceCapture* trace = captures[i];
+		if(trace && (trace->vmid == vmid || (trace->vnic && vm_has_vnic(vm, trace->vnic)))) {
+			printf("Trace: Capture of %s stopped as VM %d is destroyed\n", trace->target, vmid);
+			capture_detach(&captures[i]);
+			stopped[stopped_count++] = trace;
+		}
+
+		TraceReplay* replay = replays[i];
+		if(replay && vm_has_vnic(vm, replay->vnic)) {
+			printf("Trace: Replay to %s stopped as VM %d is destroyed\n", replay->target, vmid);
+			gfree(replay->file);
+			gfree(replay);
+			replays[i] = NULL;
+		}
+	}
+
+	if(stopped_count == 0)
+		return;
+
+	capture_quiesce();
+	for(int i = 0; i < stopped_count; i++)
+		capture_free(stopped[i]);
+}
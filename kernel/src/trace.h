@@ -0,0 +1,82 @@
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+/**
+ * @file
+ * Packet capture and replay of VNICs and NIC devices.
+ *
+ * A capture mirrors rx and tx of a target into capture rings, and the manager
+ * core drains them into a VM's storage as a pcapng file, which is downloaded
+ * by the console like any other storage. A replay reads a pcap or pcapng
+ * file uploaded to a VM's storage and injects the packets into a VNIC's rx
+ * with the original gaps between them scaled by a speed.
+ *
+ * Targets are named like the vnic command lists them, "veth<vmid>.<index>"
+ * for a VNIC of a VM, "veth0" for the manager's VNIC, or the name of a NIC
+ * device such as "eth0" (capture only).
+ */
+
+#define TRACE_MAX_COUNT		8		///< Maximum number of captures and of replays
+#define TRACE_RING_SIZE		0x100000	///< Capture ring size of each direction
+#define TRACE_BUDGET		256		///< Packets processed by a capture or a replay per loop
+#define TRACE_GRACE		100		///< Microseconds detached rings are kept for packets being copied
+
+/**
+ * Start to capture a target into a VM's storage from offset 0.
+ *
+ * @param target VNIC or NIC device name
+ * @param vmid VM which storage the pcapng file is written to
+ * @param snaplen maximum captured length of packets, 0 for the default
+ *
+ * @return true if started
+ */
+bool trace_capture_start(const char* target, uint32_t vmid, uint16_t snaplen);
+
+/**
+ * Stop a capture, packets in the capture rings are written before it stops.
+ *
+ * @param target VNIC or NIC device name
+ * @param[out] packets number of packets written, could be NULL
+ * @param[out] drops number of packets dropped by full rings or storage, could be NULL
+ *
+ * @return size of the pcapng file in the storage or -1 if the target is not captured
+ */
+ssize_t trace_capture_stop(const char* target, uint64_t* packets, uint64_t* drops);
+
+/**
+ * Start to replay a capture file in a VM's storage to a VNIC's rx.
+ *
+ * @param target VNIC name
+ * @param vmid VM which storage has the capture file from offset 0
+ * @param size capture file size
+ * @param speed multiple of the original speed, 0 to replay as fast as possible
+ *
+ * @return true if started
+ */
+bool trace_replay_start(const char* target, uint32_t vmid, size_t size, uint32_t speed);
+
+/**
+ * Stop a replay, it stops by itself at the end of the file.
+ *
+ * @param target VNIC name
+ * @param[out] packets number of packets injected, could be NULL
+ * @param[out] drops number of packets the VNIC didn't take, could be NULL
+ *
+ * @return false if the target is not replayed
+ */
+bool trace_replay_stop(const char* target, uint64_t* packets, uint64_t* drops);
+
+/**
+ * Stop captures and replays of a VM's VNICs and captures into its storage,
+ * called by vm_destroy before the VNICs and the storage are freed. Weak as
+ * the host manager shares vm.c without traces.
+ *
+ * @param vmid VM to be destroyed
+ */
+void __attribute__((weak)) trace_vm_destroy(uint32_t vmid);
+
+#endif /* __TRACE_H__ */
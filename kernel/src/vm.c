@@ -6,19 +6,23 @@
 #include <errno.h>
 #include <util/map.h>
 #include <util/ring.h>
+#include <util/log.h>
 #include <net/md5.h>
+#include <zlib.h>
 #include <timer.h>
 #include <file.h>
 #include <vnic.h>
 #include "icc.h"
 #include "vm.h"
 #include "apic.h"
+#include "asm.h"
 #include "icc.h"
 #include "gmalloc.h"
 #include "stdio.h"
 #include "shared.h"
 #include "mmap.h"
 #include "driver/nicdev.h"
+#include "trace.h"
 
 static uint32_t	last_vmid = 1;
 // FIXME: change to static
@@ -46,6 +50,20 @@ typedef struct {
 	volatile size_t*	stderr_head;
 	volatile size_t*	stderr_tail;
 	size_t			stderr_size;
+
+	char*			log;		// NULL if the application doesn't log
+	volatile size_t*	log_head;
+	volatile size_t*	log_tail;
+	size_t			log_size;
+
+	// Format registrations of the log, for consoles connected later
+	uint8_t*		log_formats;
+	size_t			log_formats_len;
+
+	// Rate limit of stdout, stderr and log
+	uint64_t		stdio_time;	// us of the last refill
+	uint64_t		stdio_tokens;	// Bytes allowed to be forwarded
+	uint32_t		stdio_dropped[3];	// Bytes of stdout, stderr, log not reported yet
 } Core;
 
 static Core cores[MP_MAX_CORE_COUNT];
@@ -74,6 +92,19 @@ static void icc_started(ICC_Message* msg) {
 		core->stderr_tail = (size_t*)((uint64_t)msg->data.started.stderr_tail - PHYSICAL_OFFSET);
 		core->stderr_size = msg->data.started.stderr_size;
 
+		core->log = NULL;
+		if(msg->data.started.log) {
+			core->log = (char*)((uint64_t)msg->data.started.log - PHYSICAL_OFFSET);
+			core->log_head = (size_t*)((uint64_t)msg->data.started.log_head - PHYSICAL_OFFSET);
+			core->log_tail = (size_t*)((uint64_t)msg->data.started.log_tail - PHYSICAL_OFFSET);
+			core->log_size = msg->data.started.log_size;
+		}
+		core->log_formats_len = 0;
+
+		core->stdio_time = timer_us();
+		core->stdio_tokens = VM_STDIO_BURST;
+		memset(core->stdio_dropped, 0, sizeof(core->stdio_dropped));
+
 		core->status = VM_STATUS_START;
 
 		printf("Execution succeed on core[%d].\n", mp_apic_id_to_core_id(msg->apic_id));
@@ -222,6 +253,7 @@ static void icc_stopped(ICC_Message* msg) {
 	cores[msg->apic_id].stdin = NULL;
 	cores[msg->apic_id].stdout = NULL;
 	cores[msg->apic_id].stderr = NULL;
+	cores[msg->apic_id].log = NULL;
 
 	printf("Execution completed on core[%d].\n", mp_apic_id_to_core_id(msg->apic_id));
 
@@ -247,6 +279,44 @@ static void icc_stopped(ICC_Message* msg) {
 	printf("]\n");
 }
 
+static void vm_free(VM* vm) {
+	if(vm->memory.blocks) {
+		for(uint32_t i = 0; i < vm->memory.count; i++) {
+			if(vm->memory.blocks[i]) {
+				bfree(vm->memory.blocks[i]);
+			}
+		}
+
+		gfree(vm->memory.blocks);
+	}
+
+	if(vm->storage.blocks) {
+		for(uint32_t i = 0; i < vm->storage.count; i++) {
+			if(vm->storage.blocks[i]) {
+				bfree(vm->storage.blocks[i]);
+			}
+		}
+
+		gfree(vm->storage.blocks);
+	}
+
+	if(vm->nics) {
+		for(uint16_t i = 0; i < vm->nic_count; i++) {
+			if(vm->nics[i])
+				//vnic_destroy(vm->nics[i]);
+				bfree(vm->nics[i]->nic);
+		}
+
+		gfree(vm->nics);
+	}
+
+	if(vm->argv) {
+		gfree(vm->argv);
+	}
+
+	gfree(vm);
+}
+
 static bool vm_delete(VM* vm, int core) {
 	bool is_destroy = true;
 
@@ -268,64 +338,49 @@ static bool vm_delete(VM* vm, int core) {
 	}
 
 	if(is_destroy) {
-		if(vm->memory.blocks) {
-			for(uint32_t i = 0; i < vm->memory.count; i++) {
-				if(vm->memory.blocks[i]) {
-					bfree(vm->memory.blocks[i]);
-				}
-			}
-
-			gfree(vm->memory.blocks);
-		}
-
-		if(vm->storage.blocks) {
-			for(uint32_t i = 0; i < vm->storage.count; i++) {
-				if(vm->storage.blocks[i]) {
-					bfree(vm->storage.blocks[i]);
-				}
-			}
-
-			gfree(vm->storage.blocks);
-		}
-
-		if(vm->nics) {
-			for(uint16_t i = 0; i < vm->nic_count; i++) {
-				if(vm->nics[i])
-					//vnic_destroy(vm->nics[i]);
-					bfree(vm->nics[i]->nic);
-			}
-
-			gfree(vm->nics);
-		}
-
-		if(vm->argv) {
-			gfree(vm->argv);
-		}
-
-		gfree(vm);
+		// Cores are released now, the storage is still used by other cores
+		if(vm->storage_refs > 0)
+			vm->is_destroyed = true;
+		else
+			vm_free(vm);
 	}
 
 	return is_destroy;
 }
 
+void vm_storage_ref(VM* vm) {
+	vm->storage_refs++;
+}
+
+void vm_storage_unref(VM* vm) {
+	if(--vm->storage_refs == 0 && vm->is_destroyed)
+		vm_free(vm);
+}
+
 static void stdio_dump(int coreno, int fd, char* buffer, volatile size_t* head, volatile size_t* tail, size_t size) {
 	if(*head == *tail)
 		return;
 
-	char header[12] = "[ Core 01 ]";
-
-	printf("\n%s ", header);
-	int length = *tail - *head;
-	for(int i = 0; i < length; i++) {
-		if(buffer[i] == '\0') {
-			if(i != length - 1)
-				printf("%s ", header);
-		}
-
-		putchar(buffer[i]);
+	// Messages are separated by null characters, each is printed at once
+	printf("\n[ Core %02d ] ", coreno);
+	size_t length = ring_readable(*head, *tail, size);
+	size_t offset = *head;
+	while(length > 0) {
+		size_t len = size - offset < length ? size - offset : length;
+		char* str = buffer + offset;
+		char* end = memchr(str, '\0', len);
+		if(end)
+			len = end - str + 1;
+
+		printf("%.*s", (int)(end ? len - 1 : len), str);
+		length -= len;
+		offset = (offset + len) % size;
+
+		if(end && length > 0)
+			printf("[ Core %02d ] ", coreno);
 	}
 
-	*head = *tail;
+	*head = offset;
 
 /*
  *        int header_len = strlen(header);
@@ -411,6 +466,60 @@ static void stdio_dump(int coreno, int fd, char* buffer, volatile size_t* head,
  */
 }
 
+static int stdio_next;	// First core of the batch, rotated not to starve the others
+
+static void log_format_keep(Core* core, size_t offset, size_t size) {
+	if(!core->log_formats) {
+		core->log_formats = gmalloc(VM_LOG_FORMATS_SIZE);
+		if(!core->log_formats)
+			return;
+	}
+
+	if(core->log_formats_len + size > VM_LOG_FORMATS_SIZE)
+		return;
+
+	size_t len1 = core->log_size - offset < size ? core->log_size - offset : size;
+	memcpy(core->log_formats + core->log_formats_len, core->log + offset, len1);
+	memcpy(core->log_formats + core->log_formats_len + len1, core->log, size - len1);
+	core->log_formats_len += size;
+}
+
+/*
+ * Bytes of whole log records from the head up to len, -1 if the ring is broken
+ */
+static ssize_t log_whole(Core* core, size_t len) {
+	size_t whole = 0;
+	while(whole + sizeof(LogRecord) <= len) {
+		size_t offset = (*core->log_head + whole) % core->log_size;
+		LogRecord* record = (LogRecord*)(core->log + offset);
+		if(record->size < sizeof(LogRecord) || record->size % 16 || record->size > LOG_RECORD_MAX_SIZE)
+			return -1;
+
+		if(whole + record->size > len)
+			break;
+
+		whole += record->size;
+	}
+
+	return whole;
+}
+
+/*
+ * Keep the format registrations in whole records from the head up to len,
+ * once they are forwarded
+ */
+static void log_formats_keep(Core* core, size_t len) {
+	size_t offset = 0;
+	while(offset < len) {
+		size_t index = (*core->log_head + offset) % core->log_size;
+		LogRecord* record = (LogRecord*)(core->log + index);
+		if(record->count == LOG_REGISTER)
+			log_format_keep(core, index, record->size);
+
+		offset += record->size;
+	}
+}
+
 static bool vm_loop(void* context) {
 	// Standard I/O/E processing
 	int get_thread_id(VM* vm, int core) {
@@ -422,25 +531,118 @@ static bool vm_loop(void* context) {
 		return -1;
 	}
 
-	for(int i = 1; i < MP_MAX_CORE_COUNT; i++) {
+	VMStdio records[VM_STDIO_MAX_BATCH];
+	size_t forwarded[MP_MAX_CORE_COUNT][3] = {};
+	int count = 0;
+	size_t budget = VM_STDIO_BATCH_SIZE;
+	uint64_t time = timer_us();
+
+	for(int j = 0; j < MP_MAX_CORE_COUNT && stdio_callback; j++) {
+		int i = (stdio_next + j) % MP_MAX_CORE_COUNT;
 		Core* core = &cores[i];
 
-		if(core->status != VM_STATUS_PAUSE && core->status != VM_STATUS_START) {
+		if(i == 0 || (core->status != VM_STATUS_PAUSE && core->status != VM_STATUS_START)) {
 			continue;
 		}
 		int thread_id = -1;
 
-		if(core->stdout != NULL && *core->stdout_head != *core->stdout_tail) {
-			thread_id = get_thread_id(core->vm, i);
-
-			stdio_callback(core->vm->id, thread_id, 1, core->stdout, core->stdout_head, core->stdout_tail, core->stdout_size);
+		// Refilled by millisecond not to lose the fractions
+		if(time - core->stdio_time >= 1000) {
+			core->stdio_tokens += (time - core->stdio_time) * VM_STDIO_RATE / 1000000;
+			if(core->stdio_tokens > VM_STDIO_BURST)
+				core->stdio_tokens = VM_STDIO_BURST;
+			core->stdio_time = time;
 		}
 
-		if(core->stderr != NULL && *core->stderr_head != *core->stderr_tail) {
+		for(int fd = 1; fd <= VM_STDIO_LOG; fd++) {
+			char* buffers[] = { core->stdout, core->stderr, core->log };
+			volatile size_t* heads[] = { core->stdout_head, core->stderr_head, core->log_head };
+			volatile size_t* tails[] = { core->stdout_tail, core->stderr_tail, core->log_tail };
+			size_t sizes[] = { core->stdout_size, core->stderr_size, core->log_size };
+
+			char* buffer = buffers[fd - 1];
+			volatile size_t* head = heads[fd - 1];
+			volatile size_t* tail = tails[fd - 1];
+			size_t size = sizes[fd - 1];
+
+			if(buffer == NULL || *head == *tail)
+				continue;
+
+			// Oldest output over the rate is dropped, so the ring never fills up.
+			// Log is not, the VM drops records when its ring is full.
+			size_t readable = ring_readable(*head, *tail, size);
+			if(readable > core->stdio_tokens && fd != VM_STDIO_LOG) {
+				size_t drop = readable - core->stdio_tokens;
+				*head = (*head + drop) % size;
+				core->stdio_dropped[fd - 1] += drop;
+				readable -= drop;
+			}
+
+			if(fd == VM_STDIO_LOG) {
+				if(readable > core->stdio_tokens)
+					readable = core->stdio_tokens;
+				if(readable > budget)
+					readable = budget;
+
+				ssize_t whole = log_whole(core, readable);
+				if(whole < 0) {
+					core->stdio_dropped[fd - 1] += ring_readable(*head, *tail, size);
+					*head = *tail;
+					continue;
+				}
+				readable = whole;
+			}
+
+			if(readable > budget)
+				readable = budget;
+
+			if(readable == 0 || count + 2 > VM_STDIO_MAX_BATCH)
+				continue;
+
+			if(fd == VM_STDIO_LOG)
+				log_formats_keep(core, readable);
+
 			if(thread_id == -1)
 				thread_id = get_thread_id(core->vm, i);
 
-			stdio_callback(core->vm->id, thread_id, 2, core->stderr, core->stderr_head, core->stderr_tail, core->stderr_size);
+			// Chunks point into the ring, two of them if it's wrapped
+			size_t len1 = size - *head < readable ? size - *head : readable;
+			VMStdio* record = &records[count++];
+			record->vmid = core->vm->id;
+			record->thread_id = thread_id;
+			record->fd = fd;
+			record->size = len1;
+			record->dropped = core->stdio_dropped[fd - 1];
+			record->str = buffer + *head;
+			core->stdio_dropped[fd - 1] = 0;
+
+			if(readable > len1) {
+				VMStdio* record2 = &records[count++];
+				*record2 = *record;
+				record2->size = readable - len1;
+				record2->dropped = 0;
+				record2->str = buffer;
+			}
+
+			forwarded[i][fd - 1] = readable;
+			core->stdio_tokens -= readable;
+			budget -= readable;
+		}
+	}
+
+	stdio_next = (stdio_next + 1) % MP_MAX_CORE_COUNT;
+
+	if(count > 0) {
+		stdio_callback(records, count);
+
+		for(int i = 1; i < MP_MAX_CORE_COUNT; i++) {
+			Core* core = &cores[i];
+			if(forwarded[i][0])
+				*core->stdout_head = (*core->stdout_head + forwarded[i][0]) % core->stdout_size;
+			if(forwarded[i][1])
+				*core->stderr_head = (*core->stderr_head + forwarded[i][1]) % core->stderr_size;
+			if(forwarded[i][2])
+				*core->log_head = (*core->log_head + forwarded[i][2]) % core->log_size;
 		}
 	}
 
@@ -482,6 +684,11 @@ void vm_init() {
 	icc_register(ICC_TYPE_RESUMED, icc_resumed);
 	icc_register(ICC_TYPE_STOPPED, icc_stopped);
 
+	// Every core records its own counters
+	shared->core_counters = gmalloc(sizeof(CoreCounters) * MP_MAX_CORE_COUNT);
+	if(shared->core_counters)
+		memset(shared->core_counters, 0, sizeof(CoreCounters) * MP_MAX_CORE_COUNT);
+
 	// Core 0 is occupied by RPC manager
 	cores[0].status = VM_STATUS_START;
 
@@ -495,6 +702,15 @@ void vm_init() {
 }
 
 uint32_t vm_create(VMSpec* vm_spec) {
+	return vm_create_id(vm_spec, 0);
+}
+
+uint32_t vm_create_id(VMSpec* vm_spec, uint32_t vmid) {
+	if(vmid != 0 && map_contains(vms, (void*)(uint64_t)vmid)) {
+		printf("Manager: VM[%d] already exists.\n", vmid);
+		return 0;
+	}
+
 	VM* vm = gmalloc(sizeof(VM));
 	memset(vm, 0, sizeof(VM));
 
@@ -567,15 +783,21 @@ uint32_t vm_create(VMSpec* vm_spec) {
 		}
 	}
 
-	// Allocate vmid
-	uint32_t vmid;
-	while(true) {
-		vmid = last_vmid++;
+	// Allocate vmid, the given one is kept
+	if(vmid != 0) {
+		vm->id = vmid;
+		map_put(vms, (void*)(uint64_t)vmid, vm);
+		if(vmid >= last_vmid)
+			last_vmid = vmid + 1;
+	} else {
+		while(true) {
+			vmid = last_vmid++;
 
-		if(vmid != 0 && !map_contains(vms, (void*)(uint64_t)vmid)) {
-			vm->id = vmid;
-			map_put(vms, (void*)(uint64_t)vmid, vm);
-			break;
+			if(vmid != 0 && !map_contains(vms, (void*)(uint64_t)vmid)) {
+				vm->id = vmid;
+				map_put(vms, (void*)(uint64_t)vmid, vm);
+				break;
+			}
 		}
 	}
 
@@ -621,6 +843,7 @@ uint32_t vm_create(VMSpec* vm_spec) {
 			VNIC_TX_QUEUE_SIZE, nics[i].output_buffer_size,
 			VNIC_SLOW_RX_QUEUE_SIZE, nics[i].slow_input_buffer_size,
 			VNIC_SLOW_TX_QUEUE_SIZE, nics[i].slow_output_buffer_size,
+			VNIC_VLAN, nics[i].vlan,
 			VNIC_NONE
 		};
 
@@ -712,6 +935,9 @@ bool vm_destroy(uint32_t vmid) {
 		}
 	}
 
+	if(trace_vm_destroy)
+		trace_vm_destroy(vmid);
+
 	map_remove(vms, (void*)(uint64_t)vmid);
 
 	printf("Manager: Delete vm[%d] on cores [", vmid);
@@ -751,6 +977,7 @@ int vm_list(uint32_t* vmids, int size) {
 typedef struct {
 	VM_STATUS_CALLBACK	callback;
 	void*			context;
+	uint32_t		vmid;
 	int			status;
 } CallbackInfo;
 
@@ -758,6 +985,10 @@ static bool status_changed(uint64_t event_type, void* event, void* context) {
 	VM* vm = event;
 	CallbackInfo* info = context;
 
+	// Other VMs may be changing their status at the same time
+	if(vm->id != info->vmid)
+		return true;
+
 	bool result = vm->status == info->status || (vm->status == VM_STATUS_START && info->status == VM_STATUS_RESUME);
 	info->callback(result, info->context);
 
@@ -838,6 +1069,7 @@ void vm_status_set(uint32_t vmid, int status, VM_STATUS_CALLBACK callback, void*
 	CallbackInfo* info = malloc(sizeof(CallbackInfo));
 	info->callback = callback;
 	info->context = context;
+	info->vmid = vmid;
 	info->status = status;
 
 	event_trigger_add(event_type, status_changed, info);
@@ -883,7 +1115,7 @@ ssize_t vm_storage_read(uint32_t vmid, void** buf, size_t offset, size_t size) {
 	if(!vm)
 		return -1;
 
-	if(offset > vm->storage.count * VM_STORAGE_SIZE_ALIGN) {
+	if(offset >= (uint64_t)vm->storage.count * VM_STORAGE_SIZE_ALIGN) {
 		*buf = NULL;
 		return 0;
 	}
@@ -965,6 +1197,85 @@ bool vm_storage_md5(uint32_t vmid, uint32_t size, uint32_t digest[4]) {
 	return true;
 }
 
+int vm_storage_digests(uint32_t vmid, uint32_t index, uint32_t (*digests)[4], int count) {
+	VM* vm = map_get(vms, (void*)(uint64_t)vmid);
+	if(!vm || count <= 0)
+		return -1;
+
+	if(index >= vm->storage.count)
+		return 0;
+
+	if((uint32_t)count > vm->storage.count - index)
+		count = vm->storage.count - index;
+
+	vm_storage_digest_blocks(vm->storage.blocks + index, count, digests);
+
+	return count;
+}
+
+void vm_storage_digest_blocks(void** blocks, int count, uint32_t (*digests)[4]) {
+	for(int i = 0; i < count; i += MD5_LANES)
+		md5_x8((uint8_t**)blocks + i, count - i < MD5_LANES ? count - i : MD5_LANES, VM_STORAGE_SIZE_ALIGN, digests + i);
+}
+
+static voidpf zalloc(voidpf opaque, uInt items, uInt size) {
+	return gmalloc(items * size);
+}
+
+static void zfree(voidpf opaque, voidpf address) {
+	gfree(address);
+}
+
+ssize_t vm_storage_inflate(void* block, size_t block_size, void* buf, size_t size) {
+	z_stream stream = {
+		.next_in = buf,
+		.avail_in = size,
+		.next_out = block,
+		.avail_out = block_size,
+		.zalloc = zalloc,
+		.zfree = zfree,
+	};
+
+	if(inflateInit(&stream) != Z_OK)
+		return -1;
+
+	int rc = inflate(&stream, Z_FINISH);
+	ssize_t len = block_size - stream.avail_out;
+	inflateEnd(&stream);
+
+	if(rc != Z_STREAM_END)
+		return -1;
+
+	// Rest of the block is cleared like a short raw block
+	memset(block + len, 0, block_size - len);
+
+	return len;
+}
+
+int vm_idle_core() {
+	static int last;
+
+	for(int i = 1; i < MP_MAX_CORE_COUNT; i++) {
+		int apic_id = (last + i) % MP_MAX_CORE_COUNT;
+		if(apic_id != 0 && cores[apic_id].status == VM_STATUS_STOP) {
+			last = apic_id;
+			return apic_id;
+		}
+	}
+
+	return -1;
+}
+
+int vm_idle_cores(uint8_t* apic_ids, int size) {
+	int count = 0;
+	for(int apic_id = 1; apic_id < MP_MAX_CORE_COUNT && count < size; apic_id++) {
+		if(cores[apic_id].status == VM_STATUS_STOP)
+			apic_ids[count++] = apic_id;
+	}
+
+	return count;
+}
+
 ssize_t vm_stdio(uint32_t vmid, int thread_id, int fd, const char* str, size_t size) {
 	VM* vm = map_get(vms, (void*)(uint64_t)vmid);
 	if(!vm)
@@ -997,6 +1308,159 @@ ssize_t vm_stdio(uint32_t vmid, int thread_id, int fd, const char* str, size_t s
 	}
 }
 
+static uint64_t tsc_to_ns(uint64_t tsc) {
+	return tsc / TIMER_FREQUENCY_PER_SEC * 1000000000UL +
+		tsc % TIMER_FREQUENCY_PER_SEC * 1000000000UL / TIMER_FREQUENCY_PER_SEC;
+}
+
+int vm_latency(uint32_t vmid, VMLatency* latencies, int size) {
+	VM* vm = map_get(vms, (void*)(uint64_t)vmid);
+	if(!vm)
+		return -1;
+
+	int count = 0;
+	for(int i = 0; i < vm->nic_count; i++) {
+		for(int j = 0; j < LATENCY_STAGE_COUNT && count < size; j++) {
+			// The VM keeps recording, so it's a snapshot of the moment
+			Latency* latency = &vm->nics[i]->nic->latency[j];
+			VMLatency* l = &latencies[count++];
+			uint64_t n = latency->count;
+
+			l->nic = i;
+			l->stage = j;
+			l->reserved = 0;
+			l->count = n;
+			l->min = n ? tsc_to_ns(latency->min) : 0;
+			l->avg = n ? tsc_to_ns(latency->sum / n) : 0;
+			l->max = tsc_to_ns(latency->max);
+			l->p50 = tsc_to_ns(latency_percentile(latency, 500));
+			l->p99 = tsc_to_ns(latency_percentile(latency, 990));
+			l->p999 = tsc_to_ns(latency_percentile(latency, 999));
+		}
+	}
+
+	return count;
+}
+
+bool vm_latency_reset(uint32_t vmid) {
+	VM* vm = map_get(vms, (void*)(uint64_t)vmid);
+	if(!vm)
+		return false;
+
+	for(int i = 0; i < vm->nic_count; i++) {
+		for(int j = 0; j < LATENCY_STAGE_COUNT; j++)
+			latency_init(&vm->nics[i]->nic->latency[j]);
+	}
+
+	return true;
+}
+
+void vm_telemetry(VMTelemetry* telemetry) {
+	telemetry->time = tsc_to_ns(rdtsc());
+	telemetry->gmalloc_used = gmalloc_used();
+	telemetry->gmalloc_total = gmalloc_total();
+	telemetry->bmalloc_used = bmalloc_used();
+	telemetry->bmalloc_total = bmalloc_total();
+}
+
+int vm_telemetry_cores(VMCoreTelemetry* telemetries, int size) {
+	uint64_t time = rdtsc();
+	uint8_t* core_map = mp_core_map();
+	int count = 0;
+	for(int i = 0; i < MP_MAX_CORE_COUNT && count < size; i++) {
+		if(core_map[i] == MP_CORE_INVALID)
+			continue;
+
+		VMCoreTelemetry* t = &telemetries[count++];
+		t->core = core_map[i];
+		t->status = cores[i].status;
+		t->reserved = 0;
+		t->vmid = cores[i].vm ? cores[i].vm->id : 0;
+		t->idle = 0;
+		t->events = 0;
+
+		CoreCounters* counters = shared->core_counters ? &shared->core_counters[i] : NULL;
+		if(counters) {
+			// Waiting time so far is added, the core adds it when it wakes up
+			uint64_t idle = counters->idle;
+			uint64_t since = counters->idle_since;
+			if(since && since < time)
+				idle += time - since;
+
+			t->idle = tsc_to_ns(idle);
+			t->events = counters->events;
+		}
+	}
+
+	return count;
+}
+
+int vm_telemetry_nics(VMNICTelemetry* telemetries, int size) {
+	int count = 0;
+
+	MapIterator iter;
+	map_iterator_init(&iter, vms);
+	while(map_iterator_has_next(&iter)) {
+		VM* vm = map_iterator_next(&iter)->data;
+		for(int i = 0; i < vm->nic_count; i++) {
+			if(count >= size)
+				return count;
+
+			VNIC* vnic = vm->nics[i];
+			VMNICTelemetry* t = &telemetries[count++];
+			t->vmid = vm->id;
+			t->nic = i;
+			t->reserved = 0;
+			t->mac = vnic->mac;
+			t->rx_packets = vnic->rx_packets;
+			t->rx_bytes = vnic->rx_bytes;
+			t->rx_drops = vnic->rx_drops;
+			t->tx_packets = vnic->tx_packets;
+			t->tx_bytes = vnic->tx_bytes;
+			t->tx_drops = vnic->tx_drops;
+			t->pool_used = nic_pool_used(vnic->nic);
+			t->pool_total = nic_pool_total(vnic->nic);
+			t->rx_queue = queue_size(&vnic->nic->rx);
+			t->rx_queue_size = vnic->nic->rx.size;
+			t->tx_queue = queue_size(&vnic->nic->tx);
+			t->tx_queue_size = vnic->nic->tx.size;
+		}
+	}
+
+	return count;
+}
+
+int vm_log_formats(VMStdio* records, int size) {
+	int get_thread_id(VM* vm, int core) {
+		for(int i = 0; i < vm->core_size; i++) {
+			if(vm->cores[i] == core)
+				return i;
+		}
+
+		return -1;
+	}
+
+	int count = 0;
+	for(int i = 1; i < MP_MAX_CORE_COUNT && count < size; i++) {
+		Core* core = &cores[i];
+		if(core->status != VM_STATUS_PAUSE && core->status != VM_STATUS_START)
+			continue;
+
+		if(!core->log || core->log_formats_len == 0)
+			continue;
+
+		VMStdio* record = &records[count++];
+		record->vmid = core->vm->id;
+		record->thread_id = get_thread_id(core->vm, i);
+		record->fd = VM_STDIO_LOG;
+		record->size = core->log_formats_len;
+		record->dropped = 0;
+		record->str = (char*)core->log_formats;
+	}
+
+	return count;
+}
+
 void vm_stdio_handler(VM_STDIO_CALLBACK callback) {
 	stdio_callback = callback;
 }
@@ -36,12 +36,23 @@ typedef struct _VM {
 	char**		argv;	// gmalloc
 
 	int		status;
+
+	int		storage_refs;	///< Requests using the storage blocks on other cores
+	bool		is_destroyed;	///< Freed when the last storage reference is released
 } VM;
 
 void vm_init();
 void vm_init();
 
 uint32_t vm_create(VMSpec* vm_spec);
+
+/**
+ * Same as vm_create, but the VM keeps the given ID, e.g. when it's restored.
+ *
+ * @param vmid ID of the VM, a new one is allocated if 0
+ * @return vmid, 0 if the VM can't be created or the ID is in use
+ */
+uint32_t vm_create_id(VMSpec* vm_spec, uint32_t vmid);
 bool vm_destroy(uint32_t vmid);
 int vm_count();
 bool vm_contains(uint32_t vmid);
@@ -56,8 +67,115 @@ ssize_t vm_storage_read(uint32_t vmid, void** buf, size_t offset, size_t size);
 ssize_t vm_storage_write(uint32_t vmid, void* buf, size_t offset, size_t size);
 ssize_t vm_storage_clear(uint32_t vmid);
 bool vm_storage_md5(uint32_t vmid, uint32_t size, uint32_t digest[4]);
+
+/**
+ * MD5 digests of storage blocks of VM_STORAGE_SIZE_ALIGN.
+ *
+ * @param index first block
+ * @param digests digests to be filled
+ * @param count maximum number of digests
+ *
+ * @return number of digests, 0 past the end of storage, -1 if the VM is not found or count is not positive
+ */
+int vm_storage_digests(uint32_t vmid, uint32_t index, uint32_t (*digests)[4], int count);
+
+/**
+ * MD5 digests of storage blocks, MD5_LANES blocks at once. The blocks are in
+ * global memory so it may run on any core.
+ */
+void vm_storage_digest_blocks(void** blocks, int count, uint32_t (*digests)[4]);
+
+/**
+ * Decompress a zlib stream into a storage block, rest of the block is cleared.
+ * It uses global memory only so it may run on any core.
+ *
+ * @return decompressed size, -1 on error
+ */
+ssize_t vm_storage_inflate(void* block, size_t block_size, void* buf, size_t size);
+
+/**
+ * Keep a VM's storage blocks while another core uses them. A VM destroyed in
+ * the meantime is freed when the last reference is released. Called by the
+ * manager core only.
+ */
+void vm_storage_ref(VM* vm);
+void vm_storage_unref(VM* vm);
+
+/**
+ * A core which is not given to any VM, round robin.
+ *
+ * @return APIC ID, -1 if every core is in use
+ */
+int vm_idle_core();
+
+/**
+ * Every core which is not given to any VM.
+ *
+ * @return number of APIC IDs filled
+ */
+int vm_idle_cores(uint8_t* apic_ids, int size);
+
 ssize_t vm_stdio(uint32_t vmid, int thread_id, int fd, const char* str, size_t size);
-typedef void(*VM_STDIO_CALLBACK)(uint32_t vmid, int thread_id, int fd, char* buffer, volatile size_t* head, volatile size_t* tail, size_t size);
+
+/**
+ * Summarize latency histograms of the VM's NICs, LATENCY_STAGE_COUNT
+ * entries per NIC in the order of NICs.
+ *
+ * @param latencies entries to be filled
+ * @param size maximum number of entries
+ *
+ * @return number of entries, -1 if the VM is not found
+ */
+int vm_latency(uint32_t vmid, VMLatency* latencies, int size);
+
+/**
+ * Clear latency histograms of the VM's NICs. Packets in flight may be
+ * recorded in the middle of it.
+ */
+bool vm_latency_reset(uint32_t vmid);
+
+/**
+ * Sample the memory of the manager and its clock.
+ */
+void vm_telemetry(VMTelemetry* telemetry);
+
+/**
+ * Sample the counters of every core, in the order of APIC IDs.
+ *
+ * @return number of entries
+ */
+int vm_telemetry_cores(VMCoreTelemetry* telemetries, int size);
+
+/**
+ * Sample the counters of the NICs of every VM. The counters are read while
+ * they're being updated, so a sample may be a packet behind.
+ *
+ * @return number of entries
+ */
+int vm_telemetry_nics(VMNICTelemetry* telemetries, int size);
+
+#define VM_STDIO_RATE		(1024 * 1024)	///< Bytes per second of stdout and stderr forwarded per core
+#define VM_STDIO_BURST		(64 * 1024)	///< Bytes forwarded at once after being quiet
+#define VM_STDIO_BATCH_SIZE	4096		///< Bytes of every core forwarded per loop, fits in an RPC message
+#define VM_STDIO_MAX_BATCH	(MP_MAX_CORE_COUNT * 6)	///< Chunks per loop, stdout, stderr and log which may be wrapped
+#define VM_LOG_FORMATS_SIZE	32768		///< Bytes of log format registrations kept per core
+
+/**
+ * Standard output and error of every core are forwarded in one batch per loop.
+ * records point into the rings of the VMs, which are consumed after callback
+ * returns. Output over VM_STDIO_RATE is dropped and reported in dropped of the
+ * next record of the core, so a chatty VM never fills its ring and stalls.
+ */
+typedef void(*VM_STDIO_CALLBACK)(VMStdio* records, int count);
 void vm_stdio_handler(VM_STDIO_CALLBACK callback);
 
+/**
+ * Log format registrations of every core forwarded so far, to be sent to a
+ * console connected later. A record per core points to whole registration
+ * records of VM_STDIO_LOG.
+ *
+ * @return count of records
+ */
+int vm_log_formats(VMStdio* records, int size);
+
 #endif /* __VM_H__ */
@@ -10,4 +10,14 @@ void __free(void *ptr, void* mem_pool);
 void* __realloc(void *ptr, size_t new_size, void* mem_pool);
 void* __calloc(size_t nelem, size_t elem_size, void* mem_pool);
 
+/**
+ * Allocate memory aligned to align bytes, which TLSF doesn't guarantee beyond
+ * the word size. The original block is kept before the aligned memory.
+ *
+ * @param align power of 2
+ * @return aligned memory which is freed by __free_aligned, NULL if not enough memory
+ */
+void* __malloc_aligned(size_t size, size_t align, void* mem_pool);
+void __free_aligned(void* ptr, void* mem_pool);
+
 #endif /* ___MALLOC_H__ */
@@ -6,8 +6,17 @@
 
 #define RPC_MAGIC		"PNRPC"
 #define RPC_MAGIC_SIZE		5
-#define RPC_VERSION		1
+#define RPC_VERSION		2
 #define RPC_BUFFER_SIZE		8192
+#define RPC_MAX_REQUESTS	256		///< Outstanding requests per connection
+#define RPC_MAX_BATCH		64		///< VMs per batch request
+#define RPC_TELEMETRY_MAX_CORES	16		///< Cores in a telemetry sample, same as MP_MAX_CORE_COUNT
+#define RPC_STDIO_MAX_BATCH	128		///< Chunks per stdio batch message
+#define RPC_BULK_CHUNK_SIZE	65536		///< Maximum payload of a bulk storage frame
+#define RPC_BULK_WINDOW		(1024 * 1024)	///< Default bytes in flight of a bulk storage transfer
+
+#define RPC_STORAGE_BLOCK_RAW		0	///< Storage block is sent as is
+#define RPC_STORAGE_BLOCK_DEFLATE	1	///< Storage block is compressed with zlib
 
 typedef enum {
 	RPC_TYPE_HELLO_REQ = 1,
@@ -34,11 +43,40 @@ typedef enum {
 	RPC_TYPE_STORAGE_MD5_RES,
 	RPC_TYPE_STDIO_REQ,
 	RPC_TYPE_STDIO_RES,
+	RPC_TYPE_LATENCY_GET_REQ,
+	RPC_TYPE_LATENCY_GET_RES,
+	RPC_TYPE_STORAGE_BULK_REQ,
+	RPC_TYPE_STORAGE_BULK_RES,
+	RPC_TYPE_STORAGE_BULK_DATA,
+	RPC_TYPE_STORAGE_DIGEST_REQ,
+	RPC_TYPE_STORAGE_DIGEST_RES,
+	RPC_TYPE_STORAGE_BLOCK_REQ,
+	RPC_TYPE_STORAGE_BLOCK_RES,
+	RPC_TYPE_VM_CREATE_BATCH_REQ,
+	RPC_TYPE_VM_CREATE_BATCH_RES,
+	RPC_TYPE_STATUS_SET_BATCH_REQ,
+	RPC_TYPE_STATUS_SET_BATCH_RES,
+	RPC_TYPE_VM_DESTROY_BATCH_REQ,
+	RPC_TYPE_VM_DESTROY_BATCH_RES,
+	RPC_TYPE_TELEMETRY_REQ,
+	RPC_TYPE_TELEMETRY_RES,
+	RPC_TYPE_STDIO_BATCH,
 	RPC_TYPE_END,			// 22
 } RPC_TYPE;
 
 typedef struct _RPC RPC;
 
+/**
+ * A request waiting for its response. Every message is headed by its type and
+ * the request ID, which a response carries back so that requests of the same
+ * type may be outstanding at once and answered in any order.
+ */
+typedef struct {
+	uint32_t	id;		///< 0 if the slot is free
+	void*		callback;
+	void*		context;
+} RPCRequest;
+
 struct _RPC {
 	// Connection information
 	int		ver;
@@ -55,35 +93,25 @@ struct _RPC {
 	uint8_t		wbuf[RPC_BUFFER_SIZE];
 	int		wbuf_index;
 	
+	// Requests, slot is the ID modulo RPC_MAX_REQUESTS
+	uint32_t	request_id;	///< ID of the message being handled, a handler which calls back later restores it first
+	uint32_t	request_next;	///< ID of the next request, never 0
+	int		request_count;	///< Outstanding requests
+	RPCRequest	requests[RPC_MAX_REQUESTS];
+	
 	// Callbacks
-	bool(*hello_callback)(void* context);
-	void* hello_context;
-	bool(*vm_create_callback)(uint32_t id, void* context);
-	void* vm_create_context;
 	void(*vm_create_handler)(RPC* rpc, VMSpec* vm, void* context, void(*callback)(RPC* rpc, uint32_t id));
 	void* vm_create_handler_context;
-	bool(*vm_get_callback)(VMSpec* vm, void* context);
-	void* vm_get_context;
 	void(*vm_get_handler)(RPC* rpc, uint32_t id, void* context, void(*callback)(RPC* rpc, VMSpec* vm));
 	void* vm_get_handler_context;
-	bool(*vm_set_callback)(bool result, void* context);
-	void* vm_set_context;
 	void(*vm_set_handler)(RPC* rpc, VMSpec* vm, void* context, void(*callback)(RPC* rpc, bool result));
 	void* vm_set_handler_context;
-	bool(*vm_destroy_callback)(bool result, void* context);
-	void* vm_destroy_context;
 	void(*vm_destroy_handler)(RPC* rpc, uint32_t id, void* context, void(*callback)(RPC* rpc, bool result));
 	void* vm_destroy_handler_context;
-	bool(*vm_list_callback)(uint32_t* ids, uint16_t count, void* context);
-	void* vm_list_context;
 	void(*vm_list_handler)(RPC* rpc, int size, void* context, void(*callback)(RPC* rpc, uint32_t* ids, int size));
 	void* vm_list_handler_context;
-	bool(*status_get_callback)(VMStatus status, void* context);
-	void* status_get_context;
 	void(*status_get_handler)(RPC* rpc, uint32_t id, void* context, void(*callback)(RPC* rpc, VMStatus status));
 	void* status_get_handler_context;
-	bool(*status_set_callback)(bool result, void* context);
-	void* status_set_context;
 	void(*status_set_handler)(RPC* rpc, uint32_t id, VMStatus status, void* context, void(*callback)(RPC* rpc, bool result));
 	void* status_set_handler_context;
 	int32_t(*storage_download_callback)(uint32_t offset, void* buf, int32_t size, void* context);
@@ -99,14 +127,57 @@ struct _RPC {
 	void* storage_upload_context;
 	void(*storage_upload_handler)(RPC* rpc, uint32_t id, uint32_t offset, void* buf, int32_t size, void* context, void(*callback)(RPC* rpc, int32_t size));
 	void* storage_upload_handler_context;
-	bool(*storage_md5_callback)(bool result, uint32_t md5[], void* context);
-	void* storage_md5_context;
 	void(*storage_md5_handler)(RPC* rpc, uint32_t id, uint64_t size, void* context, void(*callback)(RPC* rpc, bool result, uint32_t md5[]));
 	void* storage_md5_handler_context;
-	bool(*stdio_callback)(uint16_t written, void* context);
-	void* stdio_context;
 	void(*stdio_handler)(RPC* rpc, uint32_t id, uint8_t thread_id, int fd, char* str, uint16_t size, void* context, void(*callback)(RPC* rpc, uint16_t size));
 	void* stdio_handler_context;
+
+	void(*stdio_batch_handler)(RPC* rpc, VMStdio* records, int count, void* context);
+	void* stdio_batch_handler_context;
+	void(*latency_get_handler)(RPC* rpc, uint32_t id, int size, void* context, void(*callback)(RPC* rpc, VMLatency* latencies, int size));
+	void* latency_get_handler_context;
+	void(*vm_create_batch_handler)(RPC* rpc, VMSpec** vms, int count, void* context, void(*callback)(RPC* rpc, uint32_t* ids, int count));
+	void* vm_create_batch_handler_context;
+	void(*status_set_batch_handler)(RPC* rpc, uint32_t* ids, int count, VMStatus status, void* context, void(*callback)(RPC* rpc, bool* results, int count));
+	void* status_set_batch_handler_context;
+	void(*vm_destroy_batch_handler)(RPC* rpc, uint32_t* ids, int count, void* context, void(*callback)(RPC* rpc, bool* results, int count));
+	void* vm_destroy_batch_handler_context;
+	void(*telemetry_handler)(RPC* rpc, uint32_t interval, int nic_size, void* context, void(*callback)(RPC* rpc, VMTelemetry* telemetry, VMCoreTelemetry* cores, int core_count, VMNICTelemetry* nics, int nic_count));
+	void* telemetry_handler_context;
+	
+	// Bulk storage transfer, one at a time per connection
+	uint32_t storage_bulk_id;
+	bool storage_bulk_is_active;
+	bool storage_bulk_is_sender;
+	bool storage_bulk_is_done;	///< The sender's last frame has been sent or received
+	bool storage_bulk_is_pending;	///< The last frame or acknowledge is to be sent
+	int32_t storage_bulk_status;	///< 0 in progress, 1 completed, negative on error
+	uint64_t storage_bulk_offset;	///< Next offset to be sent or received
+	uint64_t storage_bulk_end;	///< (uint64_t)-1 to the end of storage
+	uint64_t storage_bulk_acked;	///< Offset acknowledged by the receiver
+	uint32_t storage_bulk_window;
+	uint8_t* storage_bulk_buf;	///< Payload of the frame being sent
+	int32_t storage_bulk_tx;	///< Bytes of the frame payload to be sent
+	int32_t storage_bulk_rx;	///< Bytes of the frame payload to be received
+	int32_t(*storage_bulk_map)(uint64_t offset, void** buf, int32_t size, void* context);
+	void(*storage_bulk_callback)(uint64_t offset, int32_t status, void* context);
+	void* storage_bulk_context;
+	int32_t(*storage_bulk_handler)(RPC* rpc, uint32_t id, uint64_t offset, void** buf, int32_t size, void* context);
+	void* storage_bulk_handler_context;
+	void(*storage_digest_handler)(RPC* rpc, uint32_t id, uint32_t index, int count, void* context, void(*callback)(RPC* rpc, uint32_t index, uint32_t* digests, int count));
+	void* storage_digest_handler_context;
+	uint32_t storage_block_id;
+	uint32_t storage_block_index;
+	uint8_t storage_block_encoding;
+	uint8_t* storage_block_buf;	///< Block being sent, NULL if none
+	int32_t storage_block_size;
+	int32_t storage_block_offset;
+	bool(*storage_block_callback)(uint32_t index, int32_t status, void* context);
+	void* storage_block_context;
+	uint8_t* storage_block_recv;	///< Block being received
+	int32_t storage_block_received;
+	void(*storage_block_handler)(RPC* rpc, uint32_t id, uint32_t index, uint8_t encoding, void* buf, int32_t size, void* context, void(*callback)(RPC* rpc, uint32_t index, int32_t status));
+	void* storage_block_handler_context;
 	
 	// Private data
 	uint8_t		data[0];
@@ -138,6 +209,85 @@ void rpc_storage_md5(RPC* rpc, uint32_t id, uint64_t size, bool(*callback)(bool
 
 int rpc_stdio(RPC* rpc, uint32_t id, uint8_t thread_id, int fd, const char* str, uint16_t size, bool(*callback)(uint16_t written, void* context), void* context);
 
+/**
+ * Send chunks of standard output or error in one message without response.
+ * Chunks are written in order while they fit in the RPC buffer, the last one
+ * may be cut, and its size is updated to the bytes written.
+ *
+ * @return count of the chunks written, 0 if none fits now
+ */
+int rpc_stdio_batch(RPC* rpc, VMStdio* records, int count);
+
+int rpc_latency_get(RPC* rpc, uint32_t id, bool(*callback)(VMLatency* latencies, uint16_t count, void* context), void* context);
+
+/**
+ * Batch VM lifecycle requests. Up to RPC_MAX_BATCH VMs are handled by one
+ * request, and the manager works on them in parallel. callback gets the
+ * results in the order of the request: VM IDs, 0 if failed to create, or
+ * true for each VM which succeeded. Batches larger than the RPC buffer should
+ * be split, the requests are pipelined anyway.
+ *
+ * @return 0 if the request doesn't fit now, try again later, negative if
+ *         count is out of range
+ */
+int rpc_vm_create_batch(RPC* rpc, VMSpec** vms, int count, bool(*callback)(uint32_t* ids, int count, void* context), void* context);
+int rpc_status_set_batch(RPC* rpc, uint32_t* ids, int count, VMStatus status, bool(*callback)(bool* results, int count, void* context), void* context);
+int rpc_vm_destroy_batch(RPC* rpc, uint32_t* ids, int count, bool(*callback)(bool* results, int count, void* context), void* context);
+
+/**
+ * Subscribe to telemetry of the manager, a sample is sent every interval.
+ * callback is called for each sample until it returns false, then the
+ * subscription is cancelled. telemetry is NULL if the manager doesn't support
+ * it.
+ *
+ * @param interval milliseconds between samples, not 0
+ */
+int rpc_telemetry(RPC* rpc, uint32_t interval, bool(*callback)(VMTelemetry* telemetry, VMCoreTelemetry* cores, uint16_t core_count, VMNICTelemetry* nics, uint16_t nic_count, void* context), void* context);
+
+/**
+ * Bulk storage transfers. Payloads are framed in chunks of up to
+ * RPC_BULK_CHUNK_SIZE which are sent from and received into the memory
+ * returned by map, so nothing is copied through RPC buffers but the bytes
+ * which happen to be read with a frame header. The sender keeps at most
+ * window bytes unacknowledged by the receiver.
+ *
+ * map returns the contiguous size available at offset, which may be smaller
+ * than size, 0 at the end of data or negative on error. It's called in
+ * ascending order of offset, so everything below offset is done when it's
+ * called.
+ *
+ * callback is called once when the transfer ends with the offset which has
+ * been acknowledged, status 0 on success or negative on error. A failed
+ * transfer can be resumed from the offset.
+ *
+ * @param offset offset of storage to start from
+ * @param size bytes to transfer, 0 to the end of storage or map
+ * @param window bytes in flight, 0 for RPC_BULK_WINDOW
+ */
+int rpc_storage_bulk_download(RPC* rpc, uint32_t id, uint64_t offset, uint64_t size, uint32_t window, int32_t(*map)(uint64_t offset, void** buf, int32_t size, void* context), void(*callback)(uint64_t offset, int32_t status, void* context), void* context);
+int rpc_storage_bulk_upload(RPC* rpc, uint32_t id, uint64_t offset, uint64_t size, uint32_t window, int32_t(*map)(uint64_t offset, void** buf, int32_t size, void* context), void(*callback)(uint64_t offset, int32_t status, void* context), void* context);
+
+/**
+ * Digests of storage blocks of VM_STORAGE_BLOCK_SIZE, as many as fit in a
+ * response. callback gets MD5 digests of 4 words each from block index,
+ * count is 0 past the end of storage and negative on error.
+ */
+int rpc_storage_digest(RPC* rpc, uint32_t id, uint32_t index, bool(*callback)(uint32_t index, uint32_t* digests, int32_t count, void* context), void* context);
+
+/**
+ * Overwrite a storage block with buf, which is RPC_STORAGE_BLOCK_RAW or
+ * RPC_STORAGE_BLOCK_DEFLATE encoded. A raw block shorter than
+ * VM_STORAGE_BLOCK_SIZE is padded with zeros, and buf larger than it is
+ * rejected in either encoding. buf must be kept until the block is sent, one
+ * block is sent at a time.
+ *
+ * callback is called for each block with status 0 on success, or negative on
+ * error, until it returns false.
+ *
+ * @return 0 if the previous block is still being sent, try again later
+ */
+int rpc_storage_block(RPC* rpc, uint32_t id, uint32_t index, uint8_t encoding, void* buf, int32_t size, bool(*callback)(uint32_t index, int32_t status, void* context), void* context);
+
 // Server side APIs
 void rpc_vm_create_handler(RPC* rpc, void(*handler)(RPC* rpc, VMSpec* vm, void* context, void(*callback)(RPC* rpc, uint32_t id)), void* context);
 void rpc_vm_get_handler(RPC* rpc, void(*handler)(RPC* rpc, uint32_t id, void* context, void(*callback)(RPC* rpc, VMSpec* vm)), void* context);
@@ -154,6 +304,53 @@ void rpc_storage_md5_handler(RPC* rpc, void(*handler)(RPC* rpc, uint32_t id, uin
 
 void rpc_stdio_handler(RPC* rpc, void(*handler)(RPC* rpc, uint32_t id, uint8_t thread_id, int fd, char* str, uint16_t size, void* context, void(*callback)(RPC* rpc, uint16_t size)), void* context);
 
+/**
+ * handler is called with every chunk of a batch, which points into the RPC
+ * buffer until handler returns.
+ */
+void rpc_stdio_batch_handler(RPC* rpc, void(*handler)(RPC* rpc, VMStdio* records, int count, void* context), void* context);
+
+void rpc_latency_get_handler(RPC* rpc, void(*handler)(RPC* rpc, uint32_t id, int size, void* context, void(*callback)(RPC* rpc, VMLatency* latencies, int size)), void* context);
+
+/**
+ * handler maps storage of VM id at offset like map of the client APIs. Bulk
+ * downloads are sent from and uploads are received into the memory it
+ * returns.
+ */
+void rpc_storage_bulk_handler(RPC* rpc, int32_t(*handler)(RPC* rpc, uint32_t id, uint64_t offset, void** buf, int32_t size, void* context), void* context);
+
+/**
+ * handler calls callback with the digests of count blocks from index, or with
+ * the count of -1 on error.
+ */
+void rpc_storage_digest_handler(RPC* rpc, void(*handler)(RPC* rpc, uint32_t id, uint32_t index, int count, void* context, void(*callback)(RPC* rpc, uint32_t index, uint32_t* digests, int count)), void* context);
+
+/**
+ * handler is called with a whole block, buf is valid only until it returns.
+ * callback may be called later, once the block is written.
+ */
+void rpc_storage_block_handler(RPC* rpc, void(*handler)(RPC* rpc, uint32_t id, uint32_t index, uint8_t encoding, void* buf, int32_t size, void* context, void(*callback)(RPC* rpc, uint32_t index, int32_t status)), void* context);
+
+/**
+ * Batch handlers call callback once with the results of every VM, in the
+ * order of the request. vms and ids are valid only until handler returns.
+ */
+void rpc_vm_create_batch_handler(RPC* rpc, void(*handler)(RPC* rpc, VMSpec** vms, int count, void* context, void(*callback)(RPC* rpc, uint32_t* ids, int count)), void* context);
+void rpc_status_set_batch_handler(RPC* rpc, void(*handler)(RPC* rpc, uint32_t* ids, int count, VMStatus status, void* context, void(*callback)(RPC* rpc, bool* results, int count)), void* context);
+void rpc_vm_destroy_batch_handler(RPC* rpc, void(*handler)(RPC* rpc, uint32_t* ids, int count, void* context, void(*callback)(RPC* rpc, bool* results, int count)), void* context);
+
+/**
+ * handler is called with rpc->request_id of a subscription, and calls
+ * callback every interval with rpc->request_id restored, nic_size NICs at
+ * most. interval 0 cancels the subscription of rpc->request_id.
+ */
+void rpc_telemetry_handler(RPC* rpc, void(*handler)(RPC* rpc, uint32_t interval, int nic_size, void* context, void(*callback)(RPC* rpc, VMTelemetry* telemetry, VMCoreTelemetry* cores, int core_count, VMNICTelemetry* nics, int nic_count)), void* context);
+
+/**
+ * @return number of requests waiting for their responses
+ */
+int rpc_pending(RPC* rpc);
+
 bool rpc_is_active(RPC* rpc);
 bool rpc_loop(RPC* rpc);
 
@@ -14,6 +14,7 @@ typedef enum {
 #define VM_MAX_NIC_COUNT	64
 #define VM_MAX_ARGC		256
 #define VM_MAX_ARGV		4096
+#define VM_STORAGE_BLOCK_SIZE	0x200000	///< Unit of storage digests and block updates
 
 typedef struct {
 	uint64_t	mac;
@@ -28,6 +29,7 @@ typedef struct {
 	uint64_t	input_bandwidth;
 	uint64_t	output_bandwidth;
 	uint32_t	pool_size;
+	uint16_t	vlan;
 } NICSpec;
 
 typedef struct {
@@ -44,4 +46,82 @@ typedef struct {
 	char**		argv;
 } VMSpec;
 
+/**
+ * Latency of a stage of packets in a NIC of a VM. Values are in nanoseconds,
+ * percentiles are the lower bounds of histogram buckets.
+ */
+typedef struct {
+	uint16_t	nic;		///< NIC index in the VM
+	uint16_t	stage;		///< LATENCY_* stage of the NIC
+	uint32_t	reserved;
+	uint64_t	count;
+	uint64_t	min;
+	uint64_t	avg;
+	uint64_t	max;
+	uint64_t	p50;
+	uint64_t	p99;
+	uint64_t	p999;
+} VMLatency;
+
+/**
+ * Counters of the manager, sampled at time. Counters of cores and NICs are
+ * cumulative, rates and loads are the differences of two samples.
+ */
+typedef struct {
+	uint64_t	time;		///< Nanoseconds of the manager's clock
+	uint64_t	gmalloc_used;	///< Bytes
+	uint64_t	gmalloc_total;
+	uint64_t	bmalloc_used;	///< Bytes of 2MB blocks
+	uint64_t	bmalloc_total;
+} VMTelemetry;
+
+/**
+ * A core, its load is 1 - (difference of idle) / (difference of time).
+ */
+typedef struct {
+	uint8_t		core;		///< Core ID
+	int8_t		status;		///< VM_STATUS_* of the core
+	uint16_t	reserved;
+	uint32_t	vmid;		///< VM which is given the core, 0 if none
+	uint64_t	idle;		///< Nanoseconds spent waiting for events
+	uint64_t	events;		///< Events handled by the event loop
+} VMCoreTelemetry;
+
+/**
+ * A NIC of a VM, packets are counted by the manager's side of the queues.
+ */
+typedef struct {
+	uint32_t	vmid;
+	uint16_t	nic;		///< NIC index in the VM
+	uint16_t	reserved;
+	uint64_t	mac;
+	uint64_t	rx_packets;
+	uint64_t	rx_bytes;
+	uint64_t	rx_drops;	///< Not queued because of the queue, pool or bandwidth
+	uint64_t	tx_packets;
+	uint64_t	tx_bytes;
+	uint64_t	tx_drops;	///< Dequeued but not taken by the device
+	uint64_t	pool_used;	///< Bytes of packet pool
+	uint64_t	pool_total;
+	uint32_t	rx_queue;	///< Packets waiting in the rx queue
+	uint32_t	rx_queue_size;
+	uint32_t	tx_queue;	///< Packets waiting in the tx queue
+	uint32_t	tx_queue_size;
+} VMNICTelemetry;
+
+/**
+ * A chunk of standard output or error of a VM thread. str points into the
+ * ring of the VM or the RPC buffer, and is valid only during the call.
+ */
+typedef struct {
+	uint32_t	vmid;
+	uint8_t		thread_id;
+	uint8_t		fd;
+	uint16_t	size;
+	uint32_t	dropped;	///< Bytes dropped right before str by the rate limit
+	char*		str;
+} VMStdio;
+
+#define VM_STDIO_LOG	3	///< fd of VMStdio which carries binary log records of util/log.h
+
 #endif /* __CONTROL_VMSPEC_H__ */
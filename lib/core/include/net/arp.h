@@ -12,6 +12,9 @@
 
 #define ARP_LEN		28		///< ARP header length
 
+#define ARP_TABLE_SIZE		1024	///< Number of ARP table slots per NIC, power of 2
+#define ARP_PENDING_SIZE	4	///< Maximum number of packets waiting for resolution per IP address
+
 /**
  * ARP header for IPv4
  */
@@ -27,15 +30,19 @@ typedef struct _ARP {
 	uint32_t tpa;			///< Target protocol address (endian32)
 } __attribute__ ((packed)) ARP;
 
-extern uint32_t ARP_TIMEOUT;		///< ARP timeout of ARP table
+extern uint32_t ARP_TIMEOUT;		///< ARP timeout of ARP table in seconds
+extern uint32_t ARP_NEGATIVE_TIMEOUT;	///< How long a failed resolution is remembered in seconds
+extern uint32_t ARP_REQUEST_INTERVAL;	///< Minimum interval between ARP requests for an IP address in milliseconds
+extern uint32_t ARP_REQUEST_RETRY;	///< Number of ARP request retransmissions before resolution fails
 
 /**
  * Process ARP packet.
  *
+ * @param nic NIC reference which received the packet
  * @param packet the packet to process
  * @return ture if ARP packet is processed (packet must not be reused)
  */
-bool arp_process(Packet* packet);
+bool arp_process(NIC* nic, Packet* packet);
 
 /**
  * Broadcast ARP request (MAC address resolving).
@@ -60,7 +67,10 @@ bool arp_announce(NIC* nic, uint32_t ip);
  * Get MAC address associated with IP address from local ARP table.
  * It will return MAC address if there is an entity in ARP table,
  * it will return 0xffffffffffff if there is no entity in ARP table.
- * If there is no entity, ARP request is will be sent.
+ * If there is no entity, ARP request is will be sent. Requests are rate limited
+ * and retransmitted in background, and failed resolution is remembered for
+ * ARP_NEGATIVE_TIMEOUT seconds without sending requests.
+ * ARP table lookup is lock free, so it can be called from every thread.
  *
  * @param nic NIC reference which manages ARP table
  * @param destination IP address
@@ -69,6 +79,21 @@ bool arp_announce(NIC* nic, uint32_t ip);
  */
 uint64_t arp_get_mac(NIC* nic, uint32_t destination, uint32_t source);
 
+/**
+ * Resolve destination MAC address of the packet and transmit it.
+ * If the MAC address is not resolved yet, the packet is queued(at most ARP_PENDING_SIZE
+ * packets per IP address, the oldest one is dropped) and will be transmitted
+ * when ARP reply arrives.
+ *
+ * @param nic NIC reference to transmit the packet
+ * @param packet the packet to transmit, Ethernet source address and type must be set
+ * @param destination next hop IP address
+ * @param source IP address of interface
+ * @return true if the packet is transmitted or queued, false if the packet is dropped
+ *         (packet must not be reused in any cases)
+ */
+bool arp_tx(NIC* nic, Packet* packet, uint32_t destination, uint32_t source);
+
 /**
  * Get IP address associated with MAC address from local ARP table.
  * 
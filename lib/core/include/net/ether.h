@@ -30,7 +30,7 @@ typedef struct _Ether {
 	uint64_t dmac: 48;			///< Destination address (endian48)
 	uint64_t smac: 48;			///< Destination address (endian48)
 	uint16_t type;				///< Ether type (endian16)
-	uint8_t payload[0];			///< Ehternet payload
+	uint8_t payload[0];			///< Ehternet payload, or VLAN tags if type is a TPID (net/vlan.h)
 } __attribute__ ((packed)) Ether;
 
 #define endian8(v)	(v)			///< Change endianness for 8 bits
@@ -0,0 +1,225 @@
+#ifndef __NET_FLOW_H__
+#define __NET_FLOW_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <packet.h>
+
+/**
+ * @file
+ * Flow table, 5-tuple connection tracking
+ *
+ * Flows are kept in preallocated entries and indexed by cache line sized
+ * buckets. The key hash is symmetric, so both directions of a connection
+ * are found as the same flow. Idle and FIN timeouts are driven by a timer wheel.
+ *
+ * The table has a shard per thread, every function accesses the shard of
+ * the calling thread(thread_id()) without locking. Packets of a connection must
+ * be handled by the same thread(e.g. steered by flow_hash()) to be tracked as one flow.
+ */
+
+#define FLOW_BUCKET_SIZE	8		///< Number of slots of a bucket
+#define FLOW_WHEEL_SIZE		1024		///< Number of timer wheel slots
+#define FLOW_WHEEL_TICK		1000000		///< Timer wheel resolution in us (1 sec)
+
+#define FLOW_ORIGINAL		0		///< Direction of the flow initiator
+#define FLOW_REPLY		1		///< Direction of the flow responder
+
+/**
+ * TCP state of the flow
+ */
+typedef enum {
+	FLOW_TCP_NONE,				///< Not TCP or no packet is seen
+	FLOW_TCP_SYN_SENT,			///< SYN is sent by the initiator
+	FLOW_TCP_SYN_RECEIVED,			///< SYN/ACK is sent by the responder
+	FLOW_TCP_ESTABLISHED,			///< Three way handshake is done
+	FLOW_TCP_FIN_WAIT,			///< FIN is sent by one side
+	FLOW_TCP_CLOSING,			///< FIN is sent by both sides
+	FLOW_TCP_CLOSED,			///< RST is sent
+} FlowTCPState;
+
+/**
+ * 5-tuple flow key. Addresses and ports are in host endian.
+ */
+typedef struct _FlowKey {
+	uint32_t	saddr;			///< Source IP address
+	uint32_t	daddr;			///< Destination IP address
+	uint16_t	sport;			///< Source port number
+	uint16_t	dport;			///< Destination port number
+	uint8_t		protocol;		///< IP protocol number
+} FlowKey;
+
+/**
+ * Flow entry
+ */
+typedef struct _Flow {
+	FlowKey		key;			///< Key in the original direction
+	uint8_t		state;			///< TCP state (FlowTCPState)
+	uint8_t		fin;			///< FIN is seen bits of each direction (internal use only)
+	uint32_t	hash;			///< Symmetric hash of the key
+	uint64_t	expire;			///< Expire time in us
+	uint64_t	packets[2];		///< Number of packets of each direction
+	uint64_t	bytes[2];		///< Number of bytes of each direction
+
+	uint64_t	slot_tick;		///< The tick of timer wheel slot (internal use only)
+	struct _Flow*	prev;			///< Timer wheel list (internal use only)
+	struct _Flow*	next;			///< Timer wheel list (internal use only)
+
+	uint8_t		data[0] __attribute__ ((aligned(8)));	///< Per flow user data
+} Flow;
+
+/**
+ * Flow expire callback, the flow will be freed after the callback is returned.
+ */
+typedef void(*FlowExpireFunc)(Flow* flow, void* context);
+
+/**
+ * Bucket, a cache line (internal use only)
+ */
+typedef struct _FlowBucket {
+	uint32_t	signatures[FLOW_BUCKET_SIZE];	///< Hash signature, 0 means empty slot
+	uint32_t	indices[FLOW_BUCKET_SIZE];	///< Index of flow entry
+} __attribute__ ((aligned(64))) FlowBucket;
+
+/**
+ * Shard of a thread (internal use only)
+ */
+typedef struct _FlowShard {
+	FlowBucket*	buckets;		///< Buckets
+	uint32_t	bucket_mask;		///< Number of buckets - 1
+
+	uint8_t*	entries;		///< Preallocated flow entries
+	uint32_t*	frees;			///< Free entry index stack
+	uint32_t	free_count;		///< Number of free entries
+
+	Flow*		wheel[FLOW_WHEEL_SIZE];	///< Timer wheel slots
+	uint64_t	tick;			///< Next tick to process
+} __attribute__ ((aligned(64))) FlowShard;
+
+/**
+ * Flow table
+ */
+typedef struct _FlowTable {
+	uint32_t	size;			///< Maximum number of flows per shard
+	uint32_t	stride;			///< Flow entry size including user data, cache line aligned
+	uint32_t	data_size;		///< Per flow user data size
+
+	uint64_t	timeout_idle;		///< Idle timeout of non TCP flows in us
+	uint64_t	timeout_syn;		///< Timeout of TCP handshake in us
+	uint64_t	timeout_established;	///< Idle timeout of established TCP flows in us
+	uint64_t	timeout_fin;		///< Timeout after FIN is sent by one side in us
+	uint64_t	timeout_close;		///< Timeout after FIN is sent by both sides or RST in us
+
+	FlowExpireFunc	expire;			///< Expire callback
+	void*		context;		///< Expire callback's context
+
+	void*		pool;			///< Memory pool (internal use only)
+	int		shard_count;		///< Number of shards
+	FlowShard*	shards;			///< Shards of threads (internal use only)
+} FlowTable;
+
+/**
+ * Create a flow table. Every entry is allocated at once.
+ *
+ * @param size maximum number of flows per thread
+ * @param data_size per flow user data size in bytes
+ * @param expire callback which is called when a flow is expired or removed, NULL to ignore
+ * @param context the callback's context
+ * @param pool memory pool to use, if NULL local memory area will be used
+ * @return flow table or NULL if there is no memory
+ */
+FlowTable* flow_table_create(uint32_t size, uint32_t data_size, FlowExpireFunc expire, void* context, void* pool);
+
+/**
+ * Destroy the flow table. Expire callback is not called.
+ *
+ * @param table flow table
+ */
+void flow_table_destroy(FlowTable* table);
+
+/**
+ * Expire timed out flows of the calling thread's shard.
+ * It needs to be called regularly, e.g. as a timer event of FLOW_WHEEL_TICK period.
+ *
+ * @param table flow table
+ * @param current current time in us
+ * @return number of flows expired
+ */
+uint32_t flow_table_expire(FlowTable* table, uint64_t current);
+
+/**
+ * Get number of flows of the calling thread's shard.
+ *
+ * @param table flow table
+ * @return number of flows
+ */
+uint32_t flow_table_size(FlowTable* table);
+
+/**
+ * Calculate symmetric hash of the key. A key and its reversed one have the same hash.
+ *
+ * @param key flow key
+ * @return hash value
+ */
+uint32_t flow_hash(FlowKey* key);
+
+/**
+ * Extract 5-tuple flow key from IPv4 packet, VLAN tags are skipped.
+ * Ports are 0 if the protocol is not TCP or UDP.
+ *
+ * @param packet Ethernet frame
+ * @param[out] key flow key
+ * @return true if the packet is IPv4
+ */
+bool flow_key(Packet* packet, FlowKey* key);
+
+/**
+ * Find the flow.
+ *
+ * @param table flow table
+ * @param key flow key
+ * @param[out] direction FLOW_ORIGINAL or FLOW_REPLY, could be NULL
+ * @return the flow or NULL if there is no flow
+ */
+Flow* flow_lookup(FlowTable* table, FlowKey* key, int* direction);
+
+/**
+ * Find the flow, or add new flow if there is no flow.
+ * New flow's user data is cleared to 0.
+ *
+ * @param table flow table
+ * @param key flow key
+ * @param current current time in us
+ * @param[out] direction FLOW_ORIGINAL or FLOW_REPLY, could be NULL
+ * @return the flow or NULL if the table is full
+ */
+Flow* flow_get(FlowTable* table, FlowKey* key, uint64_t current, int* direction);
+
+/**
+ * Update counters, TCP state and timeout of the flow.
+ *
+ * @param table flow table
+ * @param flow the flow
+ * @param direction FLOW_ORIGINAL or FLOW_REPLY
+ * @param packet the packet of the flow, TCP flags are tracked if the flow is TCP
+ * @param current current time in us
+ */
+void flow_update(FlowTable* table, Flow* flow, int direction, Packet* packet, uint64_t current);
+
+/**
+ * Remove the flow. Expire callback is called.
+ *
+ * @param table flow table
+ * @param flow the flow to remove
+ */
+void flow_remove(FlowTable* table, Flow* flow);
+
+/**
+ * Get per flow user data.
+ *
+ * @param flow the flow
+ * @return user data of data_size bytes
+ */
+void* flow_data(Flow* flow);
+
+#endif /* __NET_FLOW_H__ */
@@ -3,7 +3,8 @@
 
 #include <stdint.h>
 #include <stdbool.h>
-#include <util/set.h>
+#include <nic.h>
+#include <net/portmap.h>
 
 #define NIC_ADDR_IPv4	"net.addr.ipv4"
 #define NIC_ADDR_IPv6	"net.addr.ipv6"
@@ -13,10 +14,8 @@ typedef struct _IPv4Interface {
 	uint32_t	netmask;
 	bool		_default;	// Move to config
 	
-	Set*		udp_ports;
-	uint16_t	udp_next_port;
-	Set*		tcp_ports;
-	uint16_t	tcp_next_port;
+	PortMap*	udp_ports;
+	PortMap*	tcp_ports;
 } IPv4Interface;
 
 typedef struct _IPv6Interface {
@@ -24,13 +23,47 @@ typedef struct _IPv6Interface {
 	uint32_t	netmask[4];
 	bool		_default;	// Move to config
 	
-	Set*		udp_ports;
-	uint16_t	udp_next_port;
-	Set*		tcp_ports;
-	uint16_t	tcp_next_port;
+	PortMap*	udp_ports;
+	PortMap*	tcp_ports;
 } IPv6Interface;
 
 IPv4Interface* interface_alloc(void* pool);
 void interface_free(IPv4Interface* interface, void* pool);
 
+/**
+ * Get an object of the network stack kept in NIC config by name.
+ *
+ * @return NULL if nothing is kept
+ */
+void* interface_config_get(NIC* nic, char* name);
+
+/**
+ * Keep an object of the network stack in NIC config by name, the name is
+ * registered at the first time.
+ *
+ * @return false if NIC config is full
+ */
+bool interface_config_put(NIC* nic, char* name, void* value);
+
+/**
+ * Add IPv4 address to the NIC.
+ *
+ * @return false if the address already exists or there is no memory
+ */
+bool nic_ip_add(NIC* nic, uint32_t addr);
+
+/**
+ * Get IPv4 interface of the address.
+ *
+ * @return NULL if the NIC doesn't have the address
+ */
+IPv4Interface* nic_ip_get(NIC* nic, uint32_t addr);
+
+/**
+ * Remove IPv4 address from the NIC.
+ *
+ * @return false if the NIC doesn't have the address
+ */
+bool nic_ip_remove(NIC* nic, uint32_t addr);
+
 #endif /* __NET_INTERFACE_H__ */
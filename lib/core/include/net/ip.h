@@ -2,6 +2,7 @@
 #define __NET_IP_H__
 
 #include <packet.h>
+#include <nic.h>
 
 /**
  * @file
@@ -18,6 +19,15 @@
 #define IP_PROTOCOL_ESP         0x32	///< IP protocol number for ESP
 #define IP_PROTOCOL_AH          0x33	///< IP protocol number for AH
 
+#define IP_FLAG_MF		0x01	///< More fragments flag for ip_flags_offset
+#define IP_FLAG_DF		0x02	///< Don't fragment flag for ip_flags_offset
+
+#define IP_FRAG_TABLE_SIZE	64	///< Maximum number of datagrams being reassembled per NIC
+#define IP_FRAG_COUNT		64	///< Maximum number of fragments per datagram
+
+extern uint32_t IP_FRAG_TIMEOUT;	///< Reassembly timeout in seconds
+extern uint32_t IP_FRAG_MEMORY;		///< Maximum buffer bytes held by fragments per NIC
+
 /**
  * Set IP flags and offset at once
  */
@@ -50,5 +60,31 @@ typedef struct _IP {
  * @param ip_body_len IP body length in bytes
  */
 void ip_pack(Packet* packet, uint16_t ip_body_len);
+
+/**
+ * Reassemble IPv4 fragments. Fragments are kept in a bounded per NIC table
+ * (IP_FRAG_TABLE_SIZE datagrams, IP_FRAG_MEMORY bytes) until every fragment arrives
+ * or IP_FRAG_TIMEOUT seconds passed. The oldest datagram is evicted when the table is full.
+ * Overlapping fragments drop the whole datagram, exact duplicates are ignored.
+ *
+ * @param nic NIC reference which received the packet
+ * @param packet IPv4 packet
+ * @return the packet itself if it is not a fragment, reassembled datagram if the fragment is the last one,
+ *         NULL if the fragment is kept or dropped (packet must not be reused)
+ */
+Packet* ip_defrag(NIC* nic, Packet* packet);
+
+/**
+ * Transmit IPv4 packet, fragmenting it if it is larger than MTU.
+ * Every fragment is allocated before any of them are transmitted,
+ * so no part of the datagram is sent when the NIC pool is exhausted.
+ *
+ * @param nic NIC reference to transmit the packet
+ * @param packet packed IPv4 packet
+ * @param mtu maximum IP packet length in bytes
+ * @return true if every fragment is transmitted, false if the packet is dropped
+ *         because of DF flag, too many fragments or lack of memory (packet must not be reused)
+ */
+bool ip_fragment_tx(NIC* nic, Packet* packet, uint16_t mtu);
  
 #endif /* __NET_IP_H__ */
@@ -28,4 +28,18 @@ void md5(uint8_t* message, uint32_t len, uint32_t* hash);
  */
 void md5_blocks(void** blocks, uint32_t block_count, uint32_t block_size, uint64_t len, uint32_t* hash);
 
+#define MD5_LANES	8	///< Messages digested at once by md5_x8
+
+/**
+ * Multi-buffer MD5 digesting, up to MD5_LANES messages of the same length are
+ * digested at once in SIMD lanes. It is much faster than calling md5 for each
+ * message, but each message is still digested serially.
+ *
+ * @param messages message array
+ * @param count message count, MD5_LANES at most
+ * @param len length of each message
+ * @param[out] hashes 4 words hash for each message
+ */
+void md5_x8(uint8_t** messages, int count, uint32_t len, uint32_t (*hashes)[4]);
+
 #endif /* __NET_MD5_H__ */
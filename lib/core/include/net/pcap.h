@@ -0,0 +1,100 @@
+#ifndef __NET_PCAP_H__
+#define __NET_PCAP_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * @file
+ * pcapng writer and pcap/pcapng reader on memory buffers.
+ *
+ * Captures are written as pcapng with one Ethernet interface which timestamps
+ * are in nanoseconds. Both classic pcap (micro and nanosecond) and pcapng
+ * files of either byte order can be read, so traces taken by other tools can
+ * be replayed.
+ */
+
+#define PCAP_LINKTYPE_ETHERNET		1
+
+#define PCAP_DIRECTION_UNKNOWN		0
+#define PCAP_DIRECTION_INBOUND		1	///< Received, epb_flags inbound
+#define PCAP_DIRECTION_OUTBOUND		2	///< Sent, epb_flags outbound
+
+#define PCAPNG_HEADER_SIZE		60	///< Section header and interface description block
+#define PCAPNG_PACKET_SIZE(caplen)	(32 + (((caplen) + 3) & ~3) + 12)	///< Enhanced packet block with flags
+
+#define PCAP_MAX_INTERFACES		8	///< Interfaces of a pcapng file which are tracked
+
+typedef struct {
+	uint64_t	time;		///< Timestamp in nanoseconds, 0 for simple packets of pcapng
+	uint32_t	caplen;		///< Captured length
+	uint32_t	len;		///< Original length
+	const uint8_t*	data;		///< Captured bytes in the reader's buffer
+} PcapPacket;
+
+typedef struct {
+	const uint8_t*	buf;
+	size_t		size;
+	size_t		offset;		///< Offset of the next record or block
+
+	bool		is_ng;		///< pcapng or classic pcap
+	bool		swap;		///< Byte order is different from the host
+	uint32_t	snaplen;
+
+	// Timestamp resolution, classic pcap uses resolutions[0]
+	uint8_t		resolutions[PCAP_MAX_INTERFACES];	///< if_tsresol
+	int		interface_count;
+} PcapReader;
+
+/**
+ * Write a section header block and an Ethernet interface description block
+ * which timestamps are in nanoseconds.
+ *
+ * @param buf buffer
+ * @param size buffer size
+ * @param snaplen maximum captured length of packets
+ *
+ * @return PCAPNG_HEADER_SIZE or 0 if the buffer is too small
+ */
+size_t pcapng_header(void* buf, size_t size, uint32_t snaplen);
+
+/**
+ * Write an enhanced packet block of the interface.
+ *
+ * @param buf buffer
+ * @param size buffer size
+ * @param time timestamp in nanoseconds
+ * @param direction PCAP_DIRECTION_*
+ * @param data captured bytes
+ * @param caplen captured length
+ * @param len original length
+ *
+ * @return PCAPNG_PACKET_SIZE(caplen) or 0 if the buffer is too small
+ */
+size_t pcapng_packet(void* buf, size_t size, uint64_t time, uint8_t direction,
+		const void* data, uint32_t caplen, uint32_t len);
+
+/**
+ * Detect the format of a capture file.
+ *
+ * @param reader reader to initialize
+ * @param buf capture file
+ * @param size file size
+ *
+ * @return false if it is neither pcap nor pcapng
+ */
+bool pcap_reader_init(PcapReader* reader, const void* buf, size_t size);
+
+/**
+ * Read the next packet. Blocks which are not packets are skipped, and
+ * reading stops at a truncated or zero filled record.
+ *
+ * @param reader reader
+ * @param packet packet to be filled, packet->data points to the reader's buffer
+ *
+ * @return false at the end of the file
+ */
+bool pcap_reader_next(PcapReader* reader, PcapPacket* packet);
+
+#endif /* __NET_PCAP_H__ */
@@ -0,0 +1,107 @@
+#ifndef __NET_PORTMAP_H__
+#define __NET_PORTMAP_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * @file
+ * Bitmap based TCP/UDP port allocator
+ *
+ * Every port(0 ~ 65535) is a bit of the bitmap. A second level summary bitmap
+ * marks the full 64 bits words, so finding a free port costs a few tzcnt
+ * instructions regardless of how many ports are used.
+ * Ephemeral ports are selected as RFC 6056 recommends.
+ */
+
+#define PORTMAP_EPHEMERAL_MIN	49152		///< The first ephemeral port number (IANA)
+#define PORTMAP_EPHEMERAL_MAX	65535		///< The last ephemeral port number (IANA)
+#define PORTMAP_TABLE_SIZE	256		///< RFC 6056 double-hash perturbation table size
+
+/**
+ * Port bitmap data structure
+ */
+typedef struct _PortMap {
+	uint64_t	bitmap[65536 / 64];	///< Used port bitmap (internal use only)
+	uint64_t	full[65536 / 64 / 64];	///< Full word summary bitmap (internal use only)
+	uint32_t	size;			///< Number of used ports (internal use only)
+
+	uint64_t	seed;			///< Random number generator state (internal use only)
+	uint64_t	secret;			///< Secret key of destination hashing (internal use only)
+	uint16_t	table[PORTMAP_TABLE_SIZE];	///< Per destination perturbation table (internal use only)
+
+	void*		pool;			///< Memory pool (internal use only)
+} PortMap;
+
+/**
+ * Create a port bitmap.
+ *
+ * @param pool memory pool to use, if NULL local memory area will be used
+ * @return port bitmap or NULL if there is no memory
+ */
+PortMap* portmap_create(void* pool);
+
+/**
+ * Destroy the port bitmap.
+ *
+ * @param portmap port bitmap
+ */
+void portmap_destroy(PortMap* portmap);
+
+/**
+ * Allocate specific port number.
+ *
+ * @param portmap port bitmap
+ * @param port port number
+ * @return true if the port is allocated, false if it is already used
+ */
+bool portmap_alloc0(PortMap* portmap, uint16_t port);
+
+/**
+ * Allocate an ephemeral port number from randomised position (RFC 6056 Algorithm 2).
+ *
+ * @param portmap port bitmap
+ * @return port number or 0 if every ephemeral port is used
+ */
+uint16_t portmap_alloc(PortMap* portmap);
+
+/**
+ * Allocate an ephemeral port number for the destination (RFC 6056 Algorithm 4).
+ * Consecutive allocations for the same destination walk sequentially, so
+ * the destination rarely sees a recently used port number again,
+ * while different destinations start from unpredictable positions.
+ *
+ * @param portmap port bitmap
+ * @param saddr local IP address
+ * @param daddr destination IP address
+ * @param dport destination port number
+ * @return port number or 0 if every ephemeral port is used
+ */
+uint16_t portmap_alloc_dst(PortMap* portmap, uint32_t saddr, uint32_t daddr, uint16_t dport);
+
+/**
+ * Free port number.
+ *
+ * @param portmap port bitmap
+ * @param port port number to free
+ */
+void portmap_free(PortMap* portmap, uint16_t port);
+
+/**
+ * Check the port is used or not.
+ *
+ * @param portmap port bitmap
+ * @param port port number
+ * @return true if the port is used
+ */
+bool portmap_contains(PortMap* portmap, uint16_t port);
+
+/**
+ * Get number of used ports.
+ *
+ * @param portmap port bitmap
+ * @return number of used ports
+ */
+uint32_t portmap_size(PortMap* portmap);
+
+#endif /* __NET_PORTMAP_H__ */
@@ -66,6 +66,19 @@ bool tcp_port_alloc0(NIC* nic, uint32_t addr, uint16_t port);
  */
 uint16_t tcp_port_alloc(NIC* nic, uint32_t addr);
 
+/**
+ * Allocate TCP port number for the destination which associated with NI.
+ * Port numbers are selected per destination (RFC 6056 Algorithm 4), so
+ * the same destination rarely sees recently used port numbers again.
+ *
+ * @param nic NIC reference
+ * @param addr
+ * @param destination destination IP address
+ * @param port destination port number
+ * @return port number, 0 if there is no available port
+ */
+uint16_t tcp_port_alloc_dst(NIC* nic, uint32_t addr, uint32_t destination, uint16_t port);
+
 /**
  * Free TCP port number.
  *
@@ -1,14 +1,22 @@
 #ifndef __NET_VLAN_H__
 #define __NET_VLAN_H__
 
-#include <net/packet.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <packet.h>
+#include <net/ether.h>
 
 /**
  * @file
- * IEEE 802.1Q
+ * IEEE 802.1Q and 802.1ad(QinQ)
+ *
+ * Tags are pushed and popped by moving only the 12 bytes of MAC addresses
+ * and shifting packet->start, the payload is never copied.
  */
 
-#define VLAN_LEN			2	///< VLANv4 header length
+#define VLAN_LEN			4	///< VLAN tag length (TPID + TCI)
+#define VLAN_MAX_DEPTH			2	///< Maximum number of tags to parse (QinQ)
+#define VLAN_VID_MASK			0x0fff	///< VLAN identifier bits of TCI
 
 /**
  * Priority levels
@@ -22,21 +30,87 @@
 #define VLAN_INTERNETWORK_CONTROL	6
 #define VLAN_NETWORK_CONTROL		7	//highest
 
-#define VLAN_GET_PCP(tci)			(tci & 0xe000) >> 13
-#define VLAN_GET_DEI(tci)			(tci & 0x1000) >> 12
-#define VLAN_GET_VID(tci)			(tci & 0xfff)
+#define VLAN_GET_PCP(tci)			(((tci) & 0xe000) >> 13)
+#define VLAN_GET_DEI(tci)			(((tci) & 0x1000) >> 12)
+#define VLAN_GET_VID(tci)			((tci) & 0xfff)
+#define VLAN_TCI(pcp, dei, vid)			((uint16_t)(((pcp) & 0x7) << 13 | ((dei) & 0x1) << 12 | ((vid) & 0xfff)))
+
+#define VLAN_IS_TPID(type)	((type) == ETHER_TYPE_8021Q || (type) == ETHER_TYPE_8021AD || \
+				(type) == ETHER_TYPE_QINQ1 || (type) == ETHER_TYPE_QINQ2 || \
+				(type) == ETHER_TYPE_QINQ3)	///< Ether type is a VLAN tag
 
 /**
- * VLANv4 header
+ * VLAN header, follows MAC addresses and the TPID(Ether's type)
  */
 typedef struct _VLAN {
-	uint16_t	tci;		/// pcd(3) + dei(1) + vid(12)
-	uint16_t	type;
+	uint16_t	tci;		///< pcp(3) + dei(1) + vid(12) (endian16)
+	uint16_t	type;		///< Ether type of the body (endian16)
 	//uint16_t	pcd: 3;		///< Priority code point
 	//uint16_t	dei: 1;		///< Drop eligible indicator
 	//uint16_t	vid: 12;	///< vLAN identifier 0x000 ~ 0xfff
-	
+
 	uint8_t		body[0];	///< VLAN body payload
 } __attribute__ ((packed)) VLAN;
 
+/**
+ * Get the Ether type and the payload skipping VLAN tags.
+ *
+ * @param ether Ethernet header
+ * @param[out] payload the payload after VLAN tags, could be NULL
+ * @return Ether type of the payload (host endian)
+ */
+uint16_t vlan_ether_type(Ether* ether, void** payload);
+
+/**
+ * Get the payload of Ethernet frame skipping VLAN tags.
+ *
+ * @param ether Ethernet header
+ * @return payload after VLAN tags
+ */
+void* vlan_payload(Ether* ether);
+
+/**
+ * Get the number of VLAN tags.
+ *
+ * @param ether Ethernet header
+ * @return 0 if untagged, 1 if 802.1Q, 2 if QinQ
+ */
+int vlan_depth(Ether* ether);
+
+/**
+ * Get the outermost TCI.
+ *
+ * @param ether Ethernet header
+ * @param[out] tci TCI of the outermost tag (host endian)
+ * @return true if the frame is tagged
+ */
+bool vlan_tci(Ether* ether, uint16_t* tci);
+
+/**
+ * Get the VLAN identifier of the outermost tag.
+ *
+ * @param ether Ethernet header
+ * @return VLAN identifier or 0 if the frame is untagged
+ */
+uint16_t vlan_vid(Ether* ether);
+
+/**
+ * Push an outermost VLAN tag. The packet must have VLAN_LEN bytes of padding head.
+ *
+ * @param packet Ethernet frame
+ * @param tpid tag protocol identifier e.g. ETHER_TYPE_8021Q, ETHER_TYPE_8021AD
+ * @param tci tag control information (host endian)
+ * @return true if the tag is pushed, false if there is no padding head
+ */
+bool vlan_push(Packet* packet, uint16_t tpid, uint16_t tci);
+
+/**
+ * Pop the outermost VLAN tag.
+ *
+ * @param packet Ethernet frame
+ * @param[out] tci TCI of the popped tag (host endian), could be NULL
+ * @return true if the tag is popped, false if the frame is untagged
+ */
+bool vlan_pop(Packet* packet, uint16_t* tci);
+
 #endif /* __NET_VLAN_H__ */
@@ -9,6 +9,7 @@
 /**
  * Get thread ID. Thread ID must be allocated from 0 sequencially. 
  * So thread ID 0 means the first CPU Core of virtual machine.
+ * In user-mode PacketNgin the ID is thread local, so a VM can run as threads.
  *
  * @return thread ID
  */
@@ -0,0 +1,110 @@
+#ifndef __UTIL_LOG_H__
+#define __UTIL_LOG_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * @file
+ * Binary log of the data path. A format string is registered once, and a log
+ * record carries only the format ID, TSC and raw arguments. Records are
+ * written to the log ring of the thread without locking, forwarded by the
+ * manager as is, and formatted by the console.
+ */
+
+#define LOG_MAX_ARGS		16	///< Arguments of a record
+#define LOG_MAX_FORMATS		256	///< Formats registered by a thread
+#define LOG_MAX_FORMAT_LEN	256	///< Bytes of a format string including null character
+#define LOG_RING_SIZE		65536	///< Bytes of the log ring of a thread, multiple of 16
+
+#define LOG_REGISTER		0xff	///< count of a record which carries a format string
+
+/**
+ * Log record, followed by count arguments or a null terminated format string
+ * if count is LOG_REGISTER. Records are aligned to the size of the header in
+ * the ring, so a header is never wrapped.
+ */
+typedef struct {
+	uint16_t	size;		///< Bytes of the record including the header, multiple of 16
+	uint16_t	format;		///< Format ID
+	uint8_t		count;		///< Count of arguments, or LOG_REGISTER
+	uint8_t		reserved[3];
+	uint64_t	time;		///< TSC when the record was written
+	uint64_t	args[0];
+} LogRecord;
+
+#define LOG_RECORD_MAX_SIZE	(sizeof(LogRecord) + LOG_MAX_FORMAT_LEN)
+
+/**
+ * Register a format string. Only integer conversions are formatted, and a
+ * string argument is printed as its address. It waits until the manager takes
+ * the registration if the ring is full, so call it out of the data path.
+ *
+ * @param format printf style format string
+ * @return format ID, negative if the format can't be registered or the
+ *         application is not given a log ring
+ */
+int log_format(const char* format);
+
+/**
+ * Write a log record. Nothing is written if the ring is full, which is
+ * counted by log_drops.
+ *
+ * @param format format ID from log_format
+ * @param args arguments of the format
+ * @param count count of args, LOG_MAX_ARGS at most
+ * @return true if the record is written
+ */
+bool log_write(int format, const uint64_t* args, int count);
+
+/**
+ * Write a log record of the arguments, e.g. LOG(id, ip, port).
+ */
+#define LOG(FORMAT, ...)	log_write((FORMAT), (uint64_t[]){ __VA_ARGS__ },	\
+					sizeof((uint64_t[]){ __VA_ARGS__ }) / sizeof(uint64_t))
+
+/**
+ * Count of records which are dropped because the ring was full.
+ */
+uint64_t log_drops();
+
+/**
+ * Decoder of a log stream of a thread, which is received in chunks.
+ */
+typedef struct {
+	char*		formats[LOG_MAX_FORMATS];
+	uint8_t		buf[LOG_RECORD_MAX_SIZE];	///< Record cut by the end of a chunk
+	size_t		len;
+} LogDecoder;
+
+/**
+ * Initialize the decoder.
+ */
+void log_decoder_init(LogDecoder* decoder);
+
+/**
+ * Free the formats registered to the decoder.
+ */
+void log_decoder_destroy(LogDecoder* decoder);
+
+/**
+ * Decode a chunk of the stream, callback is called with each whole record
+ * but registrations. A record cut at the end of data is kept until the next
+ * chunk.
+ *
+ * @param format registered format of the record, NULL if unknown
+ * @return count of the records, negative if the stream is broken and the rest
+ *         of data is discarded
+ */
+int log_decode(LogDecoder* decoder, const void* data, size_t size, void(*callback)(LogRecord* record, const char* format, void* context), void* context);
+
+/**
+ * Format a record like snprintf. Conversions which take other than integers
+ * are printed as they are.
+ *
+ * @return length of the string, which may be cut to size
+ */
+int log_print(char* buf, size_t size, const char* format, LogRecord* record);
+
+#endif /* __UTIL_LOG_H__ */
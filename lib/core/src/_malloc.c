@@ -1,4 +1,5 @@
 #include <stdlib.h>
+#include <stdint.h>
 #include <tlsf.h>
 
 /* NOTE: __malloc_pool must be initialized before used */
@@ -36,3 +37,18 @@ void* __calloc(size_t nelem, size_t elem_size, void* mem_pool) {
 	else
 		return calloc_ex(nelem, elem_size, mem_pool);
 }
+
+void* __malloc_aligned(size_t size, size_t align, void* mem_pool) {
+	void* ptr = __malloc(size + align - 1 + sizeof(void*), mem_pool);
+	if(!ptr)
+		return NULL;
+
+	void** aligned = (void**)(((uintptr_t)ptr + sizeof(void*) + align - 1) & ~(uintptr_t)(align - 1));
+	aligned[-1] = ptr;
+
+	return aligned;
+}
+
+void __free_aligned(void* ptr, void* mem_pool) {
+	__free(((void**)ptr)[-1], mem_pool);
+}
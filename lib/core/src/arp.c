@@ -1,107 +1,360 @@
+#include <string.h>
 #include <timer.h>
+#include <lock.h>
 #include <_malloc.h>
 #include <net/interface.h>
 #include <net/ether.h>
 #include <net/arp.h>
 #include <util/map.h>
+#include <util/event.h>
 
 #define ARP_TABLE	"net.arp.arptable"
-#define ARP_TABLE_GC	"net.arp.arptable.gc"
 
-#define GC_INTERVAL	(10 * 1000000)	// 10 secs
+#define ARP_TABLE_MASK	(ARP_TABLE_SIZE - 1)
+#define ARP_TABLE_MAX	(ARP_TABLE_SIZE - ARP_TABLE_SIZE / 4)	// 75%
 
-typedef struct {
-	uint64_t	mac;
-	uint64_t	timeout;
-} ARPEntity;
+#define GC_PERIOD	(100 * 1000)	// 100 ms
+#define GC_BATCH	128		// Whole table is scanned in 800 ms
 
-uint32_t ARP_TIMEOUT = 14400;	// 4 hours
+#define barrier()	__asm__ __volatile__ ("" : : : "memory")
 
-bool arp_process(Packet* packet) {
-	extern uint64_t __timer_ms;
-	if(!__timer_ms)
-		return false;
+typedef enum {
+	ARP_STATE_EMPTY,		///< Never used slot, terminates probing
+	ARP_STATE_INCOMPLETE,		///< Resolution is outstanding
+	ARP_STATE_REACHABLE,		///< MAC address is valid
+	ARP_STATE_FAILED,		///< Negative entry, resolution failed recently
+	ARP_STATE_DELETED,		///< Tombstone, continues probing
+} ARPState;
 
-	Ether* ether = (Ether*)(packet->buffer + packet->start);
-	if(endian16(ether->type) != ETHER_TYPE_ARP)
-		return false;
+/**
+ * ARP entity. Written only under the table lock, read locklessly by
+ * every thread through the sequence counter.
+ */
+typedef struct {
+	volatile uint32_t	seq;		// Odd while the entity is being updated
+	uint32_t		ip;
+	uint64_t		mac;
+	uint64_t		timeout;	// Expire time, or next request time while incomplete
+	uint8_t			state;
+	uint8_t			retry;
+	uint8_t			pending_count;
+	uint32_t		source;		// Source IP address of the requests
+	Packet*			pending[ARP_PENDING_SIZE];
+} __attribute__ ((aligned(64))) ARPEntity;
 
-	ARP* arp = (ARP*)ether->payload;
-	uint32_t addr = endian32(arp->tpa);
+typedef struct {
+	ARPEntity		entities[ARP_TABLE_SIZE];
+	uint32_t		size;		// Number of non empty slots including tombstones
+	uint32_t		gc_index;
+	uint64_t		gc_event;
+	volatile uint8_t	lock;
+	NIC*			nic;
+} ARPTable;
+
+uint32_t ARP_TIMEOUT = 14400;		// 4 hours
+uint32_t ARP_NEGATIVE_TIMEOUT = 20;	// 20 secs
+uint32_t ARP_REQUEST_INTERVAL = 1000;	// 1 sec
+uint32_t ARP_REQUEST_RETRY = 3;
+
+static inline uint32_t arp_hash(uint32_t ip) {
+	return (ip * 0x9e3779b1) >> 20;
+}
 
-	if(!nic_ip_get(packet->nic, addr))
-		return false;
+static inline void entity_write_begin(ARPEntity* entity) {
+	entity->seq++;
+	barrier();
+}
 
-	Map* arp_table = nic_config_get(packet->nic, ARP_TABLE);
-	if(!arp_table) {
-		arp_table = map_create(32, map_uint64_hash, map_uint64_equals, packet->nic->pool);
-		if(!arp_table)
-			return false;
-		if(!nic_config_put(packet->nic, ARP_TABLE, arp_table)) {
-			map_destroy(arp_table);
+static inline void entity_write_end(ARPEntity* entity) {
+	barrier();
+	entity->seq++;
+}
+
+/**
+ * Lockless lookup. The entity is copied to snapshot consistently.
+ *
+ * @return true if there is an entity(not a tombstone) of the IP address
+ */
+static bool arp_lookup(ARPTable* table, uint32_t ip, ARPEntity* snapshot) {
+	uint32_t index = arp_hash(ip);
+	for(uint32_t i = 0; i < ARP_TABLE_SIZE; i++) {
+		ARPEntity* entity = &table->entities[(index + i) & ARP_TABLE_MASK];
+
+		uint32_t seq;
+		do {
+			while((seq = entity->seq) & 1)
+				__asm__ __volatile__ ("pause");
+			barrier();
+
+			snapshot->ip = entity->ip;
+			snapshot->mac = entity->mac;
+			snapshot->timeout = entity->timeout;
+			snapshot->state = entity->state;
+			barrier();
+		} while(seq != entity->seq);
+
+		if(snapshot->state == ARP_STATE_EMPTY)
 			return false;
+
+		if(snapshot->ip == ip && snapshot->state != ARP_STATE_DELETED)
+			return true;
+	}
+
+	return false;
+}
+
+/**
+ * Find the entity of the IP address or a slot to insert it. Table lock must be held.
+ *
+ * @return the entity, a free slot(EMPTY or DELETED state), or NULL if the table is full
+ */
+static ARPEntity* arp_find(ARPTable* table, uint32_t ip) {
+	ARPEntity* tombstone = NULL;
+
+	uint32_t index = arp_hash(ip);
+	for(uint32_t i = 0; i < ARP_TABLE_SIZE; i++) {
+		ARPEntity* entity = &table->entities[(index + i) & ARP_TABLE_MASK];
+		switch(entity->state) {
+			case ARP_STATE_EMPTY:
+				if(tombstone)
+					return tombstone;
+
+				if(table->size >= ARP_TABLE_MAX)
+					return NULL;
+
+				return entity;
+			case ARP_STATE_DELETED:
+				if(!tombstone)
+					tombstone = entity;
+				break;
+			default:
+				if(entity->ip == ip)
+					return entity;
 		}
 	}
 
+	return tombstone;
+}
+
+static void arp_entity_set(ARPTable* table, ARPEntity* entity, uint32_t ip, uint8_t state, uint64_t mac, uint64_t timeout) {
+	if(entity->state == ARP_STATE_EMPTY)
+		table->size++;
+
+	entity_write_begin(entity);
+	entity->ip = ip;
+	entity->mac = mac;
+	entity->timeout = timeout;
+	entity->state = state;
+	entity_write_end(entity);
+}
+
+static void arp_pending_flush(ARPEntity* entity, NIC* nic) {
+	for(int i = 0; i < entity->pending_count; i++) {
+		Packet* packet = entity->pending[i];
+		if(entity->state == ARP_STATE_REACHABLE) {
+			Ether* ether = (Ether*)(packet->buffer + packet->start);
+			ether->dmac = endian48(entity->mac);
+			nic_tx(nic, packet);
+		} else {
+			nic_free(packet);
+		}
+
+		entity->pending[i] = NULL;
+	}
+
+	entity->pending_count = 0;
+}
+
+static void arp_pending_add(ARPEntity* entity, Packet* packet) {
+	if(entity->pending_count >= ARP_PENDING_SIZE) {
+		// Drop the oldest one
+		nic_free(entity->pending[0]);
+		memmove(&entity->pending[0], &entity->pending[1], sizeof(Packet*) * (ARP_PENDING_SIZE - 1));
+		entity->pending_count--;
+	}
+
+	entity->pending[entity->pending_count++] = packet;
+}
+
+static bool arp_gc(void* context) {
+	ARPTable* table = context;
 	uint64_t current = timer_us();
 
-	// GC
-	uint64_t gc_time = (uintptr_t)nic_config_get(packet->nic, ARP_TABLE_GC);
-	if(gc_time == 0 && !nic_config_contains(packet->nic, ARP_TABLE_GC)) {
-		gc_time = current + GC_INTERVAL;
-		if(!nic_config_put(packet->nic, ARP_TABLE_GC, (void*)(uintptr_t)gc_time))
-			return false;
+	lock_lock(&table->lock);
+
+	for(int i = 0; i < GC_BATCH; i++) {
+		uint32_t index = table->gc_index;
+		table->gc_index = (index + 1) & ARP_TABLE_MASK;
+
+		ARPEntity* entity = &table->entities[index];
+		switch(entity->state) {
+			case ARP_STATE_INCOMPLETE:
+				if(entity->timeout > current)
+					break;
+
+				if(entity->retry < ARP_REQUEST_RETRY) {
+					entity->retry++;
+					entity_write_begin(entity);
+					entity->timeout = current + ARP_REQUEST_INTERVAL * 1000;
+					entity_write_end(entity);
+
+					arp_request(table->nic, entity->ip, entity->source);
+				} else {
+					entity_write_begin(entity);
+					entity->state = ARP_STATE_FAILED;
+					entity->timeout = current + (uint64_t)ARP_NEGATIVE_TIMEOUT * 1000000;
+					entity_write_end(entity);
+
+					arp_pending_flush(entity, table->nic);
+				}
+				break;
+			case ARP_STATE_REACHABLE:
+			case ARP_STATE_FAILED:
+				if(entity->timeout > current)
+					break;
+
+				entity_write_begin(entity);
+				entity->state = ARP_STATE_DELETED;
+				entity_write_end(entity);
+				// Fall through
+			case ARP_STATE_DELETED:
+				// The tombstone is not needed if the probing stops at the next slot
+				if(table->entities[(index + 1) & ARP_TABLE_MASK].state == ARP_STATE_EMPTY) {
+					entity_write_begin(entity);
+					entity->state = ARP_STATE_EMPTY;
+					entity_write_end(entity);
+					table->size--;
+				}
+				break;
+		}
 	}
 
-	if(gc_time < current) {
-		MapIterator iter;
-		map_iterator_init(&iter, arp_table);
-		while(map_iterator_has_next(&iter)) {
-			MapEntry* entry = map_iterator_next(&iter);
-			if(((ARPEntity*)entry->data)->timeout < current) {
-				__free(entry->data, packet->nic->pool);
-				map_iterator_remove(&iter);
+	lock_unlock(&table->lock);
+
+	return true;
+}
+
+static ARPTable* arp_table(NIC* nic, bool create) {
+	ARPTable* table = interface_config_get(nic, ARP_TABLE);
+	if(table || !create)
+		return table;
+
+	// Entities are cache line aligned
+	table = __malloc_aligned(sizeof(ARPTable), 64, NULL);
+	if(!table)
+		return NULL;
+
+	memset(table, 0x0, sizeof(ARPTable));
+	table->nic = nic;
+
+	if(!interface_config_put(nic, ARP_TABLE, table)) {
+		__free_aligned(table, NULL);
+		return NULL;
+	}
+
+	table->gc_event = event_timer_add(arp_gc, table, GC_PERIOD, GC_PERIOD);
+
+	return table;
+}
+
+/**
+ * Start resolution of the IP address. Table lock must be held.
+ *
+ * @return the entity or NULL if the table is full
+ */
+static ARPEntity* arp_resolve(ARPTable* table, uint32_t destination, uint32_t source, uint64_t current) {
+	ARPEntity* entity = arp_find(table, destination);
+	if(!entity)
+		return NULL;
+
+	switch(entity->state) {
+		case ARP_STATE_EMPTY:
+		case ARP_STATE_DELETED:
+			entity->retry = 0;
+			entity->source = source;
+			arp_entity_set(table, entity, destination, ARP_STATE_INCOMPLETE, 0xffffffffffff,
+					current + ARP_REQUEST_INTERVAL * 1000);
+
+			arp_request(table->nic, destination, source);
+			break;
+		case ARP_STATE_REACHABLE:
+			// Expired but not collected yet
+			if(entity->timeout <= current) {
+				entity->retry = 0;
+				entity->source = source;
+				arp_entity_set(table, entity, destination, ARP_STATE_INCOMPLETE, 0xffffffffffff,
+						current + ARP_REQUEST_INTERVAL * 1000);
+
+				arp_request(table->nic, destination, source);
 			}
-		}
+			break;
+		default:
+			// Incomplete entities are retried by GC, failed ones are not retried until expired
+			break;
+	}
 
-		gc_time = current + GC_INTERVAL;
-		if(!nic_config_put(packet->nic, ARP_TABLE_GC, (void*)(uintptr_t)gc_time))
-			return false;
+	return entity;
+}
+
+static void arp_update(ARPTable* table, uint32_t ip, uint64_t mac, uint64_t current) {
+	lock_lock(&table->lock);
+
+	ARPEntity* entity = arp_find(table, ip);
+	if(!entity) {
+		lock_unlock(&table->lock);
+		return;
 	}
 
+	arp_entity_set(table, entity, ip, ARP_STATE_REACHABLE, mac, current + (uint64_t)ARP_TIMEOUT * 1000000);
+	arp_pending_flush(entity, table->nic);
+
+	lock_unlock(&table->lock);
+}
+
+bool arp_process(NIC* nic, Packet* packet) {
+	if(!__timer_ms)
+		return false;
+
+	if(packet->end - packet->start < ETHER_LEN + ARP_LEN)
+		return false;
+
+	Ether* ether = (Ether*)(packet->buffer + packet->start);
+	if(endian16(ether->type) != ETHER_TYPE_ARP)
+		return false;
+
+	ARP* arp = (ARP*)ether->payload;
+	uint32_t addr = endian32(arp->tpa);
+
+	if(!nic_ip_get(nic, addr))
+		return false;
+
+	ARPTable* table = arp_table(nic, true);
+	if(!table)
+		return false;
+
+	uint64_t current = timer_us();
+	uint64_t smac = endian48(arp->sha);
+	uint32_t sip = endian32(arp->spa);
+
 	switch(endian16(arp->operation)) {
 		case 1:	// Request
+			// The requester will talk to us soon (RFC 826 merge)
+			arp_update(table, sip, smac, current);
+
 			ether->dmac = ether->smac;
-			ether->smac = endian48(packet->nic->mac);
+			ether->smac = endian48(nic->mac);
 			arp->operation = endian16(2);
 			arp->tha = arp->sha;
 			arp->tpa = arp->spa;
 			arp->sha = ether->smac;
 			arp->spa = endian32(addr);
 
-			nic_tx(packet->nic, packet);
+			nic_tx(nic, packet);
 
 			return true;
 		case 2: // Reply
-			;
-			uint64_t smac = endian48(arp->sha);
-			uint32_t sip = endian32(arp->spa);
-			ARPEntity* entity = map_get(arp_table, (void*)(uintptr_t)sip);
-			if(!entity) {
-				entity = __malloc(sizeof(ARPEntity), packet->nic->pool);
-				if(!entity)
-					goto done;
-
-				if(!map_put(arp_table, (void*)(uintptr_t)sip, entity)) {
-					__free(entity, packet->nic->pool);
-					goto done;
-				}
-
-			}
-			entity->mac = smac;
-			entity->timeout = current + ARP_TIMEOUT;
+			arp_update(table, sip, smac, current);
 
-done:
 			nic_free(packet);
 			return true;
 	}
@@ -111,7 +364,7 @@ done:
 
 bool arp_request(NIC* nic, uint32_t destination, uint32_t source) {
 	if(source == 0) {
-		Map* interfaces = nic_config_get(nic, NIC_ADDR_IPv4);
+		Map* interfaces = interface_config_get(nic, NIC_ADDR_IPv4);
 		if(!interfaces)
 			return false;
 
@@ -154,11 +407,11 @@ bool arp_request(NIC* nic, uint32_t destination, uint32_t source) {
 
 bool arp_announce(NIC* nic, uint32_t ip) {
 	if(ip == 0) {
-		Map* interfaces = nic_config_get(nic, NIC_ADDR_IPv4);
+		Map* interfaces = interface_config_get(nic, NIC_ADDR_IPv4);
 		if(!interfaces)
 			return false;
 
-		bool result = false;
+		bool result = true;
 
 		MapIterator iter;
 		map_iterator_init(&iter, interfaces);
@@ -197,33 +450,96 @@ bool arp_announce(NIC* nic, uint32_t ip) {
 }
 
 uint64_t arp_get_mac(NIC* nic, uint32_t destination, uint32_t source) {
-	Map* arp_table = nic_config_get(nic, ARP_TABLE);
-	if(!arp_table) {
+	ARPTable* table = arp_table(nic, true);
+	if(!table) {
 		arp_request(nic, destination, source);
 		return 0xffffffffffff;
 	}
 
-	ARPEntity* entity = map_get(arp_table, (void*)(uintptr_t)destination);
-	if(!entity) {
-		arp_request(nic, destination, source);
-		return 0xffffffffffff;
+	uint64_t current = timer_us();
+
+	ARPEntity snapshot;
+	if(arp_lookup(table, destination, &snapshot)) {
+		if(snapshot.state == ARP_STATE_REACHABLE && snapshot.timeout > current)
+			return snapshot.mac;
+
+		if(snapshot.state != ARP_STATE_REACHABLE)
+			return 0xffffffffffff;
 	}
 
-	return entity->mac;
+	lock_lock(&table->lock);
+	arp_resolve(table, destination, source, current);
+	lock_unlock(&table->lock);
+
+	return 0xffffffffffff;
+}
+
+bool arp_tx(NIC* nic, Packet* packet, uint32_t destination, uint32_t source) {
+	Ether* ether = (Ether*)(packet->buffer + packet->start);
+
+	ARPTable* table = arp_table(nic, true);
+	if(!table) {
+		nic_free(packet);
+		return false;
+	}
+
+	uint64_t current = timer_us();
+
+	ARPEntity snapshot;
+	if(arp_lookup(table, destination, &snapshot) && snapshot.state == ARP_STATE_REACHABLE && snapshot.timeout > current) {
+		ether->dmac = endian48(snapshot.mac);
+		return nic_tx(nic, packet);
+	}
+
+	lock_lock(&table->lock);
+
+	ARPEntity* entity = arp_resolve(table, destination, source, current);
+	if(!entity || entity->state == ARP_STATE_FAILED) {
+		lock_unlock(&table->lock);
+
+		nic_free(packet);
+		return false;
+	}
+
+	if(entity->state == ARP_STATE_REACHABLE) {	// Resolved by the other thread
+		ether->dmac = endian48(entity->mac);
+		lock_unlock(&table->lock);
+
+		return nic_tx(nic, packet);
+	}
+
+	arp_pending_add(entity, packet);
+
+	lock_unlock(&table->lock);
+
+	return true;
 }
 
 uint32_t arp_get_ip(NIC* nic, uint64_t mac) {
-	Map* arp_table = nic_config_get(nic, ARP_TABLE);
-	if(!arp_table) {
+	ARPTable* table = arp_table(nic, false);
+	if(!table)
 		return 0;
-	}
 
-	MapIterator iter;
-	map_iterator_init(&iter, arp_table);
-	while(map_iterator_has_next(&iter)) {
-		MapEntry* entry = map_iterator_next(&iter);
-		if(((ARPEntity*)entry->data)->mac == mac)
-			return (uint32_t)(uintptr_t)entry->key;
+	for(int i = 0; i < ARP_TABLE_SIZE; i++) {
+		ARPEntity* entity = &table->entities[i];
+
+		uint32_t seq;
+		uint32_t ip;
+		uint64_t mac2;
+		uint8_t state;
+		do {
+			while((seq = entity->seq) & 1)
+				__asm__ __volatile__ ("pause");
+			barrier();
+
+			ip = entity->ip;
+			mac2 = entity->mac;
+			state = entity->state;
+			barrier();
+		} while(seq != entity->seq);
+
+		if(state == ARP_STATE_REACHABLE && mac2 == mac)
+			return ip;
 	}
 
 	return 0;
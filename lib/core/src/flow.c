@@ -0,0 +1,433 @@
+#include <string.h>
+#include <_malloc.h>
+#include <thread.h>
+#include <net/ether.h>
+#include <net/ip.h>
+#include <net/tcp.h>
+#include <net/udp.h>
+#include <net/vlan.h>
+#include <net/flow.h>
+
+#define ROUNDUP64(x)	(((x) + 63) & ~63)
+
+#define WHEEL_MASK	(FLOW_WHEEL_SIZE - 1)
+
+#define FIN_ORIGINAL	(1 << FLOW_ORIGINAL)
+#define FIN_REPLY	(1 << FLOW_REPLY)
+
+static inline FlowShard* flow_shard(FlowTable* table) {
+	return &table->shards[thread_id() % table->shard_count];
+}
+
+static inline Flow* flow_entry(FlowTable* table, FlowShard* shard, uint32_t index) {
+	return (Flow*)(shard->entries + (size_t)index * table->stride);
+}
+
+static inline uint32_t flow_index(FlowTable* table, FlowShard* shard, Flow* flow) {
+	return ((uint8_t*)flow - shard->entries) / table->stride;
+}
+
+static inline uint32_t flow_signature(uint32_t hash) {
+	return hash ? hash : 1;
+}
+
+static inline uint32_t flow_bucket2(uint32_t hash) {
+	return (hash >> 16 | hash << 16) * 0x9e3779b1;
+}
+
+static inline bool flow_key_equals(FlowKey* key1, FlowKey* key2) {
+	return key1->saddr == key2->saddr && key1->daddr == key2->daddr &&
+		key1->sport == key2->sport && key1->dport == key2->dport &&
+		key1->protocol == key2->protocol;
+}
+
+static inline bool flow_key_reversed(FlowKey* key1, FlowKey* key2) {
+	return key1->saddr == key2->daddr && key1->daddr == key2->saddr &&
+		key1->sport == key2->dport && key1->dport == key2->sport &&
+		key1->protocol == key2->protocol;
+}
+
+uint32_t flow_hash(FlowKey* key) {
+	// Order the endpoints to be symmetric
+	uint64_t a = (uint64_t)key->saddr << 16 | key->sport;
+	uint64_t b = (uint64_t)key->daddr << 16 | key->dport;
+	if(a > b) {
+		uint64_t tmp = a;
+		a = b;
+		b = tmp;
+	}
+
+	uint64_t h = a * 0x9e3779b97f4a7c15ULL;
+	h ^= b + 0x7f4a7c159e3779b9ULL + (h << 6) + (h >> 2);
+	h ^= key->protocol;
+
+	// MurmurHash3 finalizer
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+
+	return (uint32_t)h;
+}
+
+static void wheel_add(FlowShard* shard, Flow* flow, uint64_t tick) {
+	if(tick < shard->tick)
+		tick = shard->tick;
+
+	Flow** slot = &shard->wheel[tick & WHEEL_MASK];
+	flow->slot_tick = tick;
+	flow->prev = NULL;
+	flow->next = *slot;
+	if(*slot)
+		(*slot)->prev = flow;
+	*slot = flow;
+}
+
+static void wheel_remove(FlowShard* shard, Flow* flow) {
+	if(flow->prev)
+		flow->prev->next = flow->next;
+	else
+		shard->wheel[flow->slot_tick & WHEEL_MASK] = flow->next;
+
+	if(flow->next)
+		flow->next->prev = flow->prev;
+
+	flow->prev = flow->next = NULL;
+}
+
+FlowTable* flow_table_create(uint32_t size, uint32_t data_size, FlowExpireFunc expire, void* context, void* pool) {
+	FlowTable* table = __malloc(sizeof(FlowTable), pool);
+	if(!table)
+		return NULL;
+
+	memset(table, 0x0, sizeof(FlowTable));
+	table->size = size;
+	table->stride = ROUNDUP64(sizeof(Flow) + data_size);
+	table->data_size = data_size;
+	table->timeout_idle = 30 * 1000000ULL;		// 30 secs
+	table->timeout_syn = 30 * 1000000ULL;		// 30 secs
+	table->timeout_established = 3600 * 1000000ULL;	// 1 hour
+	table->timeout_fin = 120 * 1000000ULL;		// 2 mins
+	table->timeout_close = 10 * 1000000ULL;		// 10 secs
+	table->expire = expire;
+	table->context = context;
+	table->pool = pool;
+	table->shard_count = thread_count() > 0 ? thread_count() : 1;
+
+	table->shards = __malloc_aligned(sizeof(FlowShard) * table->shard_count, 64, pool);
+	if(!table->shards)
+		goto failed;
+	memset(table->shards, 0x0, sizeof(FlowShard) * table->shard_count);
+
+	// 8 slots per bucket, load factor of buckets is at most 50%
+	uint32_t bucket_count = 1;
+	while(bucket_count * FLOW_BUCKET_SIZE < size * 2)
+		bucket_count <<= 1;
+
+	for(int i = 0; i < table->shard_count; i++) {
+		FlowShard* shard = &table->shards[i];
+
+		shard->bucket_mask = bucket_count - 1;
+		shard->buckets = __malloc_aligned(sizeof(FlowBucket) * bucket_count, 64, pool);
+		shard->entries = __malloc_aligned((size_t)table->stride * size, 64, pool);
+		shard->frees = __malloc(sizeof(uint32_t) * size, pool);
+		if(!shard->buckets || !shard->entries || !shard->frees)
+			goto failed;
+
+		memset(shard->buckets, 0x0, sizeof(FlowBucket) * bucket_count);
+		memset(shard->entries, 0x0, (size_t)table->stride * size);
+		for(uint32_t j = 0; j < size; j++)
+			shard->frees[j] = size - j - 1;
+		shard->free_count = size;
+	}
+
+	return table;
+
+failed:
+	flow_table_destroy(table);
+	return NULL;
+}
+
+void flow_table_destroy(FlowTable* table) {
+	if(table->shards) {
+		for(int i = 0; i < table->shard_count; i++) {
+			FlowShard* shard = &table->shards[i];
+			if(shard->buckets)
+				__free_aligned(shard->buckets, table->pool);
+			if(shard->entries)
+				__free_aligned(shard->entries, table->pool);
+			if(shard->frees)
+				__free(shard->frees, table->pool);
+		}
+
+		__free_aligned(table->shards, table->pool);
+	}
+
+	__free(table, table->pool);
+}
+
+uint32_t flow_table_size(FlowTable* table) {
+	FlowShard* shard = flow_shard(table);
+
+	return table->size - shard->free_count;
+}
+
+bool flow_key(Packet* packet, FlowKey* key) {
+	Ether* ether = (Ether*)(packet->buffer + packet->start);
+	IP* ip;
+	if(vlan_ether_type(ether, (void**)&ip) != ETHER_TYPE_IPv4)
+		return false;
+
+	key->saddr = endian32(ip->source);
+	key->daddr = endian32(ip->destination);
+	key->protocol = ip->protocol;
+	key->sport = 0;
+	key->dport = 0;
+
+	// Non first fragments have no port numbers
+	if(endian16(ip->flags_offset) & 0x1fff)
+		return true;
+
+	if(ip->protocol == IP_PROTOCOL_TCP || ip->protocol == IP_PROTOCOL_UDP) {
+		// TCP and UDP have port numbers at the same position
+		UDP* udp = (UDP*)((uint8_t*)ip + ip->ihl * 4);
+		key->sport = endian16(udp->source);
+		key->dport = endian16(udp->destination);
+	}
+
+	return true;
+}
+
+static Flow* flow_find(FlowTable* table, FlowShard* shard, FlowKey* key, uint32_t hash, int* direction) {
+	uint32_t signature = flow_signature(hash);
+	uint32_t buckets[2] = { hash & shard->bucket_mask, flow_bucket2(hash) & shard->bucket_mask };
+
+	for(int i = 0; i < 2; i++) {
+		FlowBucket* bucket = &shard->buckets[buckets[i]];
+		for(int j = 0; j < FLOW_BUCKET_SIZE; j++) {
+			if(bucket->signatures[j] != signature)
+				continue;
+
+			Flow* flow = flow_entry(table, shard, bucket->indices[j]);
+			if(flow_key_equals(&flow->key, key)) {
+				if(direction)
+					*direction = FLOW_ORIGINAL;
+				return flow;
+			}
+
+			if(flow_key_reversed(&flow->key, key)) {
+				if(direction)
+					*direction = FLOW_REPLY;
+				return flow;
+			}
+		}
+	}
+
+	return NULL;
+}
+
+Flow* flow_lookup(FlowTable* table, FlowKey* key, int* direction) {
+	FlowShard* shard = flow_shard(table);
+
+	return flow_find(table, shard, key, flow_hash(key), direction);
+}
+
+static int bucket_empty_slot(FlowBucket* bucket) {
+	for(int i = 0; i < FLOW_BUCKET_SIZE; i++) {
+		if(bucket->signatures[i] == 0)
+			return i;
+	}
+
+	return -1;
+}
+
+Flow* flow_get(FlowTable* table, FlowKey* key, uint64_t current, int* direction) {
+	FlowShard* shard = flow_shard(table);
+	uint32_t hash = flow_hash(key);
+
+	Flow* flow = flow_find(table, shard, key, hash, direction);
+	if(flow)
+		return flow;
+
+	if(shard->free_count == 0)
+		return NULL;
+
+	if(shard->tick == 0)
+		shard->tick = current / FLOW_WHEEL_TICK;
+
+	// Put into the less loaded bucket of the two candidates
+	FlowBucket* bucket1 = &shard->buckets[hash & shard->bucket_mask];
+	FlowBucket* bucket2 = &shard->buckets[flow_bucket2(hash) & shard->bucket_mask];
+	int slot1 = bucket_empty_slot(bucket1);
+	int slot2 = bucket_empty_slot(bucket2);
+
+	FlowBucket* bucket;
+	int slot;
+	if(slot1 >= 0 && (slot2 < 0 || slot1 <= slot2)) {
+		bucket = bucket1;
+		slot = slot1;
+	} else if(slot2 >= 0) {
+		bucket = bucket2;
+		slot = slot2;
+	} else {
+		return NULL;
+	}
+
+	uint32_t index = shard->frees[--shard->free_count];
+	flow = flow_entry(table, shard, index);
+	memset(flow, 0x0, table->stride);
+
+	flow->key = *key;
+	flow->hash = hash;
+	flow->state = FLOW_TCP_NONE;
+	flow->expire = current + (key->protocol == IP_PROTOCOL_TCP ? table->timeout_syn : table->timeout_idle);
+	wheel_add(shard, flow, flow->expire / FLOW_WHEEL_TICK);
+
+	bucket->indices[slot] = index;
+	bucket->signatures[slot] = flow_signature(hash);
+
+	if(direction)
+		*direction = FLOW_ORIGINAL;
+
+	return flow;
+}
+
+static void flow_free(FlowTable* table, FlowShard* shard, Flow* flow) {
+	uint32_t index = flow_index(table, shard, flow);
+	uint32_t signature = flow_signature(flow->hash);
+	uint32_t buckets[2] = { flow->hash & shard->bucket_mask, flow_bucket2(flow->hash) & shard->bucket_mask };
+
+	for(int i = 0; i < 2; i++) {
+		FlowBucket* bucket = &shard->buckets[buckets[i]];
+		for(int j = 0; j < FLOW_BUCKET_SIZE; j++) {
+			if(bucket->signatures[j] == signature && bucket->indices[j] == index) {
+				bucket->signatures[j] = 0;
+				goto found;
+			}
+		}
+	}
+
+found:
+	wheel_remove(shard, flow);
+	shard->frees[shard->free_count++] = index;
+}
+
+void flow_remove(FlowTable* table, Flow* flow) {
+	FlowShard* shard = flow_shard(table);
+
+	if(table->expire)
+		table->expire(flow, table->context);
+
+	flow_free(table, shard, flow);
+}
+
+static void flow_track_tcp(Flow* flow, int direction, TCP* tcp) {
+	if(tcp->rst) {
+		flow->state = FLOW_TCP_CLOSED;
+		return;
+	}
+
+	switch(flow->state) {
+		case FLOW_TCP_NONE:
+			if(tcp->syn && !tcp->ack)
+				flow->state = FLOW_TCP_SYN_SENT;
+			else if(tcp->ack)	// Picked up in the middle of the connection
+				flow->state = FLOW_TCP_ESTABLISHED;
+			break;
+		case FLOW_TCP_SYN_SENT:
+			if(direction == FLOW_REPLY && tcp->syn && tcp->ack)
+				flow->state = FLOW_TCP_SYN_RECEIVED;
+			break;
+		case FLOW_TCP_SYN_RECEIVED:
+			if(direction == FLOW_ORIGINAL && tcp->ack && !tcp->syn)
+				flow->state = FLOW_TCP_ESTABLISHED;
+			break;
+	}
+
+	if(tcp->fin && flow->state >= FLOW_TCP_ESTABLISHED && flow->state < FLOW_TCP_CLOSED) {
+		flow->fin |= 1 << direction;
+		flow->state = flow->fin == (FIN_ORIGINAL | FIN_REPLY) ? FLOW_TCP_CLOSING : FLOW_TCP_FIN_WAIT;
+	}
+}
+
+static uint64_t flow_timeout(FlowTable* table, Flow* flow) {
+	if(flow->key.protocol != IP_PROTOCOL_TCP)
+		return table->timeout_idle;
+
+	switch(flow->state) {
+		case FLOW_TCP_ESTABLISHED:
+			return table->timeout_established;
+		case FLOW_TCP_FIN_WAIT:
+			return table->timeout_fin;
+		case FLOW_TCP_CLOSING:
+		case FLOW_TCP_CLOSED:
+			return table->timeout_close;
+		default:
+			return table->timeout_syn;
+	}
+}
+
+void flow_update(FlowTable* table, Flow* flow, int direction, Packet* packet, uint64_t current) {
+	flow->packets[direction]++;
+	flow->bytes[direction] += packet->end - packet->start;
+
+	if(flow->key.protocol == IP_PROTOCOL_TCP) {
+		Ether* ether = (Ether*)(packet->buffer + packet->start);
+		IP* ip = vlan_payload(ether);
+		if(!(endian16(ip->flags_offset) & 0x1fff))
+			flow_track_tcp(flow, direction, (TCP*)((uint8_t*)ip + ip->ihl * 4));
+	}
+
+	flow->expire = current + flow_timeout(table, flow);
+
+	// Extending timeout is lazy, the flow is moved when its slot is processed
+	uint64_t tick = flow->expire / FLOW_WHEEL_TICK;
+	if(tick < flow->slot_tick) {
+		FlowShard* shard = flow_shard(table);
+		wheel_remove(shard, flow);
+		wheel_add(shard, flow, tick);
+	}
+}
+
+uint32_t flow_table_expire(FlowTable* table, uint64_t current) {
+	FlowShard* shard = flow_shard(table);
+	uint64_t now = current / FLOW_WHEEL_TICK;
+
+	if(shard->tick == 0)
+		shard->tick = now;
+
+	// Every slot is visited once at most
+	if(now - shard->tick >= FLOW_WHEEL_SIZE)
+		shard->tick = now - FLOW_WHEEL_SIZE + 1;
+
+	uint32_t count = 0;
+	for(; shard->tick <= now; shard->tick++) {
+		Flow* flow = shard->wheel[shard->tick & WHEEL_MASK];
+		while(flow) {
+			Flow* next = flow->next;
+
+			if(flow->expire <= current) {
+				if(table->expire)
+					table->expire(flow, table->context);
+
+				flow_free(table, shard, flow);
+				count++;
+			} else {
+				// A flow which expires later in this tick is visited again
+				// at the next tick, not after a round of the wheel
+				uint64_t tick = flow->expire / FLOW_WHEEL_TICK;
+				wheel_remove(shard, flow);
+				wheel_add(shard, flow, tick > shard->tick ? tick : shard->tick + 1);
+			}
+
+			flow = next;
+		}
+	}
+
+	return count;
+}
+
+void* flow_data(Flow* flow) {
+	return flow->data;
+}
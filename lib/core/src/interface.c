@@ -1,4 +1,5 @@
 #include <net/interface.h>
+#include <util/map.h>
 #include <_malloc.h>
 #include <string.h>
 
@@ -15,9 +16,79 @@ IPv4Interface* interface_alloc(void* pool) {
 
 void interface_free(IPv4Interface* interface, void* pool) {
 	if(interface->udp_ports)
-		set_destroy(interface->udp_ports);
+		portmap_destroy(interface->udp_ports);
 	if(interface->tcp_ports)
-		set_destroy(interface->tcp_ports);
+		portmap_destroy(interface->tcp_ports);
 
 	__free(interface, pool);
 }
+
+void* interface_config_get(NIC* nic, char* name) {
+	uint32_t key = nic_config_key(nic, name);
+	if(!key)
+		return NULL;
+
+	return (void*)(uintptr_t)nic_config_get(nic, key);
+}
+
+bool interface_config_put(NIC* nic, char* name, void* value) {
+	uint32_t key = nic_config_key(nic, name);
+	if(!key)
+		key = nic_config_register(nic, name);
+
+	if(!key)
+		return false;
+
+	return nic_config_put(nic, key, (uint64_t)(uintptr_t)value);
+}
+
+bool nic_ip_add(NIC* nic, uint32_t addr) {
+	Map* interfaces = interface_config_get(nic, NIC_ADDR_IPv4);
+	if(!interfaces) {
+		interfaces = map_create(4, map_uint64_hash, map_uint64_equals, NULL);
+		if(!interfaces)
+			return false;
+
+		if(!interface_config_put(nic, NIC_ADDR_IPv4, interfaces)) {
+			map_destroy(interfaces);
+			return false;
+		}
+	}
+
+	void* key = (void*)(uintptr_t)addr;
+	if(map_contains(interfaces, key))
+		return false;
+
+	IPv4Interface* interface = interface_alloc(NULL);
+	if(!interface)
+		return false;
+
+	if(!map_put(interfaces, key, interface)) {
+		interface_free(interface, NULL);
+		return false;
+	}
+
+	return true;
+}
+
+IPv4Interface* nic_ip_get(NIC* nic, uint32_t addr) {
+	Map* interfaces = interface_config_get(nic, NIC_ADDR_IPv4);
+	if(!interfaces)
+		return NULL;
+
+	return map_get(interfaces, (void*)(uintptr_t)addr);
+}
+
+bool nic_ip_remove(NIC* nic, uint32_t addr) {
+	Map* interfaces = interface_config_get(nic, NIC_ADDR_IPv4);
+	if(!interfaces)
+		return false;
+
+	IPv4Interface* interface = map_remove(interfaces, (void*)(uintptr_t)addr);
+	if(!interface)
+		return false;
+
+	interface_free(interface, NULL);
+
+	return true;
+}
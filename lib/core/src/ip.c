@@ -1,7 +1,445 @@
+#include <string.h>
+#include <timer.h>
+#include <lock.h>
+#include <_malloc.h>
+#include <nic.h>
+#include <util/event.h>
+#include <net/interface.h>
 #include <net/ether.h>
 #include <net/ip.h>
 #include <net/checksum.h>
 
+#define IP_FRAG_TABLE	"net.ip.fragtable"
+
+#define GC_PERIOD	(1000 * 1000)	// 1 sec
+
+/**
+ * Datagram being reassembled.
+ */
+typedef struct {
+	uint32_t	source;
+	uint32_t	destination;
+	uint16_t	id;
+	uint8_t		protocol;
+	uint8_t		count;		// Number of fragments, 0 means the slot is free
+	uint32_t	received;	// Body bytes received
+	uint32_t	length;		// Total body length, 0 until the last fragment arrives
+	uint32_t	memory;		// Buffer bytes held by the fragments
+	uint64_t	timeout;
+	Packet*		fragments[IP_FRAG_COUNT];	// Sorted by offset
+} IPFragment;
+
+typedef struct {
+	IPFragment	entries[IP_FRAG_TABLE_SIZE];
+	uint32_t	used;		// Number of datagrams being reassembled
+	uint32_t	memory;		// Buffer bytes held by every fragment
+	uint64_t	gc_event;
+	volatile uint8_t lock;
+	NIC*		nic;
+} IPFragmentTable;
+
+uint32_t IP_FRAG_TIMEOUT = 30;			// 30 secs
+uint32_t IP_FRAG_MEMORY = 256 * 1024;		// 256 KB
+
+static inline uint16_t frag_offset(IP* ip) {
+	return (endian16(ip->flags_offset) & 0x1fff) * 8;
+}
+
+static inline bool frag_more(IP* ip) {
+	return !!(endian16(ip->flags_offset) & 0x2000);
+}
+
+static inline uint16_t frag_length(IP* ip) {
+	return endian16(ip->length) - ip->ihl * 4;
+}
+
+static inline IP* frag_ip(Packet* packet) {
+	return (IP*)((Ether*)(packet->buffer + packet->start))->payload;
+}
+
+static void frag_drop(IPFragmentTable* table, IPFragment* entry) {
+	for(int i = 0; i < entry->count; i++)
+		nic_free(entry->fragments[i]);
+
+	table->memory -= entry->memory;
+	table->used--;
+
+	memset(entry, 0x0, sizeof(IPFragment) - sizeof(entry->fragments));
+}
+
+static bool frag_gc(void* context) {
+	IPFragmentTable* table = context;
+	uint64_t current = timer_us();
+
+	lock_lock(&table->lock);
+
+	for(int i = 0; i < IP_FRAG_TABLE_SIZE && table->used > 0; i++) {
+		IPFragment* entry = &table->entries[i];
+		if(entry->count > 0 && entry->timeout < current)
+			frag_drop(table, entry);
+	}
+
+	lock_unlock(&table->lock);
+
+	return true;
+}
+
+static IPFragmentTable* frag_table(NIC* nic) {
+	IPFragmentTable* table = interface_config_get(nic, IP_FRAG_TABLE);
+	if(table)
+		return table;
+
+	table = __malloc(sizeof(IPFragmentTable), NULL);
+	if(!table)
+		return NULL;
+
+	memset(table, 0x0, sizeof(IPFragmentTable));
+	table->nic = nic;
+
+	if(!interface_config_put(nic, IP_FRAG_TABLE, table)) {
+		__free(table, NULL);
+		return NULL;
+	}
+
+	table->gc_event = event_timer_add(frag_gc, table, GC_PERIOD, GC_PERIOD);
+
+	return table;
+}
+
+/**
+ * Find the datagram or allocate a free slot. The oldest datagram is evicted when the table is full.
+ */
+static IPFragment* frag_find(IPFragmentTable* table, IP* ip) {
+	IPFragment* free = NULL;
+	IPFragment* oldest = NULL;
+
+	for(int i = 0; i < IP_FRAG_TABLE_SIZE; i++) {
+		IPFragment* entry = &table->entries[i];
+		if(entry->count == 0) {
+			if(!free)
+				free = entry;
+			continue;
+		}
+
+		if(entry->id == ip->id && entry->source == ip->source &&
+				entry->destination == ip->destination && entry->protocol == ip->protocol)
+			return entry;
+
+		if(!oldest || entry->timeout < oldest->timeout)
+			oldest = entry;
+	}
+
+	if(!free) {
+		frag_drop(table, oldest);
+		free = oldest;
+	}
+
+	free->source = ip->source;
+	free->destination = ip->destination;
+	free->id = ip->id;
+	free->protocol = ip->protocol;
+	free->timeout = timer_us() + (uint64_t)IP_FRAG_TIMEOUT * 1000000;
+	table->used++;
+
+	return free;
+}
+
+/**
+ * Evict the oldest datagrams except the one until the memory is available.
+ */
+static bool frag_reserve(IPFragmentTable* table, IPFragment* except, uint32_t size) {
+	while(table->memory + size > IP_FRAG_MEMORY) {
+		IPFragment* oldest = NULL;
+		for(int i = 0; i < IP_FRAG_TABLE_SIZE; i++) {
+			IPFragment* entry = &table->entries[i];
+			if(entry->count == 0 || entry == except)
+				continue;
+
+			if(!oldest || entry->timeout < oldest->timeout)
+				oldest = entry;
+		}
+
+		if(!oldest)
+			return false;
+
+		frag_drop(table, oldest);
+	}
+
+	return true;
+}
+
+/**
+ * Build the datagram in the buffer of the first fragment if it is large enough,
+ * or in a newly allocated packet.
+ */
+static Packet* frag_reassemble(IPFragmentTable* table, IPFragment* entry) {
+	Packet* first = entry->fragments[0];
+	IP* ip = frag_ip(first);
+	uint16_t header = ETHER_LEN + ip->ihl * 4;
+	uint32_t length = entry->length;
+
+	Packet* packet = first;
+	int index = 1;
+	if(first->size < first->start + header + length) {
+		packet = nic_alloc(table->nic, header + length);
+		if(!packet) {
+			frag_drop(table, entry);
+			return NULL;
+		}
+
+		memcpy(packet->buffer + packet->start, first->buffer + first->start, header);
+		index = 0;
+	}
+
+	uint8_t* body = packet->buffer + packet->start + header;
+	for(int i = index; i < entry->count; i++) {
+		IP* ip2 = frag_ip(entry->fragments[i]);
+		memcpy(body + frag_offset(ip2), (uint8_t*)ip2 + ip2->ihl * 4, frag_length(ip2));
+		nic_free(entry->fragments[i]);
+	}
+
+	table->memory -= entry->memory;
+	table->used--;
+	memset(entry, 0x0, sizeof(IPFragment) - sizeof(entry->fragments));
+
+	ip = frag_ip(packet);
+	ip->length = endian16(ip->ihl * 4 + length);
+	ip->flags_offset &= endian16(0x4000);	// Keep DF only
+	ip->checksum = 0;
+	ip->checksum = endian16(checksum(ip, ip->ihl * 4));
+
+	packet->end = packet->start + header + length;
+
+	return packet;
+}
+
+Packet* ip_defrag(NIC* nic, Packet* packet) {
+	if(packet->end - packet->start < ETHER_LEN + IP_LEN) {
+		nic_free(packet);
+		return NULL;
+	}
+
+	IP* ip = frag_ip(packet);
+	if(!(ip->flags_offset & endian16(0x3fff)))	// MF and offset
+		return packet;
+
+	// Header and body must be in the packet, they are copied when reassembled
+	if(ip->ihl < IP_LEN / 4 || endian16(ip->length) < ip->ihl * 4 ||
+			ETHER_LEN + endian16(ip->length) > packet->end - packet->start) {
+		nic_free(packet);
+		return NULL;
+	}
+
+	uint16_t offset = frag_offset(ip);
+	uint16_t length = frag_length(ip);
+	bool more = frag_more(ip);
+
+	// Every fragment except the last one must be multiple of 8 bytes
+	if(length == 0 || (more && (length & 7)) || (uint32_t)offset + length > 0xffff - IP_LEN) {
+		nic_free(packet);
+		return NULL;
+	}
+
+	IPFragmentTable* table = frag_table(nic);
+	if(!table) {
+		nic_free(packet);
+		return NULL;
+	}
+
+	lock_lock(&table->lock);
+
+	IPFragment* entry = frag_find(table, ip);
+
+	// Find the position, fragments are sorted by offset
+	int index = entry->count;
+	while(index > 0 && frag_offset(frag_ip(entry->fragments[index - 1])) > offset)
+		index--;
+
+	if(index > 0) {
+		IP* prev = frag_ip(entry->fragments[index - 1]);
+		if(frag_offset(prev) == offset && frag_length(prev) == length)
+			goto duplicated;
+
+		if(frag_offset(prev) + frag_length(prev) > offset)
+			goto overlapped;
+	}
+
+	if(index < entry->count) {
+		IP* next = frag_ip(entry->fragments[index]);
+		if(offset + length > frag_offset(next))
+			goto overlapped;
+	}
+
+	if(!more) {
+		if(entry->length != 0 && entry->length != (uint32_t)offset + length)
+			goto overlapped;
+
+		if(index < entry->count)	// There are data beyond the end
+			goto overlapped;
+
+		entry->length = offset + length;
+	} else if(entry->length != 0 && (uint32_t)offset + length > entry->length) {
+		goto overlapped;
+	}
+
+	if(entry->count >= IP_FRAG_COUNT)
+		goto overlapped;
+
+	uint32_t memory = sizeof(Packet) + packet->size;
+	if(!frag_reserve(table, entry, memory))
+		goto overlapped;
+
+	memmove(&entry->fragments[index + 1], &entry->fragments[index], sizeof(Packet*) * (entry->count - index));
+	entry->fragments[index] = packet;
+	entry->count++;
+	entry->received += length;
+	entry->memory += memory;
+	table->memory += memory;
+
+	if(entry->length == 0 || entry->received != entry->length) {
+		lock_unlock(&table->lock);
+		return NULL;
+	}
+
+	Packet* datagram = frag_reassemble(table, entry);
+
+	lock_unlock(&table->lock);
+
+	return datagram;
+
+duplicated:
+	lock_unlock(&table->lock);
+
+	nic_free(packet);
+	return NULL;
+
+overlapped:
+	// Overlapping or malformed fragments drop the whole datagram (RFC 5722 policy)
+	frag_drop(table, entry);
+
+	lock_unlock(&table->lock);
+
+	nic_free(packet);
+	return NULL;
+}
+
+/**
+ * Copy the options which have copied flag for the fragments except the first one.
+ *
+ * @return length of the options copied in bytes including padding
+ */
+static uint16_t ip_options_copy(uint8_t* dest, uint8_t* options, uint16_t length) {
+	uint16_t len = 0;
+	uint16_t i = 0;
+	while(i < length) {
+		uint8_t type = options[i];
+		if(type == 0)		// End of option list
+			break;
+
+		if(type == 1) {		// No operation
+			i++;
+			continue;
+		}
+
+		if(i + 1 >= length || options[i + 1] < 2 || i + options[i + 1] > length)
+			break;
+
+		uint8_t size = options[i + 1];
+		if(type & 0x80) {	// Copied flag
+			memcpy(dest + len, options + i, size);
+			len += size;
+		}
+
+		i += size;
+	}
+
+	while(len & 3)
+		dest[len++] = 0;
+
+	return len;
+}
+
+bool ip_fragment_tx(NIC* nic, Packet* packet, uint16_t mtu) {
+	Ether* ether = (Ether*)(packet->buffer + packet->start);
+	IP* ip = (IP*)ether->payload;
+
+	uint16_t header = ip->ihl * 4;
+	uint16_t length = endian16(ip->length);
+	if(length <= mtu)
+		return nic_tx(nic, packet);
+
+	if(header < IP_LEN || length < header || ETHER_LEN + length > packet->end - packet->start) {
+		nic_free(packet);
+		return false;
+	}
+
+	if(endian16(ip->flags_offset) & 0x4000 || mtu < header + 8) {	// Don't fragment
+		nic_free(packet);
+		return false;
+	}
+
+	uint16_t chunk = (mtu - header) & ~7;
+	uint16_t body = length - header;
+	int count = (body + chunk - 1) / chunk;
+	if(count > IP_FRAG_COUNT) {
+		nic_free(packet);
+		return false;
+	}
+
+	// Allocate every fragment first not to send a part of the datagram
+	Packet* fragments[IP_FRAG_COUNT];
+	for(int i = 0; i < count; i++) {
+		fragments[i] = nic_alloc(nic, ETHER_LEN + header + chunk);
+		if(!fragments[i]) {
+			for(int j = 0; j < i; j++)
+				nic_free(fragments[j]);
+
+			nic_free(packet);
+			return false;
+		}
+	}
+
+	uint16_t base = frag_offset(ip);
+	bool more = frag_more(ip);
+
+	// Options for the fragments except the first one
+	uint8_t options[40];
+	uint16_t options_len = ip_options_copy(options, ip->body, header - IP_LEN);
+
+	for(int i = 0; i < count; i++) {
+		Packet* fragment = fragments[i];
+		Ether* ether2 = (Ether*)(fragment->buffer + fragment->start);
+		IP* ip2 = (IP*)ether2->payload;
+
+		uint16_t header2 = i == 0 ? header : IP_LEN + options_len;
+		memcpy(ether2, ether, ETHER_LEN + IP_LEN);
+		if(i == 0)
+			memcpy(ip2->body, ip->body, header - IP_LEN);
+		else
+			memcpy(ip2->body, options, options_len);
+
+		uint16_t offset = i * chunk;
+		uint16_t len = i == count - 1 ? body - offset : chunk;
+		memcpy((uint8_t*)ip2 + header2, (uint8_t*)ip + header + offset, len);
+
+		ip2->ihl = header2 / 4;
+		ip2->length = endian16(header2 + len);
+		ip2->flags_offset = ip_flags_offset((i < count - 1 || more) ? IP_FLAG_MF : 0, (base + offset) / 8);
+		ip2->checksum = 0;
+		ip2->checksum = endian16(checksum(ip2, header2));
+
+		fragment->end = fragment->start + ETHER_LEN + header2 + len;
+	}
+
+	nic_free(packet);
+
+	bool result = true;
+	for(int i = 0; i < count; i++)
+		result &= nic_tx(nic, fragments[i]);
+
+	return result;
+}
+
 void ip_pack(Packet* packet, uint16_t ip_body_len) {
 	Ether* ether = (Ether*)(packet->buffer + packet->start);
 	IP* ip = (IP*)ether->payload;
@@ -0,0 +1,288 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <util/log.h>
+
+// Log ring of the thread, given by the manager when the application is loaded
+char* __log;
+volatile size_t __log_head;
+volatile size_t __log_tail;
+volatile size_t __log_size;
+
+static int format_count;
+static uint64_t drops;
+
+static inline uint64_t tsc() {
+	uint64_t time;
+	uint32_t* p = (uint32_t*)&time;
+	asm volatile("rdtsc" : "=a"(p[0]), "=d"(p[1]));
+
+	return time;
+}
+
+static void copy(size_t offset, const void* data, size_t len) {
+	offset %= __log_size;
+	size_t len1 = __log_size - offset;
+	if(len1 > len)
+		len1 = len;
+
+	memcpy(__log + offset, data, len1);
+	memcpy(__log, (const uint8_t*)data + len1, len - len1);
+}
+
+static bool put(LogRecord* record, const void* data, size_t len) {
+	size_t head = __log_head;
+	size_t tail = __log_tail;
+	size_t writable = tail < head ? head - tail - 1 : __log_size - tail + head - 1;
+	if(record->size > writable)
+		return false;
+
+	copy(tail, record, sizeof(LogRecord));
+	copy(tail + sizeof(LogRecord), data, len);
+
+	// The manager reads the record once the tail is moved
+	asm volatile("" ::: "memory");
+	__log_tail = (tail + record->size) % __log_size;
+
+	return true;
+}
+
+int log_format(const char* format) {
+	if(!__log || format_count >= LOG_MAX_FORMATS)
+		return -1;
+
+	size_t len = strlen(format) + 1;
+	if(len > LOG_MAX_FORMAT_LEN)
+		return -2;
+
+	LogRecord record = {
+		.size = (sizeof(LogRecord) + len + 15) & ~15,
+		.format = format_count,
+		.count = LOG_REGISTER,
+		.time = tsc(),
+	};
+
+	// Records of the format are not readable without it
+	while(!put(&record, format, len));
+
+	return format_count++;
+}
+
+bool log_write(int format, const uint64_t* args, int count) {
+	if(!__log || format < 0 || format >= format_count || count < 0 || count > LOG_MAX_ARGS) {
+		drops++;
+		return false;
+	}
+
+	LogRecord record = {
+		.size = (sizeof(LogRecord) + sizeof(uint64_t) * count + 15) & ~15,
+		.format = format,
+		.count = count,
+		.time = tsc(),
+	};
+
+	if(!put(&record, args, sizeof(uint64_t) * count)) {
+		drops++;
+		return false;
+	}
+
+	return true;
+}
+
+uint64_t log_drops() {
+	return drops;
+}
+
+void log_decoder_init(LogDecoder* decoder) {
+	memset(decoder, 0, sizeof(LogDecoder));
+}
+
+void log_decoder_destroy(LogDecoder* decoder) {
+	for(int i = 0; i < LOG_MAX_FORMATS; i++) {
+		free(decoder->formats[i]);
+		decoder->formats[i] = NULL;
+	}
+
+	decoder->len = 0;
+}
+
+static bool is_valid(LogRecord* record) {
+	if(record->size < sizeof(LogRecord) || record->size > LOG_RECORD_MAX_SIZE || record->size % 16)
+		return false;
+
+	if(record->count == LOG_REGISTER)
+		return record->format < LOG_MAX_FORMATS;
+
+	return record->count <= LOG_MAX_ARGS && record->size >= sizeof(LogRecord) + sizeof(uint64_t) * record->count;
+}
+
+static void process(LogDecoder* decoder, LogRecord* record, void(*callback)(LogRecord* record, const char* format, void* context), void* context) {
+	if(record->count != LOG_REGISTER) {
+		callback(record, record->format < LOG_MAX_FORMATS ? decoder->formats[record->format] : NULL, context);
+		return;
+	}
+
+	size_t len = record->size - sizeof(LogRecord);
+	char* nul = memchr(record->args, '\0', len);
+	if(nul)
+		len = nul - (char*)record->args;
+	char* format = malloc(len + 1);
+	if(!format)
+		return;
+
+	memcpy(format, record->args, len);
+	format[len] = '\0';
+
+	free(decoder->formats[record->format]);
+	decoder->formats[record->format] = format;
+}
+
+int log_decode(LogDecoder* decoder, const void* data, size_t size, void(*callback)(LogRecord* record, const char* format, void* context), void* context) {
+	const uint8_t* p = data;
+	const uint8_t* end = p + size;
+	int count = 0;
+
+	while(p < end) {
+		// The rest of the record of the last chunk
+		if(decoder->len > 0 || (size_t)(end - p) < sizeof(LogRecord)) {
+			size_t need = decoder->len < sizeof(LogRecord) ? sizeof(LogRecord) : ((LogRecord*)decoder->buf)->size;
+			size_t len = need - decoder->len < (size_t)(end - p) ? need - decoder->len : (size_t)(end - p);
+			memcpy(decoder->buf + decoder->len, p, len);
+			decoder->len += len;
+			p += len;
+
+			LogRecord* record = (LogRecord*)decoder->buf;
+			if(decoder->len < sizeof(LogRecord))
+				break;
+
+			if(!is_valid(record)) {
+				decoder->len = 0;
+				return -1;
+			}
+
+			if(decoder->len < record->size)
+				continue;
+
+			process(decoder, record, callback, context);
+			decoder->len = 0;
+			count++;
+			continue;
+		}
+
+		LogRecord* record = (LogRecord*)p;
+		if(!is_valid(record))
+			return -1;
+
+		// Cut by the end of the chunk
+		if(record->size > (size_t)(end - p)) {
+			memcpy(decoder->buf, p, end - p);
+			decoder->len = end - p;
+			break;
+		}
+
+		process(decoder, record, callback, context);
+		p += record->size;
+		count++;
+	}
+
+	return count;
+}
+
+int log_print(char* buf, size_t size, const char* format, LogRecord* record) {
+	size_t len = 0;
+	int index = 0;
+
+	#define APPEND(...)	do {						\
+		int _n = snprintf(buf + len, size > len ? size - len : 0, __VA_ARGS__);	\
+		if(_n > 0)							\
+			len += _n;						\
+	} while(0)
+
+	const char* p = format;
+	while(*p) {
+		if(*p != '%') {
+			const char* q = strchr(p, '%');
+			int n = q ? q - p : (int)strlen(p);
+			APPEND("%.*s", n, p);
+			p += n;
+			continue;
+		}
+
+		// Conversion specification: flags, width, precision, length and conversion
+		char spec[32];
+		const char* q = p + 1;
+		q += strspn(q, "-+ #0");
+		q += strspn(q, "0123456789");
+		if(*q == '.') {
+			q++;
+			q += strspn(q, "0123456789");
+		}
+		int longs = 0;
+		while(*q == 'l' || *q == 'h' || *q == 'z' || *q == 'j' || *q == 't') {
+			if(*q == 'l')
+				longs++;
+			q++;
+		}
+
+		char conversion = *q;
+		if(conversion == '%') {
+			APPEND("%%");
+			p = q + 1;
+			continue;
+		}
+
+		if(!conversion || !strchr("diouxXcp", conversion) || (size_t)(q - p) + 2 > sizeof(spec)) {
+			// Printed as is
+			int n = conversion ? q - p + 1 : q - p;
+			APPEND("%.*s", n, p);
+			p += n;
+			continue;
+		}
+
+		// The spec is rebuilt with the widest length of the conversion
+		int n = 0;
+		const char* s = p;
+		while(s < q && *s != 'l' && *s != 'h' && *s != 'z' && *s != 'j' && *s != 't')
+			spec[n++] = *s++;
+
+		uint64_t arg = index < record->count ? record->args[index] : 0;
+		index++;
+
+		switch(conversion) {
+			case 'c':
+				spec[n++] = 'c';
+				spec[n] = '\0';
+				APPEND(spec, (int)arg);
+				break;
+			case 'p':
+				spec[n++] = 'p';
+				spec[n] = '\0';
+				APPEND(spec, (void*)arg);
+				break;
+			case 'd':
+			case 'i':
+				spec[n++] = 'l';
+				spec[n++] = conversion;
+				spec[n] = '\0';
+				APPEND(spec, longs ? (long)arg : (long)(int)arg);
+				break;
+			default:
+				spec[n++] = 'l';
+				spec[n++] = conversion;
+				spec[n] = '\0';
+				APPEND(spec, longs ? (unsigned long)arg : (unsigned long)(unsigned int)arg);
+				break;
+		}
+
+		p = q + 1;
+	}
+
+	#undef APPEND
+
+	if(size > 0 && len >= size)
+		buf[size - 1] = '\0';
+	else if(size > 0)
+		buf[len] = '\0';
+
+	return len;
+}
@@ -79,3 +79,122 @@ void md5_blocks(void** blocks, uint32_t block_count, uint32_t block_size, uint64
 	block[15] = len0 >> 29;
 	md5_compress(hash, block);
 }
+
+/*
+ * Multi-buffer MD5, a lane of vectors per message. It's compiled into SSE
+ * instructions, two registers for a vector of MD5_LANES words.
+ */
+typedef uint32_t v8u __attribute__((vector_size(4 * MD5_LANES)));
+
+static const uint32_t md5_t[64] = {
+	0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+	0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+	0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+	0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+	0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+	0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+	0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+	0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391,
+};
+
+static const int md5_s[16] = {
+	7, 12, 17, 22, 5, 9, 14, 20, 4, 11, 16, 23, 6, 10, 15, 21,
+};
+
+#define MD5_STEP(F, a, b, c, d, k, i) {						\
+	v8u x = a + (F) + m[k] + md5_t[i];					\
+	a = b + ((x << md5_s[(i) / 16 * 4 + (i) % 4]) | (x >> (32 - md5_s[(i) / 16 * 4 + (i) % 4])));	\
+}
+
+// The library is built without optimization, vectors are spilled to memory at every step then
+__attribute__((optimize("O2")))
+static void md5_compress_x8(v8u* state, uint8_t** blocks) {
+	v8u m[16];
+	for(int k = 0; k < 16; k++) {
+		for(int lane = 0; lane < MD5_LANES; lane++)
+			m[k][lane] = ((uint32_t*)blocks[lane])[k];
+	}
+
+	v8u a = state[0];
+	v8u b = state[1];
+	v8u c = state[2];
+	v8u d = state[3];
+
+	for(int i = 0; i < 16; i += 4) {
+		MD5_STEP((b & c) | (~b & d), a, b, c, d, i, i);
+		MD5_STEP((a & b) | (~a & c), d, a, b, c, i + 1, i + 1);
+		MD5_STEP((d & a) | (~d & b), c, d, a, b, i + 2, i + 2);
+		MD5_STEP((c & d) | (~c & a), b, c, d, a, i + 3, i + 3);
+	}
+
+	for(int i = 16; i < 32; i += 4) {
+		MD5_STEP((b & d) | (c & ~d), a, b, c, d, (5 * i + 1) % 16, i);
+		MD5_STEP((a & c) | (b & ~c), d, a, b, c, (5 * i + 6) % 16, i + 1);
+		MD5_STEP((d & b) | (a & ~b), c, d, a, b, (5 * i + 11) % 16, i + 2);
+		MD5_STEP((c & a) | (d & ~a), b, c, d, a, (5 * i + 16) % 16, i + 3);
+	}
+
+	for(int i = 32; i < 48; i += 4) {
+		MD5_STEP(b ^ c ^ d, a, b, c, d, (3 * i + 5) % 16, i);
+		MD5_STEP(a ^ b ^ c, d, a, b, c, (3 * i + 8) % 16, i + 1);
+		MD5_STEP(d ^ a ^ b, c, d, a, b, (3 * i + 11) % 16, i + 2);
+		MD5_STEP(c ^ d ^ a, b, c, d, a, (3 * i + 14) % 16, i + 3);
+	}
+
+	for(int i = 48; i < 64; i += 4) {
+		MD5_STEP(c ^ (b | ~d), a, b, c, d, (7 * i) % 16, i);
+		MD5_STEP(b ^ (a | ~c), d, a, b, c, (7 * i + 7) % 16, i + 1);
+		MD5_STEP(a ^ (d | ~b), c, d, a, b, (7 * i + 14) % 16, i + 2);
+		MD5_STEP(d ^ (c | ~a), b, c, d, a, (7 * i + 21) % 16, i + 3);
+	}
+
+	state[0] += a;
+	state[1] += b;
+	state[2] += c;
+	state[3] += d;
+}
+
+void md5_x8(uint8_t** messages, int count, uint32_t len, uint32_t (*hashes)[4]) {
+	v8u state[4];
+	for(int lane = 0; lane < MD5_LANES; lane++) {
+		state[0][lane] = 0x67452301;
+		state[1][lane] = 0xEFCDAB89;
+		state[2][lane] = 0x98BADCFE;
+		state[3][lane] = 0x10325476;
+	}
+
+	// Unused lanes digest the first message again
+	uint8_t* blocks[MD5_LANES];
+	uint32_t i;
+	for(i = 0; i + 64 <= len; i += 64) {
+		for(int lane = 0; lane < MD5_LANES; lane++)
+			blocks[lane] = messages[lane < count ? lane : 0] + i;
+
+		md5_compress_x8(state, blocks);
+	}
+
+	// Padding is the same for every lane but the rest of the messages
+	uint32_t tails[MD5_LANES][32];
+	int rem = len - i;
+	int tail_size = rem + 1 + 8 <= 64 ? 64 : 128;
+	for(int lane = 0; lane < MD5_LANES; lane++) {
+		uint8_t* tail = (uint8_t*)tails[lane];
+		memcpy(tail, messages[lane < count ? lane : 0] + i, rem);
+		tail[rem] = 0x80;
+		memset(tail + rem + 1, 0, tail_size - rem - 1);
+		tails[lane][tail_size / 4 - 2] = len << 3;
+		tails[lane][tail_size / 4 - 1] = len >> 29;
+	}
+
+	for(int j = 0; j < tail_size; j += 64) {
+		for(int lane = 0; lane < MD5_LANES; lane++)
+			blocks[lane] = (uint8_t*)tails[lane] + j;
+
+		md5_compress_x8(state, blocks);
+	}
+
+	for(int lane = 0; lane < count; lane++) {
+		for(int k = 0; k < 4; k++)
+			hashes[lane][k] = state[k][lane];
+	}
+}
@@ -0,0 +1,288 @@
+#include <string.h>
+#include <net/pcap.h>
+
+#define PCAP_MAGIC		0xa1b2c3d4	///< Classic pcap in microseconds
+#define PCAP_MAGIC_NS		0xa1b23c4d	///< Classic pcap in nanoseconds
+#define PCAP_HEADER_LEN		24
+#define PCAP_RECORD_LEN		16
+
+#define PCAPNG_BYTE_ORDER	0x1a2b3c4d
+#define PCAPNG_SHB		0x0a0d0d0a	///< Section header block
+#define PCAPNG_IDB		0x00000001	///< Interface description block
+#define PCAPNG_SPB		0x00000003	///< Simple packet block
+#define PCAPNG_EPB		0x00000006	///< Enhanced packet block
+
+#define PCAPNG_OPT_END		0
+#define PCAPNG_OPT_TSRESOL	9		///< if_tsresol
+#define PCAPNG_OPT_FLAGS	2		///< epb_flags
+
+#define TSRESOL_US		6
+#define TSRESOL_NS		9
+
+static void put32(uint8_t* p, uint32_t v) {
+	memcpy(p, &v, 4);
+}
+
+static void put16(uint8_t* p, uint16_t v) {
+	memcpy(p, &v, 2);
+}
+
+size_t pcapng_header(void* buf, size_t size, uint32_t snaplen) {
+	uint8_t* p = buf;
+	if(size < PCAPNG_HEADER_SIZE)
+		return 0;
+
+	// Section header block, section length is unknown
+	put32(p, PCAPNG_SHB);
+	put32(p + 4, 28);
+	put32(p + 8, PCAPNG_BYTE_ORDER);
+	put16(p + 12, 1);
+	put16(p + 14, 0);
+	put32(p + 16, 0xffffffff);
+	put32(p + 20, 0xffffffff);
+	put32(p + 24, 28);
+	p += 28;
+
+	// Interface description block with if_tsresol of nanoseconds
+	put32(p, PCAPNG_IDB);
+	put32(p + 4, 32);
+	put16(p + 8, PCAP_LINKTYPE_ETHERNET);
+	put16(p + 10, 0);
+	put32(p + 12, snaplen);
+	put16(p + 16, PCAPNG_OPT_TSRESOL);
+	put16(p + 18, 1);
+	put32(p + 20, TSRESOL_NS);
+	put32(p + 24, PCAPNG_OPT_END);
+	put32(p + 28, 32);
+
+	return PCAPNG_HEADER_SIZE;
+}
+
+size_t pcapng_packet(void* buf, size_t size, uint64_t time, uint8_t direction,
+		const void* data, uint32_t caplen, uint32_t len) {
+	uint8_t* p = buf;
+	uint32_t block_len = PCAPNG_PACKET_SIZE(caplen);
+	uint32_t padded = (caplen + 3) & ~3;
+	if(size < block_len)
+		return 0;
+
+	put32(p, PCAPNG_EPB);
+	put32(p + 4, block_len);
+	put32(p + 8, 0);
+	put32(p + 12, time >> 32);
+	put32(p + 16, time & 0xffffffff);
+	put32(p + 20, caplen);
+	put32(p + 24, len);
+	memcpy(p + 28, data, caplen);
+	memset(p + 28 + caplen, 0, padded - caplen);
+	p += 28 + padded;
+
+	put16(p, PCAPNG_OPT_FLAGS);
+	put16(p + 2, 4);
+	put32(p + 4, direction & 0x3);
+	put32(p + 8, PCAPNG_OPT_END);
+	put32(p + 12, block_len);
+
+	return block_len;
+}
+
+static uint32_t get32(PcapReader* reader, const uint8_t* p) {
+	uint32_t v;
+	memcpy(&v, p, 4);
+
+	return reader->swap ? __builtin_bswap32(v) : v;
+}
+
+static uint16_t get16(PcapReader* reader, const uint8_t* p) {
+	uint16_t v;
+	memcpy(&v, p, 2);
+
+	return reader->swap ? __builtin_bswap16(v) : v;
+}
+
+/*
+ * Convert a timestamp of if_tsresol to nanoseconds. The MSB of if_tsresol
+ * tells a power of 2 from a power of 10.
+ */
+static uint64_t to_ns(uint64_t ts, uint8_t resolution) {
+	if(resolution & 0x80) {
+		int shift = resolution & 0x7f;
+		if(shift > 63)
+			return 0;
+
+		uint64_t mask = ((uint64_t)1 << shift) - 1;
+		return (ts >> shift) * 1000000000UL + (((ts & mask) * 1000000000UL) >> shift);
+	}
+
+	uint64_t ns = ts;
+	for(int i = resolution; i < TSRESOL_NS; i++)
+		ns *= 10;
+	for(int i = TSRESOL_NS; i < resolution; i++)
+		ns /= 10;
+
+	return ns;
+}
+
+bool pcap_reader_init(PcapReader* reader, const void* buf, size_t size) {
+	memset(reader, 0, sizeof(PcapReader));
+	reader->buf = buf;
+	reader->size = size;
+
+	if(size < PCAP_HEADER_LEN)
+		return false;
+
+	uint32_t magic;
+	memcpy(&magic, buf, 4);
+
+	if(magic == PCAPNG_SHB) {
+		uint32_t order;
+		memcpy(&order, reader->buf + 8, 4);
+		if(order != PCAPNG_BYTE_ORDER && order != __builtin_bswap32(PCAPNG_BYTE_ORDER))
+			return false;
+
+		// The rest of blocks including the section header are parsed by next
+		reader->is_ng = true;
+		reader->swap = order != PCAPNG_BYTE_ORDER;
+
+		return true;
+	}
+
+	reader->swap = magic == __builtin_bswap32(PCAP_MAGIC) || magic == __builtin_bswap32(PCAP_MAGIC_NS);
+	magic = reader->swap ? __builtin_bswap32(magic) : magic;
+	if(magic != PCAP_MAGIC && magic != PCAP_MAGIC_NS)
+		return false;
+
+	if(get32(reader, reader->buf + 20) != PCAP_LINKTYPE_ETHERNET)
+		return false;
+
+	reader->snaplen = get32(reader, reader->buf + 16);
+	reader->resolutions[0] = magic == PCAP_MAGIC_NS ? TSRESOL_NS : TSRESOL_US;
+	reader->interface_count = 1;
+	reader->offset = PCAP_HEADER_LEN;
+
+	return true;
+}
+
+static bool pcap_next(PcapReader* reader, PcapPacket* packet) {
+	if(reader->offset + PCAP_RECORD_LEN > reader->size)
+		return false;
+
+	const uint8_t* p = reader->buf + reader->offset;
+	uint32_t sec = get32(reader, p);
+	uint32_t frac = get32(reader, p + 4);
+	uint32_t caplen = get32(reader, p + 8);
+	uint32_t len = get32(reader, p + 12);
+
+	if(caplen == 0 || caplen > len || reader->offset + PCAP_RECORD_LEN + caplen > reader->size)
+		return false;
+
+	packet->time = (uint64_t)sec * 1000000000UL + to_ns(frac, reader->resolutions[0]);
+	packet->caplen = caplen;
+	packet->len = len;
+	packet->data = p + PCAP_RECORD_LEN;
+	reader->offset += PCAP_RECORD_LEN + caplen;
+
+	return true;
+}
+
+static void pcapng_interface(PcapReader* reader, const uint8_t* block, uint32_t block_len) {
+	if(reader->interface_count >= PCAP_MAX_INTERFACES)
+		return;
+
+	uint8_t resolution = TSRESOL_US;
+	uint32_t offset = 16;
+
+	// Options are followed by the trailing block length
+	while(offset + 4 <= block_len - 4) {
+		uint16_t code = get16(reader, block + offset);
+		uint16_t len = get16(reader, block + offset + 2);
+		if(code == PCAPNG_OPT_END)
+			break;
+
+		if(code == PCAPNG_OPT_TSRESOL && len == 1)
+			resolution = block[offset + 4];
+
+		offset += 4 + ((len + 3) & ~3);
+	}
+
+	if(get32(reader, block + 12) > reader->snaplen)
+		reader->snaplen = get32(reader, block + 12);
+
+	reader->resolutions[reader->interface_count++] = resolution;
+}
+
+static bool pcapng_next(PcapReader* reader, PcapPacket* packet) {
+	while(reader->offset + 12 <= reader->size) {
+		const uint8_t* block = reader->buf + reader->offset;
+		uint32_t type;
+		memcpy(&type, block, 4);
+
+		if(type == PCAPNG_SHB) {
+			// A new section may have another byte order and interfaces
+			uint32_t order;
+			memcpy(&order, block + 8, 4);
+			if(order != PCAPNG_BYTE_ORDER && order != __builtin_bswap32(PCAPNG_BYTE_ORDER))
+				return false;
+
+			reader->swap = order != PCAPNG_BYTE_ORDER;
+			reader->interface_count = 0;
+		}
+
+		type = get32(reader, block);
+		uint32_t block_len = get32(reader, block + 4);
+		if(block_len < 12 || block_len % 4 || reader->offset + block_len > reader->size)
+			return false;
+
+		reader->offset += block_len;
+
+		uint32_t interface;
+		uint32_t caplen;
+		uint32_t len;
+		uint64_t ts;
+
+		switch(type) {
+			case PCAPNG_IDB:
+				if(block_len >= 20)
+					pcapng_interface(reader, block, block_len);
+				break;
+			case PCAPNG_EPB:
+				if(block_len < 32)
+					return false;
+
+				interface = get32(reader, block + 8);
+				ts = (uint64_t)get32(reader, block + 12) << 32 | get32(reader, block + 16);
+				caplen = get32(reader, block + 20);
+				if((uint64_t)caplen + 28 > block_len - 4)
+					return false;
+
+				packet->time = to_ns(ts, interface < (uint32_t)reader->interface_count ?
+						reader->resolutions[interface] : TSRESOL_US);
+				packet->caplen = caplen;
+				packet->len = get32(reader, block + 24);
+				packet->data = block + 28;
+				return true;
+			case PCAPNG_SPB:
+				if(block_len < 16)
+					return false;
+
+				// Simple packets have no timestamp, they are sent back to back
+				len = get32(reader, block + 8);
+				caplen = len < block_len - 16 ? len : block_len - 16;
+
+				packet->time = 0;
+				packet->caplen = caplen;
+				packet->len = len;
+				packet->data = block + 12;
+				return true;
+		}
+	}
+
+	return false;
+}
+
+bool pcap_reader_next(PcapReader* reader, PcapPacket* packet) {
+	if(reader->is_ng)
+		return pcapng_next(reader, packet);
+	else
+		return pcap_next(reader, packet);
+}
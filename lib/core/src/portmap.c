@@ -0,0 +1,201 @@
+#include <string.h>
+#include <timer.h>
+#include <_malloc.h>
+#include <net/portmap.h>
+
+#define EPHEMERAL_COUNT	(PORTMAP_EPHEMERAL_MAX - PORTMAP_EPHEMERAL_MIN + 1)
+
+static uint64_t portmap_random(PortMap* portmap) {
+	// xorshift64*
+	uint64_t x = portmap->seed;
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	portmap->seed = x;
+
+	return x * 0x2545f4914f6cdd1dULL;
+}
+
+static uint64_t portmap_hash(uint64_t key, uint32_t saddr, uint32_t daddr, uint16_t dport) {
+	uint64_t h = key ^ ((uint64_t)saddr << 32 | daddr);
+	h ^= (uint64_t)dport * 0x9e3779b97f4a7c15ULL;
+
+	// MurmurHash3 finalizer
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+
+	return h;
+}
+
+static bool rdrand(uint64_t* value) {
+	uint32_t eax, ebx, ecx, edx;
+	asm volatile("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(1), "c"(0));
+	if(!(ecx & (1 << 30)))
+		return false;
+
+	// It may fail transiently when the entropy source is drained
+	for(int i = 0; i < 10; i++) {
+		uint8_t ok;
+		asm volatile("rdrand %0; setc %1" : "=r"(*value), "=qm"(ok));
+		if(ok)
+			return true;
+	}
+
+	return false;
+}
+
+/*
+ * Secret key of RFC 6056, from RDRAND if the CPU has it. Otherwise the
+ * jitter of the TSC over cpuid, which is serializing and takes a varying
+ * number of cycles, is accumulated.
+ */
+static uint64_t portmap_entropy() {
+	uint64_t value;
+	if(rdrand(&value))
+		return value;
+
+	value = 0;
+	for(int i = 0; i < 64; i++) {
+		uint32_t eax, ebx, ecx, edx;
+		asm volatile("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(0), "c"(0));
+		value = portmap_hash(value, (uint32_t)timer_frequency(), eax, i);
+	}
+
+	return value;
+}
+
+PortMap* portmap_create(void* pool) {
+	PortMap* portmap = __malloc(sizeof(PortMap), pool);
+	if(!portmap)
+		return NULL;
+
+	memset(portmap, 0x0, sizeof(PortMap));
+	portmap->pool = pool;
+
+	portmap->seed = portmap_entropy();
+	if(!portmap->seed)
+		portmap->seed = 0x9e3779b97f4a7c15ULL;
+
+	portmap->secret = portmap_random(portmap);
+	for(int i = 0; i < PORTMAP_TABLE_SIZE; i++)
+		portmap->table[i] = (uint16_t)portmap_random(portmap);
+
+	return portmap;
+}
+
+void portmap_destroy(PortMap* portmap) {
+	__free(portmap, portmap->pool);
+}
+
+static inline void portmap_set(PortMap* portmap, uint16_t port) {
+	uint32_t word = port >> 6;
+	portmap->bitmap[word] |= (uint64_t)1 << (port & 63);
+	if(portmap->bitmap[word] == UINT64_MAX)
+		portmap->full[word >> 6] |= (uint64_t)1 << (word & 63);
+
+	portmap->size++;
+}
+
+/**
+ * Find the first free port in [from, to] by tzcnt over the bitmap and summary.
+ *
+ * @return port number or -1 if there is no free port in the range
+ */
+static int32_t portmap_find(PortMap* portmap, uint32_t from, uint32_t to) {
+	uint32_t word = from >> 6;
+	uint64_t free = ~portmap->bitmap[word] & (UINT64_MAX << (from & 63));
+	if(free) {
+		uint32_t port = (word << 6) + __builtin_ctzll(free);
+		return port <= to ? (int32_t)port : -1;
+	}
+
+	uint32_t last = to >> 6;
+	word++;
+	while(word <= last) {
+		uint32_t summary = word >> 6;
+		uint64_t available = ~portmap->full[summary] & (UINT64_MAX << (word & 63));
+		if(available) {
+			word = (summary << 6) + __builtin_ctzll(available);
+			if(word > last)
+				return -1;
+
+			uint32_t port = (word << 6) + __builtin_ctzll(~portmap->bitmap[word]);
+			return port <= to ? (int32_t)port : -1;
+		}
+
+		word = (summary + 1) << 6;
+	}
+
+	return -1;
+}
+
+/**
+ * Find a free ephemeral port from start, wrapping around the ephemeral range.
+ */
+static int32_t portmap_find_ephemeral(PortMap* portmap, uint32_t start) {
+	int32_t port = portmap_find(portmap, start, PORTMAP_EPHEMERAL_MAX);
+	if(port < 0 && start > PORTMAP_EPHEMERAL_MIN)
+		port = portmap_find(portmap, PORTMAP_EPHEMERAL_MIN, start - 1);
+
+	return port;
+}
+
+bool portmap_alloc0(PortMap* portmap, uint16_t port) {
+	if(portmap_contains(portmap, port))
+		return false;
+
+	portmap_set(portmap, port);
+
+	return true;
+}
+
+uint16_t portmap_alloc(PortMap* portmap) {
+	uint32_t start = PORTMAP_EPHEMERAL_MIN + portmap_random(portmap) % EPHEMERAL_COUNT;
+	int32_t port = portmap_find_ephemeral(portmap, start);
+	if(port < 0)
+		return 0;
+
+	portmap_set(portmap, port);
+
+	return port;
+}
+
+uint16_t portmap_alloc_dst(PortMap* portmap, uint32_t saddr, uint32_t daddr, uint16_t dport) {
+	uint32_t offset = portmap_hash(portmap->secret, saddr, daddr, dport);
+	uint32_t index = portmap_hash(~portmap->secret, saddr, daddr, dport) % PORTMAP_TABLE_SIZE;
+
+	uint32_t start = PORTMAP_EPHEMERAL_MIN + (offset + portmap->table[index]) % EPHEMERAL_COUNT;
+	int32_t port = portmap_find_ephemeral(portmap, start);
+	if(port < 0)
+		return 0;
+
+	// Skip the ports tested, as if they were probed one by one
+	uint32_t distance = (uint32_t)port >= start ? port - start : port + EPHEMERAL_COUNT - start;
+	portmap->table[index] += distance + 1;
+
+	portmap_set(portmap, port);
+
+	return port;
+}
+
+void portmap_free(PortMap* portmap, uint16_t port) {
+	if(!portmap_contains(portmap, port))
+		return;
+
+	uint32_t word = port >> 6;
+	portmap->full[word >> 6] &= ~((uint64_t)1 << (word & 63));
+	portmap->bitmap[word] &= ~((uint64_t)1 << (port & 63));
+
+	portmap->size--;
+}
+
+bool portmap_contains(PortMap* portmap, uint16_t port) {
+	return !!(portmap->bitmap[port >> 6] & ((uint64_t)1 << (port & 63)));
+}
+
+uint32_t portmap_size(PortMap* portmap) {
+	return portmap->size;
+}
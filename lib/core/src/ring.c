@@ -13,8 +13,9 @@ ssize_t ring_write(char* buf, size_t head, volatile size_t* tail, size_t size, c
 		
 		return len0;
 	} else {
-		size_t len1 = size - *tail;
-		size_t len2 = head;
+		// A byte is left empty not to look like an empty ring
+		size_t len1 = head == 0 ? size - *tail - 1 : size - *tail;
+		size_t len2 = head == 0 ? 0 : head - 1;
 		
 		if(len1 >= len) {
 			len1 = len;
@@ -67,5 +68,5 @@ size_t ring_readable(size_t head, size_t tail, size_t size) {
 }
 
 size_t ring_writable(size_t head, size_t tail, size_t size) {
-	return tail < head ? head - tail - 1 : size - tail + head;
+	return tail < head ? head - tail - 1 : size - tail + head - 1;
 }
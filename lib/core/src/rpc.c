@@ -198,12 +198,101 @@ if((VALUE) <= 0) {			\
 	return;				\
 }
 
+// Client API sends a request, its response is delivered to callback
+#define REQUEST(TYPE)			\
+	uint32_t _id = request_id(rpc);	\
+	if(!_id)			\
+		return 0;		\
+	WRITE(write_header(rpc, (TYPE), _id));
+
+#define PENDING(CALLBACK, CONTEXT)	\
+	request_add(rpc, _id, (CALLBACK), (CONTEXT));
+
 #define RETURN2()			\
 if(rpc->wbuf_index > 0 && rpc->write && wbuf_flush(rpc) < 0 && rpc->close) {	\
 	rpc->close(rpc);							\
 	return;									\
 }
 
+#define HEADER_SIZE	(sizeof(uint16_t) + sizeof(uint32_t))
+
+static int write_header(RPC* rpc, uint16_t type, uint32_t id) {
+	if(rpc->wbuf_index + HEADER_SIZE > RPC_BUFFER_SIZE)
+		return 0;
+	
+	write_uint16(rpc, type);
+	write_uint32(rpc, id);
+	
+	return HEADER_SIZE;
+}
+
+static int read_header(RPC* rpc, uint16_t* type, uint32_t* id) {
+	int len = read_uint16(rpc, type);
+	if(len <= 0)
+		return len;
+	
+	int len2 = read_uint32(rpc, id);
+	if(len2 <= 0) {
+		rpc->rbuf_read -= len;
+		return len2;
+	}
+	
+	return len + len2;
+}
+
+/*
+ * Next request ID, 0 if its slot is still waiting for a response
+ */
+static uint32_t request_id(RPC* rpc) {
+	if(rpc->request_next == 0)
+		rpc->request_next = 1;
+	
+	if(rpc->requests[rpc->request_next % RPC_MAX_REQUESTS].id)
+		return 0;
+	
+	return rpc->request_next;
+}
+
+static void request_add(RPC* rpc, uint32_t id, void* callback, void* context) {
+	RPCRequest* request = &rpc->requests[id % RPC_MAX_REQUESTS];
+	request->id = id;
+	request->callback = callback;
+	request->context = context;
+	
+	rpc->request_count++;
+	rpc->request_next = id + 1;
+}
+
+/*
+ * Callback of the request the response is for, NULL if it's unknown. The
+ * request keeps waiting for more responses.
+ */
+static void* request_get(RPC* rpc, void** context) {
+	RPCRequest* request = &rpc->requests[rpc->request_id % RPC_MAX_REQUESTS];
+	if(rpc->request_id == 0 || request->id != rpc->request_id)
+		return NULL;
+	
+	*context = request->context;
+	
+	return request->callback;
+}
+
+/*
+ * Same as request_get, but the request is done
+ */
+static void* request_remove(RPC* rpc, void** context) {
+	RPCRequest* request = &rpc->requests[rpc->request_id % RPC_MAX_REQUESTS];
+	if(rpc->request_id == 0 || request->id != rpc->request_id)
+		return NULL;
+	
+	// A request without callback is done as well
+	void* callback = request_get(rpc, context);
+	request->id = 0;
+	rpc->request_count--;
+	
+	return callback;
+}
+
 static int write_vm(RPC* rpc, VMSpec* vm) {
 	INIT();
 	
@@ -228,6 +317,7 @@ static int write_vm(RPC* rpc, VMSpec* vm) {
 		WRITE(write_uint8(rpc, vm->nics[i].padding_head));
 		WRITE(write_uint8(rpc, vm->nics[i].padding_tail));
 		WRITE(write_uint32(rpc, vm->nics[i].pool_size));
+		WRITE(write_uint16(rpc, vm->nics[i].vlan));
 	}
 	
 	WRITE(write_uint16(rpc, vm->argc));
@@ -289,6 +379,7 @@ static int read_vm(RPC* rpc, VMSpec** vm2) {
 		READ2(read_uint8(rpc, &vm->nics[i].padding_head), failed);
 		READ2(read_uint8(rpc, &vm->nics[i].padding_tail), failed);
 		READ2(read_uint32(rpc, &vm->nics[i].pool_size), failed);
+		READ2(read_uint16(rpc, &vm->nics[i].vlan), failed);
 	}
 	
 	READ2(read_uint16(rpc, &vm->argc), failed);
@@ -353,21 +444,20 @@ static int wbuf_flush(RPC* rpc) {
 int rpc_hello(RPC* rpc, bool(*callback)(void* context), void* context) {
 	INIT();
 	
-	WRITE(write_uint16(rpc, RPC_TYPE_HELLO_REQ));
+	REQUEST(RPC_TYPE_HELLO_REQ);
 	WRITE(write_string(rpc, RPC_MAGIC));
 	WRITE(write_uint32(rpc, RPC_VERSION));
 	
-	rpc->hello_callback = callback;
-	rpc->hello_context = context;
+	PENDING(callback, context);
 	
 	RETURN();
 }
 
 static int hello_res_handler(RPC* rpc) {
-	if(rpc->hello_callback && !rpc->hello_callback(rpc->hello_context)) {
-		rpc->hello_callback = NULL;
-		rpc->hello_context = NULL;
-	}
+	void* context;
+	bool(*callback)(void*) = request_remove(rpc, &context);
+	if(callback)
+		callback(context);
 	
 	return 1;
 }
@@ -395,7 +485,7 @@ static int hello_req_handler(RPC* rpc) {
 		return -1;
 	}
 	
-	WRITE(write_uint16(rpc, RPC_TYPE_HELLO_RES));
+	WRITE(write_header(rpc, RPC_TYPE_HELLO_RES, rpc->request_id));
 	
 	RETURN();
 }
@@ -404,11 +494,10 @@ static int hello_req_handler(RPC* rpc) {
 int rpc_vm_create(RPC* rpc, VMSpec* vm, bool(*callback)(uint32_t id, void* context), void* context) {
 	INIT();
 	
-	WRITE(write_uint16(rpc, RPC_TYPE_VM_CREATE_REQ));
+	REQUEST(RPC_TYPE_VM_CREATE_REQ);
 	WRITE(write_vm(rpc, vm));
 	
-	rpc->vm_create_callback = callback;
-	rpc->vm_create_context = context;
+	PENDING(callback, context);
 	
 	RETURN();
 }
@@ -419,10 +508,10 @@ static int vm_create_res_handler(RPC* rpc) {
 	uint32_t id;
 	READ(read_uint32(rpc, &id));
 	
-	if(rpc->vm_create_callback && !rpc->vm_create_callback(id, rpc->vm_create_context)) {
-		rpc->vm_create_callback = NULL;
-		rpc->vm_create_context = NULL;
-	}
+	void* context;
+	bool(*callback)(uint32_t id, void* context) = request_remove(rpc, &context);
+	if(callback)
+		callback(id, context);
 	
 	RETURN();
 }
@@ -437,7 +526,7 @@ void rpc_vm_create_handler(RPC* rpc, void(*handler)(RPC* rpc, VMSpec* vm, void*
 static void vm_create_handler_callback(RPC* rpc, uint32_t id) {
 	INIT2();
 	
-	WRITE2(write_uint16(rpc, RPC_TYPE_VM_CREATE_RES));
+	WRITE2(write_header(rpc, RPC_TYPE_VM_CREATE_RES, rpc->request_id));
 	WRITE2(write_uint32(rpc, id));
 	
 	RETURN2();
@@ -465,11 +554,10 @@ static int vm_create_req_handler(RPC* rpc) {
 int rpc_vm_get(RPC* rpc, uint32_t id, bool(*callback)(VMSpec* vm, void* context), void* context) {
 	INIT();
 	
-	WRITE(write_uint16(rpc, RPC_TYPE_VM_GET_REQ));
+	REQUEST(RPC_TYPE_VM_GET_REQ);
 	WRITE(write_uint32(rpc, id));
 	
-	rpc->vm_get_callback = callback;
-	rpc->vm_get_context = context;
+	PENDING(callback, context);
 	
 	RETURN();
 }
@@ -480,10 +568,10 @@ static int vm_get_res_handler(RPC* rpc) {
 	VMSpec* vm;
 	READ(read_vm(rpc, &vm));
 	
-	if(rpc->vm_get_callback && !rpc->vm_get_callback(vm, rpc->vm_get_context)) {
-		rpc->vm_get_callback = NULL;
-		rpc->vm_get_context = NULL;
-	}
+	void* context;
+	bool(*callback)(VMSpec* vm, void* context) = request_remove(rpc, &context);
+	if(callback)
+		callback(vm, context);
 	
 	if(vm)
 		vm_free(vm);
@@ -500,7 +588,7 @@ void rpc_vm_get_handler(RPC* rpc, void(*handler)(RPC* rpc, uint32_t id, void* co
 static void vm_get_handler_callback(RPC* rpc, VMSpec* vm) {
 	INIT2();
 	
-	WRITE2(write_uint16(rpc, RPC_TYPE_VM_GET_RES));
+	WRITE2(write_header(rpc, RPC_TYPE_VM_GET_RES, rpc->request_id));
 	WRITE2(write_vm(rpc, vm));
 	
 	RETURN2();
@@ -525,11 +613,10 @@ static int vm_get_req_handler(RPC* rpc) {
 int rpc_vm_set(RPC* rpc, VMSpec* vm, bool(*callback)(bool result, void* context), void* context) {
 	INIT();
 	
-	WRITE(write_uint16(rpc, RPC_TYPE_VM_SET_REQ));
+	REQUEST(RPC_TYPE_VM_SET_REQ);
 	WRITE(write_vm(rpc, vm));
 	
-	rpc->vm_set_callback = callback;
-	rpc->vm_set_context = context;
+	PENDING(callback, context);
 	
 	RETURN();
 }
@@ -540,10 +627,10 @@ static int vm_set_res_handler(RPC* rpc) {
 	bool result;
 	READ(read_bool(rpc, &result));
 	
-	if(rpc->vm_set_callback && !rpc->vm_set_callback(result, rpc->vm_set_context)) {
-		rpc->vm_set_callback = NULL;
-		rpc->vm_set_context = NULL;
-	}
+	void* context;
+	bool(*callback)(bool result, void* context) = request_remove(rpc, &context);
+	if(callback)
+		callback(result, context);
 	
 	RETURN();
 }
@@ -557,7 +644,7 @@ void rpc_vm_set_handler(RPC* rpc, void(*handler)(RPC* rpc, VMSpec* vm, void* con
 static void vm_set_handler_callback(RPC* rpc, bool result) {
 	INIT2();
 	
-	WRITE2(write_uint16(rpc, RPC_TYPE_VM_SET_RES));
+	WRITE2(write_header(rpc, RPC_TYPE_VM_SET_RES, rpc->request_id));
 	WRITE2(write_bool(rpc, result));
 	
 	RETURN2();
@@ -585,11 +672,10 @@ static int vm_set_req_handler(RPC* rpc) {
 int rpc_vm_destroy(RPC* rpc, uint32_t id, bool(*callback)(bool result, void* context), void* context) {
 	INIT();
 	
-	WRITE(write_uint16(rpc, RPC_TYPE_VM_DELETE_REQ));
+	REQUEST(RPC_TYPE_VM_DELETE_REQ);
 	WRITE(write_uint32(rpc, id));
 	
-	rpc->vm_destroy_callback = callback;
-	rpc->vm_destroy_context = context;
+	PENDING(callback, context);
 	
 	RETURN();
 }
@@ -600,10 +686,10 @@ static int vm_destroy_res_handler(RPC* rpc) {
 	bool result = false;
 	READ(read_bool(rpc, &result));
 	
-	if(rpc->vm_destroy_callback && !rpc->vm_destroy_callback(result, rpc->vm_destroy_context)) {
-		rpc->vm_destroy_callback = NULL;
-		rpc->vm_destroy_context = NULL;
-	}
+	void* context;
+	bool(*callback)(bool result, void* context) = request_remove(rpc, &context);
+	if(callback)
+		callback(result, context);
 	
 	RETURN();
 }
@@ -617,7 +703,7 @@ void rpc_vm_destroy_handler(RPC* rpc, void(*handler)(RPC* rpc, uint32_t id, void
 static void vm_destroy_handler_callback(RPC* rpc, bool result) {
 	INIT2();
 	
-	WRITE2(write_uint16(rpc, RPC_TYPE_VM_DELETE_RES));
+	WRITE2(write_header(rpc, RPC_TYPE_VM_DELETE_RES, rpc->request_id));
 	WRITE2(write_bool(rpc, result));
 	
 	RETURN2();
@@ -642,10 +728,9 @@ static int vm_destroy_req_handler(RPC* rpc) {
 int rpc_vm_list(RPC* rpc, bool(*callback)(uint32_t* ids, uint16_t count, void* context), void* context) {
 	INIT();
 	
-	WRITE(write_uint16(rpc, RPC_TYPE_VM_LIST_REQ));
+	REQUEST(RPC_TYPE_VM_LIST_REQ);
 	
-	rpc->vm_list_callback = callback;
-	rpc->vm_list_context = context;
+	PENDING(callback, context);
 	
 	RETURN();
 }
@@ -657,10 +742,10 @@ static int vm_list_res_handler(RPC* rpc) {
 	uint32_t* list;
 	READ(read_bytes(rpc, (void**)&list, &size));
 	
-	if(rpc->vm_list_callback && !rpc->vm_list_callback(list, (size < 0 ? 0 : size) / sizeof(uint32_t), rpc->vm_list_context)) {
-		rpc->vm_list_callback = NULL;
-		rpc->vm_list_context = NULL;
-	}
+	void* context;
+	bool(*callback)(uint32_t* ids, uint16_t count, void* context) = request_remove(rpc, &context);
+	if(callback)
+		callback(list, (size < 0 ? 0 : size) / sizeof(uint32_t), context);
 	
 	RETURN();
 }
@@ -674,7 +759,7 @@ void rpc_vm_list_handler(RPC* rpc, void(*handler)(RPC* rpc, int size, void* cont
 static void vm_list_handler_callback(RPC* rpc, uint32_t* ids, int size) {
 	INIT2();
 	
-	WRITE2(write_uint16(rpc, RPC_TYPE_VM_LIST_RES));
+	WRITE2(write_header(rpc, RPC_TYPE_VM_LIST_RES, rpc->request_id));
 	WRITE2(write_bytes(rpc, ids, sizeof(uint32_t) * size));
 	
 	RETURN2();
@@ -698,11 +783,10 @@ static int vm_list_req_handler(RPC* rpc) {
 int rpc_status_get(RPC* rpc, uint32_t id, bool(*callback)(VMStatus status, void* context), void* context) {
 	INIT();
 	
-	WRITE(write_uint16(rpc, RPC_TYPE_STATUS_GET_REQ));
+	REQUEST(RPC_TYPE_STATUS_GET_REQ);
 	WRITE(write_uint32(rpc, id));
 	
-	rpc->status_get_callback = callback;
-	rpc->status_get_context = context;
+	PENDING(callback, context);
 	
 	RETURN();
 }
@@ -713,10 +797,10 @@ static int status_get_res_handler(RPC* rpc) {
 	uint32_t status;
 	READ(read_uint32(rpc, &status));
 	
-	if(rpc->status_get_callback && !rpc->status_get_callback(status, rpc->status_get_context)) {
-		rpc->status_get_callback = NULL;
-		rpc->status_get_context = NULL;
-	}
+	void* context;
+	bool(*callback)(VMStatus status, void* context) = request_remove(rpc, &context);
+	if(callback)
+		callback(status, context);
 	
 	RETURN();
 }
@@ -730,7 +814,7 @@ void rpc_storage_md5_handler(RPC* rpc, void(*handler)(RPC* rpc, uint32_t id, uin
 static void storage_md5_handler_callback(RPC* rpc, bool result, uint32_t md5[]) {
 		INIT2();
 		
-		WRITE2(write_uint16(rpc, RPC_TYPE_STORAGE_MD5_RES));
+		WRITE2(write_header(rpc, RPC_TYPE_STORAGE_MD5_RES, rpc->request_id));
 		WRITE2(write_bool(rpc, result));
 		for(int i = 0; i < 4; i++) {
 			if(md5) {
@@ -752,7 +836,7 @@ static int storage_md5_req_handler(RPC* rpc) {
 	READ(read_uint64(rpc, &size));
 	
 	if(rpc->status_get_handler) {
-		rpc->storage_md5_handler(rpc, id, size, rpc->storage_md5_context, storage_md5_handler_callback);
+		rpc->storage_md5_handler(rpc, id, size, rpc->storage_md5_handler_context, storage_md5_handler_callback);
 	} else {
 		storage_md5_handler_callback(rpc, false, NULL);
 	}
@@ -764,12 +848,15 @@ static int storage_md5_req_handler(RPC* rpc) {
 void rpc_storage_md5(RPC* rpc, uint32_t id, uint64_t size, bool(*callback)(bool result, uint32_t md5[], void* context), void* context) {
 	INIT();
 	
-	WRITE2(write_uint16(rpc, RPC_TYPE_STORAGE_MD5_REQ));
+	uint32_t _id = request_id(rpc);
+	if(!_id)
+		return;
+	
+	WRITE2(write_header(rpc, RPC_TYPE_STORAGE_MD5_REQ, _id));
 	WRITE2(write_uint32(rpc, id));
 	WRITE2(write_uint64(rpc, size));
 	
-	rpc->storage_md5_callback = callback;
-	rpc->storage_md5_context = context;
+	PENDING(callback, context);
 	
 	RETURN2();
 }
@@ -785,10 +872,10 @@ static int storage_md5_res_handler(RPC* rpc) {
 		READ(read_uint32(rpc, &md5[i]));
 	}
 
-	if(rpc->storage_md5_callback && !rpc->storage_md5_callback(result, md5, rpc->storage_md5_context)) {
-		rpc->storage_md5_callback = NULL;
-		rpc->storage_md5_context = NULL;
-	}
+	void* context;
+	bool(*callback)(bool result, uint32_t md5[], void* context) = request_remove(rpc, &context);
+	if(callback)
+		callback(result, md5, context);
 
 	RETURN();
 }
@@ -802,7 +889,7 @@ void rpc_status_get_handler(RPC* rpc, void(*handler)(RPC* rpc, uint32_t id, void
 static void status_get_handler_callback(RPC* rpc, VMStatus status) {
 	INIT2();
 	
-	WRITE2(write_uint16(rpc, RPC_TYPE_STATUS_GET_RES));
+	WRITE2(write_header(rpc, RPC_TYPE_STATUS_GET_RES, rpc->request_id));
 	WRITE2(write_uint32(rpc, status));
 	
 	RETURN2();
@@ -827,12 +914,11 @@ static int status_get_req_handler(RPC* rpc) {
 int rpc_status_set(RPC* rpc, uint32_t id, VMStatus status, bool(*callback)(bool result, void* context), void* context) {
 	INIT();
 	
-	WRITE(write_uint16(rpc, RPC_TYPE_STATUS_SET_REQ));
+	REQUEST(RPC_TYPE_STATUS_SET_REQ);
 	WRITE(write_uint32(rpc, id));
 	WRITE(write_uint32(rpc, (uint32_t)status));
 	
-	rpc->status_set_callback = callback;
-	rpc->status_set_context = context;
+	PENDING(callback, context);
 	
 	RETURN();
 }
@@ -843,10 +929,10 @@ static int status_set_res_handler(RPC* rpc) {
 	bool result = false;
 	READ(read_bool(rpc, &result));
 	
-	if(rpc->status_set_callback && !rpc->status_set_callback(result, rpc->status_set_context)) {
-		rpc->status_set_callback = NULL;
-		rpc->status_set_context = NULL;
-	}
+	void* context;
+	bool(*callback)(bool result, void* context) = request_remove(rpc, &context);
+	if(callback)
+		callback(result, context);
 	
 	RETURN();
 }
@@ -860,7 +946,7 @@ void rpc_status_set_handler(RPC* rpc, void(*handler)(RPC* rpc, uint32_t id, VMSt
 static void status_set_handler_callback(RPC* rpc, bool result) {
 	INIT2();
 	
-	WRITE2(write_uint16(rpc, RPC_TYPE_STATUS_SET_RES));
+	WRITE2(write_header(rpc, RPC_TYPE_STATUS_SET_RES, rpc->request_id));
 	WRITE2(write_bool(rpc, result));
 	
 	RETURN2();
@@ -884,11 +970,216 @@ static int status_set_req_handler(RPC* rpc) {
 	RETURN();
 }
 
+// vm_create_batch client API
+int rpc_vm_create_batch(RPC* rpc, VMSpec** vms, int count, bool(*callback)(uint32_t* ids, int count, void* context), void* context) {
+	INIT();
+	
+	if(count < 0 || count > RPC_MAX_BATCH)
+		return -1;
+	
+	REQUEST(RPC_TYPE_VM_CREATE_BATCH_REQ);
+	WRITE(write_uint16(rpc, count));
+	for(int i = 0; i < count; i++) {
+		WRITE(write_vm(rpc, vms[i]));
+	}
+	
+	PENDING(callback, context);
+	
+	RETURN();
+}
+
+static int vm_create_batch_res_handler(RPC* rpc) {
+	INIT();
+	
+	void* ids;
+	int32_t len;
+	READ(read_bytes(rpc, &ids, &len));
+	
+	void* context;
+	bool(*callback)(uint32_t* ids, int count, void* context) = request_remove(rpc, &context);
+	if(callback)
+		callback(ids, len / sizeof(uint32_t), context);
+	
+	RETURN();
+}
+
+// vm_create_batch server API
+void rpc_vm_create_batch_handler(RPC* rpc, void(*handler)(RPC* rpc, VMSpec** vms, int count, void* context, void(*callback)(RPC* rpc, uint32_t* ids, int count)), void* context) {
+	rpc->vm_create_batch_handler = handler;
+	rpc->vm_create_batch_handler_context = context;
+}
+
+static void vm_create_batch_handler_callback(RPC* rpc, uint32_t* ids, int count) {
+	INIT2();
+	
+	WRITE2(write_header(rpc, RPC_TYPE_VM_CREATE_BATCH_RES, rpc->request_id));
+	WRITE2(write_bytes(rpc, ids, sizeof(uint32_t) * count));
+	
+	RETURN2();
+}
+
+static int vm_create_batch_req_handler(RPC* rpc) {
+	INIT();
+	
+	uint16_t count;
+	READ(read_uint16(rpc, &count));
+	if(count > RPC_MAX_BATCH)
+		return -1;
+	
+	VMSpec* vms[RPC_MAX_BATCH] = { NULL, };
+	
+	void failed() {
+		for(int i = 0; i < count; i++) {
+			if(vms[i])
+				vm_free(vms[i]);
+		}
+	}
+	
+	for(int i = 0; i < count; i++) {
+		READ2(read_vm(rpc, &vms[i]), failed);
+	}
+	
+	if(rpc->vm_create_batch_handler) {
+		rpc->vm_create_batch_handler(rpc, vms, count, rpc->vm_create_batch_handler_context, vm_create_batch_handler_callback);
+	} else {
+		uint32_t ids[RPC_MAX_BATCH] = { 0, };
+		vm_create_batch_handler_callback(rpc, ids, count);
+	}
+	
+	failed();
+	
+	RETURN();
+}
+
+/*
+ * Per-VM results of status_set_batch and vm_destroy_batch
+ */
+static int results_res_handler(RPC* rpc) {
+	INIT();
+	
+	void* results;
+	int32_t len;
+	READ(read_bytes(rpc, &results, &len));
+	
+	void* context;
+	bool(*callback)(bool* results, int count, void* context) = request_remove(rpc, &context);
+	if(callback)
+		callback(results, len / sizeof(bool), context);
+	
+	RETURN();
+}
+
+// status_set_batch client API
+int rpc_status_set_batch(RPC* rpc, uint32_t* ids, int count, VMStatus status, bool(*callback)(bool* results, int count, void* context), void* context) {
+	INIT();
+	
+	if(count < 0 || count > RPC_MAX_BATCH)
+		return -1;
+	
+	REQUEST(RPC_TYPE_STATUS_SET_BATCH_REQ);
+	WRITE(write_uint32(rpc, (uint32_t)status));
+	WRITE(write_bytes(rpc, ids, sizeof(uint32_t) * count));
+	
+	PENDING(callback, context);
+	
+	RETURN();
+}
+
+// status_set_batch server API
+void rpc_status_set_batch_handler(RPC* rpc, void(*handler)(RPC* rpc, uint32_t* ids, int count, VMStatus status, void* context, void(*callback)(RPC* rpc, bool* results, int count)), void* context) {
+	rpc->status_set_batch_handler = handler;
+	rpc->status_set_batch_handler_context = context;
+}
+
+static void status_set_batch_handler_callback(RPC* rpc, bool* results, int count) {
+	INIT2();
+	
+	WRITE2(write_header(rpc, RPC_TYPE_STATUS_SET_BATCH_RES, rpc->request_id));
+	WRITE2(write_bytes(rpc, results, sizeof(bool) * count));
+	
+	RETURN2();
+}
+
+static int status_set_batch_req_handler(RPC* rpc) {
+	INIT();
+	
+	uint32_t status;
+	READ(read_uint32(rpc, &status));
+	
+	void* ids;
+	int32_t len;
+	READ(read_bytes(rpc, &ids, &len));
+	
+	int count = len / sizeof(uint32_t);
+	if(count > RPC_MAX_BATCH)
+		return -1;
+	
+	if(rpc->status_set_batch_handler) {
+		rpc->status_set_batch_handler(rpc, ids, count, status, rpc->status_set_batch_handler_context, status_set_batch_handler_callback);
+	} else {
+		bool results[RPC_MAX_BATCH] = { false, };
+		status_set_batch_handler_callback(rpc, results, count);
+	}
+	
+	RETURN();
+}
+
+// vm_destroy_batch client API
+int rpc_vm_destroy_batch(RPC* rpc, uint32_t* ids, int count, bool(*callback)(bool* results, int count, void* context), void* context) {
+	INIT();
+	
+	if(count < 0 || count > RPC_MAX_BATCH)
+		return -1;
+	
+	REQUEST(RPC_TYPE_VM_DESTROY_BATCH_REQ);
+	WRITE(write_bytes(rpc, ids, sizeof(uint32_t) * count));
+	
+	PENDING(callback, context);
+	
+	RETURN();
+}
+
+// vm_destroy_batch server API
+void rpc_vm_destroy_batch_handler(RPC* rpc, void(*handler)(RPC* rpc, uint32_t* ids, int count, void* context, void(*callback)(RPC* rpc, bool* results, int count)), void* context) {
+	rpc->vm_destroy_batch_handler = handler;
+	rpc->vm_destroy_batch_handler_context = context;
+}
+
+static void vm_destroy_batch_handler_callback(RPC* rpc, bool* results, int count) {
+	INIT2();
+	
+	WRITE2(write_header(rpc, RPC_TYPE_VM_DESTROY_BATCH_RES, rpc->request_id));
+	WRITE2(write_bytes(rpc, results, sizeof(bool) * count));
+	
+	RETURN2();
+}
+
+static int vm_destroy_batch_req_handler(RPC* rpc) {
+	INIT();
+	
+	void* ids;
+	int32_t len;
+	READ(read_bytes(rpc, &ids, &len));
+	
+	int count = len / sizeof(uint32_t);
+	if(count > RPC_MAX_BATCH)
+		return -1;
+	
+	if(rpc->vm_destroy_batch_handler) {
+		rpc->vm_destroy_batch_handler(rpc, ids, count, rpc->vm_destroy_batch_handler_context, vm_destroy_batch_handler_callback);
+	} else {
+		bool results[RPC_MAX_BATCH] = { false, };
+		vm_destroy_batch_handler_callback(rpc, results, count);
+	}
+	
+	RETURN();
+}
+
 // storage_download client API
 int rpc_storage_download(RPC* rpc, uint32_t id, uint64_t size, int32_t(*callback)(uint32_t offset, void* buf, int32_t size, void* context), void* context) {
 	INIT();
 	
-	WRITE(write_uint16(rpc, RPC_TYPE_STORAGE_DOWNLOAD_REQ));
+	WRITE(write_header(rpc, RPC_TYPE_STORAGE_DOWNLOAD_REQ, 0));
 	WRITE(write_uint32(rpc, id));
 	WRITE(write_uint64(rpc, size));
 	
@@ -941,13 +1232,13 @@ static void storage_download_handler_callback(RPC* rpc, void* buf, int32_t size)
 	INIT2();
 	
 	if(size > 0) {
-		WRITE2(write_uint16(rpc, RPC_TYPE_STORAGE_DOWNLOAD_RES));
+		WRITE2(write_header(rpc, RPC_TYPE_STORAGE_DOWNLOAD_RES, rpc->request_id));
 		WRITE2(write_uint32(rpc, rpc->storage_download_offset));
 		WRITE2(write_bytes(rpc, buf, size));
 		
 		rpc->storage_download_offset += size;
 	} else {
-		WRITE2(write_uint16(rpc, RPC_TYPE_STORAGE_DOWNLOAD_RES));
+		WRITE2(write_header(rpc, RPC_TYPE_STORAGE_DOWNLOAD_RES, rpc->request_id));
 		WRITE2(write_uint32(rpc, rpc->storage_download_offset));
 		WRITE2(write_bytes(rpc, NULL, size));
 	
@@ -1008,7 +1299,7 @@ static int upload(RPC* rpc) {
 	if(rpc->storage_upload_callback) {
 		size = rpc->storage_upload_callback(rpc->storage_upload_offset, &buf, 1460, rpc->storage_upload_context);
 		
-		WRITE(write_uint16(rpc, RPC_TYPE_STORAGE_UPLOAD_REQ));
+		WRITE(write_header(rpc, RPC_TYPE_STORAGE_UPLOAD_REQ, 0));
 		WRITE(write_uint32(rpc, rpc->storage_upload_id));
 		WRITE(write_uint32(rpc, rpc->storage_upload_offset));
 		WRITE(write_bytes(rpc, buf, size));
@@ -1035,7 +1326,7 @@ void storage_upload_handler_callback(RPC* rpc, int32_t size) {
 		
 		INIT2();
 		
-		WRITE2(write_uint16(rpc, RPC_TYPE_STORAGE_UPLOAD_RES));
+		WRITE2(write_header(rpc, RPC_TYPE_STORAGE_UPLOAD_RES, rpc->request_id));
 		WRITE2(write_int32(rpc, size));
 		
 		RETURN2();
@@ -1068,14 +1359,13 @@ static int storage_upload_req_handler(RPC* rpc) {
 int rpc_stdio(RPC* rpc, uint32_t id, uint8_t thread_id, int fd, const char* str, uint16_t size, bool(*callback)(uint16_t written, void* context), void* context) {
 	INIT();
 	
-	WRITE(write_uint16(rpc, RPC_TYPE_STDIO_REQ));
+	REQUEST(RPC_TYPE_STDIO_REQ);
 	WRITE(write_uint32(rpc, id));
 	WRITE(write_uint8(rpc, thread_id));
 	WRITE(write_uint8(rpc, fd));
 	WRITE(write_bytes(rpc, (void*)str, size));
 	
-	rpc->stdio_callback = callback;
-	rpc->stdio_context = context;
+	PENDING(callback, context);
 	
 	RETURN();
 }
@@ -1086,10 +1376,10 @@ static int stdio_res_handler(RPC* rpc) {
 	uint16_t written;
 	READ(read_uint16(rpc, &written));
 	
-	if(rpc->stdio_callback && !rpc->stdio_callback(written, rpc->stdio_context)) {
-		rpc->stdio_callback = NULL;
-		rpc->stdio_context = NULL;
-	}
+	void* context;
+	bool(*callback)(uint16_t written, void* context) = request_remove(rpc, &context);
+	if(callback)
+		callback(written, context);
 	
 	RETURN();
 }
@@ -1103,7 +1393,7 @@ void rpc_stdio_handler(RPC* rpc, void(*handler)(RPC* rpc, uint32_t id, uint8_t t
 static void stdio_handler_callback(RPC* rpc, uint16_t size) {
 	INIT2();
 	
-	WRITE2(write_uint16(rpc, RPC_TYPE_STDIO_RES));
+	WRITE2(write_header(rpc, RPC_TYPE_STDIO_RES, rpc->request_id));
 	WRITE2(write_uint16(rpc, size));
 	
 	RETURN2();
@@ -1134,6 +1424,803 @@ static int stdio_req_handler(RPC* rpc) {
 	RETURN();
 }
 
+// stdio_batch client API
+int rpc_stdio_batch(RPC* rpc, VMStdio* records, int count) {
+	INIT();
+	
+	if(count > RPC_STDIO_MAX_BATCH)
+		count = RPC_STDIO_MAX_BATCH;
+	
+	// No response, so no request ID is taken
+	WRITE(write_header(rpc, RPC_TYPE_STDIO_BATCH, 0));
+	int count_index = rpc->wbuf_index;
+	WRITE(write_uint16(rpc, 0));
+	
+	const int overhead = sizeof(uint32_t) + sizeof(uint8_t) * 2 + sizeof(uint32_t) + sizeof(int32_t);
+	uint16_t written = 0;
+	while(written < count) {
+		VMStdio* record = &records[written];
+		// A chunk is cut only if a meaningful part of it fits
+		int available = RPC_BUFFER_SIZE - rpc->wbuf_index - overhead;
+		if(available <= 0 || (available < record->size && available < 64))
+			break;
+		
+		bool is_cut = available < record->size;
+		if(is_cut)
+			record->size = available;
+		
+		write_uint32(rpc, record->vmid);
+		write_uint8(rpc, record->thread_id);
+		write_uint8(rpc, record->fd);
+		write_uint32(rpc, record->dropped);
+		write_bytes(rpc, record->str, record->size);
+		written++;
+		
+		if(is_cut)
+			break;
+	}
+	
+	if(written == 0) {
+		ROLLBACK();
+		return 0;
+	}
+	
+	memcpy(rpc->wbuf + count_index, &written, sizeof(uint16_t));
+	
+	return written;
+}
+
+// stdio_batch server API
+void rpc_stdio_batch_handler(RPC* rpc, void(*handler)(RPC* rpc, VMStdio* records, int count, void* context), void* context) {
+	rpc->stdio_batch_handler = handler;
+	rpc->stdio_batch_handler_context = context;
+}
+
+static int stdio_batch_req_handler(RPC* rpc) {
+	INIT();
+	
+	uint16_t count;
+	READ(read_uint16(rpc, &count));
+	
+	if(count > RPC_STDIO_MAX_BATCH)
+		return -1;
+	
+	VMStdio records[RPC_STDIO_MAX_BATCH];
+	for(int i = 0; i < count; i++) {
+		VMStdio* record = &records[i];
+		READ(read_uint32(rpc, &record->vmid));
+		READ(read_uint8(rpc, &record->thread_id));
+		READ(read_uint8(rpc, &record->fd));
+		READ(read_uint32(rpc, &record->dropped));
+		
+		int32_t len;
+		READ(read_bytes(rpc, (void**)&record->str, &len));
+		record->size = len;
+	}
+	
+	if(rpc->stdio_batch_handler)
+		rpc->stdio_batch_handler(rpc, records, count, rpc->stdio_batch_handler_context);
+	
+	RETURN();
+}
+
+// latency_get client API
+int rpc_latency_get(RPC* rpc, uint32_t id, bool(*callback)(VMLatency* latencies, uint16_t count, void* context), void* context) {
+	INIT();
+	
+	REQUEST(RPC_TYPE_LATENCY_GET_REQ);
+	WRITE(write_uint32(rpc, id));
+	
+	PENDING(callback, context);
+	
+	RETURN();
+}
+
+static int latency_get_res_handler(RPC* rpc) {
+	INIT();
+	
+	int32_t size;
+	VMLatency* latencies;
+	READ(read_bytes(rpc, (void**)&latencies, &size));
+	
+	void* context;
+	bool(*callback)(VMLatency* latencies, uint16_t count, void* context) = request_remove(rpc, &context);
+	if(callback)
+		callback(latencies, (size < 0 ? 0 : size) / sizeof(VMLatency), context);
+	
+	RETURN();
+}
+
+// latency_get server API
+void rpc_latency_get_handler(RPC* rpc, void(*handler)(RPC* rpc, uint32_t id, int size, void* context, void(*callback)(RPC* rpc, VMLatency* latencies, int size)), void* context) {
+	rpc->latency_get_handler = handler;
+	rpc->latency_get_handler_context = context;
+}
+
+static void latency_get_handler_callback(RPC* rpc, VMLatency* latencies, int size) {
+	INIT2();
+	
+	WRITE2(write_header(rpc, RPC_TYPE_LATENCY_GET_RES, rpc->request_id));
+	WRITE2(write_bytes(rpc, latencies, sizeof(VMLatency) * size));
+	
+	RETURN2();
+}
+
+static int latency_get_req_handler(RPC* rpc) {
+	INIT();
+	
+	uint32_t id;
+	READ(read_uint32(rpc, &id));
+	
+	// Entries which fit in a response
+	int size = (RPC_BUFFER_SIZE - HEADER_SIZE - sizeof(int32_t)) / sizeof(VMLatency);
+	if(rpc->latency_get_handler) {
+		rpc->latency_get_handler(rpc, id, size, rpc->latency_get_handler_context, latency_get_handler_callback);
+	} else {
+		latency_get_handler_callback(rpc, NULL, 0);
+	}
+	
+	RETURN();
+}
+
+// telemetry client API
+int rpc_telemetry(RPC* rpc, uint32_t interval, bool(*callback)(VMTelemetry* telemetry, VMCoreTelemetry* cores, uint16_t core_count, VMNICTelemetry* nics, uint16_t nic_count, void* context), void* context) {
+	INIT();
+	
+	if(interval == 0)
+		return -1;
+	
+	REQUEST(RPC_TYPE_TELEMETRY_REQ);
+	WRITE(write_uint32(rpc, interval));
+	
+	PENDING(callback, context);
+	
+	RETURN();
+}
+
+/*
+ * Cancel a subscription, it's sent again if a sample of it still comes
+ */
+static void telemetry_cancel(RPC* rpc, uint32_t id) {
+	INIT2();
+	
+	WRITE2(write_header(rpc, RPC_TYPE_TELEMETRY_REQ, id));
+	WRITE2(write_uint32(rpc, 0));
+}
+
+static int telemetry_res_handler(RPC* rpc) {
+	INIT();
+	
+	VMTelemetry* telemetry;
+	int32_t size;
+	READ(read_bytes(rpc, (void**)&telemetry, &size));
+	
+	VMCoreTelemetry* cores;
+	int32_t core_size;
+	READ(read_bytes(rpc, (void**)&cores, &core_size));
+	
+	VMNICTelemetry* nics;
+	int32_t nic_size;
+	READ(read_bytes(rpc, (void**)&nics, &nic_size));
+	
+	if(size != sizeof(VMTelemetry))
+		telemetry = NULL;
+	
+	void* context;
+	bool(*callback)(VMTelemetry* telemetry, VMCoreTelemetry* cores, uint16_t core_count, VMNICTelemetry* nics, uint16_t nic_count, void* context) = request_get(rpc, &context);
+	if(!callback) {
+		telemetry_cancel(rpc, rpc->request_id);
+	} else if(!callback(telemetry, cores, (core_size < 0 ? 0 : core_size) / sizeof(VMCoreTelemetry), nics, (nic_size < 0 ? 0 : nic_size) / sizeof(VMNICTelemetry), context)) {
+		request_remove(rpc, &context);
+		telemetry_cancel(rpc, rpc->request_id);
+	}
+	
+	RETURN();
+}
+
+// telemetry server API
+void rpc_telemetry_handler(RPC* rpc, void(*handler)(RPC* rpc, uint32_t interval, int nic_size, void* context, void(*callback)(RPC* rpc, VMTelemetry* telemetry, VMCoreTelemetry* cores, int core_count, VMNICTelemetry* nics, int nic_count)), void* context) {
+	rpc->telemetry_handler = handler;
+	rpc->telemetry_handler_context = context;
+}
+
+static void telemetry_handler_callback(RPC* rpc, VMTelemetry* telemetry, VMCoreTelemetry* cores, int core_count, VMNICTelemetry* nics, int nic_count) {
+	INIT2();
+	
+	WRITE2(write_header(rpc, RPC_TYPE_TELEMETRY_RES, rpc->request_id));
+	WRITE2(write_bytes(rpc, telemetry, telemetry ? sizeof(VMTelemetry) : 0));
+	WRITE2(write_bytes(rpc, cores, sizeof(VMCoreTelemetry) * core_count));
+	WRITE2(write_bytes(rpc, nics, sizeof(VMNICTelemetry) * nic_count));
+	
+	RETURN2();
+}
+
+static int telemetry_req_handler(RPC* rpc) {
+	INIT();
+	
+	uint32_t interval;
+	READ(read_uint32(rpc, &interval));
+	
+	// NICs which fit in a response with every core
+	int nic_size = (RPC_BUFFER_SIZE - HEADER_SIZE - sizeof(int32_t) * 3 - sizeof(VMTelemetry) - sizeof(VMCoreTelemetry) * RPC_TELEMETRY_MAX_CORES) / sizeof(VMNICTelemetry);
+	if(rpc->telemetry_handler) {
+		rpc->telemetry_handler(rpc, interval, nic_size, rpc->telemetry_handler_context, telemetry_handler_callback);
+	} else if(interval > 0) {
+		telemetry_handler_callback(rpc, NULL, NULL, 0, NULL, 0);
+	}
+	
+	RETURN();
+}
+
+// storage_digest client API
+int rpc_storage_digest(RPC* rpc, uint32_t id, uint32_t index, bool(*callback)(uint32_t index, uint32_t* digests, int32_t count, void* context), void* context) {
+	INIT();
+	
+	REQUEST(RPC_TYPE_STORAGE_DIGEST_REQ);
+	WRITE(write_uint32(rpc, id));
+	WRITE(write_uint32(rpc, index));
+	
+	PENDING(callback, context);
+	
+	RETURN();
+}
+
+static int storage_digest_res_handler(RPC* rpc) {
+	INIT();
+	
+	uint32_t index;
+	READ(read_uint32(rpc, &index));
+	
+	int32_t size;
+	uint32_t* digests;
+	READ(read_bytes(rpc, (void**)&digests, &size));
+	
+	int32_t count = size < 0 ? size : size / (int32_t)(sizeof(uint32_t) * 4);
+	void* context;
+	bool(*callback)(uint32_t index, uint32_t* digests, int32_t count, void* context) = request_remove(rpc, &context);
+	if(callback)
+		callback(index, digests, count, context);
+	
+	RETURN();
+}
+
+// storage_digest server API
+void rpc_storage_digest_handler(RPC* rpc, void(*handler)(RPC* rpc, uint32_t id, uint32_t index, int count, void* context, void(*callback)(RPC* rpc, uint32_t index, uint32_t* digests, int count)), void* context) {
+	rpc->storage_digest_handler = handler;
+	rpc->storage_digest_handler_context = context;
+}
+
+static void storage_digest_handler_callback(RPC* rpc, uint32_t index, uint32_t* digests, int count) {
+	INIT2();
+	
+	WRITE2(write_header(rpc, RPC_TYPE_STORAGE_DIGEST_RES, rpc->request_id));
+	WRITE2(write_uint32(rpc, index));
+	WRITE2(write_bytes(rpc, digests, count < 0 ? count : (int32_t)(sizeof(uint32_t) * 4 * count)));
+	
+	RETURN2();
+}
+
+static int storage_digest_req_handler(RPC* rpc) {
+	INIT();
+	
+	uint32_t id;
+	READ(read_uint32(rpc, &id));
+	
+	uint32_t index;
+	READ(read_uint32(rpc, &index));
+	
+	// Digests which fit in a response
+	int count = (RPC_BUFFER_SIZE - HEADER_SIZE - sizeof(uint32_t) - sizeof(int32_t)) / (sizeof(uint32_t) * 4);
+	if(rpc->storage_digest_handler) {
+		rpc->storage_digest_handler(rpc, id, index, count, rpc->storage_digest_handler_context, storage_digest_handler_callback);
+	} else {
+		storage_digest_handler_callback(rpc, index, NULL, -1);
+	}
+	
+	RETURN();
+}
+
+// storage_block client API
+int rpc_storage_block(RPC* rpc, uint32_t id, uint32_t index, uint8_t encoding, void* buf, int32_t size, bool(*callback)(uint32_t index, int32_t status, void* context), void* context) {
+	// Previous block is not sent yet
+	if(rpc->storage_block_buf)
+		return 0;
+	
+	rpc->storage_block_id = id;
+	rpc->storage_block_index = index;
+	rpc->storage_block_encoding = encoding;
+	rpc->storage_block_buf = buf;
+	rpc->storage_block_size = size;
+	rpc->storage_block_offset = 0;
+	rpc->storage_block_callback = callback;
+	rpc->storage_block_context = context;
+	
+	return 1;
+}
+
+static int storage_block_res_handler(RPC* rpc) {
+	INIT();
+	
+	uint32_t index;
+	READ(read_uint32(rpc, &index));
+	
+	int32_t status;
+	READ(read_int32(rpc, &status));
+	
+	if(rpc->storage_block_callback && !rpc->storage_block_callback(index, status, rpc->storage_block_context)) {
+		rpc->storage_block_callback = NULL;
+		rpc->storage_block_context = NULL;
+	}
+	
+	RETURN();
+}
+
+static int block(RPC* rpc) {
+	INIT();
+	
+	// Pieces as many as wbuf can take
+	int header = HEADER_SIZE + sizeof(uint32_t) * 2 + sizeof(uint8_t) + sizeof(int32_t) * 3;
+	while(rpc->storage_block_buf && rpc->wbuf_index + header < RPC_BUFFER_SIZE) {
+		int32_t len = rpc->storage_block_size - rpc->storage_block_offset;
+		if(len > RPC_BUFFER_SIZE - rpc->wbuf_index - header)
+			len = RPC_BUFFER_SIZE - rpc->wbuf_index - header;
+		
+		WRITE(write_header(rpc, RPC_TYPE_STORAGE_BLOCK_REQ, 0));
+		WRITE(write_uint32(rpc, rpc->storage_block_id));
+		WRITE(write_uint32(rpc, rpc->storage_block_index));
+		WRITE(write_uint8(rpc, rpc->storage_block_encoding));
+		WRITE(write_int32(rpc, rpc->storage_block_size));
+		WRITE(write_int32(rpc, rpc->storage_block_offset));
+		WRITE(write_bytes(rpc, rpc->storage_block_buf + rpc->storage_block_offset, len));
+		
+		rpc->storage_block_offset += len;
+		if(rpc->storage_block_offset >= rpc->storage_block_size)
+			rpc->storage_block_buf = NULL;
+		
+		_wbuf_index = rpc->wbuf_index;
+	}
+	
+	RETURN();
+}
+
+// storage_block server API
+void rpc_storage_block_handler(RPC* rpc, void(*handler)(RPC* rpc, uint32_t id, uint32_t index, uint8_t encoding, void* buf, int32_t size, void* context, void(*callback)(RPC* rpc, uint32_t index, int32_t status)), void* context) {
+	rpc->storage_block_handler = handler;
+	rpc->storage_block_handler_context = context;
+}
+
+static void storage_block_handler_callback(RPC* rpc, uint32_t index, int32_t status) {
+	INIT2();
+	
+	WRITE2(write_header(rpc, RPC_TYPE_STORAGE_BLOCK_RES, rpc->request_id));
+	WRITE2(write_uint32(rpc, index));
+	WRITE2(write_int32(rpc, status));
+	
+	RETURN2();
+}
+
+static int storage_block_req_handler(RPC* rpc) {
+	INIT();
+	
+	uint32_t id;
+	READ(read_uint32(rpc, &id));
+	
+	uint32_t index;
+	READ(read_uint32(rpc, &index));
+	
+	uint8_t encoding;
+	READ(read_uint8(rpc, &encoding));
+	
+	int32_t size;
+	READ(read_int32(rpc, &size));
+	
+	int32_t offset;
+	READ(read_int32(rpc, &offset));
+	
+	void* buf;
+	int32_t len;
+	READ(read_bytes(rpc, &buf, &len));
+	
+	// Pieces of a block are gathered until the last one, a block larger than
+	// a storage block is rejected without being allocated
+	if(offset == 0) {
+		free(rpc->storage_block_recv);
+		rpc->storage_block_recv = size > 0 && size <= VM_STORAGE_BLOCK_SIZE ? malloc(size) : NULL;
+		rpc->storage_block_received = 0;
+	}
+	
+	if(!rpc->storage_block_recv || offset != rpc->storage_block_received || len < 0 || offset + len > size) {
+		if(offset + len >= size)
+			storage_block_handler_callback(rpc, index, -1);
+		
+		RETURN();
+	}
+	
+	memcpy(rpc->storage_block_recv + offset, buf, len);
+	rpc->storage_block_received += len;
+	
+	if(rpc->storage_block_received == size) {
+		if(rpc->storage_block_handler) {
+			rpc->storage_block_handler(rpc, id, index, encoding, rpc->storage_block_recv, size, rpc->storage_block_handler_context, storage_block_handler_callback);
+		} else {
+			storage_block_handler_callback(rpc, index, -1);
+		}
+		
+		free(rpc->storage_block_recv);
+		rpc->storage_block_recv = NULL;
+		rpc->storage_block_received = 0;
+	}
+	
+	RETURN();
+}
+
+// storage_bulk common
+static int32_t bulk_map(RPC* rpc, uint64_t offset, void** buf, int32_t size) {
+	if(rpc->storage_bulk_map)
+		return rpc->storage_bulk_map(offset, buf, size, rpc->storage_bulk_context);
+	else if(rpc->storage_bulk_handler)
+		return rpc->storage_bulk_handler(rpc, rpc->storage_bulk_id, offset, buf, size, rpc->storage_bulk_handler_context);
+	else
+		return -1;
+}
+
+static void bulk_start(RPC* rpc, uint32_t id, bool is_sender, uint64_t offset, uint64_t size, uint32_t window) {
+	rpc->storage_bulk_id = id;
+	rpc->storage_bulk_is_active = true;
+	rpc->storage_bulk_is_sender = is_sender;
+	rpc->storage_bulk_is_done = false;
+	rpc->storage_bulk_is_pending = false;
+	rpc->storage_bulk_status = 0;
+	rpc->storage_bulk_offset = offset;
+	rpc->storage_bulk_end = size ? offset + size : (uint64_t)-1;
+	rpc->storage_bulk_acked = offset;
+	rpc->storage_bulk_window = window ? window : RPC_BULK_WINDOW;
+	rpc->storage_bulk_buf = NULL;
+	rpc->storage_bulk_tx = 0;
+}
+
+/*
+ * Both sides have sent their last frames, the client is notified
+ */
+static void bulk_finish(RPC* rpc, uint64_t offset, int32_t status) {
+	void(*callback)(uint64_t offset, int32_t status, void* context) = rpc->storage_bulk_callback;
+	void* context = rpc->storage_bulk_context;
+	
+	rpc->storage_bulk_id = 0;
+	rpc->storage_bulk_is_active = false;
+	rpc->storage_bulk_is_done = false;
+	rpc->storage_bulk_is_pending = false;
+	rpc->storage_bulk_buf = NULL;
+	rpc->storage_bulk_tx = 0;
+	rpc->storage_bulk_map = NULL;
+	rpc->storage_bulk_callback = NULL;
+	rpc->storage_bulk_context = NULL;
+	
+	if(callback)
+		callback(offset, status < 0 ? status : 0, context);
+}
+
+/*
+ * Receiver side: acknowledges received bytes, or writes the last
+ * acknowledge which is pending
+ */
+static int bulk_ack(RPC* rpc) {
+	if(!rpc->storage_bulk_is_active || rpc->storage_bulk_is_sender)
+		return 0;
+	
+	if(!rpc->storage_bulk_is_pending && (rpc->storage_bulk_status != 0 || rpc->storage_bulk_offset == rpc->storage_bulk_acked))
+		return 0;
+	
+	INIT();
+	
+	WRITE(write_header(rpc, RPC_TYPE_STORAGE_BULK_RES, rpc->request_id));
+	WRITE(write_uint64(rpc, rpc->storage_bulk_offset));
+	WRITE(write_int32(rpc, rpc->storage_bulk_is_pending ? rpc->storage_bulk_status : 0));
+	
+	rpc->storage_bulk_acked = rpc->storage_bulk_offset;
+	
+	if(rpc->storage_bulk_is_pending) {
+		rpc->storage_bulk_is_pending = false;
+		
+		// Otherwise frames are dropped until the sender's last one
+		if(rpc->storage_bulk_is_done)
+			bulk_finish(rpc, rpc->storage_bulk_offset, rpc->storage_bulk_status);
+	}
+	
+	RETURN();
+}
+
+/*
+ * Receiver side: the transfer is over with status, 1 on success or negative
+ * on error. is_done is true if the sender's last frame has been received.
+ */
+static void bulk_end(RPC* rpc, int32_t status, bool is_done) {
+	if(rpc->storage_bulk_status == 0) {
+		rpc->storage_bulk_status = status;
+		rpc->storage_bulk_is_pending = true;
+	}
+	
+	rpc->storage_bulk_is_done = is_done;
+	
+	if(rpc->storage_bulk_is_pending)
+		bulk_ack(rpc);
+	else if(is_done)
+		bulk_finish(rpc, rpc->storage_bulk_offset, rpc->storage_bulk_status);
+}
+
+/*
+ * Receiver side: reads payload of the current frame straight into the mapped
+ * memory, or drops it if the transfer has failed
+ */
+static int bulk_receive(RPC* rpc) {
+	int size = 0;
+	while(rpc->storage_bulk_rx > 0) {
+		bool is_receiving = rpc->storage_bulk_is_active && !rpc->storage_bulk_is_sender && rpc->storage_bulk_status == 0;
+		
+		void* buf = NULL;
+		int32_t len = rpc->storage_bulk_rx;
+		if(is_receiving) {
+			len = bulk_map(rpc, rpc->storage_bulk_offset, &buf, len);
+			if(len <= 0) {
+				bulk_end(rpc, len < 0 ? len : -1, false);
+				continue;
+			}
+		}
+		
+		int len2 = rpc->rbuf_index - rpc->rbuf_read;
+		if(len2 > 0) {
+			// Bytes which were read with the frame header
+			len2 = len2 < len ? len2 : len;
+			if(buf)
+				memcpy(buf, rpc->rbuf + rpc->rbuf_read, len2);
+			rpc->rbuf_read += len2;
+		} else {
+			rpc->rbuf_read = 0;
+			rpc->rbuf_index = 0;
+			
+			len2 = buf ? rpc->read(rpc, buf, len) : 0;
+			if(len2 < 0)
+				return len2;
+			
+			if(len2 == 0) {
+				// Nothing has arrived, or the I/O can't read partially
+				len2 = rpc->read(rpc, rpc->rbuf, RPC_BUFFER_SIZE);
+				if(len2 < 0)
+					return len2;
+				
+				if(len2 == 0)
+					return size;
+				
+				rpc->rbuf_index = len2;
+				continue;
+			}
+		}
+		
+		rpc->storage_bulk_rx -= len2;
+		if(is_receiving)
+			rpc->storage_bulk_offset += len2;
+		size += len2;
+		
+		if(rpc->storage_bulk_rx == 0 && is_receiving)
+			bulk_ack(rpc);
+	}
+	
+	return size;
+}
+
+/*
+ * Sender side: frames as much as the window allows, and the last frame
+ */
+static int bulk_send(RPC* rpc) {
+	int size = 0;
+	while(rpc->storage_bulk_is_active && rpc->storage_bulk_is_sender) {
+		if(rpc->storage_bulk_tx > 0) {
+			// Header goes first
+			if(rpc->wbuf_index > 0) {
+				int len = wbuf_flush(rpc);
+				if(len < 0)
+					return len;
+				
+				if(rpc->wbuf_index > 0)
+					return size;
+			}
+			
+			int len = rpc->write(rpc, rpc->storage_bulk_buf, rpc->storage_bulk_tx);
+			if(len < 0)
+				return len;
+			
+			if(len == 0)
+				return size;
+			
+			rpc->storage_bulk_buf += len;
+			rpc->storage_bulk_tx -= len;
+			size += len;
+			continue;
+		}
+		
+		// Waiting for the last acknowledge
+		if(rpc->storage_bulk_is_done)
+			return size;
+		
+		uint64_t flight = rpc->storage_bulk_offset - rpc->storage_bulk_acked;
+		if(flight >= rpc->storage_bulk_window && !rpc->storage_bulk_is_pending)
+			return size;
+		
+		int header = HEADER_SIZE + sizeof(uint64_t) + sizeof(int32_t);
+		if(rpc->wbuf_index + header > RPC_BUFFER_SIZE) {
+			int len = wbuf_flush(rpc);
+			if(len < 0)
+				return len;
+			
+			if(rpc->wbuf_index + header > RPC_BUFFER_SIZE)
+				return size;
+		}
+		
+		void* buf = NULL;
+		int32_t len = rpc->storage_bulk_status;
+		if(!rpc->storage_bulk_is_pending) {
+			uint64_t len2 = rpc->storage_bulk_window - flight;
+			if(len2 > RPC_BULK_CHUNK_SIZE)
+				len2 = RPC_BULK_CHUNK_SIZE;
+			if(len2 > rpc->storage_bulk_end - rpc->storage_bulk_offset)
+				len2 = rpc->storage_bulk_end - rpc->storage_bulk_offset;
+			
+			len = len2 > 0 ? bulk_map(rpc, rpc->storage_bulk_offset, &buf, len2) : 0;
+		}
+		
+		write_header(rpc, RPC_TYPE_STORAGE_BULK_DATA, 0);
+		write_uint64(rpc, rpc->storage_bulk_offset);
+		write_int32(rpc, len);
+		size += header;
+		
+		if(len > 0) {
+			rpc->storage_bulk_buf = buf;
+			rpc->storage_bulk_tx = len;
+			rpc->storage_bulk_offset += len;
+		} else if(rpc->storage_bulk_is_pending) {
+			// Receiver has ended it already
+			bulk_finish(rpc, rpc->storage_bulk_acked, rpc->storage_bulk_status);
+		} else {
+			rpc->storage_bulk_is_done = true;
+			rpc->storage_bulk_status = len;
+		}
+	}
+	
+	return size;
+}
+
+static int bulk(RPC* rpc) {
+	int len = bulk_ack(rpc);
+	if(len < 0)
+		return len;
+	
+	int len2 = bulk_send(rpc);
+	if(len2 < 0)
+		return len2;
+	
+	return len + len2;
+}
+
+// storage_bulk client API
+static int storage_bulk(RPC* rpc, uint32_t id, bool is_upload, uint64_t offset, uint64_t size, uint32_t window, int32_t(*map)(uint64_t offset, void** buf, int32_t size, void* context), void(*callback)(uint64_t offset, int32_t status, void* context), void* context) {
+	if(rpc->storage_bulk_is_active)
+		return -1;
+	
+	INIT();
+	
+	WRITE(write_header(rpc, RPC_TYPE_STORAGE_BULK_REQ, 0));
+	WRITE(write_uint32(rpc, id));
+	WRITE(write_bool(rpc, is_upload));
+	WRITE(write_uint64(rpc, offset));
+	WRITE(write_uint64(rpc, size));
+	WRITE(write_uint32(rpc, window));
+	
+	bulk_start(rpc, id, is_upload, offset, size, window);
+	rpc->storage_bulk_map = map;
+	rpc->storage_bulk_callback = callback;
+	rpc->storage_bulk_context = context;
+	
+	RETURN();
+}
+
+int rpc_storage_bulk_download(RPC* rpc, uint32_t id, uint64_t offset, uint64_t size, uint32_t window, int32_t(*map)(uint64_t offset, void** buf, int32_t size, void* context), void(*callback)(uint64_t offset, int32_t status, void* context), void* context) {
+	return storage_bulk(rpc, id, false, offset, size, window, map, callback, context);
+}
+
+int rpc_storage_bulk_upload(RPC* rpc, uint32_t id, uint64_t offset, uint64_t size, uint32_t window, int32_t(*map)(uint64_t offset, void** buf, int32_t size, void* context), void(*callback)(uint64_t offset, int32_t status, void* context), void* context) {
+	return storage_bulk(rpc, id, true, offset, size, window, map, callback, context);
+}
+
+static int storage_bulk_res_handler(RPC* rpc) {
+	INIT();
+	
+	uint64_t offset;
+	READ(read_uint64(rpc, &offset));
+	
+	int32_t status;
+	READ(read_int32(rpc, &status));
+	
+	// Acknowledges of an ended transfer are ignored
+	if(rpc->storage_bulk_is_active && rpc->storage_bulk_is_sender) {
+		if(offset > rpc->storage_bulk_acked && offset <= rpc->storage_bulk_offset)
+			rpc->storage_bulk_acked = offset;
+		
+		if(status != 0) {
+			if(rpc->storage_bulk_is_done) {
+				// Answer to the last frame
+				bulk_finish(rpc, rpc->storage_bulk_acked, rpc->storage_bulk_status < 0 ? rpc->storage_bulk_status : status);
+			} else {
+				// Receiver has failed, the last frame is sent to end the stream
+				rpc->storage_bulk_status = status;
+				rpc->storage_bulk_is_pending = true;
+			}
+		}
+	}
+	
+	RETURN();
+}
+
+static int storage_bulk_data_handler(RPC* rpc) {
+	INIT();
+	
+	uint64_t offset;
+	READ(read_uint64(rpc, &offset));
+	
+	int32_t size;
+	READ(read_int32(rpc, &size));
+	
+	bool is_receiver = rpc->storage_bulk_is_active && !rpc->storage_bulk_is_sender;
+	if(is_receiver && rpc->storage_bulk_status == 0 && offset != rpc->storage_bulk_offset)
+		bulk_end(rpc, -1, false);
+	
+	if(size > 0) {
+		rpc->storage_bulk_rx = size;
+		
+		_len = bulk_receive(rpc);
+		if(_len < 0)
+			return _len;
+		
+		_size += _len;
+	} else if(is_receiver) {
+		bulk_end(rpc, size < 0 ? size : 1, true);
+	}
+	
+	RETURN();
+}
+
+// storage_bulk server API
+void rpc_storage_bulk_handler(RPC* rpc, int32_t(*handler)(RPC* rpc, uint32_t id, uint64_t offset, void** buf, int32_t size, void* context), void* context) {
+	rpc->storage_bulk_handler = handler;
+	rpc->storage_bulk_handler_context = context;
+}
+
+static int storage_bulk_req_handler(RPC* rpc) {
+	INIT();
+	
+	uint32_t id;
+	READ(read_uint32(rpc, &id));
+	
+	bool is_upload;
+	READ(read_bool(rpc, &is_upload));
+	
+	uint64_t offset;
+	READ(read_uint64(rpc, &offset));
+	
+	uint64_t size;
+	READ(read_uint64(rpc, &size));
+	
+	uint32_t window;
+	READ(read_uint32(rpc, &window));
+	
+	// A new request replaces the one in progress
+	if(rpc->storage_bulk_is_active)
+		bulk_finish(rpc, rpc->storage_bulk_offset, -1);
+	
+	bulk_start(rpc, id, !is_upload, offset, size, window);
+	
+	RETURN();
+}
+
 // Handlers
 typedef int(*Handler)(RPC*);
 
@@ -1163,12 +2250,35 @@ static Handler handlers[] = {
 	storage_md5_res_handler,
 	stdio_req_handler,
 	stdio_res_handler,
+	latency_get_req_handler,
+	latency_get_res_handler,
+	storage_bulk_req_handler,
+	storage_bulk_res_handler,
+	storage_bulk_data_handler,
+	storage_digest_req_handler,
+	storage_digest_res_handler,
+	storage_block_req_handler,
+	storage_block_res_handler,
+	vm_create_batch_req_handler,
+	vm_create_batch_res_handler,
+	status_set_batch_req_handler,
+	results_res_handler,
+	vm_destroy_batch_req_handler,
+	results_res_handler,
+	telemetry_req_handler,
+	telemetry_res_handler,
+	stdio_batch_req_handler,
 	download,
 	upload,
+	block,
 };
 
+int rpc_pending(RPC* rpc) {
+	return rpc->request_count;
+}
+
 bool rpc_is_active(RPC* rpc) {
-	return rpc->storage_download_id > 0 || rpc->storage_upload_id > 0 || rpc->wbuf_index > 0;
+	return rpc->storage_download_id > 0 || rpc->storage_upload_id > 0 || rpc->storage_bulk_is_active || rpc->storage_bulk_rx > 0 || rpc->storage_block_buf || rpc->wbuf_index > 0;
 }
 
 bool rpc_loop(RPC* rpc) {
@@ -1180,11 +2290,36 @@ bool rpc_loop(RPC* rpc) {
 	}
 	
 	bool is_first = true;
+	if(rpc->storage_bulk_is_active) {
+		int len = bulk(rpc);
+		if(len < 0 || (rpc->wbuf_index > 0 && rpc->write && wbuf_flush(rpc) < 0)) {
+			if(rpc->close)
+				rpc->close(rpc);
+			return false;
+		}
+	}
+	
 	while(true) {
+		// Rest of a bulk frame's payload
+		if(rpc->storage_bulk_rx > 0) {
+			int len = bulk_receive(rpc);
+			if(len < 0 || (rpc->wbuf_index > 0 && rpc->write && wbuf_flush(rpc) < 0)) {
+				if(rpc->close)
+					rpc->close(rpc);
+				return false;
+			}
+			
+			if(rpc->storage_bulk_rx > 0)
+				return len > 0;
+			
+			rbuf_flush(rpc);
+		}
+		
 		INIT();
 		
 		uint16_t type = (uint16_t)-1;
-		_len = read_uint16(rpc, &type);
+		rpc->request_id = 0;
+		_len = read_header(rpc, &type, &rpc->request_id);
 		
 		if(_len > 0) {
 			if(type >= RPC_TYPE_END || !handlers[type]) {
@@ -1206,6 +2341,8 @@ bool rpc_loop(RPC* rpc) {
 				type = RPC_TYPE_END;	// download
 			} else if(rpc->storage_upload_id > 0 && rpc->storage_upload_offset != (uint32_t)-1) {
 				type = RPC_TYPE_END + 1;// upload
+			} else if(rpc->storage_block_buf) {
+				type = RPC_TYPE_END + 2;// block
 			}
 		}
 		
@@ -4,59 +4,49 @@
 #include <net/ip.h>
 #include <net/tcp.h>
 #include <net/checksum.h>
-#include <util/map.h>
+#include <net/portmap.h>
 
-bool tcp_port_alloc0(NIC* nic, uint32_t addr, uint16_t port) {
+static PortMap* tcp_portmap(NIC* nic, uint32_t addr) {
 	IPv4Interface* interface = nic_ip_get(nic, addr);
 	if(!interface)
-		return false;
+		return NULL;
 
-	if(!interface->tcp_ports) {
-		interface->tcp_ports = set_create(64, set_uint64_hash, set_uint64_equals, nic->pool);
-		if(!interface->tcp_ports)
-			return false;
-	}
+	if(!interface->tcp_ports)
+		interface->tcp_ports = portmap_create(NULL);
+
+	return interface->tcp_ports;
+}
 
-	if(set_contains(interface->tcp_ports, (void*)(uintptr_t)port))
+bool tcp_port_alloc0(NIC* nic, uint32_t addr, uint16_t port) {
+	PortMap* ports = tcp_portmap(nic, addr);
+	if(!ports)
 		return false;
 
-	return set_put(interface->tcp_ports, (void*)(uintptr_t)port);
+	return portmap_alloc0(ports, port);
 }
 
 uint16_t tcp_port_alloc(NIC* nic, uint32_t addr) {
-	IPv4Interface* interface = nic_ip_get(nic, addr);
-	if(!interface)
+	PortMap* ports = tcp_portmap(nic, addr);
+	if(!ports)
 		return 0;
 
-	if(!interface->tcp_ports) {
-		interface->tcp_ports = set_create(64, set_uint64_hash, set_uint64_equals, nic->pool);
-		if(!interface->tcp_ports)
-			return 0;
-	}
-
-	uint16_t port = interface->tcp_next_port;
-	if(port < 49152)
-		port = 49152;
-	
-	while(set_contains(interface->tcp_ports, (void*)(uintptr_t)port)) {
-		if(++port < 49152)
-			port = 49152;
-	}	
+	return portmap_alloc(ports);
+}
 
-	if(!set_put(interface->tcp_ports, (void*)(uintptr_t)port))
+uint16_t tcp_port_alloc_dst(NIC* nic, uint32_t addr, uint32_t destination, uint16_t port) {
+	PortMap* ports = tcp_portmap(nic, addr);
+	if(!ports)
 		return 0;
-	
-	interface->tcp_next_port = port;
-	
-	return port;
+
+	return portmap_alloc_dst(ports, addr, destination, port);
 }
 
 void tcp_port_free(NIC* nic, uint32_t addr, uint16_t port) {
 	IPv4Interface* interface = nic_ip_get(nic, addr);
-	if(interface == NULL)
+	if(interface == NULL || interface->tcp_ports == NULL)
 		return;
 	
-	set_remove(interface->tcp_ports, (void*)(uintptr_t)port);
+	portmap_free(interface->tcp_ports, port);
 }
 
 void tcp_pack(Packet* packet, uint16_t tcp_body_len) {
@@ -0,0 +1,315 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include <stdlib.h>
+#include <malloc.h>
+#include <string.h>
+#include <tlsf.h>
+#include <vnic.h>
+#include <util/event.h>
+#include <net/ether.h>
+#include <net/arp.h>
+#include <net/interface.h>
+
+#define NIC_SIZE	0x200000
+
+#define LOCAL_MAC	0x001122334455
+#define LOCAL_IP	0xc0a80001	// 192.168.0.1
+#define PEER_MAC	0x0066778899aa
+#define PEER_IP		0xc0a80002	// 192.168.0.2
+#define OTHER_IP	0xc0a80003	// 192.168.0.3
+
+extern void* __malloc_pool;
+
+/*
+ * Time and the GC timer are driven by the test
+ */
+uint64_t __timer_ms = 1;
+
+static uint64_t now;
+static EventFunc gc_func;
+static void* gc_context;
+
+uint64_t timer_us() {
+	return now;
+}
+
+uint64_t timer_frequency() {
+	return now;
+}
+
+uint64_t event_timer_add(EventFunc func, void* context, clock_t delay, clock_t period) {
+	gc_func = func;
+	gc_context = context;
+
+	return 1;
+}
+
+static VNIC vnic;
+static NIC* nic;
+
+static void arp_setup() {
+	__malloc_pool = malloc(0x400000);
+	init_memory_pool(0x400000, __malloc_pool, 0);
+
+	memset(&vnic, 0x0, sizeof(VNIC));
+	vnic.nic = memalign(NIC_SIZE, NIC_SIZE);
+	uint64_t attrs[] = {
+		VNIC_DEV, 0,
+		VNIC_MAC, LOCAL_MAC,
+		VNIC_POOL_SIZE, NIC_SIZE,
+		VNIC_RX_BANDWIDTH, 1000000000,
+		VNIC_TX_BANDWIDTH, 1000000000,
+		VNIC_PADDING_HEAD, 0,
+		VNIC_PADDING_TAIL, 0,
+		VNIC_RX_QUEUE_SIZE, 64,
+		VNIC_TX_QUEUE_SIZE, 64,
+		VNIC_SLOW_RX_QUEUE_SIZE, 64,
+		VNIC_SLOW_TX_QUEUE_SIZE, 64,
+		VNIC_NONE
+	};
+	assert_true(vnic_init(&vnic, attrs));
+	nic = vnic.nic;
+
+	assert_true(nic_ip_add(nic, LOCAL_IP));
+	now = 1000000;
+	gc_func = NULL;
+}
+
+static void arp_teardown() {
+	free(vnic.nic);
+	destroy_memory_pool(__malloc_pool);
+	free(__malloc_pool);
+	__malloc_pool = NULL;
+}
+
+static Packet* arp_packet(uint16_t operation, uint64_t sha, uint32_t spa, uint32_t tpa) {
+	Packet* packet = nic_alloc(nic, ETHER_LEN + ARP_LEN);
+	assert_non_null(packet);
+
+	Ether* ether = (Ether*)(packet->buffer + packet->start);
+	ether->dmac = endian48(operation == 1 ? 0xffffffffffff : LOCAL_MAC);
+	ether->smac = endian48(sha);
+	ether->type = endian16(ETHER_TYPE_ARP);
+
+	ARP* arp = (ARP*)ether->payload;
+	arp->htype = endian16(1);
+	arp->ptype = endian16(0x0800);
+	arp->hlen = endian8(6);
+	arp->plen = endian8(4);
+	arp->operation = endian16(operation);
+	arp->sha = endian48(sha);
+	arp->spa = endian32(spa);
+	arp->tha = endian48(0);
+	arp->tpa = endian32(tpa);
+
+	arp_pack(packet);
+
+	return packet;
+}
+
+static Packet* ip_packet() {
+	Packet* packet = nic_alloc(nic, 64);
+	assert_non_null(packet);
+
+	Ether* ether = (Ether*)(packet->buffer + packet->start);
+	ether->smac = endian48(LOCAL_MAC);
+	ether->type = endian16(ETHER_TYPE_IPv4);
+	packet->end = packet->start + 64;
+
+	return packet;
+}
+
+// Chunks of the packets not freed
+static int pool_used() {
+	uint8_t* bitmap = (void*)nic + nic->pool.bitmap;
+	int used = 0;
+	for(uint32_t i = 0; i < nic->pool.count; i++)
+		used += !!bitmap[i];
+
+	return used;
+}
+
+// Count ARP requests sent and free every packet sent
+static int requests() {
+	int count = 0;
+	Packet* packet;
+	while((packet = vnic_tx(&vnic))) {
+		Ether* ether = (Ether*)(packet->buffer + packet->start);
+		ARP* arp = (ARP*)ether->payload;
+		if(endian16(ether->type) == ETHER_TYPE_ARP && endian16(arp->operation) == 1) {
+			assert_int_equal(endian48(ether->dmac), 0xffffffffffff);
+			count++;
+		}
+
+		nic_free(packet);
+	}
+
+	return count;
+}
+
+// The whole table is scanned in 8 periods
+static void gc(uint64_t us) {
+	now += us;
+	assert_non_null(gc_func);
+	for(int i = 0; i < 8; i++)
+		assert_true(gc_func(gc_context));
+}
+
+static void request_func(void** state) {
+	arp_setup();
+
+	int used = pool_used();
+
+	// Request for the other host is not processed
+	Packet* packet = arp_packet(1, PEER_MAC, PEER_IP, OTHER_IP);
+	assert_false(arp_process(nic, packet));
+	nic_free(packet);
+
+	// Truncated packet is not processed
+	packet = arp_packet(1, PEER_MAC, PEER_IP, LOCAL_IP);
+	packet->end = packet->start + ETHER_LEN + ARP_LEN - 1;
+	assert_false(arp_process(nic, packet));
+	nic_free(packet);
+
+	assert_true(arp_process(nic, arp_packet(1, PEER_MAC, PEER_IP, LOCAL_IP)));
+
+	packet = vnic_tx(&vnic);
+	assert_non_null(packet);
+	Ether* ether = (Ether*)(packet->buffer + packet->start);
+	ARP* arp = (ARP*)ether->payload;
+	assert_int_equal(endian48(ether->dmac), PEER_MAC);
+	assert_int_equal(endian48(ether->smac), LOCAL_MAC);
+	assert_int_equal(endian16(arp->operation), 2);
+	assert_int_equal(endian48(arp->sha), LOCAL_MAC);
+	assert_int_equal(endian32(arp->spa), LOCAL_IP);
+	assert_int_equal(endian48(arp->tha), PEER_MAC);
+	assert_int_equal(endian32(arp->tpa), PEER_IP);
+	nic_free(packet);
+
+	// The requester is learned without a request
+	assert_int_equal(arp_get_mac(nic, PEER_IP, LOCAL_IP), PEER_MAC);
+	assert_int_equal(arp_get_ip(nic, PEER_MAC), PEER_IP);
+	assert_int_equal(requests(), 0);
+
+	assert_int_equal(pool_used(), used);
+
+	arp_teardown();
+}
+
+static void resolve_func(void** state) {
+	arp_setup();
+
+	int used = pool_used();
+
+	assert_int_equal(arp_get_mac(nic, PEER_IP, LOCAL_IP), 0xffffffffffff);
+	assert_int_equal(requests(), 1);
+
+	// Requests are rate limited while resolving
+	assert_int_equal(arp_get_mac(nic, PEER_IP, LOCAL_IP), 0xffffffffffff);
+	assert_true(arp_tx(nic, ip_packet(), PEER_IP, LOCAL_IP));
+	assert_int_equal(requests(), 0);
+
+	// The oldest one is dropped
+	for(int i = 0; i < ARP_PENDING_SIZE; i++)
+		assert_true(arp_tx(nic, ip_packet(), PEER_IP, LOCAL_IP));
+	assert_null(vnic_tx(&vnic));
+
+	assert_true(arp_process(nic, arp_packet(2, PEER_MAC, PEER_IP, LOCAL_IP)));
+
+	int count = 0;
+	Packet* packet;
+	while((packet = vnic_tx(&vnic))) {
+		Ether* ether = (Ether*)(packet->buffer + packet->start);
+		assert_int_equal(endian16(ether->type), ETHER_TYPE_IPv4);
+		assert_int_equal(endian48(ether->dmac), PEER_MAC);
+		nic_free(packet);
+		count++;
+	}
+	assert_int_equal(count, ARP_PENDING_SIZE);
+
+	// Sent at once after resolved
+	assert_int_equal(arp_get_mac(nic, PEER_IP, LOCAL_IP), PEER_MAC);
+	assert_true(arp_tx(nic, ip_packet(), PEER_IP, LOCAL_IP));
+	packet = vnic_tx(&vnic);
+	assert_non_null(packet);
+	nic_free(packet);
+
+	assert_int_equal(pool_used(), used);
+
+	arp_teardown();
+}
+
+static void negative_func(void** state) {
+	arp_setup();
+
+	int used = pool_used();
+
+	assert_int_equal(arp_get_mac(nic, PEER_IP, LOCAL_IP), 0xffffffffffff);
+	assert_true(arp_tx(nic, ip_packet(), PEER_IP, LOCAL_IP));
+	assert_int_equal(requests(), 1);
+
+	// Not retransmitted before the interval
+	gc(ARP_REQUEST_INTERVAL * 1000 / 2);
+	assert_int_equal(requests(), 0);
+
+	for(uint32_t i = 0; i < ARP_REQUEST_RETRY; i++) {
+		gc(ARP_REQUEST_INTERVAL * 1000);
+		assert_int_equal(requests(), 1);
+	}
+
+	// Failed, the pending packet is dropped
+	gc(ARP_REQUEST_INTERVAL * 1000);
+	assert_int_equal(requests(), 0);
+	assert_int_equal(pool_used(), used);
+
+	// No requests while the failure is remembered
+	assert_int_equal(arp_get_mac(nic, PEER_IP, LOCAL_IP), 0xffffffffffff);
+	assert_false(arp_tx(nic, ip_packet(), PEER_IP, LOCAL_IP));
+	gc((uint64_t)ARP_NEGATIVE_TIMEOUT * 1000000 / 2);
+	assert_int_equal(arp_get_mac(nic, PEER_IP, LOCAL_IP), 0xffffffffffff);
+	assert_int_equal(requests(), 0);
+
+	gc((uint64_t)ARP_NEGATIVE_TIMEOUT * 1000000);
+	assert_int_equal(arp_get_mac(nic, PEER_IP, LOCAL_IP), 0xffffffffffff);
+	assert_int_equal(requests(), 1);
+
+	assert_int_equal(pool_used(), used);
+
+	arp_teardown();
+}
+
+static void expire_func(void** state) {
+	arp_setup();
+
+	assert_true(arp_process(nic, arp_packet(2, PEER_MAC, PEER_IP, LOCAL_IP)));
+	assert_int_equal(arp_get_mac(nic, PEER_IP, LOCAL_IP), PEER_MAC);
+
+	// Expired before it's collected
+	now += (uint64_t)ARP_TIMEOUT * 1000000;
+	assert_int_equal(arp_get_mac(nic, PEER_IP, LOCAL_IP), 0xffffffffffff);
+	assert_int_equal(requests(), 1);
+
+	assert_true(arp_process(nic, arp_packet(2, PEER_MAC, PEER_IP, LOCAL_IP)));
+	assert_int_equal(arp_get_mac(nic, PEER_IP, LOCAL_IP), PEER_MAC);
+
+	// Collected
+	gc((uint64_t)ARP_TIMEOUT * 1000000);
+	assert_int_equal(arp_get_ip(nic, PEER_MAC), 0);
+	assert_int_equal(arp_get_mac(nic, PEER_IP, LOCAL_IP), 0xffffffffffff);
+	assert_int_equal(requests(), 1);
+
+	arp_teardown();
+}
+
+int main(void) {
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(request_func),
+		cmocka_unit_test(resolve_func),
+		cmocka_unit_test(negative_func),
+		cmocka_unit_test(expire_func),
+	};
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
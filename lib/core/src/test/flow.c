@@ -0,0 +1,250 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include <net/ether.h>
+#include <net/ip.h>
+#include <net/tcp.h>
+#include <net/flow.h>
+#include <_malloc.h>
+#include <tlsf.h>
+
+#include <malloc.h>
+#include <string.h>
+
+extern void* __malloc_pool;
+
+static uint8_t buffer[sizeof(Packet) + ETHER_LEN + IP_LEN + TCP_LEN];
+
+static void flow_setup() {
+	__malloc_pool = malloc(0x100000);
+	init_memory_pool(0x100000, __malloc_pool, 0);
+}
+
+static void flow_teardown() {
+	destroy_memory_pool(__malloc_pool);
+	free(__malloc_pool);
+	__malloc_pool = NULL;
+}
+
+static Packet* tcp_packet(FlowKey* key, bool syn, bool ack, bool fin, bool rst) {
+	memset(buffer, 0x0, sizeof(buffer));
+
+	Packet* packet = (Packet*)buffer;
+	packet->start = 0;
+	packet->end = ETHER_LEN + IP_LEN + TCP_LEN;
+	packet->size = ETHER_LEN + IP_LEN + TCP_LEN;
+
+	Ether* ether = (Ether*)(packet->buffer + packet->start);
+	ether->type = endian16(ETHER_TYPE_IPv4);
+
+	IP* ip = (IP*)ether->payload;
+	ip->version = 4;
+	ip->ihl = IP_LEN / 4;
+	ip->protocol = IP_PROTOCOL_TCP;
+	ip->source = endian32(key->saddr);
+	ip->destination = endian32(key->daddr);
+
+	TCP* tcp = (TCP*)ip->body;
+	tcp->source = endian16(key->sport);
+	tcp->destination = endian16(key->dport);
+	tcp->syn = syn;
+	tcp->ack = ack;
+	tcp->fin = fin;
+	tcp->rst = rst;
+
+	return packet;
+}
+
+static void flow_hash_symmetric_func() {
+	FlowKey key = { 0xc0a80001, 0x0a000001, 49152, 80, IP_PROTOCOL_TCP };
+	FlowKey reversed = { 0x0a000001, 0xc0a80001, 80, 49152, IP_PROTOCOL_TCP };
+	FlowKey other = { 0xc0a80001, 0x0a000001, 49153, 80, IP_PROTOCOL_TCP };
+
+	assert_int_equal(flow_hash(&key), flow_hash(&reversed));
+	assert_int_not_equal(flow_hash(&key), flow_hash(&other));
+}
+
+static void flow_get_func() {
+	flow_setup();
+
+	FlowTable* table = flow_table_create(1024, 16, NULL, NULL, NULL);
+	assert_non_null(table);
+
+	FlowKey key = { 0xc0a80001, 0x0a000001, 49152, 80, IP_PROTOCOL_TCP };
+	FlowKey reversed = { 0x0a000001, 0xc0a80001, 80, 49152, IP_PROTOCOL_TCP };
+
+	int direction = -1;
+	assert_null(flow_lookup(table, &key, &direction));
+
+	Flow* flow = flow_get(table, &key, 0, &direction);
+	assert_non_null(flow);
+	assert_int_equal(FLOW_ORIGINAL, direction);
+	assert_int_equal(1, flow_table_size(table));
+
+	assert_true(flow == flow_lookup(table, &reversed, &direction));
+	assert_int_equal(FLOW_REPLY, direction);
+	assert_true(flow == flow_get(table, &reversed, 0, &direction));
+	assert_int_equal(1, flow_table_size(table));
+
+	flow_remove(table, flow);
+	assert_null(flow_lookup(table, &key, NULL));
+	assert_int_equal(0, flow_table_size(table));
+
+	flow_table_destroy(table);
+	flow_teardown();
+}
+
+static void flow_full_func() {
+	flow_setup();
+
+	FlowTable* table = flow_table_create(256, 0, NULL, NULL, NULL);
+	assert_non_null(table);
+
+	FlowKey key = { 0xc0a80001, 0x0a000001, 0, 53, IP_PROTOCOL_UDP };
+	for(int i = 0; i < 256; i++) {
+		key.sport = 1024 + i;
+		Flow* flow = flow_get(table, &key, 0, NULL);
+		assert_non_null(flow);
+		assert_int_equal(key.sport, flow->key.sport);
+	}
+
+	key.sport = 1024 + 256;
+	assert_null(flow_get(table, &key, 0, NULL));
+
+	for(int i = 0; i < 256; i++) {
+		key.sport = 1024 + i;
+		assert_non_null(flow_lookup(table, &key, NULL));
+	}
+
+	flow_table_destroy(table);
+	flow_teardown();
+}
+
+static int expired;
+
+static void expire_callback(Flow* flow, void* context) {
+	assert_int_equal(0x12345678, *(uint32_t*)flow_data(flow));
+	expired++;
+}
+
+static void flow_tcp_func() {
+	flow_setup();
+
+	FlowTable* table = flow_table_create(64, sizeof(uint32_t), expire_callback, NULL, NULL);
+	assert_non_null(table);
+
+	FlowKey key = { 0xc0a80001, 0x0a000001, 49152, 80, IP_PROTOCOL_TCP };
+	FlowKey reversed = { 0x0a000001, 0xc0a80001, 80, 49152, IP_PROTOCOL_TCP };
+	uint64_t time = 1000 * FLOW_WHEEL_TICK;
+
+	int direction;
+	Flow* flow = flow_get(table, &key, time, &direction);
+	assert_non_null(flow);
+	*(uint32_t*)flow_data(flow) = 0x12345678;
+
+	flow_update(table, flow, direction, tcp_packet(&key, true, false, false, false), time);
+	assert_int_equal(FLOW_TCP_SYN_SENT, flow->state);
+
+	flow_get(table, &reversed, time, &direction);
+	flow_update(table, flow, direction, tcp_packet(&reversed, true, true, false, false), time);
+	assert_int_equal(FLOW_TCP_SYN_RECEIVED, flow->state);
+
+	flow_update(table, flow, FLOW_ORIGINAL, tcp_packet(&key, false, true, false, false), time);
+	assert_int_equal(FLOW_TCP_ESTABLISHED, flow->state);
+	assert_int_equal(2, flow->packets[FLOW_ORIGINAL]);
+	assert_int_equal(1, flow->packets[FLOW_REPLY]);
+
+	// Established flow survives the handshake timeout
+	assert_int_equal(0, flow_table_expire(table, time + table->timeout_syn + FLOW_WHEEL_TICK));
+
+	time += table->timeout_syn + FLOW_WHEEL_TICK;
+	flow_update(table, flow, FLOW_ORIGINAL, tcp_packet(&key, false, true, true, false), time);
+	assert_int_equal(FLOW_TCP_FIN_WAIT, flow->state);
+	flow_update(table, flow, FLOW_REPLY, tcp_packet(&reversed, false, true, true, false), time);
+	assert_int_equal(FLOW_TCP_CLOSING, flow->state);
+
+	// Close timeout is much shorter than established timeout
+	assert_int_equal(0, flow_table_expire(table, time + table->timeout_close - FLOW_WHEEL_TICK));
+	assert_int_equal(0, expired);
+	assert_int_equal(1, flow_table_expire(table, time + table->timeout_close + FLOW_WHEEL_TICK));
+	assert_int_equal(1, expired);
+	assert_null(flow_lookup(table, &key, NULL));
+
+	flow_table_destroy(table);
+	flow_teardown();
+}
+
+static void flow_idle_func() {
+	flow_setup();
+
+	FlowTable* table = flow_table_create(64, 0, NULL, NULL, NULL);
+	assert_non_null(table);
+
+	FlowKey key = { 0xc0a80001, 0x0a000001, 5353, 53, IP_PROTOCOL_UDP };
+	uint64_t time = 1000 * FLOW_WHEEL_TICK;
+	assert_non_null(flow_get(table, &key, time, NULL));
+	assert_int_equal(0, flow_table_expire(table, time));
+
+	// Longer than a round of the wheel
+	uint64_t long_timeout = (FLOW_WHEEL_SIZE * 3 + 5) * (uint64_t)FLOW_WHEEL_TICK;
+	table->timeout_idle = long_timeout;
+	Flow* flow = flow_lookup(table, &key, NULL);
+	flow_update(table, flow, FLOW_ORIGINAL, tcp_packet(&key, false, false, false, false), time);
+
+	for(uint64_t t = time; t < time + long_timeout; t += FLOW_WHEEL_TICK * 100)
+		assert_int_equal(0, flow_table_expire(table, t));
+
+	assert_int_equal(1, flow_table_expire(table, time + long_timeout + FLOW_WHEEL_TICK));
+	assert_int_equal(0, flow_table_size(table));
+
+	flow_table_destroy(table);
+	flow_teardown();
+}
+
+static void flow_fraction_func() {
+	flow_setup();
+
+	FlowTable* table = flow_table_create(64, 0, NULL, NULL, NULL);
+	assert_non_null(table);
+
+	// Expires in the middle of a tick which is already processed
+	FlowKey key = { 0xc0a80001, 0x0a000001, 5353, 53, IP_PROTOCOL_UDP };
+	uint64_t time = 1000 * FLOW_WHEEL_TICK + FLOW_WHEEL_TICK / 4;
+	table->timeout_idle = 30 * FLOW_WHEEL_TICK + FLOW_WHEEL_TICK / 2;
+	assert_non_null(flow_get(table, &key, time, NULL));
+
+	uint64_t expire = time + table->timeout_idle;
+	for(uint64_t t = time; t < expire; t += FLOW_WHEEL_TICK / 3)
+		assert_int_equal(0, flow_table_expire(table, t));
+
+	// Expired within a tick after its time
+	assert_int_equal(1, flow_table_expire(table, expire + FLOW_WHEEL_TICK));
+	assert_int_equal(0, flow_table_size(table));
+
+	// Extended inside the tick of the last expiration
+	assert_non_null(flow_get(table, &key, expire, NULL));
+	Flow* flow = flow_lookup(table, &key, NULL);
+	flow_update(table, flow, FLOW_ORIGINAL, tcp_packet(&key, false, false, false, false), expire + FLOW_WHEEL_TICK + 1);
+	assert_int_equal(0, flow_table_expire(table, expire + FLOW_WHEEL_TICK + 2));
+
+	expire += FLOW_WHEEL_TICK + 1 + table->timeout_idle;
+	assert_int_equal(0, flow_table_expire(table, expire - 1));
+	assert_int_equal(1, flow_table_expire(table, expire + FLOW_WHEEL_TICK));
+
+	flow_table_destroy(table);
+	flow_teardown();
+}
+
+int main(void) {
+	const struct CMUnitTest UnitTest[] = {
+		cmocka_unit_test(flow_hash_symmetric_func),
+		cmocka_unit_test(flow_get_func),
+		cmocka_unit_test(flow_full_func),
+		cmocka_unit_test(flow_tcp_func),
+		cmocka_unit_test(flow_idle_func),
+		cmocka_unit_test(flow_fraction_func),
+	};
+	return cmocka_run_group_tests(UnitTest, NULL, NULL);
+}
@@ -0,0 +1,299 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include <stdlib.h>
+#include <malloc.h>
+#include <string.h>
+#include <tlsf.h>
+#include <vnic.h>
+#include <util/event.h>
+#include <net/ether.h>
+#include <net/ip.h>
+#include <net/checksum.h>
+
+#define NIC_SIZE	0x200000
+
+#define BODY_LEN	3000
+#define MTU		1500
+
+extern void* __malloc_pool;
+
+/*
+ * Time and the GC timer are driven by the test
+ */
+static uint64_t now;
+static EventFunc gc_func;
+static void* gc_context;
+
+uint64_t timer_us() {
+	return now;
+}
+
+uint64_t timer_frequency() {
+	return now;
+}
+
+uint64_t event_timer_add(EventFunc func, void* context, clock_t delay, clock_t period) {
+	gc_func = func;
+	gc_context = context;
+
+	return 1;
+}
+
+static VNIC vnic;
+static NIC* nic;
+
+static void ip_setup() {
+	__malloc_pool = malloc(0x400000);
+	init_memory_pool(0x400000, __malloc_pool, 0);
+
+	memset(&vnic, 0x0, sizeof(VNIC));
+	vnic.nic = memalign(NIC_SIZE, NIC_SIZE);
+	uint64_t attrs[] = {
+		VNIC_DEV, 0,
+		VNIC_MAC, 0x001122334455,
+		VNIC_POOL_SIZE, NIC_SIZE,
+		VNIC_RX_BANDWIDTH, 1000000000,
+		VNIC_TX_BANDWIDTH, 1000000000,
+		VNIC_PADDING_HEAD, 0,
+		VNIC_PADDING_TAIL, 0,
+		VNIC_RX_QUEUE_SIZE, 64,
+		VNIC_TX_QUEUE_SIZE, 64,
+		VNIC_SLOW_RX_QUEUE_SIZE, 64,
+		VNIC_SLOW_TX_QUEUE_SIZE, 64,
+		VNIC_NONE
+	};
+	assert_true(vnic_init(&vnic, attrs));
+	nic = vnic.nic;
+
+	now = 1000000;
+	gc_func = NULL;
+}
+
+static void ip_teardown() {
+	free(vnic.nic);
+	destroy_memory_pool(__malloc_pool);
+	free(__malloc_pool);
+	__malloc_pool = NULL;
+}
+
+// Chunks of the packets not freed
+static int pool_used() {
+	uint8_t* bitmap = (void*)nic + nic->pool.bitmap;
+	int used = 0;
+	for(uint32_t i = 0; i < nic->pool.count; i++)
+		used += !!bitmap[i];
+
+	return used;
+}
+
+static IP* packet_ip(Packet* packet) {
+	return (IP*)((Ether*)(packet->buffer + packet->start))->payload;
+}
+
+static Packet* ip_packet(uint16_t id, uint16_t len) {
+	Packet* packet = nic_alloc(nic, ETHER_LEN + IP_LEN + len);
+	assert_non_null(packet);
+
+	Ether* ether = (Ether*)(packet->buffer + packet->start);
+	ether->dmac = endian48(0x0066778899aa);
+	ether->smac = endian48(0x001122334455);
+	ether->type = endian16(ETHER_TYPE_IPv4);
+
+	IP* ip = (IP*)ether->payload;
+	memset(ip, 0x0, IP_LEN);
+	ip->version = 4;
+	ip->ihl = IP_LEN / 4;
+	ip->id = endian16(id);
+	ip->protocol = IP_PROTOCOL_UDP;
+	ip->source = endian32(0xc0a80001);
+	ip->destination = endian32(0xc0a80002);
+
+	for(int i = 0; i < len; i++)
+		ip->body[i] = i * 7;
+
+	ip_pack(packet, len);
+
+	return packet;
+}
+
+// Fragment the datagram and take the fragments sent
+static int fragment(uint16_t id, Packet** fragments) {
+	assert_true(ip_fragment_tx(nic, ip_packet(id, BODY_LEN), MTU));
+
+	int count = 0;
+	Packet* packet;
+	while((packet = vnic_tx(&vnic)))
+		fragments[count++] = packet;
+
+	return count;
+}
+
+static void defrag_func(void** state) {
+	ip_setup();
+
+	int used = pool_used();
+
+	// Not a fragment
+	Packet* packet = ip_packet(1, 100);
+	assert_ptr_equal(ip_defrag(nic, packet), packet);
+	nic_free(packet);
+
+	Packet* fragments[IP_FRAG_COUNT];
+	int count = fragment(2, fragments);
+	assert_int_equal(count, 3);
+	for(int i = 0; i < count; i++) {
+		IP* ip = packet_ip(fragments[i]);
+		assert_true(endian16(ip->length) <= MTU);
+		assert_int_equal(checksum(ip, ip->ihl * 4), 0);
+	}
+
+	// Out of order, with a duplicate
+	assert_null(ip_defrag(nic, fragments[2]));
+	Packet* duplicate = nic_alloc(nic, fragments[1]->end - fragments[1]->start);
+	memcpy(duplicate->buffer + duplicate->start, fragments[1]->buffer + fragments[1]->start, fragments[1]->end - fragments[1]->start);
+	duplicate->end = duplicate->start + fragments[1]->end - fragments[1]->start;
+	assert_null(ip_defrag(nic, fragments[1]));
+	assert_null(ip_defrag(nic, duplicate));
+
+	packet = ip_defrag(nic, fragments[0]);
+	assert_non_null(packet);
+
+	IP* ip = packet_ip(packet);
+	assert_int_equal(endian16(ip->length), IP_LEN + BODY_LEN);
+	assert_int_equal(endian16(ip->flags_offset), 0);
+	assert_int_equal(checksum(ip, ip->ihl * 4), 0);
+	assert_int_equal(packet->end - packet->start, ETHER_LEN + IP_LEN + BODY_LEN);
+	for(int i = 0; i < BODY_LEN; i++)
+		assert_int_equal(ip->body[i], (uint8_t)(i * 7));
+
+	nic_free(packet);
+	assert_int_equal(pool_used(), used);
+
+	ip_teardown();
+}
+
+static void truncated_func(void** state) {
+	ip_setup();
+
+	int used = pool_used();
+
+	Packet* fragments[IP_FRAG_COUNT];
+	int count = fragment(3, fragments);
+	assert_int_equal(count, 3);
+
+	// Length is larger than the packet, the datagram is not completed by it
+	assert_null(ip_defrag(nic, fragments[0]));
+	assert_null(ip_defrag(nic, fragments[2]));
+	Packet* packet = fragments[1];
+	packet->end -= 8;
+	assert_null(ip_defrag(nic, packet));
+
+	now += (uint64_t)IP_FRAG_TIMEOUT * 1000000 + 1;
+	gc_func(gc_context);
+	assert_int_equal(pool_used(), used);
+
+	count = fragment(4, fragments);
+	assert_int_equal(count, 3);
+
+	// Too short for the header
+	packet = fragments[2];
+	packet->end = packet->start + ETHER_LEN + IP_LEN - 1;
+	assert_null(ip_defrag(nic, packet));
+
+	// Header length is larger than the length
+	packet = fragments[1];
+	packet_ip(packet)->ihl = 15;
+	packet_ip(packet)->length = endian16(IP_LEN);
+	assert_null(ip_defrag(nic, packet));
+
+	nic_free(fragments[0]);
+	assert_int_equal(pool_used(), used);
+
+	ip_teardown();
+}
+
+static void overlap_func(void** state) {
+	ip_setup();
+
+	int used = pool_used();
+
+	Packet* fragments[IP_FRAG_COUNT];
+	int count = fragment(5, fragments);
+	assert_int_equal(count, 3);
+
+	assert_null(ip_defrag(nic, fragments[0]));
+
+	// Overlaps the first one, the whole datagram is dropped
+	IP* ip = packet_ip(fragments[1]);
+	ip->flags_offset = ip_flags_offset(IP_FLAG_MF, (endian16(ip->flags_offset) & 0x1fff) - 1);
+	assert_null(ip_defrag(nic, fragments[1]));
+	assert_null(ip_defrag(nic, fragments[2]));
+
+	gc_func(gc_context);
+	now += (uint64_t)IP_FRAG_TIMEOUT * 1000000 + 1;
+	gc_func(gc_context);
+	assert_int_equal(pool_used(), used);
+
+	ip_teardown();
+}
+
+static void timeout_func(void** state) {
+	ip_setup();
+
+	int used = pool_used();
+
+	Packet* fragments[IP_FRAG_COUNT];
+	int count = fragment(6, fragments);
+	assert_int_equal(count, 3);
+
+	assert_null(ip_defrag(nic, fragments[0]));
+	assert_null(ip_defrag(nic, fragments[1]));
+
+	// Kept until the timeout
+	now += (uint64_t)IP_FRAG_TIMEOUT * 1000000 / 2;
+	gc_func(gc_context);
+	assert_true(pool_used() > used);
+
+	now += (uint64_t)IP_FRAG_TIMEOUT * 1000000;
+	gc_func(gc_context);
+	nic_free(fragments[2]);
+	assert_int_equal(pool_used(), used);
+
+	ip_teardown();
+}
+
+static void dont_fragment_func(void** state) {
+	ip_setup();
+
+	int used = pool_used();
+
+	Packet* packet = ip_packet(7, BODY_LEN);
+	IP* ip = packet_ip(packet);
+	ip->flags_offset = ip_flags_offset(IP_FLAG_DF, 0);
+	assert_false(ip_fragment_tx(nic, packet, MTU));
+	assert_null(vnic_tx(&vnic));
+
+	// Length is larger than the packet
+	packet = ip_packet(8, BODY_LEN);
+	packet->end -= 100;
+	assert_false(ip_fragment_tx(nic, packet, MTU));
+	assert_null(vnic_tx(&vnic));
+
+	assert_int_equal(pool_used(), used);
+
+	ip_teardown();
+}
+
+int main(void) {
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(defrag_func),
+		cmocka_unit_test(truncated_func),
+		cmocka_unit_test(overlap_func),
+		cmocka_unit_test(timeout_func),
+		cmocka_unit_test(dont_fragment_func),
+	};
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,88 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include <latency.h>
+
+static Latency latency;
+
+static void latency_record_func() {
+	latency_init(&latency);
+	assert_int_equal(latency_percentile(&latency, 500), 0);
+
+	for(uint64_t i = 1; i <= 1000; i++)
+		latency_record(&latency, i);
+
+	assert_int_equal(latency.count, 1000);
+	assert_int_equal(latency.sum, 500500);
+	assert_int_equal(latency.min, 1);
+	assert_int_equal(latency.max, 1000);
+
+	// Small values have their own buckets
+	assert_int_equal(latency_percentile(&latency, 1), 1);
+
+	// Others are the lower bounds of buckets within 1/16
+	uint32_t percentiles[] = { 500, 990, 999 };
+	for(int i = 0; i < 3; i++) {
+		uint64_t value = latency_percentile(&latency, percentiles[i]);
+		assert_true(value <= percentiles[i]);
+		assert_true(value >= percentiles[i] - percentiles[i] / LATENCY_SUB_BUCKETS);
+	}
+}
+
+static void latency_bucket_func() {
+	latency_init(&latency);
+
+	// Every value falls in a bucket which lower bound is not larger than it
+	for(uint64_t value = 1; value < (1UL << 40); value = value * 3 / 2 + 1) {
+		latency_init(&latency);
+		latency_record(&latency, value);
+
+		uint64_t lower = latency_percentile(&latency, 1000);
+		assert_true(lower <= value);
+		assert_true(value - lower <= value / LATENCY_SUB_BUCKETS);
+	}
+
+	// Values out of range are in the last bucket
+	latency_init(&latency);
+	latency_record(&latency, (uint64_t)-1);
+	assert_true(latency_percentile(&latency, 1000) > 0);
+	assert_int_equal(latency.max, (uint64_t)-1);
+}
+
+static void latency_stamp_func() {
+	Packet packet = { .time = 0 };
+
+	latency_init(&latency);
+
+	// Not stamped yet, nothing to record
+	latency_stamp(&latency, &packet, 100);
+	assert_int_equal(latency.count, 0);
+	assert_int_equal(packet.time, 100);
+
+	latency_stamp(&latency, &packet, 150);
+	assert_int_equal(latency.count, 1);
+	assert_int_equal(latency.sum, 50);
+	assert_int_equal(packet.time, 150);
+
+	// TSC of another core which is behind
+	latency_stamp(&latency, &packet, 140);
+	assert_int_equal(latency.count, 1);
+	assert_int_equal(packet.time, 140);
+
+	// Stamped without recording
+	latency_stamp(NULL, &packet, 200);
+	assert_int_equal(latency.count, 1);
+	assert_int_equal(packet.time, 200);
+}
+
+int main(void) {
+	const struct CMUnitTest UnitTest[] = {
+		cmocka_unit_test(latency_record_func),
+		cmocka_unit_test(latency_bucket_func),
+		cmocka_unit_test(latency_stamp_func),
+	};
+
+	return cmocka_run_group_tests(UnitTest, NULL, NULL);
+}
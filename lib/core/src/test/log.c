@@ -0,0 +1,209 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <util/log.h>
+
+#define RING_SIZE	1024
+
+// Log ring of the thread, which is given by the manager in PacketNgin
+extern char* __log;
+extern volatile size_t __log_head;
+extern volatile size_t __log_tail;
+extern volatile size_t __log_size;
+
+static char ring[RING_SIZE];
+
+typedef struct {
+	int	count;
+	char	lines[16][128];
+	int	formats[16];
+} Output;
+
+static void callback(LogRecord* record, const char* format, void* context) {
+	Output* output = context;
+	if(output->count >= 16)
+		return;
+
+	output->formats[output->count] = record->format;
+	if(format)
+		log_print(output->lines[output->count], 128, format, record);
+	else
+		strcpy(output->lines[output->count], "unknown");
+	output->count++;
+}
+
+// Read the ring like the manager, the data may be wrapped
+static size_t drain(uint8_t* buf) {
+	size_t len = 0;
+	while(__log_head != __log_tail) {
+		buf[len++] = __log[__log_head];
+		__log_head = (__log_head + 1) % __log_size;
+	}
+
+	return len;
+}
+
+static int setup(void** state) {
+	__log = ring;
+	__log_head = 0;
+	__log_tail = 0;
+	__log_size = RING_SIZE;
+
+	return 0;
+}
+
+static void write_func(void** state) {
+	int incoming = log_format("Incoming: %d.%d.%d.%d:%d\n");
+	int outgoing = log_format("Outgoing: %lx %u %s\n");
+	assert_true(incoming >= 0);
+	assert_int_equal(outgoing, incoming + 1);
+
+	assert_true(LOG(incoming, 192, 168, 0, 1, 8080));
+	assert_true(LOG(outgoing, 0x001122334455, (uint32_t)-1, 0x1234));
+
+	// Invalid format ID and too many arguments
+	uint64_t drops = log_drops();
+	assert_false(LOG(outgoing + 1, 0));
+	uint64_t args[LOG_MAX_ARGS + 1] = {};
+	assert_false(log_write(incoming, args, LOG_MAX_ARGS + 1));
+	assert_int_equal(log_drops(), drops + 2);
+
+	uint8_t buf[RING_SIZE];
+	size_t len = drain(buf);
+	assert_int_equal(len % 16, 0);
+
+	LogDecoder decoder;
+	log_decoder_init(&decoder);
+	Output output = {};
+	assert_int_equal(log_decode(&decoder, buf, len, callback, &output), 4);
+	assert_int_equal(output.count, 2);
+	assert_string_equal(output.lines[0], "Incoming: 192.168.0.1:8080\n");
+	// String conversion is not followed
+	assert_string_equal(output.lines[1], "Outgoing: 1122334455 4294967295 %s\n");
+	log_decoder_destroy(&decoder);
+}
+
+static void full_func(void** state) {
+	int format = log_format("%d\n");
+	assert_true(format >= 0);
+
+	int count = 0;
+	uint64_t drops = log_drops();
+	while(LOG(format, count))
+		count++;
+
+	assert_true(count > 0);
+	assert_true(LOG(format, 0) == false);
+	assert_int_equal(log_drops(), drops + 2);
+
+	// Whole records are left in the ring
+	uint8_t buf[RING_SIZE];
+	size_t len = drain(buf);
+	assert_int_equal(len % 16, 0);
+
+	// The registration and the records
+	LogDecoder decoder;
+	log_decoder_init(&decoder);
+	Output output = {};
+	assert_int_equal(log_decode(&decoder, buf, len, callback, &output), count + 1);
+	assert_string_equal(output.lines[0], "0\n");
+	log_decoder_destroy(&decoder);
+
+	// Without the registration, like a console connected later
+	LogRecord* record = (LogRecord*)buf;
+	log_decoder_init(&decoder);
+	output = (Output){};
+	assert_int_equal(log_decode(&decoder, buf + record->size, len - record->size, callback, &output), count);
+	assert_string_equal(output.lines[0], "unknown");
+	log_decoder_destroy(&decoder);
+
+	// Writable again after it's read
+	assert_true(LOG(format, 1));
+	drain(buf);
+}
+
+static void split_func(void** state) {
+	int format = log_format("%s: %x %x %x\n");
+	assert_true(format >= 0);
+	for(int i = 0; i < 4; i++)
+		assert_true(LOG(format, i, i * 2, i * 3));
+
+	uint8_t buf[RING_SIZE];
+	size_t len = drain(buf);
+
+	// Fed in every chunk size, records are cut at any byte
+	for(size_t chunk = 1; chunk <= len; chunk++) {
+		LogDecoder decoder;
+		log_decoder_init(&decoder);
+		Output output = {};
+
+		int count = 0;
+		for(size_t offset = 0; offset < len; offset += chunk) {
+			int rc = log_decode(&decoder, buf + offset, offset + chunk < len ? chunk : len - offset, callback, &output);
+			assert_true(rc >= 0);
+			count += rc;
+		}
+
+		assert_int_equal(count, 5);
+		assert_int_equal(output.count, 4);
+		assert_string_equal(output.lines[3], "%s: 3 6 9\n");
+		log_decoder_destroy(&decoder);
+	}
+}
+
+static void broken_func(void** state) {
+	uint8_t buf[64] = {};
+	LogRecord* record = (LogRecord*)buf;
+	record->size = 17;
+
+	LogDecoder decoder;
+	log_decoder_init(&decoder);
+	Output output = {};
+	assert_true(log_decode(&decoder, buf, sizeof(buf), callback, &output) < 0);
+	assert_int_equal(output.count, 0);
+
+	// Too many arguments for the size
+	record->size = 32;
+	record->count = 4;
+	assert_true(log_decode(&decoder, buf, sizeof(buf), callback, &output) < 0);
+	log_decoder_destroy(&decoder);
+}
+
+static void print_func(void** state) {
+	uint8_t buf[sizeof(LogRecord) + sizeof(uint64_t) * 4];
+	LogRecord* record = (LogRecord*)buf;
+	record->count = 4;
+	record->args[0] = -5;
+	record->args[1] = 0xff;
+	record->args[2] = 'A';
+	record->args[3] = 0x100000000;
+
+	char str[64];
+	log_print(str, sizeof(str), "%d %04x %c %lu %d%%", record);
+	// Missing argument is 0
+	assert_string_equal(str, "-5 00ff A 4294967296 0%");
+
+	// Floating point and pointer to string are printed as they are
+	log_print(str, sizeof(str), "%f %-10s %n", record);
+	assert_string_equal(str, "%f %-10s %n");
+
+	// Cut to the size
+	assert_int_equal(log_print(str, 4, "%d %d", record), 6);
+	assert_string_equal(str, "-5 ");
+}
+
+int main(void) {
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(write_func),
+		cmocka_unit_test(full_func),
+		cmocka_unit_test(split_func),
+		cmocka_unit_test(broken_func),
+		cmocka_unit_test(print_func),
+	};
+	return cmocka_run_group_tests(tests, setup, NULL);
+}
@@ -0,0 +1,97 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <net/md5.h>
+
+#define BLOCK_SIZE	0x200000	// Same as VM_STORAGE_SIZE_ALIGN
+
+static void md5_known_func() {
+	// RFC 1321 test suite
+	uint8_t* messages[] = { (uint8_t*)"", (uint8_t*)"abc", (uint8_t*)"message digest" };
+	uint32_t hashes[3][4];
+
+	md5_x8(messages + 1, 1, 3, hashes);
+	uint8_t abc[16] = { 0x90, 0x01, 0x50, 0x98, 0x3c, 0xd2, 0x4f, 0xb0, 0xd6, 0x96, 0x3f, 0x7d, 0x28, 0xe1, 0x7f, 0x72 };
+	assert_memory_equal(hashes[0], abc, 16);
+
+	md5_x8(messages, 1, 0, hashes);
+	uint8_t empty[16] = { 0xd4, 0x1d, 0x8c, 0xd9, 0x8f, 0x00, 0xb2, 0x04, 0xe9, 0x80, 0x09, 0x98, 0xec, 0xf8, 0x42, 0x7e };
+	assert_memory_equal(hashes[0], empty, 16);
+}
+
+static void md5_lanes_func() {
+	uint8_t* messages[MD5_LANES];
+	for(int i = 0; i < MD5_LANES; i++) {
+		messages[i] = malloc(200);
+		for(int j = 0; j < 200; j++)
+			messages[i][j] = i * 31 + j * 7;
+	}
+
+	// Lengths around the padding boundaries, any number of lanes
+	uint32_t lens[] = { 1, 55, 56, 63, 64, 119, 120, 128, 200 };
+	for(int l = 0; l < sizeof(lens) / sizeof(lens[0]); l++) {
+		for(int count = 1; count <= MD5_LANES; count++) {
+			uint32_t hashes[MD5_LANES][4];
+			md5_x8(messages, count, lens[l], hashes);
+
+			for(int i = 0; i < count; i++) {
+				uint32_t hash[4];
+				md5(messages[i], lens[l], hash);
+				assert_memory_equal(hashes[i], hash, sizeof(hash));
+			}
+		}
+	}
+
+	for(int i = 0; i < MD5_LANES; i++)
+		free(messages[i]);
+}
+
+static uint64_t now() {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+
+	return tv.tv_sec * 1000000UL + tv.tv_usec;
+}
+
+static void md5_benchmark_func() {
+	uint8_t* messages[MD5_LANES];
+	for(int i = 0; i < MD5_LANES; i++) {
+		messages[i] = malloc(BLOCK_SIZE);
+		memset(messages[i], i, BLOCK_SIZE);
+	}
+
+	uint32_t hashes[MD5_LANES][4];
+	uint64_t time = now();
+	for(int i = 0; i < MD5_LANES; i++)
+		md5(messages[i], BLOCK_SIZE, hashes[i]);
+	uint64_t serial = now() - time;
+
+	uint32_t hashes2[MD5_LANES][4];
+	time = now();
+	md5_x8(messages, MD5_LANES, BLOCK_SIZE, hashes2);
+	uint64_t multi = now() - time;
+
+	assert_memory_equal(hashes, hashes2, sizeof(hashes));
+
+	double mb = (double)BLOCK_SIZE * MD5_LANES / (1024 * 1024);
+	printf("MD5 of %d blocks, md5: %.1f MB/s, md5_x8: %.1f MB/s\n", MD5_LANES,
+			mb * 1000000 / (serial ? serial : 1), mb * 1000000 / (multi ? multi : 1));
+
+	for(int i = 0; i < MD5_LANES; i++)
+		free(messages[i]);
+}
+
+int main(void) {
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(md5_known_func),
+		cmocka_unit_test(md5_lanes_func),
+		cmocka_unit_test(md5_benchmark_func),
+	};
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,169 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include <net/pcap.h>
+#include <capture.h>
+
+#include <string.h>
+
+#define RING_SIZE	1024
+
+static uint8_t file[16384];
+static uint8_t frame[1514];
+
+static void fill_frame(uint8_t seed) {
+	for(size_t i = 0; i < sizeof(frame); i++)
+		frame[i] = seed + i;
+}
+
+static void pcapng_write_read_func() {
+	size_t offset = pcapng_header(file, sizeof(file), 1514);
+	assert_int_equal(offset, PCAPNG_HEADER_SIZE);
+
+	for(int i = 0; i < 3; i++) {
+		fill_frame(i);
+		size_t len = pcapng_packet(file + offset, sizeof(file) - offset, 1000000000UL * i + 7,
+				i % 2 ? PCAP_DIRECTION_OUTBOUND : PCAP_DIRECTION_INBOUND, frame, 61 + i, 61 + i);
+		assert_int_equal(len, PCAPNG_PACKET_SIZE(61 + i));
+		offset += len;
+	}
+
+	// Space is not enough
+	assert_int_equal(pcapng_packet(file + offset, 100, 0, 0, frame, 1514, 1514), 0);
+
+	PcapReader reader;
+	PcapPacket packet;
+	assert_true(pcap_reader_init(&reader, file, offset));
+
+	for(int i = 0; i < 3; i++) {
+		assert_true(pcap_reader_next(&reader, &packet));
+		fill_frame(i);
+		assert_int_equal(packet.time, 1000000000UL * i + 7);
+		assert_int_equal(packet.caplen, 61 + i);
+		assert_int_equal(packet.len, 61 + i);
+		assert_memory_equal(packet.data, frame, 61 + i);
+	}
+
+	assert_int_equal(reader.snaplen, 1514);
+	assert_false(pcap_reader_next(&reader, &packet));
+}
+
+static void pcapng_zero_tail_func() {
+	// Captures in storage are followed by zeros
+	memset(file, 0, sizeof(file));
+	size_t offset = pcapng_header(file, sizeof(file), 1514);
+	offset += pcapng_packet(file + offset, sizeof(file) - offset, 1, 0, frame, 60, 60);
+
+	PcapReader reader;
+	PcapPacket packet;
+	assert_true(pcap_reader_init(&reader, file, sizeof(file)));
+	assert_true(pcap_reader_next(&reader, &packet));
+	assert_false(pcap_reader_next(&reader, &packet));
+}
+
+static void put32(uint8_t* p, uint32_t v, bool swap) {
+	if(swap)
+		v = __builtin_bswap32(v);
+
+	memcpy(p, &v, 4);
+}
+
+static size_t classic_pcap(uint32_t magic, bool swap) {
+	memset(file, 0, sizeof(file));
+	put32(file, magic, swap);
+	put32(file + 4, 2 | 4 << 16, swap);
+	put32(file + 16, 65535, swap);
+	put32(file + 20, PCAP_LINKTYPE_ETHERNET, swap);
+
+	uint8_t* p = file + 24;
+	put32(p, 3, swap);
+	put32(p + 4, 500, swap);
+	put32(p + 8, 60, swap);
+	put32(p + 12, 1514, swap);
+	fill_frame(9);
+	memcpy(p + 16, frame, 60);
+
+	return 24 + 16 + 60;
+}
+
+static void pcap_classic_func() {
+	PcapReader reader;
+	PcapPacket packet;
+
+	for(int swap = 0; swap < 2; swap++) {
+		size_t size = classic_pcap(0xa1b2c3d4, swap);
+		assert_true(pcap_reader_init(&reader, file, size));
+		assert_true(pcap_reader_next(&reader, &packet));
+		assert_int_equal(packet.time, 3000000000UL + 500000);
+		assert_int_equal(packet.caplen, 60);
+		assert_int_equal(packet.len, 1514);
+		assert_memory_equal(packet.data, frame, 60);
+		assert_false(pcap_reader_next(&reader, &packet));
+
+		// Nanosecond resolution
+		size = classic_pcap(0xa1b23c4d, swap);
+		assert_true(pcap_reader_init(&reader, file, size));
+		assert_true(pcap_reader_next(&reader, &packet));
+		assert_int_equal(packet.time, 3000000500UL);
+	}
+
+	memset(file, 0, sizeof(file));
+	assert_false(pcap_reader_init(&reader, file, sizeof(file)));
+}
+
+static void capture_ring_func() {
+	static uint8_t memory[CAPTURE_MEMORY_SIZE(RING_SIZE)];
+	Capture* capture = (Capture*)memory;
+	CaptureRecord record;
+	uint8_t data[CAPTURE_SNAPLEN];
+
+	capture_init(capture, RING_SIZE, 100, CAPTURE_TX);
+	assert_false(capture_peek(capture, &record));
+
+	// Records wrap around the end of the ring many times
+	for(int i = 0; i < 100; i++) {
+		fill_frame(i);
+		assert_true(capture_write(capture, i, frame, 60 + i));
+		assert_true(capture_write(capture, i + 1000, frame, 60 + i));
+
+		for(int j = 0; j < 2; j++) {
+			assert_true(capture_read(capture, &record, data));
+			assert_int_equal(record.time, i + j * 1000);
+			assert_int_equal(record.len, 60 + i);
+			assert_int_equal(record.caplen, 60 + i < 100 ? 60 + i : 100);
+			assert_int_equal(record.direction, CAPTURE_TX);
+			assert_memory_equal(data, frame, record.caplen);
+		}
+
+		assert_false(capture_read(capture, &record, data));
+	}
+
+	// Packets are dropped when the ring is full
+	int count = 0;
+	while(capture_write(capture, count, frame, 100))
+		count++;
+
+	assert_true(count > 0);
+	assert_int_equal(capture->drops, 1);
+	assert_int_equal(capture->packets, 200 + count);
+
+	for(int i = 0; i < count; i++) {
+		assert_true(capture_peek(capture, &record));
+		assert_int_equal(record.time, i);
+		assert_true(capture_read(capture, &record, data));
+	}
+	assert_false(capture_peek(capture, &record));
+}
+
+int main(void) {
+	const struct CMUnitTest UnitTest[] = {
+		cmocka_unit_test(pcapng_write_read_func),
+		cmocka_unit_test(pcapng_zero_tail_func),
+		cmocka_unit_test(pcap_classic_func),
+		cmocka_unit_test(capture_ring_func),
+	};
+
+	return cmocka_run_group_tests(UnitTest, NULL, NULL);
+}
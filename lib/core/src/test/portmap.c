@@ -0,0 +1,98 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include <net/portmap.h>
+#include <_malloc.h>
+#include <tlsf.h>
+
+#include <malloc.h>
+
+extern void* __malloc_pool;
+
+static void portmap_setup() {
+	__malloc_pool = malloc(0x40000);
+	init_memory_pool(0x40000, __malloc_pool, 0);
+}
+
+static void portmap_teardown() {
+	destroy_memory_pool(__malloc_pool);
+	free(__malloc_pool);
+	__malloc_pool = NULL;
+}
+
+static void portmap_alloc0_func() {
+	portmap_setup();
+
+	PortMap* portmap = portmap_create(NULL);
+	assert_non_null(portmap);
+
+	assert_true(portmap_alloc0(portmap, 0));
+	assert_true(portmap_alloc0(portmap, 80));
+	assert_true(portmap_alloc0(portmap, 65535));
+	assert_false(portmap_alloc0(portmap, 80));
+	assert_int_equal(3, portmap_size(portmap));
+
+	portmap_free(portmap, 80);
+	assert_false(portmap_contains(portmap, 80));
+	assert_true(portmap_alloc0(portmap, 80));
+
+	portmap_destroy(portmap);
+	portmap_teardown();
+}
+
+static void portmap_alloc_exhaust_func() {
+	portmap_setup();
+
+	PortMap* portmap = portmap_create(NULL);
+	assert_non_null(portmap);
+
+	/* Every ephemeral port must be allocated exactly once */
+	int count = PORTMAP_EPHEMERAL_MAX - PORTMAP_EPHEMERAL_MIN + 1;
+	for(int i = 0; i < count; i++) {
+		uint16_t port = portmap_alloc(portmap);
+		assert_in_range(port, PORTMAP_EPHEMERAL_MIN, PORTMAP_EPHEMERAL_MAX);
+	}
+	assert_int_equal(count, portmap_size(portmap));
+	assert_int_equal(0, portmap_alloc(portmap));
+	assert_int_equal(0, portmap_alloc_dst(portmap, 0xc0a80001, 0xc0a80002, 80));
+
+	/* Freed port is the only candidate */
+	portmap_free(portmap, 50000);
+	assert_int_equal(50000, portmap_alloc(portmap));
+
+	portmap_free(portmap, PORTMAP_EPHEMERAL_MAX);
+	assert_int_equal(PORTMAP_EPHEMERAL_MAX, portmap_alloc_dst(portmap, 0xc0a80001, 0xc0a80002, 80));
+
+	portmap_destroy(portmap);
+	portmap_teardown();
+}
+
+static void portmap_alloc_dst_func() {
+	portmap_setup();
+
+	PortMap* portmap = portmap_create(NULL);
+	assert_non_null(portmap);
+
+	/* Same destination walks sequentially */
+	uint16_t port = portmap_alloc_dst(portmap, 0xc0a80001, 0xc0a80002, 80);
+	assert_in_range(port, PORTMAP_EPHEMERAL_MIN, PORTMAP_EPHEMERAL_MAX);
+	portmap_free(portmap, port);
+
+	uint16_t next = portmap_alloc_dst(portmap, 0xc0a80001, 0xc0a80002, 80);
+	uint16_t expected = port == PORTMAP_EPHEMERAL_MAX ? PORTMAP_EPHEMERAL_MIN : port + 1;
+	assert_int_equal(expected, next);
+
+	portmap_destroy(portmap);
+	portmap_teardown();
+}
+
+int main(void) {
+	const struct CMUnitTest UnitTest[] = {
+		cmocka_unit_test(portmap_alloc0_func),
+		cmocka_unit_test(portmap_alloc_exhaust_func),
+		cmocka_unit_test(portmap_alloc_dst_func),
+	};
+	return cmocka_run_group_tests(UnitTest, NULL, NULL);
+}
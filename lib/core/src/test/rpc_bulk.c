@@ -0,0 +1,502 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <control/rpc.h>
+
+#define BLOCK_SIZE	0x200000	// Same as VM_STORAGE_SIZE_ALIGN
+#define BLOCK_COUNT	16
+#define STORAGE_SIZE	((uint64_t)BLOCK_SIZE * BLOCK_COUNT)
+#define VMID		7
+
+/*
+ * Loopback connection, a pipe per direction
+ */
+typedef struct {
+	uint8_t*	buf;
+	int		size;
+	int		head;
+	int		tail;
+} Pipe;
+
+typedef struct {
+	Pipe*		in;
+	Pipe*		out;
+	int		mtu;	// Maximum bytes per write, like a socket buffer
+} PipeData;
+
+static uint8_t* blocks[BLOCK_COUNT];
+static uint8_t* file;
+
+static int pipe_read(RPC* rpc, void* buf, int size) {
+	Pipe* pipe = ((PipeData*)rpc->data)->in;
+	int len = pipe->tail - pipe->head;
+	if(len > size)
+		len = size;
+
+	memcpy(buf, pipe->buf + pipe->head, len);
+	pipe->head += len;
+	if(pipe->head == pipe->tail)
+		pipe->head = pipe->tail = 0;
+
+	return len;
+}
+
+static int pipe_write(RPC* rpc, void* buf, int size) {
+	PipeData* data = (PipeData*)rpc->data;
+	Pipe* pipe = data->out;
+	if(pipe->head > 0 && pipe->tail + size > pipe->size) {
+		memmove(pipe->buf, pipe->buf + pipe->head, pipe->tail - pipe->head);
+		pipe->tail -= pipe->head;
+		pipe->head = 0;
+	}
+
+	int len = pipe->size - pipe->tail;
+	if(len > size)
+		len = size;
+	if(len > data->mtu)
+		len = data->mtu;
+
+	memcpy(pipe->buf + pipe->tail, buf, len);
+	pipe->tail += len;
+
+	return len;
+}
+
+static Pipe* pipe_create(int size) {
+	Pipe* pipe = calloc(1, sizeof(Pipe));
+	pipe->buf = malloc(size);
+	pipe->size = size;
+
+	return pipe;
+}
+
+static void pipe_destroy(Pipe* pipe) {
+	free(pipe->buf);
+	free(pipe);
+}
+
+static RPC* rpc_create(Pipe* in, Pipe* out, int mtu) {
+	RPC* rpc = calloc(1, sizeof(RPC) + sizeof(PipeData));
+	rpc->read = pipe_read;
+	rpc->write = pipe_write;
+
+	PipeData* data = (PipeData*)rpc->data;
+	data->in = in;
+	data->out = out;
+	data->mtu = mtu;
+
+	return rpc;
+}
+
+/*
+ * Server side, same as the manager's storage handlers
+ */
+static int32_t storage_bulk_handler(RPC* rpc, uint32_t id, uint64_t offset, void** buf, int32_t size, void* context) {
+	if(id != VMID)
+		return -1;
+
+	if(offset >= STORAGE_SIZE) {
+		*buf = NULL;
+		return 0;
+	}
+
+	*buf = blocks[offset / BLOCK_SIZE] + offset % BLOCK_SIZE;
+	if(offset % BLOCK_SIZE + size > BLOCK_SIZE)
+		return BLOCK_SIZE - offset % BLOCK_SIZE;
+	else
+		return size;
+}
+
+static void storage_download_handler(RPC* rpc, uint32_t id, uint64_t download_size, uint32_t offset, int32_t size, void* context, void(*callback)(RPC* rpc, void* buf, int32_t size)) {
+	void* buf = NULL;
+	if(offset + size > download_size)
+		size = download_size - offset;
+	size = storage_bulk_handler(rpc, id, offset, &buf, size, context);
+
+	callback(rpc, buf, size);
+}
+
+static void storage_digest_handler(RPC* rpc, uint32_t id, uint32_t index, int count, void* context, void(*callback)(RPC* rpc, uint32_t index, uint32_t* digests, int count)) {
+	if(id != VMID) {
+		callback(rpc, index, NULL, -1);
+		return;
+	}
+
+	// Stand-in digest, the first words of the block
+	uint32_t digests[count][4];
+	int i;
+	for(i = 0; i < count && index + i < BLOCK_COUNT; i++)
+		memcpy(digests[i], blocks[index + i], sizeof(digests[i]));
+
+	callback(rpc, index, (uint32_t*)digests, i);
+}
+
+static void storage_block_handler(RPC* rpc, uint32_t id, uint32_t index, uint8_t encoding, void* buf, int32_t size, void* context, void(*callback)(RPC* rpc, uint32_t index, int32_t status)) {
+	if(id != VMID || index >= BLOCK_COUNT || encoding != RPC_STORAGE_BLOCK_RAW || size > BLOCK_SIZE) {
+		callback(rpc, index, -1);
+		return;
+	}
+
+	memcpy(blocks[index], buf, size);
+	memset(blocks[index] + size, 0, BLOCK_SIZE - size);
+	callback(rpc, index, 0);
+}
+
+/*
+ * Client side, the file is in memory
+ */
+typedef struct {
+	uint64_t	size;
+	uint64_t	offset;
+	int32_t		status;
+	bool		is_done;
+	uint64_t	fail_at;	// Make map fail at the offset, 0 not to
+} Transfer;
+
+static int32_t file_map(uint64_t offset, void** buf, int32_t size, void* context) {
+	Transfer* transfer = context;
+	if(transfer->fail_at && offset >= transfer->fail_at)
+		return -2;
+
+	if(offset >= transfer->size)
+		return 0;
+
+	*buf = file + offset;
+	return offset + size > transfer->size ? (int32_t)(transfer->size - offset) : size;
+}
+
+static void file_done(uint64_t offset, int32_t status, void* context) {
+	Transfer* transfer = context;
+	transfer->offset = offset;
+	transfer->status = status;
+	transfer->is_done = true;
+}
+
+static int32_t file_download(uint32_t offset, void* buf, int32_t size, void* context) {
+	Transfer* transfer = context;
+	if(size <= 0) {
+		transfer->status = size;
+		transfer->is_done = true;
+		return 0;
+	}
+
+	memcpy(file + offset, buf, size);
+	transfer->offset = offset + size;
+
+	return size;
+}
+
+static void fill(uint8_t seed) {
+	for(int i = 0; i < BLOCK_COUNT; i++) {
+		for(int j = 0; j < BLOCK_SIZE; j += sizeof(uint32_t))
+			*(uint32_t*)(blocks[i] + j) = (i * BLOCK_SIZE + j) * 2654435761U + seed;
+	}
+}
+
+static bool storage_equals(uint64_t offset, uint64_t size) {
+	for(uint64_t i = offset; i < offset + size; i++) {
+		if(blocks[i / BLOCK_SIZE][i % BLOCK_SIZE] != file[i])
+			return false;
+	}
+
+	return true;
+}
+
+static RPC* client;
+static RPC* server;
+static Pipe* up;
+static Pipe* down;
+
+static void loopback_open(int pipe_size, int mtu) {
+	up = pipe_create(pipe_size);
+	down = pipe_create(pipe_size);
+	client = rpc_create(down, up, mtu);
+	server = rpc_create(up, down, mtu);
+	rpc_storage_bulk_handler(server, storage_bulk_handler, NULL);
+	rpc_storage_download_handler(server, storage_download_handler, NULL);
+	rpc_storage_digest_handler(server, storage_digest_handler, NULL);
+	rpc_storage_block_handler(server, storage_block_handler, NULL);
+}
+
+static void loopback_close() {
+	free(client);
+	free(server);
+	pipe_destroy(up);
+	pipe_destroy(down);
+}
+
+static void run(Transfer* transfer) {
+	for(int i = 0; !transfer->is_done || rpc_is_active(server); i++) {
+		rpc_loop(client);
+		rpc_loop(server);
+		assert_true(i < 10000000);
+	}
+}
+
+static uint64_t now() {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+
+	return tv.tv_sec * 1000000UL + tv.tv_usec;
+}
+
+static int setup(void** state) {
+	for(int i = 0; i < BLOCK_COUNT; i++)
+		blocks[i] = malloc(BLOCK_SIZE);
+	file = malloc(STORAGE_SIZE);
+
+	return 0;
+}
+
+static int teardown(void** state) {
+	for(int i = 0; i < BLOCK_COUNT; i++)
+		free(blocks[i]);
+	free(file);
+
+	return 0;
+}
+
+static void bulk_download_func() {
+	loopback_open(262144, 65536);
+	fill(1);
+	memset(file, 0, STORAGE_SIZE);
+
+	// To the end of storage
+	Transfer transfer = { .size = STORAGE_SIZE };
+	assert_true(rpc_storage_bulk_download(client, VMID, 0, 0, 0, file_map, file_done, &transfer) > 0);
+	run(&transfer);
+
+	assert_int_equal(transfer.status, 0);
+	assert_int_equal(transfer.offset, STORAGE_SIZE);
+	assert_true(storage_equals(0, STORAGE_SIZE));
+	assert_false(rpc_is_active(client));
+
+	loopback_close();
+}
+
+static void bulk_download_window_func() {
+	// Window is smaller than a chunk, frames cross the blocks
+	loopback_open(4096, 1460);
+	fill(2);
+	memset(file, 0, STORAGE_SIZE);
+
+	uint64_t offset = BLOCK_SIZE - 5000;
+	Transfer transfer = { .size = STORAGE_SIZE };
+	assert_true(rpc_storage_bulk_download(client, VMID, offset, 100000, 3000, file_map, file_done, &transfer) > 0);
+	run(&transfer);
+
+	assert_int_equal(transfer.status, 0);
+	assert_int_equal(transfer.offset, offset + 100000);
+	assert_true(storage_equals(offset, 100000));
+	assert_int_equal(file[offset - 1], 0);
+	assert_int_equal(file[offset + 100000], 0);
+
+	loopback_close();
+}
+
+static void bulk_upload_resume_func() {
+	loopback_open(262144, 65536);
+	fill(3);
+	for(uint64_t i = 0; i < STORAGE_SIZE; i++)
+		file[i] = i * 7 + 3;
+
+	// Client fails in the middle
+	uint64_t size = STORAGE_SIZE - 12345;
+	Transfer transfer = { .size = size, .fail_at = 5 * BLOCK_SIZE + 100 };
+	assert_true(rpc_storage_bulk_upload(client, VMID, 0, size, 0, file_map, file_done, &transfer) > 0);
+	run(&transfer);
+
+	assert_int_equal(transfer.status, -2);
+	assert_true(transfer.offset < size);
+	assert_true(storage_equals(0, transfer.offset));
+
+	// Resume from what has been acknowledged
+	uint64_t offset = transfer.offset;
+	transfer = (Transfer){ .size = size };
+	assert_true(rpc_storage_bulk_upload(client, VMID, offset, size - offset, 0, file_map, file_done, &transfer) > 0);
+	run(&transfer);
+
+	assert_int_equal(transfer.status, 0);
+	assert_int_equal(transfer.offset, size);
+	assert_true(storage_equals(0, size));
+	assert_false(storage_equals(size, 1));
+
+	loopback_close();
+}
+
+static void bulk_error_func() {
+	loopback_open(262144, 65536);
+
+	// VM is not found
+	Transfer transfer = { .size = STORAGE_SIZE };
+	assert_true(rpc_storage_bulk_download(client, VMID + 1, 0, 0, 0, file_map, file_done, &transfer) > 0);
+	run(&transfer);
+	assert_true(transfer.status < 0);
+	assert_int_equal(transfer.offset, 0);
+
+	transfer = (Transfer){ .size = STORAGE_SIZE };
+	assert_true(rpc_storage_bulk_upload(client, VMID + 1, 0, 0, 0, file_map, file_done, &transfer) > 0);
+	run(&transfer);
+	assert_true(transfer.status < 0);
+	assert_false(rpc_is_active(client));
+
+	// Connection is still usable
+	transfer = (Transfer){ .size = STORAGE_SIZE };
+	assert_true(rpc_storage_bulk_download(client, VMID, 0, 4096, 0, file_map, file_done, &transfer) > 0);
+	run(&transfer);
+	assert_int_equal(transfer.status, 0);
+	assert_int_equal(transfer.offset, 4096);
+
+	loopback_close();
+}
+
+typedef struct {
+	uint32_t	digests[BLOCK_COUNT][4];
+	int		count;
+	int		blocks;
+	int		errors;
+	bool		is_done;
+} Sync;
+
+static bool digest_received(uint32_t index, uint32_t* digests, int32_t count, void* context) {
+	Sync* sync = context;
+	if(count > 0)
+		memcpy(sync->digests[index], digests, sizeof(uint32_t) * 4 * count);
+
+	sync->count = count;
+	sync->is_done = true;
+
+	return false;
+}
+
+static bool block_written(uint32_t index, int32_t status, void* context) {
+	Sync* sync = context;
+	if(status < 0)
+		sync->errors++;
+	else
+		sync->blocks++;
+	sync->is_done = true;
+
+	return true;
+}
+
+static void run_sync(Sync* sync) {
+	for(int i = 0; !sync->is_done || rpc_is_active(client) || rpc_is_active(server); i++) {
+		rpc_loop(client);
+		rpc_loop(server);
+		assert_true(i < 10000000);
+	}
+}
+
+static void digest_func() {
+	loopback_open(262144, 1460);
+	fill(5);
+
+	// Digests are requested until the end of storage
+	Sync sync = {};
+	uint32_t index = 0;
+	do {
+		sync.is_done = false;
+		assert_true(rpc_storage_digest(client, VMID, index, digest_received, &sync) > 0);
+		run_sync(&sync);
+		index += sync.count;
+	} while(sync.count > 0);
+
+	assert_int_equal(index, BLOCK_COUNT);
+	for(int i = 0; i < BLOCK_COUNT; i++)
+		assert_memory_equal(sync.digests[i], blocks[i], sizeof(sync.digests[i]));
+
+	sync = (Sync){};
+	assert_true(rpc_storage_digest(client, VMID + 1, 0, digest_received, &sync) > 0);
+	run_sync(&sync);
+	assert_true(sync.count < 0);
+
+	loopback_close();
+}
+
+static void block_func() {
+	loopback_open(262144, 1460);
+	fill(6);
+	for(uint64_t i = 0; i < STORAGE_SIZE; i++)
+		file[i] = i * 13 + 1;
+
+	// Whole block, a short block padded with zeros and a block out of range
+	Sync sync = {};
+	assert_int_equal(rpc_storage_block(client, VMID, 3, RPC_STORAGE_BLOCK_RAW, file + 3 * BLOCK_SIZE, BLOCK_SIZE, block_written, &sync), 1);
+	assert_int_equal(rpc_storage_block(client, VMID, 4, RPC_STORAGE_BLOCK_RAW, file, 100, block_written, &sync), 0);
+	run_sync(&sync);
+
+	sync.is_done = false;
+	assert_int_equal(rpc_storage_block(client, VMID, 4, RPC_STORAGE_BLOCK_RAW, file + 4 * BLOCK_SIZE, 100, block_written, &sync), 1);
+	run_sync(&sync);
+
+	sync.is_done = false;
+	assert_int_equal(rpc_storage_block(client, VMID, BLOCK_COUNT, RPC_STORAGE_BLOCK_RAW, file, 100, block_written, &sync), 1);
+	run_sync(&sync);
+
+	// Larger than a block
+	sync.is_done = false;
+	assert_int_equal(rpc_storage_block(client, VMID, 5, RPC_STORAGE_BLOCK_DEFLATE, file, BLOCK_SIZE + 1, block_written, &sync), 1);
+	run_sync(&sync);
+
+	assert_int_equal(sync.blocks, 2);
+	assert_int_equal(sync.errors, 2);
+	assert_true(storage_equals(3 * BLOCK_SIZE, BLOCK_SIZE + 100));
+	assert_int_equal(blocks[4][100], 0);
+	assert_int_equal(blocks[4][BLOCK_SIZE - 1], 0);
+	assert_false(storage_equals(2 * BLOCK_SIZE, 1));
+	assert_false(rpc_is_active(client));
+
+	loopback_close();
+}
+
+static void bulk_benchmark_func() {
+	loopback_open(262144, 65536);
+	fill(4);
+
+	uint64_t time = now();
+	Transfer transfer = { .size = STORAGE_SIZE };
+	rpc_storage_download(client, VMID, STORAGE_SIZE, file_download, &transfer);
+	run(&transfer);
+	uint64_t legacy = now() - time;
+	assert_int_equal(transfer.offset, STORAGE_SIZE);
+
+	time = now();
+	transfer = (Transfer){ .size = STORAGE_SIZE };
+	rpc_storage_bulk_download(client, VMID, 0, 0, 0, file_map, file_done, &transfer);
+	run(&transfer);
+	uint64_t download = now() - time;
+	assert_int_equal(transfer.offset, STORAGE_SIZE);
+
+	time = now();
+	transfer = (Transfer){ .size = STORAGE_SIZE };
+	rpc_storage_bulk_upload(client, VMID, 0, 0, 0, file_map, file_done, &transfer);
+	run(&transfer);
+	uint64_t upload = now() - time;
+	assert_int_equal(transfer.offset, STORAGE_SIZE);
+
+	double mb = (double)STORAGE_SIZE / (1024 * 1024);
+	printf("Loopback %.0f MB, legacy download: %.1f MB/s, bulk download: %.1f MB/s, bulk upload: %.1f MB/s\n",
+			mb, mb * 1000000 / (legacy ? legacy : 1), mb * 1000000 / (download ? download : 1), mb * 1000000 / (upload ? upload : 1));
+
+	loopback_close();
+}
+
+int main(void) {
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(bulk_download_func),
+		cmocka_unit_test(bulk_download_window_func),
+		cmocka_unit_test(bulk_upload_resume_func),
+		cmocka_unit_test(bulk_error_func),
+		cmocka_unit_test(digest_func),
+		cmocka_unit_test(block_func),
+		cmocka_unit_test(bulk_benchmark_func),
+	};
+	return cmocka_run_group_tests(tests, setup, teardown);
+}
@@ -0,0 +1,583 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <control/rpc.h>
+
+#define VM_COUNT	64
+
+/*
+ * Loopback connection, a pipe per direction
+ */
+typedef struct {
+	uint8_t*	buf;
+	int		size;
+	int		head;
+	int		tail;
+} Pipe;
+
+typedef struct {
+	Pipe*		in;
+	Pipe*		out;
+	int		mtu;	// Maximum bytes per write, like a socket buffer
+} PipeData;
+
+static int pipe_read(RPC* rpc, void* buf, int size) {
+	Pipe* pipe = ((PipeData*)rpc->data)->in;
+	int len = pipe->tail - pipe->head;
+	if(len > size)
+		len = size;
+
+	memcpy(buf, pipe->buf + pipe->head, len);
+	pipe->head += len;
+	if(pipe->head == pipe->tail)
+		pipe->head = pipe->tail = 0;
+
+	return len;
+}
+
+static int pipe_write(RPC* rpc, void* buf, int size) {
+	PipeData* data = (PipeData*)rpc->data;
+	Pipe* pipe = data->out;
+	if(pipe->head > 0 && pipe->tail + size > pipe->size) {
+		memmove(pipe->buf, pipe->buf + pipe->head, pipe->tail - pipe->head);
+		pipe->tail -= pipe->head;
+		pipe->head = 0;
+	}
+
+	int len = pipe->size - pipe->tail;
+	if(len > size)
+		len = size;
+	if(len > data->mtu)
+		len = data->mtu;
+
+	memcpy(pipe->buf + pipe->tail, buf, len);
+	pipe->tail += len;
+
+	return len;
+}
+
+static Pipe* pipe_create(int size) {
+	Pipe* pipe = calloc(1, sizeof(Pipe));
+	pipe->buf = malloc(size);
+	pipe->size = size;
+
+	return pipe;
+}
+
+static void pipe_destroy(Pipe* pipe) {
+	free(pipe->buf);
+	free(pipe);
+}
+
+static RPC* rpc_create(Pipe* in, Pipe* out, int mtu) {
+	RPC* rpc = calloc(1, sizeof(RPC) + sizeof(PipeData));
+	rpc->read = pipe_read;
+	rpc->write = pipe_write;
+
+	PipeData* data = (PipeData*)rpc->data;
+	data->in = in;
+	data->out = out;
+	data->mtu = mtu;
+
+	return rpc;
+}
+
+/*
+ * Server side, status of even VMs is answered later in reverse order like an
+ * asynchronous handler of the manager
+ */
+typedef struct {
+	RPC*		rpc;
+	uint32_t	request_id;
+	uint32_t	vmid;
+	void(*callback)(RPC* rpc, VMStatus status);
+} Deferred;
+
+static Deferred deferred[VM_COUNT];
+static int deferred_count;
+
+static VMStatus vm_status(uint32_t vmid) {
+	return vmid % 2 ? VM_STATUS_START : VM_STATUS_PAUSE;
+}
+
+static void status_get_handler(RPC* rpc, uint32_t id, void* context, void(*callback)(RPC* rpc, VMStatus status)) {
+	if(id % 2) {
+		callback(rpc, vm_status(id));
+		return;
+	}
+
+	Deferred* d = &deferred[deferred_count++];
+	d->rpc = rpc;
+	d->request_id = rpc->request_id;
+	d->vmid = id;
+	d->callback = callback;
+}
+
+static void deferred_answer() {
+	while(deferred_count > 0) {
+		Deferred* d = &deferred[--deferred_count];
+		d->rpc->request_id = d->request_id;
+		d->callback(d->rpc, vm_status(d->vmid));
+	}
+}
+
+/*
+ * Batch handlers, VMs of odd ID exist
+ */
+static void vm_create_batch_handler(RPC* rpc, VMSpec** vms, int count, void* context, void(*callback)(RPC* rpc, uint32_t* ids, int count)) {
+	uint32_t ids[RPC_MAX_BATCH];
+	for(int i = 0; i < count; i++)
+		ids[i] = vms[i] && vms[i]->core_size > 0 ? 100 + vms[i]->core_size : 0;
+
+	callback(rpc, ids, count);
+}
+
+static void status_set_batch_handler(RPC* rpc, uint32_t* ids, int count, VMStatus status, void* context, void(*callback)(RPC* rpc, bool* results, int count)) {
+	bool results[RPC_MAX_BATCH];
+	for(int i = 0; i < count; i++)
+		results[i] = ids[i] % 2 && status == VM_STATUS_START;
+
+	callback(rpc, results, count);
+}
+
+static RPC* client;
+static RPC* server;
+
+/*
+ * Telemetry subscription, samples are sent by the test like the timer of the
+ * manager
+ */
+typedef struct {
+	uint32_t	request_id;
+	uint32_t	interval;
+	int		nic_size;
+	int		cancels;
+	void(*callback)(RPC* rpc, VMTelemetry* telemetry, VMCoreTelemetry* cores, int core_count, VMNICTelemetry* nics, int nic_count);
+} Subscription;
+
+static Subscription subscription;
+
+static void telemetry_handler(RPC* rpc, uint32_t interval, int nic_size, void* context, void(*callback)(RPC* rpc, VMTelemetry* telemetry, VMCoreTelemetry* cores, int core_count, VMNICTelemetry* nics, int nic_count)) {
+	if(interval == 0) {
+		if(subscription.request_id == rpc->request_id) {
+			subscription.interval = 0;
+			subscription.cancels++;
+		}
+		return;
+	}
+
+	subscription.request_id = rpc->request_id;
+	subscription.interval = interval;
+	subscription.nic_size = nic_size;
+	subscription.callback = callback;
+}
+
+static void telemetry_sample(uint64_t time) {
+	if(subscription.interval == 0)
+		return;
+
+	VMTelemetry telemetry = { .time = time, .gmalloc_used = 1, .gmalloc_total = 2 };
+	VMCoreTelemetry cores[2] = {
+		{ .core = 0, .idle = time / 2, .events = time },
+		{ .core = 1, .vmid = 7, .idle = 0, .events = 1 },
+	};
+	VMNICTelemetry nics[3] = {
+		{ .vmid = 7, .nic = 0, .rx_packets = time },
+		{ .vmid = 7, .nic = 1, .tx_packets = time },
+		{ .vmid = 8, .nic = 0, .rx_drops = time },
+	};
+
+	server->request_id = subscription.request_id;
+	subscription.callback(server, &telemetry, cores, 2, nics, subscription.nic_size < 3 ? subscription.nic_size : 3);
+}
+
+static Pipe* up;
+static Pipe* down;
+
+static void loopback_open(int pipe_size, int mtu) {
+	up = pipe_create(pipe_size);
+	down = pipe_create(pipe_size);
+	client = rpc_create(down, up, mtu);
+	server = rpc_create(up, down, mtu);
+	rpc_status_get_handler(server, status_get_handler, NULL);
+	rpc_vm_create_batch_handler(server, vm_create_batch_handler, NULL);
+	rpc_status_set_batch_handler(server, status_set_batch_handler, NULL);
+	rpc_telemetry_handler(server, telemetry_handler, NULL);
+	memset(&subscription, 0, sizeof(Subscription));
+	deferred_count = 0;
+}
+
+static void loopback_close() {
+	free(client);
+	free(server);
+	pipe_destroy(up);
+	pipe_destroy(down);
+}
+
+static void run() {
+	for(int i = 0; rpc_pending(client) > 0; i++) {
+		rpc_loop(client);
+		rpc_loop(server);
+		if(i % 2)
+			deferred_answer();
+		assert_true(i < 1000);
+	}
+}
+
+/*
+ * Client side
+ */
+typedef struct {
+	uint32_t	vmid;
+	VMStatus	status;
+	int		order;	// Order of the response, 0 if not received
+} Status;
+
+static int received;
+
+static bool status_received(VMStatus status, void* context) {
+	Status* s = context;
+	assert_int_equal(s->order, 0);
+
+	s->status = status;
+	s->order = ++received;
+
+	return false;
+}
+
+static void pipeline_func() {
+	loopback_open(1 << 16, 1 << 16);
+
+	Status statuses[VM_COUNT] = {};
+	received = 0;
+
+	// Every request is sent before any response
+	for(int i = 0; i < VM_COUNT; i++) {
+		statuses[i].vmid = i;
+		assert_true(rpc_status_get(client, i, status_received, &statuses[i]) > 0);
+	}
+	assert_int_equal(rpc_pending(client), VM_COUNT);
+
+	run();
+
+	assert_int_equal(received, VM_COUNT);
+	for(int i = 0; i < VM_COUNT; i++) {
+		assert_int_not_equal(statuses[i].order, 0);
+		assert_int_equal(statuses[i].status, vm_status(i));
+	}
+
+	// Deferred responses are out of order
+	assert_true(statuses[0].order > statuses[2].order);
+	assert_true(statuses[0].order > statuses[1].order);
+
+	loopback_close();
+}
+
+static void pipeline_full_func() {
+	loopback_open(1 << 16, 1 << 16);
+
+	Status statuses[RPC_MAX_REQUESTS] = {};
+	received = 0;
+
+	for(int i = 0; i < RPC_MAX_REQUESTS; i++) {
+		statuses[i].vmid = i % VM_COUNT * 2 + 1;
+		assert_true(rpc_status_get(client, statuses[i].vmid, status_received, &statuses[i]) > 0);
+	}
+
+	// No slot until a response is received
+	Status status = {};
+	assert_int_equal(rpc_status_get(client, 1, status_received, &status), 0);
+	assert_int_equal(rpc_pending(client), RPC_MAX_REQUESTS);
+
+	while(rpc_pending(client) == RPC_MAX_REQUESTS) {
+		rpc_loop(client);
+		rpc_loop(server);
+	}
+	assert_true(rpc_status_get(client, 1, status_received, &status) > 0);
+
+	run();
+
+	assert_int_equal(received, RPC_MAX_REQUESTS + 1);
+	assert_int_equal(status.status, VM_STATUS_START);
+
+	loopback_close();
+}
+
+static void response_unknown_func() {
+	loopback_open(1 << 16, 1 << 16);
+
+	Status statuses[2] = {};
+	received = 0;
+
+	assert_true(rpc_status_get(client, 0, status_received, &statuses[0]) > 0);
+	assert_true(rpc_status_get(client, 1, status_received, &statuses[1]) > 0);
+
+	// Response of the deferred request is lost, the other is still delivered
+	while(received == 0) {
+		rpc_loop(client);
+		rpc_loop(server);
+	}
+	deferred_count = 0;
+
+	assert_int_equal(statuses[1].order, 1);
+	assert_int_equal(statuses[0].order, 0);
+	assert_int_equal(rpc_pending(client), 1);
+
+	loopback_close();
+}
+
+typedef struct {
+	int		count;
+	uint32_t	ids[RPC_MAX_BATCH];
+	bool		results[RPC_MAX_BATCH];
+} Batch;
+
+static bool vms_created(uint32_t* ids, int count, void* context) {
+	Batch* batch = context;
+	batch->count = count;
+	memcpy(batch->ids, ids, sizeof(uint32_t) * count);
+
+	return false;
+}
+
+static bool vms_done(bool* results, int count, void* context) {
+	Batch* batch = context;
+	batch->count = count;
+	memcpy(batch->results, results, sizeof(bool) * count);
+
+	return false;
+}
+
+static void batch_func() {
+	loopback_open(1 << 16, 1 << 16);
+
+	// Create
+	char* argv[] = { "/boot/init", "hello" };
+	VMSpec specs[3] = {
+		{ .core_size = 1, .argc = 2, .argv = argv },
+		{ .core_size = 0, .argc = 2, .argv = argv },
+		{ .core_size = 4, .argc = 1, .argv = argv },
+	};
+	VMSpec* vms[4] = { &specs[0], &specs[1], NULL, &specs[2] };
+
+	Batch created = { .count = -1 };
+	assert_true(rpc_vm_create_batch(client, vms, 4, vms_created, &created) > 0);
+
+	// Start, every batch is answered by its own response
+	uint32_t ids[RPC_MAX_BATCH];
+	for(int i = 0; i < RPC_MAX_BATCH; i++)
+		ids[i] = i;
+
+	Batch started = { .count = -1 };
+	Batch paused = { .count = -1 };
+	assert_true(rpc_status_set_batch(client, ids, RPC_MAX_BATCH, VM_STATUS_START, vms_done, &started) > 0);
+	assert_true(rpc_status_set_batch(client, ids, 3, VM_STATUS_PAUSE, vms_done, &paused) > 0);
+
+	// Destroy, no handler
+	Batch destroyed = { .count = -1 };
+	assert_true(rpc_vm_destroy_batch(client, ids + 1, 2, vms_done, &destroyed) > 0);
+
+	assert_true(rpc_status_set_batch(client, ids, RPC_MAX_BATCH + 1, VM_STATUS_START, vms_done, NULL) < 0);
+	assert_int_equal(rpc_pending(client), 4);
+
+	run();
+
+	assert_int_equal(created.count, 4);
+	assert_int_equal(created.ids[0], 101);
+	assert_int_equal(created.ids[1], 0);
+	assert_int_equal(created.ids[2], 0);
+	assert_int_equal(created.ids[3], 104);
+
+	assert_int_equal(started.count, RPC_MAX_BATCH);
+	for(int i = 0; i < RPC_MAX_BATCH; i++)
+		assert_int_equal(started.results[i], i % 2);
+
+	assert_int_equal(paused.count, 3);
+	for(int i = 0; i < 3; i++)
+		assert_false(paused.results[i]);
+
+	assert_int_equal(destroyed.count, 2);
+	assert_false(destroyed.results[0]);
+	assert_false(destroyed.results[1]);
+
+	loopback_close();
+}
+
+typedef struct {
+	int		count;
+	uint64_t	time;
+	uint16_t	core_count;
+	uint16_t	nic_count;
+	uint32_t	vmid;
+} Samples;
+
+static bool telemetry_received(VMTelemetry* telemetry, VMCoreTelemetry* cores, uint16_t core_count, VMNICTelemetry* nics, uint16_t nic_count, void* context) {
+	Samples* samples = context;
+	assert_non_null(telemetry);
+	assert_true(telemetry->time > samples->time);
+
+	samples->count++;
+	samples->time = telemetry->time;
+	samples->core_count = core_count;
+	samples->nic_count = nic_count;
+	samples->vmid = cores[1].vmid;
+	assert_int_equal(nics[nic_count - 1].rx_drops, telemetry->time);
+
+	// Unsubscribed after 3 samples
+	return samples->count < 3;
+}
+
+static void telemetry_func() {
+	loopback_open(1 << 16, 1 << 16);
+
+	assert_true(rpc_telemetry(client, 0, telemetry_received, NULL) < 0);
+
+	Samples samples = {};
+	assert_true(rpc_telemetry(client, 100, telemetry_received, &samples) > 0);
+
+	// Other requests are answered between the samples
+	Status status = {};
+	received = 0;
+	assert_true(rpc_status_get(client, 1, status_received, &status) > 0);
+
+	for(int i = 1; i <= 10; i++) {
+		rpc_loop(client);
+		rpc_loop(server);
+		telemetry_sample(i);
+	}
+
+	assert_int_equal(status.status, VM_STATUS_START);
+	assert_int_equal(samples.count, 3);
+	assert_int_equal(samples.core_count, 2);
+	assert_int_equal(samples.vmid, 7);
+	assert_int_equal(subscription.interval, 0);
+	assert_int_equal(subscription.cancels, 1);
+	assert_int_equal(rpc_pending(client), 0);
+
+	loopback_close();
+}
+
+static void telemetry_nic_size_func() {
+	loopback_open(4096, 4096);
+
+	// NICs are limited by the buffer of the client
+	Samples samples = {};
+	assert_true(rpc_telemetry(client, 1, telemetry_received, &samples) > 0);
+	while(subscription.interval == 0) {
+		rpc_loop(client);
+		rpc_loop(server);
+	}
+
+	assert_true(subscription.nic_size > 0);
+	telemetry_sample(1);
+	rpc_loop(client);
+	assert_int_equal(samples.count, 1);
+	assert_int_equal(samples.nic_count, subscription.nic_size < 3 ? subscription.nic_size : 3);
+
+	loopback_close();
+}
+
+/*
+ * Standard output, server side sends batches to the client
+ */
+static VMStdio stdio_records[RPC_STDIO_MAX_BATCH * 2];
+static char stdio_buf[RPC_BUFFER_SIZE * 2];
+static int stdio_count;
+static int stdio_len;
+
+static void stdio_batch_received(RPC* rpc, VMStdio* records, int count, void* context) {
+	for(int i = 0; i < count; i++) {
+		VMStdio* record = &stdio_records[stdio_count++];
+		*record = records[i];
+		record->str = stdio_buf + stdio_len;
+		memcpy(record->str, records[i].str, records[i].size);
+		stdio_len += records[i].size;
+	}
+}
+
+static void stdio_batch_func() {
+	loopback_open(1 << 16, 1 << 16);
+	rpc_stdio_batch_handler(client, stdio_batch_received, NULL);
+	stdio_count = stdio_len = 0;
+
+	char out[] = "hello\n";
+	char err[] = "error\n";
+	VMStdio records[3] = {
+		{ .vmid = 1, .thread_id = 0, .fd = 1, .size = 6, .str = out },
+		{ .vmid = 1, .thread_id = 0, .fd = 2, .size = 6, .dropped = 100, .str = err },
+		{ .vmid = 2, .thread_id = 3, .fd = 1, .size = 0, .dropped = 7, .str = out },
+	};
+	assert_int_equal(rpc_stdio_batch(server, records, 3), 3);
+
+	// No request is taken
+	assert_int_equal(rpc_pending(server), 0);
+	for(int i = 0; i < 4; i++) {
+		rpc_loop(server);
+		rpc_loop(client);
+	}
+
+	assert_int_equal(stdio_count, 3);
+	assert_int_equal(stdio_records[0].vmid, 1);
+	assert_memory_equal(stdio_records[0].str, "hello\n", 6);
+	assert_int_equal(stdio_records[1].fd, 2);
+	assert_int_equal(stdio_records[1].dropped, 100);
+	assert_memory_equal(stdio_records[1].str, "error\n", 6);
+	assert_int_equal(stdio_records[2].thread_id, 3);
+	assert_int_equal(stdio_records[2].size, 0);
+	assert_int_equal(stdio_records[2].dropped, 7);
+
+	// Larger than the buffer, the last chunk is cut
+	static char big[RPC_BUFFER_SIZE];
+	memset(big, 'x', sizeof(big));
+	VMStdio bigs[2] = {
+		{ .vmid = 1, .fd = 1, .size = RPC_BUFFER_SIZE / 2, .str = big },
+		{ .vmid = 1, .fd = 1, .size = RPC_BUFFER_SIZE / 2, .str = big },
+	};
+	assert_int_equal(rpc_stdio_batch(server, bigs, 2), 2);
+	assert_true(bigs[1].size < RPC_BUFFER_SIZE / 2);
+	assert_int_equal(rpc_stdio_batch(server, bigs, 2), 0);
+
+	stdio_count = stdio_len = 0;
+	for(int i = 0; i < 4; i++) {
+		rpc_loop(server);
+		rpc_loop(client);
+	}
+	assert_int_equal(stdio_count, 2);
+	assert_int_equal(stdio_len, RPC_BUFFER_SIZE / 2 + bigs[1].size);
+
+	loopback_close();
+}
+
+static void stdio_no_callback_func() {
+	loopback_open(1 << 16, 1 << 16);
+
+	// Requests without callback are done by their responses
+	for(int i = 0; i < RPC_MAX_REQUESTS * 2; i++) {
+		assert_true(rpc_stdio(client, 1, 0, 0, "a", 1, NULL, NULL) > 0);
+		rpc_loop(client);
+		rpc_loop(server);
+		rpc_loop(client);
+	}
+	assert_int_equal(rpc_pending(client), 0);
+
+	loopback_close();
+}
+
+int main(void) {
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(pipeline_func),
+		cmocka_unit_test(pipeline_full_func),
+		cmocka_unit_test(response_unknown_func),
+		cmocka_unit_test(batch_func),
+		cmocka_unit_test(telemetry_func),
+		cmocka_unit_test(telemetry_nic_size_func),
+		cmocka_unit_test(stdio_batch_func),
+		cmocka_unit_test(stdio_no_callback_func),
+	};
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
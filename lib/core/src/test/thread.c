@@ -3,10 +3,18 @@
 #include <setjmp.h>
 #include <cmocka.h>
 
+#include <pthread.h>
 #include <thread.h>
 
-extern int __thread_id;
+#define THREAD_COUNT	4
+#define ROUND_COUNT	1000
+
+extern __thread int __thread_id;
 extern int __thread_count;
+extern uint8_t volatile* __barrior_lock;
+extern uint32_t volatile* __barrior;
+
+static int volatile arrived[ROUND_COUNT];
 
 static void thread_id_func() {
 	for(int i = 0; i < 4000; i++) {
@@ -22,14 +30,46 @@ static void thread_count_func() {
 	}
 }
 
+static void* barrior_thread(void* data) {
+	__thread_id = (int)(intptr_t)data;
+
+	for(int i = 0; i < ROUND_COUNT; i++) {
+		__sync_fetch_and_add(&arrived[i], 1);
+		thread_barrior();
+
+		// Nobody passes the barrior before everybody arrives
+		assert_int_equal(arrived[i], THREAD_COUNT);
+		thread_barrior();
+	}
+
+	return NULL;
+}
+
 static void thread_barrior_func() {
+	static uint8_t volatile lock;
+	static uint32_t volatile barrior;
+	pthread_t threads[THREAD_COUNT];
+
+	__barrior_lock = &lock;
+	__barrior = &barrior;
+	__thread_count = THREAD_COUNT;
+	__thread_id = THREAD_COUNT;
+
+	for(int i = 0; i < THREAD_COUNT; i++)
+		pthread_create(&threads[i], NULL, barrior_thread, (void*)(intptr_t)i);
+
+	for(int i = 0; i < THREAD_COUNT; i++)
+		pthread_join(threads[i], NULL);
 
+	// Thread IDs are thread local
+	assert_int_equal(thread_id(), THREAD_COUNT);
 }
 
 int main() {
 	const struct CMUnitTest UnitTest[] = {
 		cmocka_unit_test(thread_id_func),
-		cmocka_unit_test(thread_count_func)
+		cmocka_unit_test(thread_count_func),
+		cmocka_unit_test(thread_barrior_func)
 	};
 
 	return cmocka_run_group_tests(UnitTest, NULL, NULL);
@@ -0,0 +1,115 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include <net/ether.h>
+#include <net/ip.h>
+#include <net/vlan.h>
+
+#include <string.h>
+
+#define HEAD	32
+
+static uint8_t buffer[sizeof(Packet) + HEAD + ETHER_LEN + IP_LEN];
+
+static Packet* ip_packet() {
+	memset(buffer, 0x0, sizeof(buffer));
+
+	Packet* packet = (Packet*)buffer;
+	packet->start = HEAD;
+	packet->end = HEAD + ETHER_LEN + IP_LEN;
+	packet->size = HEAD + ETHER_LEN + IP_LEN;
+
+	Ether* ether = (Ether*)(packet->buffer + packet->start);
+	ether->dmac = endian48(0x020000000001);
+	ether->smac = endian48(0x020000000002);
+	ether->type = endian16(ETHER_TYPE_IPv4);
+
+	IP* ip = (IP*)ether->payload;
+	ip->version = 4;
+	ip->ihl = IP_LEN / 4;
+	ip->source = endian32(0xc0a80001);
+
+	return packet;
+}
+
+static void vlan_untagged_func() {
+	Packet* packet = ip_packet();
+	Ether* ether = (Ether*)(packet->buffer + packet->start);
+
+	void* payload;
+	assert_int_equal(ETHER_TYPE_IPv4, vlan_ether_type(ether, &payload));
+	assert_true(payload == ether->payload);
+	assert_int_equal(0, vlan_depth(ether));
+	assert_int_equal(0, vlan_vid(ether));
+	assert_false(vlan_pop(packet, NULL));
+	assert_int_equal(HEAD, packet->start);
+}
+
+static void vlan_push_pop_func() {
+	Packet* packet = ip_packet();
+
+	assert_true(vlan_push(packet, ETHER_TYPE_8021Q, VLAN_TCI(VLAN_VOICE, 0, 100)));
+	assert_int_equal(HEAD - VLAN_LEN, packet->start);
+
+	Ether* ether = (Ether*)(packet->buffer + packet->start);
+	assert_int_equal(0x020000000001, endian48(ether->dmac));
+	assert_int_equal(0x020000000002, endian48(ether->smac));
+	assert_int_equal(ETHER_TYPE_8021Q, endian16(ether->type));
+	assert_int_equal(1, vlan_depth(ether));
+	assert_int_equal(100, vlan_vid(ether));
+
+	IP* ip = vlan_payload(ether);
+	assert_int_equal(0xc0a80001, endian32(ip->source));
+
+	uint16_t tci;
+	assert_true(vlan_pop(packet, &tci));
+	assert_int_equal(VLAN_VOICE, VLAN_GET_PCP(tci));
+	assert_int_equal(100, VLAN_GET_VID(tci));
+	assert_int_equal(HEAD, packet->start);
+
+	ether = (Ether*)(packet->buffer + packet->start);
+	assert_int_equal(0x020000000001, endian48(ether->dmac));
+	assert_int_equal(0x020000000002, endian48(ether->smac));
+	assert_int_equal(ETHER_TYPE_IPv4, endian16(ether->type));
+}
+
+static void vlan_qinq_func() {
+	Packet* packet = ip_packet();
+
+	assert_true(vlan_push(packet, ETHER_TYPE_8021Q, 100));
+	assert_true(vlan_push(packet, ETHER_TYPE_8021AD, 200));
+
+	Ether* ether = (Ether*)(packet->buffer + packet->start);
+	assert_int_equal(2, vlan_depth(ether));
+	assert_int_equal(200, vlan_vid(ether));
+
+	IP* ip;
+	assert_int_equal(ETHER_TYPE_IPv4, vlan_ether_type(ether, (void**)&ip));
+	assert_int_equal(0xc0a80001, endian32(ip->source));
+
+	uint16_t tci;
+	assert_true(vlan_pop(packet, &tci));
+	assert_int_equal(200, tci);
+	ether = (Ether*)(packet->buffer + packet->start);
+	assert_int_equal(100, vlan_vid(ether));
+}
+
+static void vlan_no_head_func() {
+	Packet* packet = ip_packet();
+	packet->start = VLAN_LEN - 1;
+
+	assert_false(vlan_push(packet, ETHER_TYPE_8021Q, 100));
+	assert_int_equal(VLAN_LEN - 1, packet->start);
+}
+
+int main(void) {
+	const struct CMUnitTest UnitTest[] = {
+		cmocka_unit_test(vlan_untagged_func),
+		cmocka_unit_test(vlan_push_pop_func),
+		cmocka_unit_test(vlan_qinq_func),
+		cmocka_unit_test(vlan_no_head_func),
+	};
+	return cmocka_run_group_tests(UnitTest, NULL, NULL);
+}
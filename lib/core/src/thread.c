@@ -1,7 +1,11 @@
 #include <lock.h>
 #include <thread.h>
 
+#ifdef LINUX
+__thread int __thread_id;	// Threads of user-mode PacketNgin share a process
+#else
 int __thread_id;
+#endif
 int __thread_count;
 
 uint8_t volatile* __barrior_lock;
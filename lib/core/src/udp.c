@@ -3,53 +3,49 @@
 #include <net/ether.h>
 #include <net/ip.h>
 #include <net/udp.h>
-#include <util/map.h>
+#include <net/portmap.h>
 
-bool udp_port_alloc0(NIC* nic, uint32_t addr, uint16_t port) {
+static PortMap* udp_portmap(NIC* nic, uint32_t addr) {
 	IPv4Interface* interface = nic_ip_get(nic, addr);
-	if(!interface->udp_ports) {
-		interface->udp_ports = set_create(64, set_uint64_hash, set_uint64_equals, nic->pool);
-		if(!interface->udp_ports)
-			return false;
-	}
+	if(!interface)
+		return NULL;
+
+	if(!interface->udp_ports)
+		interface->udp_ports = portmap_create(NULL);
 
-	if(set_contains(interface->udp_ports, (void*)(uintptr_t)port))
+	return interface->udp_ports;
+}
+
+bool udp_port_alloc0(NIC* nic, uint32_t addr, uint16_t port) {
+	PortMap* ports = udp_portmap(nic, addr);
+	if(!ports)
 		return false;
 
-	return set_put(interface->udp_ports, (void*)(uintptr_t)port);
+	return portmap_alloc0(ports, port);
 }
 
 uint16_t udp_port_alloc(NIC* nic, uint32_t addr) {
-	IPv4Interface* interface = nic_ip_get(nic, addr);
-	if(!interface->udp_ports) {
-		interface->udp_ports = set_create(64, set_uint64_hash, set_uint64_equals, nic->pool);
-		if(!interface->udp_ports)
-			return 0;
-	}
-
-	uint16_t port = interface->udp_next_port;
-	if(port < 49152)
-		port = 49152;
+	PortMap* ports = udp_portmap(nic, addr);
+	if(!ports)
+		return 0;
 
-	while(set_contains(interface->udp_ports, (void*)(uintptr_t)port)) {
-		if(++port < 49152)
-			port = 49152;
-	}	
+	return portmap_alloc(ports);
+}
 
-	if(!set_put(interface->udp_ports, (void*)(uintptr_t)port))
+uint16_t udp_port_alloc_dst(NIC* nic, uint32_t addr, uint32_t destination, uint16_t port) {
+	PortMap* ports = udp_portmap(nic, addr);
+	if(!ports)
 		return 0;
 
-	interface->udp_next_port = port;
-
-	return port;
+	return portmap_alloc_dst(ports, addr, destination, port);
 }
 
 void udp_port_free(NIC* nic, uint32_t addr, uint16_t port) {
 	IPv4Interface* interface = nic_ip_get(nic, addr);
-	if(interface == NULL)
+	if(interface == NULL || interface->udp_ports == NULL)
 		return;
 	
-	set_remove(interface->udp_ports, (void*)(uintptr_t)port);
+	portmap_free(interface->udp_ports, port);
 }
 
 void udp_pack(Packet* packet, uint16_t udp_body_len) {
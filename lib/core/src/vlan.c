@@ -0,0 +1,96 @@
+#include <string.h>
+#include <net/vlan.h>
+
+#define MAC_LEN		12	// Destination and source MAC addresses
+
+uint16_t vlan_ether_type(Ether* ether, void** payload) {
+	uint16_t type = endian16(ether->type);
+	uint8_t* body = ether->payload;
+
+	for(int i = 0; i < VLAN_MAX_DEPTH && VLAN_IS_TPID(type); i++) {
+		VLAN* vlan = (VLAN*)body;
+		type = endian16(vlan->type);
+		body = vlan->body;
+	}
+
+	if(payload)
+		*payload = body;
+
+	return type;
+}
+
+void* vlan_payload(Ether* ether) {
+	void* payload;
+	vlan_ether_type(ether, &payload);
+
+	return payload;
+}
+
+int vlan_depth(Ether* ether) {
+	uint16_t type = endian16(ether->type);
+	VLAN* vlan = (VLAN*)ether->payload;
+
+	int depth = 0;
+	while(depth < VLAN_MAX_DEPTH && VLAN_IS_TPID(type)) {
+		type = endian16(vlan->type);
+		vlan++;
+		depth++;
+	}
+
+	return depth;
+}
+
+bool vlan_tci(Ether* ether, uint16_t* tci) {
+	if(!VLAN_IS_TPID(endian16(ether->type)))
+		return false;
+
+	VLAN* vlan = (VLAN*)ether->payload;
+	*tci = endian16(vlan->tci);
+
+	return true;
+}
+
+uint16_t vlan_vid(Ether* ether) {
+	uint16_t tci;
+	if(!vlan_tci(ether, &tci))
+		return 0;
+
+	return VLAN_GET_VID(tci);
+}
+
+bool vlan_push(Packet* packet, uint16_t tpid, uint16_t tci) {
+	if(packet->start < VLAN_LEN)
+		return false;
+
+	uint8_t* src = packet->buffer + packet->start;
+	packet->start -= VLAN_LEN;
+	Ether* ether = (Ether*)(packet->buffer + packet->start);
+	memmove(ether, src, MAC_LEN);
+
+	// Previous TPID or Ether type becomes the type of the tag
+	VLAN* vlan = (VLAN*)ether->payload;
+	vlan->type = ((Ether*)src)->type;
+	vlan->tci = endian16(tci);
+	ether->type = endian16(tpid);
+
+	return true;
+}
+
+bool vlan_pop(Packet* packet, uint16_t* tci) {
+	if(packet->end - packet->start < ETHER_LEN + VLAN_LEN)
+		return false;
+
+	Ether* ether = (Ether*)(packet->buffer + packet->start);
+	if(!VLAN_IS_TPID(endian16(ether->type)))
+		return false;
+
+	VLAN* vlan = (VLAN*)ether->payload;
+	if(tci)
+		*tci = endian16(vlan->tci);
+
+	// The type of the tag is already in place of the new Ether type
+	packet->start += VLAN_LEN;
+	memmove(packet->buffer + packet->start, ether, MAC_LEN);
+
+	return true;
+}
@@ -54,6 +54,7 @@
 #include "netif/ppp_oe.h"
 
 #include <string.h>
+#include <stdlib.h>
 #include <lwip/init.h>
 #include <netif/etharp.h>
 #include <nic.h>
@@ -76,6 +77,25 @@ struct netif_private {
 	NIC_DPI	postprocessor;
 };
 
+/* Received packet which lwIP refers in place, given back to the NIC when the
+ * pbuf is freed */
+struct packet_pbuf {
+	struct pbuf_custom	pbuf;
+	Packet*			packet;
+	struct packet_pbuf*	next;	/* Free list */
+};
+
+static struct packet_pbuf* packet_pbufs;
+
+static void packet_pbuf_free(struct pbuf* p) {
+	struct packet_pbuf* pp = (struct packet_pbuf*)p;
+	nic_free(pp->packet);
+	pp->packet = NULL;
+
+	pp->next = packet_pbufs;
+	packet_pbufs = pp;
+}
+
 /**
  * In this function, the hardware should be initialized.
  * Called from ethernetif_init().
@@ -135,8 +155,19 @@ low_level_output(struct netif *netif, struct pbuf *p)
   pbuf_header(p, -ETH_PAD_SIZE); /* drop the padding word */
 #endif
 
+  /* Segments are kept by TCP to be retransmitted, so they are copied once
+   * into the packet which the NIC owns after nic_tx */
   u16_t tot_len = p->tot_len;
   Packet* packet = nic_alloc(nic, tot_len);
+  if(!packet) {
+#if ETH_PAD_SIZE
+    pbuf_header(p, ETH_PAD_SIZE); /* reclaim the padding word */
+#endif
+    LINK_STATS_INC(link.memerr);
+    LINK_STATS_INC(link.drop);
+    return ERR_MEM;
+  }
+
   packet->end = packet->start + tot_len;
   int idx = 0;
   for(q = p; q != NULL; q = q->next) {
@@ -180,6 +211,27 @@ low_level_input(struct netif *netif, Packet* packet)
   len += ETH_PAD_SIZE; /* allow room for Ethernet padding */
 #endif
 
+  /* The packet is referred without copy if the padding word fits in the
+   * head room of it */
+  if(packet->start >= ETH_PAD_SIZE) {
+    struct packet_pbuf* pp = packet_pbufs;
+    if(pp)
+      packet_pbufs = pp->next;
+    else
+      pp = malloc(sizeof(struct packet_pbuf));
+
+    if(pp) {
+      pp->packet = packet;
+      pp->pbuf.custom_free_function = packet_pbuf_free;
+      p = pbuf_alloced_custom(PBUF_RAW, len, PBUF_REF, &pp->pbuf,
+          packet->buffer + packet->start - ETH_PAD_SIZE, len);
+
+      LINK_STATS_INC(link.recv);
+
+      return p;
+    }
+  }
+
   /* We allocate a pbuf chain of pbufs from the pool. */
   p = pbuf_alloc(PBUF_RAW, len, PBUF_POOL);
   
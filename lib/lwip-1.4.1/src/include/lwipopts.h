@@ -10,7 +10,7 @@
 #define MEMP_NUM_UDP_PCB            20
 #define MEMP_NUM_TCP_PCB            20
 #define MEMP_NUM_TCP_PCB_LISTEN     16
-#define MEMP_NUM_TCP_SEG            128
+#define MEMP_NUM_TCP_SEG            512
 #define MEMP_NUM_REASSDATA          32
 #define MEMP_NUM_ARP_QUEUE          10
 #define PBUF_POOL_SIZE              512
@@ -24,9 +24,12 @@
 #define LWIP_BROADCAST_PING         1
 #define LWIP_MULTICAST_PING         1
 #define LWIP_RAW                    1
-#define TCP_WND                     (4 * TCP_MSS)
+// Windows for LAN bulk transfers, the largest without window scaling
+#define TCP_WND                     (44 * TCP_MSS)
 #define TCP_MSS                     1460
-#define TCP_SND_BUF                 (8 * TCP_MSS)
+#define TCP_SND_BUF                 (44 * TCP_MSS)
+#define TCP_SND_QUEUELEN            (4 * TCP_SND_BUF / TCP_MSS)
+#define TCP_OVERSIZE                TCP_MSS
 #define TCP_LISTEN_BACKLOG          1
 #define LWIP_NETIF_STATUS_CALLBACK  1
 #define LWIP_NETIF_LINK_CALLBACK    1
@@ -181,10 +181,13 @@ int _write_r(struct _reent* r, int file, char *ptr, int len) {
 	switch(file) {
 		case 0: // stdin
 			return ring_write(__stdin, __stdin_head, &__stdin_tail, __stdin_size, ptr, len);
+		// Output which doesn't fit is dropped, the app never waits for the console
 		case 1: // stdout
-			return ring_write(__stdout, __stdout_head, &__stdout_tail, __stdout_size, ptr, len);
+			ring_write(__stdout, __stdout_head, &__stdout_tail, __stdout_size, ptr, len);
+			return len;
 		case 2: // stderr
-			return ring_write(__stderr, __stderr_head, &__stderr_tail, __stderr_size, ptr, len);
+			ring_write(__stderr, __stderr_head, &__stderr_tail, __stderr_size, ptr, len);
+			return len;
 		default:
 			return -1;
 	}
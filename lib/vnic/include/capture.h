@@ -0,0 +1,104 @@
+#ifndef __CAPTURE_H__
+#define __CAPTURE_H__
+
+#include <packet.h>
+
+/**
+ * @file
+ * Lock-free packet capture ring. Packets are copied into the ring by one
+ * producer, the core which dispatches them, and drained by one consumer, the
+ * manager core. A capture is attached to one direction of a VNIC or a NIC
+ * device, so rx and tx which are processed on different cores have their own.
+ */
+
+#define CAPTURE_RX		0	///< Packet received by a VM or from a NIC device
+#define CAPTURE_TX		1	///< Packet sent by a VM or to a NIC device
+
+#define CAPTURE_SNAPLEN		2048	///< Default maximum captured length of a packet
+
+/**
+ * Header of a captured packet, followed by caplen bytes of the packet.
+ */
+typedef struct {
+	uint64_t	time;		///< Timestamp of the packet (TSC)
+	uint16_t	len;		///< Original length
+	uint16_t	caplen;		///< Captured length
+	uint8_t		direction;	///< CAPTURE_RX or CAPTURE_TX
+	uint8_t		reserved[3];
+} CaptureRecord;
+
+typedef struct {
+	volatile size_t	head;		///< Read offset, updated by the consumer
+	volatile size_t	tail;		///< Write offset, updated by the producer
+	size_t		size;		///< Buffer size
+	uint16_t	snaplen;
+	uint8_t		direction;
+
+	uint64_t	packets;	///< Captured packets
+	uint64_t	drops;		///< Packets dropped because the ring is full
+
+	uint8_t		buffer[0];
+} Capture;
+
+/**
+ * Memory size of a capture which buffer is size bytes.
+ */
+#define CAPTURE_MEMORY_SIZE(size)	(sizeof(Capture) + (size))
+
+/**
+ * Initialize a capture in memory of CAPTURE_MEMORY_SIZE(size) bytes.
+ *
+ * @param capture capture
+ * @param size buffer size
+ * @param snaplen maximum captured length of a packet, 0 for CAPTURE_SNAPLEN
+ * @param direction CAPTURE_RX or CAPTURE_TX
+ */
+void capture_init(Capture* capture, size_t size, uint16_t snaplen, uint8_t direction);
+
+/**
+ * Copy a packet into the ring. It is not blocked, the packet is dropped if
+ * the ring is full. Only one core may call it at a time.
+ *
+ * @param capture capture
+ * @param time timestamp (TSC)
+ * @param data packet
+ * @param size packet size
+ *
+ * @return true if the packet is captured
+ */
+bool capture_write(Capture* capture, uint64_t time, const uint8_t* data, uint16_t size);
+
+/**
+ * Copy a packet between packet->start and packet->end into the ring with
+ * packet->time as the timestamp.
+ */
+bool capture_packet(Capture* capture, Packet* packet);
+
+/**
+ * Copy a frame which is not in a packet into the ring with the current TSC
+ * as the timestamp.
+ */
+bool capture_frame(Capture* capture, const uint8_t* data, uint16_t size);
+
+/**
+ * Get the header of the oldest captured packet without removing it.
+ *
+ * @param capture capture
+ * @param record header to be filled
+ *
+ * @return false if the ring is empty
+ */
+bool capture_peek(Capture* capture, CaptureRecord* record);
+
+/**
+ * Remove the oldest captured packet. Only one core may call it at a time.
+ *
+ * @param capture capture
+ * @param record header to be filled
+ * @param data buffer of at least record->caplen bytes, snaplen is enough
+ *
+ * @return false if the ring is empty
+ */
+bool capture_read(Capture* capture, CaptureRecord* record, uint8_t* data);
+
+#endif /* __CAPTURE_H__ */
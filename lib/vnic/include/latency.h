@@ -0,0 +1,78 @@
+#ifndef __LATENCY_H__
+#define __LATENCY_H__
+
+#include <packet.h>
+
+/**
+ * @file
+ * Latency histograms of packets. A packet is stamped with the TSC in
+ * packet->time at every stage of its path, and the time since the previous
+ * stamp is recorded in the histogram of the stage which has just ended.
+ *
+ * Buckets are HDR style: values under LATENCY_SUB_BUCKETS ticks have their
+ * own buckets, larger ones have LATENCY_SUB_BUCKETS buckets per power of 2,
+ * so a value is reported within 1/LATENCY_SUB_BUCKETS of itself.
+ */
+
+#define LATENCY_SUB_BITS	4
+#define LATENCY_SUB_BUCKETS	(1 << LATENCY_SUB_BITS)
+#define LATENCY_BUCKETS		(LATENCY_SUB_BUCKETS * 38)	///< Up to 2^41 ticks, minutes in TSC
+
+/**
+ * Stages of the path of a packet, each is recorded in the NIC of the VM.
+ */
+#define LATENCY_RX_DISPATCH	0	///< Driver rx to the VM's rx queue (host)
+#define LATENCY_RX_QUEUE	1	///< Waiting in the rx queue until the VM dequeues it
+#define LATENCY_VM		2	///< Dequeued by the VM to queued to tx, forwarded packets only
+#define LATENCY_TX_QUEUE	3	///< Waiting in the tx queue until the host dequeues it
+#define LATENCY_TX_DRIVER	4	///< Dequeued by the host to handed to the driver
+#define LATENCY_STAGE_COUNT	5
+
+typedef struct {
+	uint64_t	count;
+	uint64_t	sum;
+	uint64_t	min;
+	uint64_t	max;
+	uint64_t	buckets[LATENCY_BUCKETS];
+} Latency;
+
+/**
+ * Clear a histogram.
+ */
+void latency_init(Latency* latency);
+
+/**
+ * Add a value to a histogram. Only one core may call it at a time, readers
+ * on other cores may see a value which is partly recorded.
+ *
+ * @param latency histogram
+ * @param ticks latency in TSC
+ */
+void latency_record(Latency* latency, uint64_t ticks);
+
+/**
+ * Stamp a packet with time. The time since the previous stamp is recorded,
+ * nothing is recorded if the packet has not been stamped (packet->time is 0).
+ *
+ * @param latency histogram of the stage which ends, NULL not to record
+ * @param packet packet
+ * @param time current TSC
+ */
+void latency_stamp(Latency* latency, Packet* packet, uint64_t time);
+
+/**
+ * Value of a percentile, the smallest value of the bucket which contains it.
+ *
+ * @param latency histogram
+ * @param percentile in per mille, e.g. 999 for p99.9
+ *
+ * @return latency in TSC, 0 if nothing is recorded
+ */
+uint64_t latency_percentile(Latency* latency, uint32_t percentile);
+
+/**
+ * Current TSC.
+ */
+uint64_t latency_now();
+
+#endif /* __LATENCY_H__ */
@@ -2,6 +2,7 @@
 #define __NIC_H__
 
 #include <packet.h>
+#include <latency.h>
 #ifndef MODULE
 #include <stddef.h>
 #include <stdbool.h>
@@ -52,6 +53,7 @@ typedef struct _NIC_Pool {
  *
  * NIC_MAGIC_HEADER (8 bytes)
  * Metadata (bandwidth, pdding, queue, pool)
+ * Latency histograms
  * Config
  * Fast path rx queue
  * Fast path tx queue
@@ -82,6 +84,9 @@ typedef struct _NIC {
 
 	NIC_Pool	pool;
 
+	// Recorded by the side which ends the stage, read by the manager
+	Latency		latency[LATENCY_STAGE_COUNT];
+
 	uint32_t	config;
 	uint8_t		config_head[0];
 	uint8_t		config_tail[0] __attribute__((__aligned__(NIC_HEADER_SIZE)));
@@ -111,6 +116,14 @@ bool nic_has_rx(NIC* nic);
 Packet* nic_rx(NIC* nic);
 uint32_t nic_rx_size(NIC* nic);
 
+/**
+ * Dequeue received packets at once, the queue head is given back to the host
+ * once for the burst.
+ *
+ * @return number of packets dequeued
+ */
+uint32_t nic_rx_burst(NIC* nic, Packet** packets, uint32_t count);
+
 bool nic_has_srx(NIC* nic);
 Packet* nic_srx(NIC* nic);
 uint32_t nic_srx_size(NIC* nic);
@@ -118,6 +131,14 @@ uint32_t nic_srx_size(NIC* nic);
 bool nic_tx(NIC* nic, Packet* packet);
 bool nic_try_tx(NIC* nic, Packet* packet);
 bool nic_tx_dup(NIC* nic, Packet* packet);
+
+/**
+ * Queue packets at once, the host sees the whole burst with one update of
+ * the queue tail. Packets which don't fit in the queue are not freed.
+ *
+ * @return number of packets queued, packets[0] ~ packets[return - 1]
+ */
+uint32_t nic_tx_burst(NIC* nic, Packet** packets, uint32_t count);
 bool nic_has_tx(NIC* nic);
 uint32_t nic_tx_size(NIC* nic);
 
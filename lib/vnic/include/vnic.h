@@ -2,6 +2,7 @@
 #define __VNIC_H__
 
 #include "nic.h"
+#include "capture.h"
 
 #define MAX_VNIC_COUNT		8
 
@@ -29,6 +30,7 @@ typedef enum {
 	VNIC_RX_ACCEPT,		///< List of accept MAC addresses to receive
 	VNIC_TX_ACCEPT_ALL,		///< To accept all packets to send
 	VNIC_TX_ACCEPT,		///< List of accept MAC addresses to send
+	VNIC_VLAN,			///< VLAN identifier, 0 to receive every frame as is
 } VNIC_ATTRIBUTES;
 
 typedef struct {
@@ -43,6 +45,7 @@ typedef struct {
 	uint32_t	id;	// NIC unique ID (unique ID in RTOS)
 
 	uint64_t	mac;
+	uint16_t	vlan;	// VLAN ID, tags are stripped on rx and inserted on tx (0: trunk)
 
 	uint16_t	budget;
 
@@ -66,6 +69,18 @@ typedef struct {
 	// Buffer
 	uint64_t	rx_closed;
 	uint64_t	tx_closed;
+
+	// Mirror of the traffic, NULL if not captured
+	Capture*	rx_capture;
+	Capture*	tx_capture;
+
+	// Counters, written by the core which dispatches to the VNIC and read by the manager without locking
+	uint64_t	rx_packets;
+	uint64_t	rx_bytes;
+	uint64_t	rx_drops;
+	uint64_t	tx_packets;
+	uint64_t	tx_bytes;
+	uint64_t	tx_drops;
 } VNIC;
 
 bool vnic_init(VNIC* vnic, uint64_t* attrs);
@@ -73,7 +88,16 @@ uint32_t vnic_update(VNIC* nic, uint64_t* attrs);
 
 bool vnic_has_rx(VNIC* vnic);
 bool vnic_rx(VNIC* vnic, uint8_t* buf1, size_t size1, uint8_t* buf2, size_t size2);
+
+/**
+ * Same as vnic_rx, but the frame was received by the driver at stamp. The time
+ * until it's queued is recorded as LATENCY_RX_DISPATCH of the VNIC.
+ *
+ * @param stamp TSC when the frame is received, 0 if unknown
+ */
+bool vnic_rx_stamped(VNIC* vnic, uint64_t stamp, uint8_t* buf1, size_t size1, uint8_t* buf2, size_t size2);
 bool vnic_rx2(VNIC* vnic, Packet* packet);
+uint32_t vnic_rx_burst(VNIC* vnic, Packet** packets, uint32_t count);
 
 bool vnic_has_srx(VNIC* vnic);
 bool vnic_srx(VNIC* vnic, uint8_t* buf1, size_t size1, uint8_t* buf2, size_t size2);
@@ -0,0 +1,110 @@
+#include <string.h>
+#include <nic.h>
+#include <capture.h>
+
+/*
+ * A record is a CaptureRecord followed by the captured bytes, padded to 8
+ * bytes. Records wrap around the end of the buffer. One byte is always left
+ * empty to tell a full ring from an empty one.
+ */
+
+#define RECORD_ALIGN	8
+
+static size_t record_size(uint16_t caplen) {
+	return ROUNDUP(sizeof(CaptureRecord) + caplen, RECORD_ALIGN);
+}
+
+static void ring_copy_in(Capture* capture, size_t offset, const void* data, size_t len) {
+	size_t len1 = capture->size - offset;
+	if(len1 > len)
+		len1 = len;
+
+	memcpy(capture->buffer + offset, data, len1);
+	memcpy(capture->buffer, (const uint8_t*)data + len1, len - len1);
+}
+
+static void ring_copy_out(Capture* capture, size_t offset, void* data, size_t len) {
+	size_t len1 = capture->size - offset;
+	if(len1 > len)
+		len1 = len;
+
+	memcpy(data, capture->buffer + offset, len1);
+	memcpy((uint8_t*)data + len1, capture->buffer, len - len1);
+}
+
+void capture_init(Capture* capture, size_t size, uint16_t snaplen, uint8_t direction) {
+	capture->head = 0;
+	capture->tail = 0;
+	capture->size = size - size % RECORD_ALIGN;
+	capture->snaplen = snaplen ? snaplen : CAPTURE_SNAPLEN;
+	capture->direction = direction;
+	capture->packets = 0;
+	capture->drops = 0;
+}
+
+bool capture_write(Capture* capture, uint64_t time, const uint8_t* data, uint16_t size) {
+	uint16_t caplen = size < capture->snaplen ? size : capture->snaplen;
+	size_t len = record_size(caplen);
+	size_t head = capture->head;
+	size_t tail = capture->tail;
+	size_t writable = tail < head ? head - tail - 1 : capture->size - tail + head - 1;
+
+	if(len > writable) {
+		capture->drops++;
+		return false;
+	}
+
+	CaptureRecord record = {
+		.time = time,
+		.len = size,
+		.caplen = caplen,
+		.direction = capture->direction,
+	};
+
+	ring_copy_in(capture, tail, &record, sizeof(CaptureRecord));
+	ring_copy_in(capture, (tail + sizeof(CaptureRecord)) % capture->size, data, caplen);
+
+	// The record is written before it is published to the consumer
+	__sync_synchronize();
+	capture->tail = (tail + len) % capture->size;
+	capture->packets++;
+
+	return true;
+}
+
+bool capture_packet(Capture* capture, Packet* packet) {
+	return capture_write(capture, packet->time, packet->buffer + packet->start, packet->end - packet->start);
+}
+
+bool capture_frame(Capture* capture, const uint8_t* data, uint16_t size) {
+	uint64_t time;
+	uint32_t* p = (uint32_t*)&time;
+	asm volatile("rdtsc" : "=a"(p[0]), "=d"(p[1]));
+
+	return capture_write(capture, time, data, size);
+}
+
+bool capture_peek(Capture* capture, CaptureRecord* record) {
+	size_t head = capture->head;
+	if(head == capture->tail)
+		return false;
+
+	__sync_synchronize();
+	ring_copy_out(capture, head, record, sizeof(CaptureRecord));
+
+	return true;
+}
+
+bool capture_read(Capture* capture, CaptureRecord* record, uint8_t* data) {
+	if(!capture_peek(capture, record))
+		return false;
+
+	size_t head = capture->head;
+	ring_copy_out(capture, (head + sizeof(CaptureRecord)) % capture->size, data, record->caplen);
+
+	// The record is read before its space is given back to the producer
+	__sync_synchronize();
+	capture->head = (head + record_size(record->caplen)) % capture->size;
+
+	return true;
+}
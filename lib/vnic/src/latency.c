@@ -0,0 +1,76 @@
+#include <string.h>
+#include <latency.h>
+
+static int bucket_index(uint64_t ticks) {
+	if(ticks < LATENCY_SUB_BUCKETS)
+		return ticks;
+
+	int msb = 63 - __builtin_clzl(ticks);
+	int index = (msb - LATENCY_SUB_BITS + 1) * LATENCY_SUB_BUCKETS +
+		((ticks >> (msb - LATENCY_SUB_BITS)) & (LATENCY_SUB_BUCKETS - 1));
+
+	return index < LATENCY_BUCKETS ? index : LATENCY_BUCKETS - 1;
+}
+
+/*
+ * The smallest value of a bucket
+ */
+static uint64_t bucket_value(int index) {
+	if(index < LATENCY_SUB_BUCKETS)
+		return index;
+
+	int msb = index / LATENCY_SUB_BUCKETS + LATENCY_SUB_BITS - 1;
+	uint64_t sub = index % LATENCY_SUB_BUCKETS;
+
+	return (LATENCY_SUB_BUCKETS + sub) << (msb - LATENCY_SUB_BITS);
+}
+
+void latency_init(Latency* latency) {
+	memset(latency, 0, sizeof(Latency));
+	latency->min = (uint64_t)-1;
+}
+
+void latency_record(Latency* latency, uint64_t ticks) {
+	latency->buckets[bucket_index(ticks)]++;
+	latency->sum += ticks;
+	if(ticks < latency->min)
+		latency->min = ticks;
+	if(ticks > latency->max)
+		latency->max = ticks;
+	latency->count++;
+}
+
+void latency_stamp(Latency* latency, Packet* packet, uint64_t time) {
+	// TSCs of cores may be a little bit apart
+	if(latency && packet->time && time >= packet->time)
+		latency_record(latency, time - packet->time);
+
+	packet->time = time;
+}
+
+uint64_t latency_percentile(Latency* latency, uint32_t percentile) {
+	uint64_t total = 0;
+	for(int i = 0; i < LATENCY_BUCKETS; i++)
+		total += latency->buckets[i];
+
+	if(!total)
+		return 0;
+
+	uint64_t rank = (total * percentile + 999) / 1000;
+	uint64_t count = 0;
+	for(int i = 0; i < LATENCY_BUCKETS; i++) {
+		count += latency->buckets[i];
+		if(count >= rank)
+			return bucket_value(i);
+	}
+
+	return latency->max;
+}
+
+uint64_t latency_now() {
+	uint64_t time;
+	uint32_t* p = (uint32_t*)&time;
+	asm volatile("rdtsc" : "=a"(p[0]), "=d"(p[1]));
+
+	return time;
+}
@@ -209,6 +209,8 @@ bool nic_has_rx(NIC* nic) {
 Packet* nic_rx(NIC* nic) {
 	lock_lock(&nic->rx.rlock);
 	Packet* packet = queue_pop(nic, &nic->rx);
+	if(packet)
+		latency_stamp(&nic->latency[LATENCY_RX_QUEUE], packet, latency_now());
 	lock_unlock(&nic->rx.rlock);
 
 	return packet;
@@ -218,6 +220,25 @@ uint32_t nic_rx_size(NIC* nic) {
 	return queue_size(&nic->rx);
 }
 
+uint32_t nic_rx_burst(NIC* nic, Packet** packets, uint32_t count) {
+	uint64_t time = latency_now();
+	uint32_t i = 0;
+
+	lock_lock(&nic->rx.rlock);
+	NIC_Queue queue = nic->rx;
+	for(; i < count; i++) {
+		packets[i] = queue_pop(nic, &queue);
+		if(!packets[i])
+			break;
+
+		latency_stamp(&nic->latency[LATENCY_RX_QUEUE], packets[i], time);
+	}
+	nic->rx.head = queue.head;
+	lock_unlock(&nic->rx.rlock);
+
+	return i;
+}
+
 bool nic_has_srx(NIC* nic) {
 	return !queue_empty(&nic->srx);
 }
@@ -238,9 +259,31 @@ bool nic_has_tx(NIC* nic) {
 	return !queue_empty(&nic->tx);
 }
 
+/*
+ * Push a packet to a tx queue stamped with time. A packet which was received
+ * has the time it was dequeued, so the time in the VM is recorded. The stamp
+ * is restored if the packet is not queued, it's still the caller's.
+ */
+static bool tx_push(NIC* nic, NIC_Queue* queue, Packet* packet, uint64_t time) {
+	uint64_t stamp = packet->time;
+
+	packet->time = time;
+	if(!queue_push(nic, queue, packet)) {
+		packet->time = stamp;
+		return false;
+	}
+
+	if(stamp && time >= stamp)
+		latency_record(&nic->latency[LATENCY_VM], time - stamp);
+
+	return true;
+}
+
 bool nic_tx(NIC* nic, Packet* packet) {
+	uint64_t time = latency_now();
+
 	lock_lock(&nic->tx.wlock);
-	if(!queue_push(nic, &nic->tx, packet)) {
+	if(!tx_push(nic, &nic->tx, packet, time)) {
 		lock_unlock(&nic->tx.wlock);
 
 		nic_free(packet);
@@ -252,8 +295,10 @@ bool nic_tx(NIC* nic, Packet* packet) {
 }
 
 bool nic_try_tx(NIC* nic, Packet* packet) {
+	uint64_t time = latency_now();
+
 	lock_lock(&nic->tx.wlock);
-	bool result = queue_push(nic, &nic->tx, packet);
+	bool result = tx_push(nic, &nic->tx, packet, time);
 	lock_unlock(&nic->tx.wlock);
 
 	return result;
@@ -278,7 +323,7 @@ bool nic_tx_dup(NIC* nic, Packet* packet) {
 	packet2->end = packet2->start + len;
 	memcpy(packet2->buffer + packet2->start, packet->buffer + packet->start, len);
 
-	if(!queue_push(nic, &nic->tx, packet)) {
+	if(!tx_push(nic, &nic->tx, packet, latency_now())) {
 		lock_unlock(&nic->tx.wlock);
 
 		nic_free(packet);
@@ -289,6 +334,22 @@ bool nic_tx_dup(NIC* nic, Packet* packet) {
 	}
 }
 
+uint32_t nic_tx_burst(NIC* nic, Packet** packets, uint32_t count) {
+	uint64_t time = latency_now();
+	uint32_t i = 0;
+
+	lock_lock(&nic->tx.wlock);
+	NIC_Queue queue = nic->tx;
+	for(; i < count; i++) {
+		if(!tx_push(nic, &queue, packets[i], time))
+			break;
+	}
+	nic->tx.tail = queue.tail;
+	lock_unlock(&nic->tx.wlock);
+
+	return i;
+}
+
 bool nic_tx_available(NIC* nic) {
 	return queue_available(&nic->tx);
 }
@@ -94,6 +94,9 @@ static int nic_init(uint64_t mac, void* base, size_t size,
 	nic->pool.used = 0;
 	nic->pool.lock = 0;
 
+	for(int i = 0; i < LATENCY_STAGE_COUNT; i++)
+		latency_init(&nic->latency[i]);
+
 	nic->config = 0;
 	bzero(nic->config_head, (size_t)((uintptr_t)nic->config_tail - (uintptr_t)nic->config_head));
 
@@ -143,6 +146,7 @@ bool vnic_init(VNIC* vnic, uint64_t* attrs) {
 	vnic->magic = vnic->nic->magic;
 	vnic->id = vnic->nic->id;
 	vnic->mac = vnic->nic->mac;
+	vnic->vlan = has_key(VNIC_VLAN) ? get_value(VNIC_VLAN) & 0xfff : 0;
 	vnic->rx_bandwidth = vnic->nic->rx_bandwidth;
 	vnic->tx_bandwidth = vnic->nic->tx_bandwidth;
 	vnic->padding_head = vnic->nic->padding_head;
@@ -157,6 +161,10 @@ bool vnic_init(VNIC* vnic, uint64_t* attrs) {
 // 	vnic->max_buffer_size = 2048;
 
 	vnic->rx_closed = vnic->tx_closed = timer_frequency();
+	vnic->rx_capture = vnic->tx_capture = NULL;
+
+	vnic->rx_packets = vnic->rx_bytes = vnic->rx_drops = 0;
+	vnic->tx_packets = vnic->tx_bytes = vnic->tx_drops = 0;
 
 	return true;
 }
@@ -172,8 +180,12 @@ bool vnic_rx_available(VNIC* vnic) {
 	return queue_available(&vnic->rx);
 }
 
-//TODO return error number
 bool vnic_rx(VNIC* vnic, uint8_t* buf1, size_t size1, uint8_t* buf2, size_t size2) {
+	return vnic_rx_stamped(vnic, 0, buf1, size1, buf2, size2);
+}
+
+//TODO return error number
+bool vnic_rx_stamped(VNIC* vnic, uint64_t stamp, uint8_t* buf1, size_t size1, uint8_t* buf2, size_t size2) {
 	uint64_t time = timer_frequency();
 	//TODO
 	/*
@@ -188,6 +200,7 @@ bool vnic_rx(VNIC* vnic, uint8_t* buf1, size_t size1, uint8_t* buf2, size_t size
 	if(queue_available(&vnic->rx)) {
 		Packet* packet = nic_alloc(vnic->nic, size1 + size2);
 		if(packet == NULL) {
+			vnic->rx_drops++;
 			lock_unlock(&vnic->nic->rx.wlock);
 			return false;
 		}
@@ -196,8 +209,17 @@ bool vnic_rx(VNIC* vnic, uint8_t* buf1, size_t size1, uint8_t* buf2, size_t size
 		memcpy(packet->buffer + packet->start + size1, buf2, size2);
 
 		packet->end = packet->start + size1 + size2;
+		packet->time = stamp;
 
 		if(queue_push(vnic->nic, &vnic->rx, packet)) {
+			// The VM doesn't see the packet until the tail is published
+			latency_stamp(&vnic->nic->latency[LATENCY_RX_DISPATCH], packet, time);
+			if(vnic->rx_capture)
+				capture_packet(vnic->rx_capture, packet);
+
+			vnic->rx_packets++;
+			vnic->rx_bytes += size1 + size2;
+
 			vnic->nic->rx.tail = vnic->rx.tail;
 			lock_unlock(&vnic->nic->rx.wlock);
 
@@ -208,11 +230,13 @@ bool vnic_rx(VNIC* vnic, uint8_t* buf1, size_t size1, uint8_t* buf2, size_t size
 
 			return true;
 		} else {
+			vnic->rx_drops++;
 			lock_unlock(&vnic->nic->rx.wlock);
 			nic_free(packet);
 			return false;
 		}
 	} else {
+		vnic->rx_drops++;
 		lock_unlock(&vnic->nic->rx.wlock);
 		return false;
 	}
@@ -221,12 +245,24 @@ bool vnic_rx(VNIC* vnic, uint8_t* buf1, size_t size1, uint8_t* buf2, size_t size
 bool vnic_rx2(VNIC* vnic, Packet* packet) {
 	uint64_t time = timer_frequency();
 	if(vnic->rx_closed - vnic->rx_wait_grace > time) {
+		vnic->rx_drops++;
+		nic_free(packet);
 		return false;
 	}
+
 	//TODO try_lock
 	lock_lock(&vnic->nic->rx.wlock);
 	vnic->rx.head = vnic->nic->rx.head;
 	if(queue_push(vnic->nic, &vnic->rx, packet)) {
+		latency_stamp(&vnic->nic->latency[LATENCY_RX_DISPATCH], packet, time);
+
+		// Captured before the VM sees it, the VM frees the packet
+		if(vnic->rx_capture)
+			capture_packet(vnic->rx_capture, packet);
+
+		vnic->rx_packets++;
+		vnic->rx_bytes += packet->end - packet->start;
+
 		vnic->nic->rx.tail = vnic->rx.tail;
 		lock_unlock(&vnic->nic->rx.wlock);
 
@@ -237,12 +273,56 @@ bool vnic_rx2(VNIC* vnic, Packet* packet) {
 
 		return true;
 	} else {
+		vnic->rx_drops++;
 		lock_unlock(&vnic->nic->rx.wlock);
 		nic_free(packet);
 		return false;
 	}
 }
 
+/*
+ * Queue packets with one update of the shared tail, so the VM sees the whole
+ * burst at once. Packets which don't fit in the queue are freed.
+ */
+uint32_t vnic_rx_burst(VNIC* vnic, Packet** packets, uint32_t count) {
+	uint64_t time = timer_frequency();
+	uint32_t size = 0;
+	uint32_t i = 0;
+
+	if(vnic->rx_closed - vnic->rx_wait_grace > time)
+		goto drop;
+
+	lock_lock(&vnic->nic->rx.wlock);
+	vnic->rx.head = vnic->nic->rx.head;
+	for(; i < count; i++) {
+		if(!queue_push(vnic->nic, &vnic->rx, packets[i]))
+			break;
+
+		latency_stamp(&vnic->nic->latency[LATENCY_RX_DISPATCH], packets[i], time);
+
+		if(vnic->rx_capture)
+			capture_packet(vnic->rx_capture, packets[i]);
+
+		size += packets[i]->end - packets[i]->start;
+	}
+	vnic->rx_packets += i;
+	vnic->rx_bytes += size;
+	vnic->nic->rx.tail = vnic->rx.tail;
+	lock_unlock(&vnic->nic->rx.wlock);
+
+	if(vnic->rx_closed > time)
+		vnic->rx_closed += vnic->rx_wait * size;
+	else
+		vnic->rx_closed = time + vnic->rx_wait * size;
+
+drop:
+	vnic->rx_drops += count - i;
+	for(uint32_t j = i; j < count; j++)
+		nic_free(packets[j]);
+
+	return i;
+}
+
 bool vnic_has_srx(VNIC* vnic) {
 	vnic->srx.head = vnic->nic->srx.head;
 	return queue_available(&vnic->srx);
@@ -310,6 +390,12 @@ Packet* vnic_tx(VNIC* vnic) {
 	Packet* packet = queue_pop(vnic->nic, &vnic->tx);
 
 	if(packet) {
+		latency_stamp(&vnic->nic->latency[LATENCY_TX_QUEUE], packet, time);
+		vnic->tx_packets++;
+		vnic->tx_bytes += packet->end - packet->start;
+		if(vnic->tx_capture)
+			capture_packet(vnic->tx_capture, packet);
+
 		if(vnic->tx_closed > time)
 			vnic->tx_closed += vnic->tx_wait * (packet->end - packet->start);
 		else
@@ -80,3 +80,28 @@ workspace "Utility"
         location "build"
         targetname "stdin"
         files { "src/stdin.c" }
+
+    project "latency"
+        kind "ConsoleApp"
+        location "build"
+        targetname "latency"
+        files { "src/latency.c" }
+
+    project "sync"
+        kind "ConsoleApp"
+        location "build"
+        targetname "sync"
+        files { "src/sync.c" }
+        links { "z" }
+
+    project "digest"
+        kind "ConsoleApp"
+        location "build"
+        targetname "digest"
+        files { "src/digest.c" }
+
+    project "top"
+        kind "ConsoleApp"
+        location "build"
+        targetname "top"
+        files { "src/top.c" }
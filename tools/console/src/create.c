@@ -69,7 +69,7 @@ static int vm_create(int argc, char* argv[]) {
 				;
 				// Suboptions for NIC
 				enum {
-					MAC, DEV, IBUF, OBUF, IBAND, OBAND, HPAD, TPAD, POOL, SLOWPATH,
+					MAC, DEV, IBUF, OBUF, IBAND, OBAND, HPAD, TPAD, POOL, SLOWPATH, VLAN,
 				};
 
 				char* const token[] = {
@@ -83,6 +83,7 @@ static int vm_create(int argc, char* argv[]) {
 					[TPAD]	= "tpad",
 					[POOL]	= "pool",
 					[SLOWPATH]	= "slowpath",
+					[VLAN]	= "vlan",
 				};
 
 				char* subopts = optarg;
@@ -98,6 +99,7 @@ static int vm_create(int argc, char* argv[]) {
 				nic->padding_head = 32;
 				nic->padding_tail = 32;
 				nic->pool_size = 0x400000; /* 4 MB */
+				nic->vlan = 0;	/* Trunk */
 				nic->slowpath = true;	//Enable
 				while(*subopts != '\0') {
 					switch(getsubopt(&subopts, token, &value)) {
@@ -128,6 +130,9 @@ static int vm_create(int argc, char* argv[]) {
 						case POOL:
 							nic->pool_size = strtol(value, NULL, 16);
 							break;
+						case VLAN:
+							nic->vlan = atoi(value) & 0xfff;
+							break;
 						case SLOWPATH:
 							if(!strcmp(value, "y")) {
 								nic->slowpath = true;
@@ -14,32 +14,65 @@ static void help() {
 
 #define UNDERLINE(OPTION) ANSI_UNDERLINED_PRE #OPTION ANSI_UNDERLINED_POST
 
-	printf("Usage: destroy " UNDERLINE(VM ID) "\n");
+	printf("Usage: destroy " UNDERLINE(VM ID) " [VM ID...]\n");
 }
 
-bool callback_vm_destroy(bool result, void* context) {
-	if(result)
-		printf("true\n");
-	else
-		printf("false\n");
+// VMs are destroyed in batches, which are pipelined
+static uint32_t* vmids;
+static int vm_count;
+static int vm_sent;
+
+static bool callback_vm_destroy(bool* results, int count, void* context) {
+	uint32_t* ids = context;
+
+	for(int i = 0; i < count; i++) {
+		if(vm_count > 1)
+			printf("%u: ", ids[i]);
+
+		if(results[i])
+			printf("true\n");
+		else
+			printf("false\n");
+	}
+
+	if(vm_sent == vm_count && rpc_pending(rpc) == 0)
+		rpc_disconnect(rpc);
 
-	rpc_disconnect(rpc);
 	return false;
 }
 
+static void send_vm_destroy() {
+	while(vm_sent < vm_count) {
+		int count = vm_count - vm_sent < RPC_MAX_BATCH ? vm_count - vm_sent : RPC_MAX_BATCH;
+		if(rpc_vm_destroy_batch(rpc, vmids + vm_sent, count, callback_vm_destroy, vmids + vm_sent) <= 0)
+			break;
+
+		vm_sent += count;
+	}
+}
+
 static int vm_destroy(int argc, char** argv) {
 	if(argc < 2) {
 		help();
 		return -1;
 	}
 
-	if(!is_uint32(argv[1])) {
-		help();
-		return -2;
+	for(int i = 1; i < argc; i++) {
+		if(!is_uint32(argv[i])) {
+			help();
+			return -2;
+		}
 	}
 
-	uint32_t vmid = parse_uint32(argv[1]);
-	rpc_vm_destroy(rpc, vmid, callback_vm_destroy, NULL);
+	vm_count = argc - 1;
+	vmids = malloc(sizeof(uint32_t) * vm_count);
+	if(!vmids)
+		return -3;
+
+	for(int i = 0; i < vm_count; i++)
+		vmids[i] = parse_uint32(argv[i + 1]);
+
+	send_vm_destroy();
 
 	return 0;
 }
@@ -67,6 +100,7 @@ int main(int argc, char *argv[]) {
 	while(1) {
 		if(rpc_connected(rpc)) {
 			rpc_loop(rpc);
+			send_vm_destroy();
 		} else {
 			free(rpc);
 			break;
@@ -0,0 +1,144 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <util/types.h>
+#include <net/md5.h>
+#include <control/rpc.h>
+#include <control/vmspec.h>
+
+#include "rpc.h"
+
+static RPC* rpc;
+
+static void help() {
+#define ANSI_UNDERLINED_PRE  "\033[4m"
+#define ANSI_UNDERLINED_POST "\033[0m"
+
+#define UNDERLINE(OPTION) ANSI_UNDERLINED_PRE #OPTION ANSI_UNDERLINED_POST
+	printf("Usage: digest " UNDERLINE(VM ID) " [-b]\n");
+	printf("\tMD5 of the storage block digests, -b prints the digest of each block\n");
+}
+
+typedef struct {
+	uint32_t	vmid;
+	bool		is_blocks;
+	uint32_t	(*digests)[4];
+	uint32_t	count;
+} DigestInfo;
+
+static void print_digest(uint32_t digest[4]) {
+	uint8_t* bytes = (uint8_t*)digest;
+	for(int i = 0; i < 16; i++)
+		printf("%02x", bytes[i]);
+}
+
+static bool callback_storage_digest(uint32_t index, uint32_t* digests, int32_t count, void* context) {
+	DigestInfo* digest_info = context;
+
+	if(count < 0) {
+		printf("Storage Digest Error: %d\n", count);
+		rpc_disconnect(rpc);
+		return false;
+	}
+
+	if(count == 0) {
+		if(!digest_info->is_blocks) {
+			// Digest of the digests in block order
+			uint32_t digest[4];
+			md5((uint8_t*)digest_info->digests, sizeof(uint32_t) * 4 * digest_info->count, digest);
+			fprintf(stderr, "\n");
+			print_digest(digest);
+			printf("\n");
+		}
+
+		rpc_disconnect(rpc);
+		return false;
+	}
+
+	if(digest_info->is_blocks) {
+		for(int i = 0; i < count; i++) {
+			printf("%u ", index + i);
+			print_digest(digests + i * 4);
+			printf("\n");
+		}
+	} else {
+		void* digests2 = realloc(digest_info->digests, sizeof(uint32_t) * 4 * (index + count));
+		if(!digests2) {
+			printf("Not enough memory\n");
+			rpc_disconnect(rpc);
+			return false;
+		}
+
+		digest_info->digests = digests2;
+		memcpy(digest_info->digests[index], digests, sizeof(uint32_t) * 4 * count);
+
+		// Each response is a progress
+		fprintf(stderr, "\r%lu MB digested", (uint64_t)(index + count) * VM_STORAGE_BLOCK_SIZE / (1024 * 1024));
+	}
+
+	digest_info->count = index + count;
+	rpc_storage_digest(rpc, digest_info->vmid, digest_info->count, callback_storage_digest, digest_info);
+
+	return true;
+}
+
+static int digest(int argc, char** argv, DigestInfo* digest_info) {
+	if(argc < 2 || argc > 3) {
+		help();
+		return -1;
+	}
+
+	if(!is_uint32(argv[1])) {
+		help();
+		return -2;
+	}
+
+	if(argc == 3) {
+		if(strcmp(argv[2], "-b")) {
+			help();
+			return -3;
+		}
+		digest_info->is_blocks = true;
+	}
+
+	digest_info->vmid = parse_uint32(argv[1]);
+	rpc_storage_digest(rpc, digest_info->vmid, 0, callback_storage_digest, digest_info);
+
+	return 0;
+}
+
+int main(int argc, char *argv[]) {
+	RPCSession* session = rpc_session();
+	if(!session) {
+		printf("RPC server not connected\n");
+		return ERROR_RPC_DISCONNECTED;
+	}
+
+	rpc = rpc_connect(session->host, session->port, 3, true);
+	if(rpc == NULL) {
+		printf("Failed to connect RPC server\n");
+		return ERROR_RPC_DISCONNECTED;
+	}
+
+	DigestInfo digest_info = {};
+	int rc;
+	if((rc = digest(argc, argv, &digest_info))) {
+		printf("Failed to digest storage. Error code : %d\n", rc);
+		rpc_disconnect(rpc);
+		return ERROR_CMD_EXECUTE;
+	}
+
+	while(1) {
+		if(rpc_connected(rpc)) {
+			rpc_loop(rpc);
+		} else {
+			free(rpc);
+			break;
+		}
+	}
+
+	free(digest_info.digests);
+
+	return 0;
+}
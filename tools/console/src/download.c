@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -5,6 +6,8 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <util/types.h>
 #include <control/rpc.h>
 
@@ -18,77 +21,100 @@ static void help() {
 
 #define UNDERLINE(OPTION) ANSI_UNDERLINED_PRE #OPTION ANSI_UNDERLINED_POST
 
-	// TODO: Why size is needed?
-	printf("Usage: download " UNDERLINE(VM ID) " " UNDERLINE(FILE) " [SIZE]\n");
+	printf("Usage: download " UNDERLINE(VM ID) " " UNDERLINE(FILE) " [SIZE [OFFSET [WINDOW]]]\n");
+	printf("\tSIZE is to the end of storage by default, OFFSET resumes a failed download\n");
 }
 
 typedef struct {
 	char		path[256];
 	int		fd;
-	uint64_t	file_size;
-	uint32_t	offset;
+	uint8_t*	file;
+	uint64_t	file_size;	// Mapped size of the file
+	uint64_t	size;		// Bytes to download from offset, 0 to the end of storage
+	uint64_t	offset;
 	uint64_t	current_time;
 } FileInfo;
 
-static int callback_storage_download(uint32_t offset, void* buf, int32_t size, void* context) {
-	FileInfo* file_info = context;
+static void file_close(FileInfo* file_info, uint64_t size) {
+	if(file_info->file)
+		munmap(file_info->file, file_info->file_size);
+	if(size < file_info->file_size && ftruncate(file_info->fd, size) < 0)
+		printf("Failed to resize file\n");
+	close(file_info->fd);
+	free(file_info);
+}
 
-	if(size < 0) {
-		printf("Storage Download Error\n");
-		close(file_info->fd);
-		printf("false\n");
-		remove(file_info->path);
-		free(file_info);
+static bool file_map(FileInfo* file_info, uint64_t size) {
+	if(size <= file_info->file_size)
+		return true;
 
-		rpc_disconnect(rpc);
-		return 0;
-	}
+	// Storage size is unknown, the file grows while downloading
+	if(size < file_info->file_size * 2)
+		size = file_info->file_size * 2;
 
-	if(file_info->offset != offset) {
-		lseek(file_info->fd, offset, SEEK_SET);
-		file_info->offset = offset;
-	}
+	if(ftruncate(file_info->fd, size) < 0)
+		return false;
 
-	size = write(file_info->fd, buf, size);
-	file_info->offset += size;
+	void* file;
+	if(file_info->file)
+		file = mremap(file_info->file, file_info->file_size, size, MREMAP_MAYMOVE);
+	else
+		file = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, file_info->fd, 0);
 
-	if(size < 0) {
-		printf("Write Error!\n");
-		close(file_info->fd);
-		printf("false\n");
-		remove(file_info->path);
-		free(file_info);
+	if(file == MAP_FAILED)
+		return false;
 
-		rpc_disconnect(rpc);
-		return 0;
+	file_info->file = file;
+	file_info->file_size = size;
+
+	return true;
+}
+
+static int32_t map_storage_download(uint64_t offset, void** buf, int32_t size, void* context) {
+	FileInfo* file_info = context;
+
+	if(!file_map(file_info, offset + size)) {
+		printf("\nFailed to map file\n");
+		return -1;
 	}
 
-	if(size == 0) {
-		printf("\nStorage Download Completed\n");
-		printf("Total Size : %d Byte\n", file_info->offset);
-		close(file_info->fd);
+	// Frames are received straight into the mapped file
+	*buf = file_info->file + offset;
+
+	if(offset / (1024 * 1024) != (offset + size) / (1024 * 1024)) {
+		printf(".");
+		fflush(stdout);
+	}
+
+	return size;
+}
+
+static void callback_storage_download(uint64_t offset, int32_t status, void* context) {
+	FileInfo* file_info = context;
 
+	if(status < 0) {
+		printf("\nStorage Download Error: %d\n", status);
+		printf("Resume from offset: %lu\n", offset);
+		printf("false\n");
+	} else {
 		struct timeval tv;
 		gettimeofday(&tv, NULL);
 		uint64_t current = tv.tv_sec * 1000 * 1000 + tv.tv_usec;
-		printf("time = %0.3f ms\n", (float)(current - file_info->current_time) / (float)1000);
+		float time = (float)(current - file_info->current_time) / (float)1000;
 
+		printf("\nStorage Download Completed\n");
+		printf("Total Size : %lu Byte\n", offset);
+		printf("time = %0.3f ms, %0.3f MB/s\n", time, (offset - file_info->offset) / (time * 1000));
 		printf("true\n");
-		free(file_info);
-
-		rpc_disconnect(rpc);
-
-		return 0;
 	}
-
-	printf(".");
 	fflush(stdout);
 
-	return size;
+	file_close(file_info, offset);
+	rpc_disconnect(rpc);
 }
 
 static int download(int argc, char** argv) {
-	if(argc < 3) {
+	if(argc < 3 || argc > 6) {
 		help();
 		return -1;
 	}
@@ -103,40 +129,48 @@ static int download(int argc, char** argv) {
 		return -3;
 	}
 
-	uint32_t vmid = parse_uint32(argv[1]);
+	for(int i = 3; i < argc; i++) {
+		if(!is_uint64(argv[i])) {
+			help();
+			return -4;
+		}
+	}
 
-	FileInfo* file_info = (FileInfo*)malloc(sizeof(FileInfo));;
+	FileInfo* file_info = (FileInfo*)malloc(sizeof(FileInfo));
 	if(file_info == NULL) {
-		return -4;
+		return -5;
 	}
 	memset(file_info, 0, sizeof(FileInfo));
 
-	file_info->fd = open(argv[2], O_WRONLY | O_CREAT | O_TRUNC, 0755);
-
+	uint32_t vmid = parse_uint32(argv[1]);
+	if(argc >= 4)
+		file_info->size = parse_uint64(argv[3]);
+	if(argc >= 5)
+		file_info->offset = parse_uint64(argv[4]);
+	uint32_t window = 0;
+	if(argc >= 6)
+		window = parse_uint64(argv[5]);
+
+	// A resumed download keeps what has been received
+	file_info->fd = open(argv[2], O_RDWR | O_CREAT | (file_info->offset ? 0 : O_TRUNC), 0755);
 	if(file_info->fd < 0) {
 		free(file_info);
-		return -5;
+		return -6;
 	}
 
 	strcpy(file_info->path, argv[2]);
-	lseek(file_info->fd, 0, SEEK_SET);
-	uint64_t download_size = 0;
-	if(argc == 4) {
-		if(!is_uint32(argv[3]))
-			return -6;
 
-		download_size = parse_uint32(argv[3]);
-	} else {
-		download_size = 0;
+	struct stat st;
+	if(fstat(file_info->fd, &st) < 0 || !file_map(file_info, st.st_size > 0 ? (uint64_t)st.st_size : 1)) {
+		file_close(file_info, (uint64_t)-1);
+		return -7;
 	}
 
-	file_info->offset = 0;
-
 	struct timeval tv;
 	gettimeofday(&tv, NULL);
 	file_info->current_time = tv.tv_sec * 1000 * 1000 + tv.tv_usec;
 
-	rpc_storage_download(rpc, vmid, download_size, callback_storage_download, file_info);
+	rpc_storage_bulk_download(rpc, vmid, file_info->offset, file_info->size, window, map_storage_download, callback_storage_download, file_info);
 
 	return 0;
 }
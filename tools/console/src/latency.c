@@ -0,0 +1,85 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <util/types.h>
+#include <control/rpc.h>
+
+#include "rpc.h"
+
+static RPC* rpc;
+
+static const char* stages[] = {
+	"rx dispatch", "rx queue", "vm", "tx queue", "tx driver"
+};
+
+static void help() {
+#define ANSI_UNDERLINED_PRE  "\033[4m"
+#define ANSI_UNDERLINED_POST "\033[0m"
+
+#define UNDERLINE(OPTION) ANSI_UNDERLINED_PRE #OPTION ANSI_UNDERLINED_POST
+
+	printf("Usage: latency " UNDERLINE(VM ID) "\n");
+}
+
+static bool callback_latency_get(VMLatency* latencies, uint16_t count, void* context) {
+	printf("%3s %-12s %12s %10s %10s %10s %10s %10s %10s\n",
+			"NIC", "Stage", "Count", "Min(ns)", "Avg", "p50", "p99", "p99.9", "Max");
+	for(int i = 0; i < count; i++) {
+		VMLatency* l = &latencies[i];
+		const char* stage = l->stage < sizeof(stages) / sizeof(stages[0]) ? stages[l->stage] : "unknown";
+
+		printf("%3d %-12s %12lu %10lu %10lu %10lu %10lu %10lu %10lu\n",
+				l->nic, stage, l->count, l->min, l->avg,
+				l->p50, l->p99, l->p999, l->max);
+	}
+
+	rpc_disconnect(rpc);
+	return false;
+}
+
+static int latency_get(int argc, char** argv) {
+	if(argc < 2) {
+		help();
+		return -1;
+	}
+
+	if(!is_uint32(argv[1])) {
+		help();
+		return -2;
+	}
+
+	uint32_t vmid = parse_uint32(argv[1]);
+	rpc_latency_get(rpc, vmid, callback_latency_get, NULL);
+
+	return 0;
+}
+
+int main(int argc, char *argv[]) {
+	RPCSession* session = rpc_session();
+	if(!session) {
+		printf("RPC server not connected\n");
+		return ERROR_RPC_DISCONNECTED;
+	}
+
+	rpc = rpc_connect(session->host, session->port, 3, true);
+	if(rpc == NULL) {
+		printf("Failed to connect RPC server\n");
+		return ERROR_RPC_DISCONNECTED;
+	}
+	
+	int rc;
+	if((rc = latency_get(argc, argv))) {
+		printf("Failed to get VM latency. Error code : %d\n", rc);
+		rpc_disconnect(rpc);
+		return ERROR_CMD_EXECUTE;
+	}
+
+	while(1) {
+		if(rpc_connected(rpc)) {
+			rpc_loop(rpc);
+		} else {
+			free(rpc);
+			break;
+		}
+	}
+}
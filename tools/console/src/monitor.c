@@ -1,9 +1,12 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <util/types.h>
+#include <util/log.h>
 #include <control/rpc.h>
+#include <control/vmspec.h>
 
 #include "rpc.h"
 
@@ -18,23 +21,114 @@ static void help() {
 	printf("Usage: monitor [VM ID] [THREAD ID]\n");
 }
 
-static void stdio_handler(RPC* rpc, uint32_t id, uint8_t thread_id, int fd, char* str, uint16_t size, void* context, void(*callback)(RPC* rpc, uint16_t size)) {
+#define MAX_DECODERS	64
+
+// Log stream of a thread is decoded with the formats it registered
+typedef struct {
+	uint32_t	vmid;
+	uint8_t		thread_id;
+	LogDecoder*	decoder;
+} Decoder;
+
+static Decoder decoders[MAX_DECODERS];
+static int decoder_count;
+
+static LogDecoder* decoder_get(uint32_t vmid, uint8_t thread_id) {
+	for(int i = 0; i < decoder_count; i++) {
+		if(decoders[i].vmid == vmid && decoders[i].thread_id == thread_id)
+			return decoders[i].decoder;
+	}
+
+	if(decoder_count >= MAX_DECODERS)
+		return NULL;
+
+	LogDecoder* decoder = malloc(sizeof(LogDecoder));
+	if(!decoder)
+		return NULL;
+
+	log_decoder_init(decoder);
+	decoders[decoder_count].vmid = vmid;
+	decoders[decoder_count].thread_id = thread_id;
+	decoders[decoder_count].decoder = decoder;
+	decoder_count++;
+
+	return decoder;
+}
+
+static void log_callback(LogRecord* record, const char* format, void* context) {
+	char buf[1024];
+	if(format) {
+		log_print(buf, sizeof(buf), format, record);
+	} else {
+		// Registered before the monitor is connected
+		int len = snprintf(buf, sizeof(buf), "format %u:", record->format);
+		for(int i = 0; i < record->count && len < (int)sizeof(buf); i++)
+			len += snprintf(buf + len, sizeof(buf) - len, " 0x%lx", record->args[i]);
+	}
+
+	size_t len = strlen(buf);
+	printf("[%lu] %s%s", record->time, buf, len > 0 && buf[len - 1] == '\n' ? "" : "\n");
+}
+
+static uint16_t stdio_print(uint32_t id, uint8_t thread_id, int fd, char* str, uint16_t size, uint32_t dropped) {
 	static uint32_t current_id = -1;
 	static uint8_t current_thread_id = -1;
+	static int current_fd = -1;
 
-	if(!(current_id == id && current_thread_id == thread_id)) {
+	if(!(current_id == id && current_thread_id == thread_id && current_fd == fd)) {
 		current_id = id;
 		current_thread_id = thread_id;
-		printf( "***** vmid=%d thread=%d standard %s *****\n", current_id, current_thread_id, fd == 1 ? "Output" : "Error");
+		current_fd = fd;
+		if(fd == VM_STDIO_LOG)
+			printf( "***** vmid=%d thread=%d Log *****\n", current_id, current_thread_id);
+		else
+			printf( "***** vmid=%d thread=%d standard %s *****\n", current_id, current_thread_id, fd == 1 ? "Output" : "Error");
 		fflush(stdout);
 	}
 
-	size = write(1, str, size);
+	if(fd == VM_STDIO_LOG) {
+		LogDecoder* decoder = decoder_get(id, thread_id);
+		if(!decoder)
+			return size;
+
+		// Records are dropped as a whole, but a stream which is cut can't be continued
+		if(dropped) {
+			printf("***** %u bytes of log dropped *****\n", dropped);
+			decoder->len = 0;
+		}
+
+		if(log_decode(decoder, str, size, log_callback, NULL) < 0) {
+			printf("***** Log is broken *****\n");
+			decoder->len = 0;
+		}
+		fflush(stdout);
+
+		return size;
+	}
+
+	if(dropped) {
+		printf("\n***** %u bytes dropped *****\n", dropped);
+		fflush(stdout);
+	}
+
+	ssize_t len = size > 0 ? write(1, str, size) : 0;
+
+	return len < 0 ? 0 : len;
+}
+
+static void stdio_handler(RPC* rpc, uint32_t id, uint8_t thread_id, int fd, char* str, uint16_t size, void* context, void(*callback)(RPC* rpc, uint16_t size)) {
+	size = stdio_print(id, thread_id, fd, str, size, 0);
 	fflush(stdout);
 
 	callback(rpc, size);
 }
 
+static void stdio_batch_handler(RPC* rpc, VMStdio* records, int count, void* context) {
+	for(int i = 0; i < count; i++)
+		stdio_print(records[i].vmid, records[i].thread_id, records[i].fd, records[i].str, records[i].size, records[i].dropped);
+	fflush(stdout);
+}
+
 static int vm_monitor(int argc, char** argv) {
 	// TODO: Selectively monitor by VM, Thread
 /*
@@ -63,6 +157,7 @@ static int vm_monitor(int argc, char** argv) {
  */
 
 	rpc_stdio_handler(rpc, stdio_handler, NULL);
+	rpc_stdio_batch_handler(rpc, stdio_batch_handler, NULL);
 
 	return 0;
 }
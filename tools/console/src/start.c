@@ -16,36 +16,58 @@ static void help(char* command) {
 
 #define UNDERLINE(OPTION) ANSI_UNDERLINED_PRE #OPTION ANSI_UNDERLINED_POST
 
-	printf("Usage: %s " UNDERLINE(VM ID) "\n", command);
+	printf("Usage: %s " UNDERLINE(VM ID) " [VM ID...]\n", command);
 }
 
-static bool callback_status_set(bool result, void* context) {
-	void(*callback)(char* result, int exit_status) = context;
+// VMs are changed in batches, which are pipelined
+static uint32_t* vmids;
+static int vm_count;
+static int vm_sent;
+static VMStatus vmstatus;
 
-	if(result) {
-		printf("true\n");
-	} else {
-		printf("false\n");
+static bool callback_status_set(bool* results, int count, void* context) {
+	uint32_t* ids = context;
+
+	for(int i = 0; i < count; i++) {
+		if(vm_count > 1)
+			printf("%u: ", ids[i]);
+
+		if(results[i]) {
+			printf("true\n");
+		} else {
+			printf("false\n");
+		}
 	}
 
-	rpc_disconnect(rpc);
+	if(vm_sent == vm_count && rpc_pending(rpc) == 0)
+		rpc_disconnect(rpc);
+
 	return false;
 }
 
+static void send_status_set() {
+	while(vm_sent < vm_count) {
+		int count = vm_count - vm_sent < RPC_MAX_BATCH ? vm_count - vm_sent : RPC_MAX_BATCH;
+		if(rpc_status_set_batch(rpc, vmids + vm_sent, count, vmstatus, callback_status_set, vmids + vm_sent) <= 0)
+			break;
+
+		vm_sent += count;
+	}
+}
+
 static int status_set(int argc, char** argv) {
 	if(argc < 2) {
 		help(argv[0]);
 		return -1;
 	}
 
-	if(!is_uint32(argv[1])) {
-		help(argv[0]);
-		return -2;
+	for(int i = 1; i < argc; i++) {
+		if(!is_uint32(argv[i])) {
+			help(argv[0]);
+			return -2;
+		}
 	}
 
-	uint32_t vmid = parse_uint32(argv[1]);
-	VMStatus vmstatus;
-
 	if(strcmp(argv[0], "start") == 0)
 		vmstatus = VM_STATUS_START;
 	else if(strcmp(argv[0], "pause") == 0)
@@ -57,7 +79,15 @@ static int status_set(int argc, char** argv) {
 	else 
 		return -3;
 
-	rpc_status_set(rpc, vmid, vmstatus, callback_status_set, NULL);
+	vm_count = argc - 1;
+	vmids = malloc(sizeof(uint32_t) * vm_count);
+	if(!vmids)
+		return -4;
+
+	for(int i = 0; i < vm_count; i++)
+		vmids[i] = parse_uint32(argv[i + 1]);
+
+	send_status_set();
 
 	return 0;
 }
@@ -87,6 +117,7 @@ int main(int argc, char *argv[]) {
 	while(1) {
 		if(rpc_connected(rpc)) {
 			rpc_loop(rpc);
+			send_status_set();
 		} else {
 			free(rpc);
 			break;
@@ -14,10 +14,20 @@ static void help() {
 
 #define UNDERLINE(OPTION) ANSI_UNDERLINED_PRE #OPTION ANSI_UNDERLINED_POST
 
-	printf("Usage: status " UNDERLINE(VM ID) "\n");
+	printf("Usage: status " UNDERLINE(VM ID) " [VM ID...]\n");
 }
 
+// Requests are pipelined, responses may come in any order
+static uint32_t* vmids;
+static int vm_count;
+static int vm_sent;
+
 static bool callback_status_get(VMStatus status, void* context) {
+	uint32_t vmid = (uint64_t)context;
+
+	if(vm_count > 1)
+		printf("%u: ", vmid);
+
 	if(status == VM_STATUS_STOP)
 		printf("stop\n");
 	else if(status == VM_STATUS_PAUSE)
@@ -29,23 +39,39 @@ static bool callback_status_get(VMStatus status, void* context) {
 	else if(status == VM_STATUS_INVALID)
 		printf("invalid\n");
 
-	rpc_disconnect(rpc);
+	if(vm_sent == vm_count && rpc_pending(rpc) == 0)
+		rpc_disconnect(rpc);
+
 	return false;
 }
 
+static void send_status_get() {
+	while(vm_sent < vm_count && rpc_status_get(rpc, vmids[vm_sent], callback_status_get, (void*)(uint64_t)vmids[vm_sent]) > 0)
+		vm_sent++;
+}
+
 static int status_get(int argc, char** argv) {
 	if(argc < 2) {
 		help();
 		return -1;
 	}
 
-	if(!is_uint32(argv[1])) {
-		help();
-		return -2;
+	for(int i = 1; i < argc; i++) {
+		if(!is_uint32(argv[i])) {
+			help();
+			return -2;
+		}
 	}
 
-	uint32_t vmid = parse_uint32(argv[1]);
-	rpc_status_get(rpc, vmid, callback_status_get, NULL);
+	vm_count = argc - 1;
+	vmids = malloc(sizeof(uint32_t) * vm_count);
+	if(!vmids)
+		return -3;
+
+	for(int i = 0; i < vm_count; i++)
+		vmids[i] = parse_uint32(argv[i + 1]);
+
+	send_status_get();
 
 	return 0;
 }
@@ -73,6 +99,7 @@ int main(int argc, char *argv[]) {
 	while(1) {
 		if(rpc_connected(rpc)) {
 			rpc_loop(rpc);
+			send_status_get();
 		} else {
 			free(rpc);
 			break;
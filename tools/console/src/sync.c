@@ -0,0 +1,287 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/time.h>
+#include <sys/mman.h>
+#include <zlib.h>
+#include <util/types.h>
+#include <net/md5.h>
+#include <control/rpc.h>
+#include <control/vmspec.h>
+
+#include "rpc.h"
+
+static RPC* rpc;
+
+static void help() {
+#define ANSI_UNDERLINED_PRE  "\033[4m"
+#define ANSI_UNDERLINED_POST "\033[0m"
+
+#define UNDERLINE(OPTION) ANSI_UNDERLINED_PRE #OPTION ANSI_UNDERLINED_POST
+	printf("Usage: sync " UNDERLINE(VM ID) " " UNDERLINE(FILE) " [LEVEL]\n");
+	printf("\tOnly the blocks which differ from the storage are sent, compressed with zlib LEVEL (default: 1, 0: not compressed)\n");
+}
+
+typedef struct {
+	uint32_t	vmid;
+	int		fd;
+	uint8_t*	file;
+	uint64_t	file_size;
+	int		level;
+
+	// Digests of the storage
+	uint32_t	(*digests)[4];
+	uint32_t	count;
+	bool		is_digest_pending;
+	bool		is_digest_done;
+
+	// Blocks are compressed into one buffer while the other is being sent
+	uint8_t*	buffers[2];
+	uint8_t*	zero;
+	uint8_t*	padded;
+	int		turn;
+	uint32_t	index;
+	uint8_t		encoding;
+	void*		buf;
+	int32_t		size;
+	bool		is_prepared;
+
+	uint32_t	sent;
+	uint32_t	written;
+	uint32_t	errors;
+	uint64_t	sent_bytes;
+	uint64_t	current_time;
+} SyncInfo;
+
+static bool callback_storage_digest(uint32_t index, uint32_t* digests, int32_t count, void* context) {
+	SyncInfo* sync_info = context;
+	sync_info->is_digest_pending = false;
+
+	if(count < 0) {
+		printf("Storage Digest Error: %d\n", count);
+		printf("false\n");
+		rpc_disconnect(rpc);
+		return false;
+	}
+
+	if(count == 0) {
+		// Storage is not grown by sync
+		if(sync_info->file_size > (uint64_t)sync_info->count * VM_STORAGE_BLOCK_SIZE) {
+			printf("File is larger than the storage: %u blocks\n", sync_info->count);
+			printf("false\n");
+			rpc_disconnect(rpc);
+			return false;
+		}
+
+		sync_info->is_digest_done = true;
+		return false;
+	}
+
+	void* digests2 = realloc(sync_info->digests, sizeof(uint32_t) * 4 * (index + count));
+	if(!digests2) {
+		printf("Not enough memory\n");
+		rpc_disconnect(rpc);
+		return false;
+	}
+
+	sync_info->digests = digests2;
+	memcpy(sync_info->digests[index], digests, sizeof(uint32_t) * 4 * count);
+	sync_info->count = index + count;
+
+	return false;
+}
+
+static bool callback_storage_block(uint32_t index, int32_t status, void* context) {
+	SyncInfo* sync_info = context;
+
+	sync_info->written++;
+	if(status < 0) {
+		printf("\nStorage Block Error: block %u, %d\n", index, status);
+		sync_info->errors++;
+	} else {
+		printf(".");
+	}
+	fflush(stdout);
+
+	return true;
+}
+
+/*
+ * Block of the file, zero padded like the storage
+ */
+static uint8_t* file_block(SyncInfo* sync_info, uint32_t index) {
+	uint64_t offset = (uint64_t)index * VM_STORAGE_BLOCK_SIZE;
+	if(offset + VM_STORAGE_BLOCK_SIZE <= sync_info->file_size)
+		return sync_info->file + offset;
+
+	if(offset >= sync_info->file_size)
+		return sync_info->zero;
+
+	// Only the last block of the file is padded
+	memcpy(sync_info->padded, sync_info->file + offset, sync_info->file_size - offset);
+	memset(sync_info->padded + sync_info->file_size - offset, 0, offset + VM_STORAGE_BLOCK_SIZE - sync_info->file_size);
+
+	return sync_info->padded;
+}
+
+static bool prepare(SyncInfo* sync_info) {
+	for(; sync_info->index < sync_info->count; sync_info->index++) {
+		uint8_t* block = file_block(sync_info, sync_info->index);
+
+		uint32_t digest[4];
+		md5(block, VM_STORAGE_BLOCK_SIZE, digest);
+		if(!memcmp(digest, sync_info->digests[sync_info->index], sizeof(digest)))
+			continue;
+
+		sync_info->encoding = RPC_STORAGE_BLOCK_RAW;
+		sync_info->buf = block;
+		sync_info->size = VM_STORAGE_BLOCK_SIZE;
+
+		// Raw block is sent if it's not getting smaller
+		uint8_t* buffer = sync_info->buffers[sync_info->turn];
+		uLongf len = compressBound(VM_STORAGE_BLOCK_SIZE);
+		if(sync_info->level > 0 && compress2(buffer, &len, block, VM_STORAGE_BLOCK_SIZE, sync_info->level) == Z_OK && len < VM_STORAGE_BLOCK_SIZE) {
+			sync_info->encoding = RPC_STORAGE_BLOCK_DEFLATE;
+			sync_info->buf = buffer;
+			sync_info->size = len;
+		}
+
+		return true;
+	}
+
+	return false;
+}
+
+static void done(SyncInfo* sync_info) {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	uint64_t current = tv.tv_sec * 1000 * 1000 + tv.tv_usec;
+	float time = (float)(current - sync_info->current_time) / (float)1000;
+
+	printf("\nStorage Sync %s\n", sync_info->errors ? "Failed" : "Completed");
+	printf("%u of %u blocks changed, %lu bytes sent instead of %lu\n", sync_info->sent, sync_info->count,
+			sync_info->sent_bytes, (uint64_t)sync_info->sent * VM_STORAGE_BLOCK_SIZE);
+	printf("time = %0.3f ms, %0.3f MB/s\n", time, (double)sync_info->file_size / (time * 1000));
+	printf("%s\n", sync_info->errors ? "false" : "true");
+	fflush(stdout);
+
+	rpc_disconnect(rpc);
+}
+
+static void step(SyncInfo* sync_info) {
+	if(!sync_info->is_digest_done) {
+		if(!sync_info->is_digest_pending)
+			sync_info->is_digest_pending = rpc_storage_digest(rpc, sync_info->vmid, sync_info->count, callback_storage_digest, sync_info) > 0;
+		return;
+	}
+
+	if(!sync_info->is_prepared)
+		sync_info->is_prepared = prepare(sync_info);
+
+	if(sync_info->is_prepared) {
+		if(rpc_storage_block(rpc, sync_info->vmid, sync_info->index, sync_info->encoding, sync_info->buf, sync_info->size, callback_storage_block, sync_info) > 0) {
+			sync_info->sent++;
+			sync_info->sent_bytes += sync_info->size;
+			sync_info->index++;
+			sync_info->turn ^= 1;
+			sync_info->is_prepared = false;
+		}
+	} else if(sync_info->written == sync_info->sent) {
+		done(sync_info);
+	}
+}
+
+static int sync_storage(int argc, char** argv, SyncInfo* sync_info) {
+	if(argc < 3 || argc > 4) {
+		help();
+		return -1;
+	}
+
+	if(!is_uint32(argv[1])) {
+		help();
+		return -2;
+	}
+
+	sync_info->level = 1;
+	if(argc >= 4) {
+		if(!is_uint8(argv[3]) || parse_uint8(argv[3]) > 9) {
+			help();
+			return -3;
+		}
+		sync_info->level = parse_uint8(argv[3]);
+	}
+
+	sync_info->vmid = parse_uint32(argv[1]);
+
+	sync_info->fd = open(argv[2], O_RDONLY);
+	if(sync_info->fd < 0)
+		return -4;
+
+	sync_info->file_size = lseek(sync_info->fd, 0, SEEK_END);
+	lseek(sync_info->fd, 0, SEEK_SET);
+	if(sync_info->file_size == 0) {
+		printf("File is empty\n");
+		return -5;
+	}
+
+	sync_info->file = mmap(NULL, sync_info->file_size, PROT_READ, MAP_PRIVATE, sync_info->fd, 0);
+	if(sync_info->file == MAP_FAILED)
+		return -6;
+
+	sync_info->buffers[0] = malloc(compressBound(VM_STORAGE_BLOCK_SIZE));
+	sync_info->buffers[1] = malloc(compressBound(VM_STORAGE_BLOCK_SIZE));
+	sync_info->zero = calloc(1, VM_STORAGE_BLOCK_SIZE);
+	sync_info->padded = malloc(VM_STORAGE_BLOCK_SIZE);
+	if(!sync_info->buffers[0] || !sync_info->buffers[1] || !sync_info->zero || !sync_info->padded)
+		return -7;
+
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	sync_info->current_time = tv.tv_sec * 1000 * 1000 + tv.tv_usec;
+
+	return 0;
+}
+
+int main(int argc, char *argv[]) {
+	RPCSession* session = rpc_session();
+	if(!session) {
+		printf("RPC server not connected\n");
+		return ERROR_RPC_DISCONNECTED;
+	}
+
+	rpc = rpc_connect(session->host, session->port, 3, true);
+	if(rpc == NULL) {
+		printf("Failed to connect RPC server\n");
+		return ERROR_RPC_DISCONNECTED;
+	}
+
+	SyncInfo sync_info = {};
+	int rc;
+	if((rc = sync_storage(argc, argv, &sync_info))) {
+		printf("Failed to sync file. Error code : %d\n", rc);
+		rpc_disconnect(rpc);
+		return ERROR_CMD_EXECUTE;
+	}
+
+	while(rpc_connected(rpc)) {
+		rpc_loop(rpc);
+		if(rpc_connected(rpc))
+			step(&sync_info);
+	}
+	free(rpc);
+
+	free(sync_info.digests);
+	free(sync_info.buffers[0]);
+	free(sync_info.buffers[1]);
+	free(sync_info.zero);
+	free(sync_info.padded);
+	if(sync_info.file && sync_info.file != MAP_FAILED)
+		munmap(sync_info.file, sync_info.file_size);
+	if(sync_info.fd > 0)
+		close(sync_info.fd);
+
+	return 0;
+}
@@ -0,0 +1,195 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <util/types.h>
+#include <control/rpc.h>
+#include <control/vmspec.h>
+
+#include "rpc.h"
+
+#define ANSI_CLEAR	"\033[H\033[2J"
+#define MB		(1024 * 1024)
+
+static RPC* rpc;
+
+static void help() {
+#define ANSI_UNDERLINED_PRE  "\033[4m"
+#define ANSI_UNDERLINED_POST "\033[0m"
+
+#define UNDERLINE(OPTION) ANSI_UNDERLINED_PRE #OPTION ANSI_UNDERLINED_POST
+
+	printf("Usage: top [" UNDERLINE(INTERVAL) "]\n");
+	printf("\tINTERVAL is milliseconds between samples (default: 1000)\n");
+}
+
+typedef struct {
+	bool		is_sampled;
+	VMTelemetry	telemetry;
+	VMCoreTelemetry	cores[RPC_TELEMETRY_MAX_CORES];
+	uint16_t	core_count;
+	VMNICTelemetry*	nics;
+	uint16_t	nic_count;
+} TopInfo;
+
+static VMCoreTelemetry* core_find(TopInfo* top_info, uint8_t core) {
+	for(int i = 0; i < top_info->core_count; i++) {
+		if(top_info->cores[i].core == core)
+			return &top_info->cores[i];
+	}
+
+	return NULL;
+}
+
+static VMNICTelemetry* nic_find(TopInfo* top_info, uint32_t vmid, uint16_t nic) {
+	for(int i = 0; i < top_info->nic_count; i++) {
+		if(top_info->nics[i].vmid == vmid && top_info->nics[i].nic == nic)
+			return &top_info->nics[i];
+	}
+
+	return NULL;
+}
+
+static double rate(uint64_t current, uint64_t prev, double seconds) {
+	return current >= prev ? (double)(current - prev) / seconds : 0;
+}
+
+static bool callback_telemetry(VMTelemetry* telemetry, VMCoreTelemetry* cores, uint16_t core_count, VMNICTelemetry* nics, uint16_t nic_count, void* context) {
+	TopInfo* top_info = context;
+	if(!telemetry) {
+		printf("Telemetry is not supported by the manager\n");
+		rpc_disconnect(rpc);
+		return false;
+	}
+
+	// Rates are shown from the second sample
+	uint64_t elapsed = top_info->is_sampled && telemetry->time > top_info->telemetry.time ? telemetry->time - top_info->telemetry.time : 0;
+	double seconds = (double)elapsed / 1000000000.0;
+
+	printf(ANSI_CLEAR);
+	printf("gmalloc: %lu / %lu MB, bmalloc: %lu / %lu MB\n\n",
+			telemetry->gmalloc_used / MB, telemetry->gmalloc_total / MB,
+			telemetry->bmalloc_used / MB, telemetry->bmalloc_total / MB);
+
+	printf("%4s %8s %6s %8s %12s\n", "Core", "VM", "Status", "Load(%)", "Events/s");
+	for(int i = 0; i < core_count; i++) {
+		VMCoreTelemetry* c = &cores[i];
+		VMCoreTelemetry* p = core_find(top_info, c->core);
+
+		if(elapsed && p) {
+			double idle = (double)rate(c->idle, p->idle, 1) / (double)elapsed;
+			double load = idle < 1 ? (1 - idle) * 100 : 0;
+			printf("%4d %8u %6d %8.1f %12.0f\n", c->core, c->vmid, c->status, load, rate(c->events, p->events, seconds));
+		} else {
+			printf("%4d %8u %6d %8s %12s\n", c->core, c->vmid, c->status, "-", "-");
+		}
+	}
+
+	printf("\n%8s %3s %-17s %10s %10s %8s %10s %10s %8s %11s %11s %11s\n",
+			"VM", "NIC", "MAC", "RX pps", "RX MB/s", "RX drop", "TX pps", "TX MB/s", "TX drop", "Pool(KB)", "RX queue", "TX queue");
+	for(int i = 0; i < nic_count; i++) {
+		VMNICTelemetry* n = &nics[i];
+		VMNICTelemetry* p = nic_find(top_info, n->vmid, n->nic);
+
+		char mac[18];
+		sprintf(mac, "%02lx:%02lx:%02lx:%02lx:%02lx:%02lx",
+				(n->mac >> 40) & 0xff, (n->mac >> 32) & 0xff, (n->mac >> 24) & 0xff,
+				(n->mac >> 16) & 0xff, (n->mac >> 8) & 0xff, (n->mac >> 0) & 0xff);
+
+		char pool[24];
+		char rx_queue[24];
+		char tx_queue[24];
+		sprintf(pool, "%lu/%lu", n->pool_used / 1024, n->pool_total / 1024);
+		sprintf(rx_queue, "%u/%u", n->rx_queue, n->rx_queue_size);
+		sprintf(tx_queue, "%u/%u", n->tx_queue, n->tx_queue_size);
+
+		if(elapsed && p) {
+			printf("%8u %3d %-17s %10.0f %10.2f %8lu %10.0f %10.2f %8lu %11s %11s %11s\n",
+					n->vmid, n->nic, mac,
+					rate(n->rx_packets, p->rx_packets, seconds), rate(n->rx_bytes, p->rx_bytes, seconds) / MB, n->rx_drops,
+					rate(n->tx_packets, p->tx_packets, seconds), rate(n->tx_bytes, p->tx_bytes, seconds) / MB, n->tx_drops,
+					pool, rx_queue, tx_queue);
+		} else {
+			printf("%8u %3d %-17s %10s %10s %8lu %10s %10s %8lu %11s %11s %11s\n",
+					n->vmid, n->nic, mac, "-", "-", n->rx_drops, "-", "-", n->tx_drops,
+					pool, rx_queue, tx_queue);
+		}
+	}
+	fflush(stdout);
+
+	// Keep the sample to get the rates of the next one
+	if(nic_count > top_info->nic_count) {
+		VMNICTelemetry* nics2 = realloc(top_info->nics, sizeof(VMNICTelemetry) * nic_count);
+		if(!nics2) {
+			printf("Not enough memory\n");
+			rpc_disconnect(rpc);
+			return false;
+		}
+		top_info->nics = nics2;
+	}
+
+	memcpy(&top_info->telemetry, telemetry, sizeof(VMTelemetry));
+	top_info->core_count = core_count < RPC_TELEMETRY_MAX_CORES ? core_count : RPC_TELEMETRY_MAX_CORES;
+	memcpy(top_info->cores, cores, sizeof(VMCoreTelemetry) * top_info->core_count);
+	memcpy(top_info->nics, nics, sizeof(VMNICTelemetry) * nic_count);
+	top_info->nic_count = nic_count;
+	top_info->is_sampled = true;
+
+	return true;
+}
+
+static int top(int argc, char** argv, TopInfo* top_info) {
+	if(argc > 2) {
+		help();
+		return -1;
+	}
+
+	uint32_t interval = 1000;
+	if(argc == 2) {
+		if(!is_uint32(argv[1]) || parse_uint32(argv[1]) == 0) {
+			help();
+			return -2;
+		}
+		interval = parse_uint32(argv[1]);
+	}
+
+	if(rpc_telemetry(rpc, interval, callback_telemetry, top_info) < 0)
+		return -3;
+
+	return 0;
+}
+
+int main(int argc, char *argv[]) {
+	RPCSession* session = rpc_session();
+	if(!session) {
+		printf("RPC server not connected\n");
+		return ERROR_RPC_DISCONNECTED;
+	}
+
+	rpc = rpc_connect(session->host, session->port, 3, true);
+	if(rpc == NULL) {
+		printf("Failed to connect RPC server\n");
+		return ERROR_RPC_DISCONNECTED;
+	}
+
+	TopInfo top_info = {};
+	int rc;
+	if((rc = top(argc, argv, &top_info))) {
+		printf("Failed to subscribe telemetry. Error code : %d\n", rc);
+		rpc_disconnect(rpc);
+		return ERROR_CMD_EXECUTE;
+	}
+
+	while(1) {
+		if(rpc_connected(rpc)) {
+			rpc_loop(rpc);
+		} else {
+			free(rpc);
+			break;
+		}
+	}
+
+	free(top_info.nics);
+
+	return 0;
+}
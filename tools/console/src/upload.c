@@ -5,6 +5,7 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/time.h>
+#include <sys/mman.h>
 #include <util/types.h>
 #include <control/rpc.h>
 
@@ -17,80 +18,66 @@ static void help() {
 #define ANSI_UNDERLINED_POST "\033[0m"
 
 #define UNDERLINE(OPTION) ANSI_UNDERLINED_PRE #OPTION ANSI_UNDERLINED_POST
-	printf("Usage: upload " UNDERLINE(VM ID) " " UNDERLINE(FILE) " [SIZE]\n");
+	printf("Usage: upload " UNDERLINE(VM ID) " " UNDERLINE(FILE) " [SIZE [OFFSET [WINDOW]]]\n");
+	printf("\tOFFSET resumes a failed upload, WINDOW is bytes in flight\n");
 }
 
 typedef struct {
 	char		path[256];
 	int		fd;
+	uint8_t*	file;
 	uint64_t	file_size;
-	uint32_t	offset;
+	uint64_t	offset;
 	uint64_t	current_time;
 } FileInfo;
 
-static int32_t callback_storage_upload(uint32_t offset, void** buf, int32_t size, void* context) {
+static int32_t map_storage_upload(uint64_t offset, void** buf, int32_t size, void* context) {
 	FileInfo* file_info = context;
-	static uint8_t ubuf[2048];
 
-	if(size < 0) {
-		printf("Storage Upload Error\n");
-		fflush(stdout);
+	if(offset >= file_info->file_size)
+		return 0;
 
-		close(file_info->fd);
-		free(file_info);
+	// Frames are sent straight from the mapped file
+	*buf = file_info->file + offset;
+	if(offset + size > file_info->file_size)
+		size = file_info->file_size - offset;
 
-		printf("false\n");
-		rpc_disconnect(rpc);
-		return 0;
+	if(offset / (1024 * 1024) != (offset + size) / (1024 * 1024)) {
+		printf(".");
+		fflush(stdout);
 	}
 
-	if(size == 0) {
-		printf("\nStorage Upload Completed\n");
-		fflush(stdout);
+	return size;
+}
 
+static void callback_storage_upload(uint64_t offset, int32_t status, void* context) {
+	FileInfo* file_info = context;
+
+	if(status < 0) {
+		printf("\nStorage Upload Error: %d\n", status);
+		printf("Resume from offset: %lu\n", offset);
+		printf("false\n");
+	} else {
 		struct timeval tv;
 		gettimeofday(&tv, NULL);
 		uint64_t current = tv.tv_sec * 1000 * 1000 + tv.tv_usec;
-		printf("time = %0.3f ms\n", (float)(current - file_info->current_time) / (float)1000);
-
-		close(file_info->fd);
-		free(file_info);
+		float time = (float)(current - file_info->current_time) / (float)1000;
 
+		printf("\nStorage Upload Completed\n");
+		printf("time = %0.3f ms, %0.3f MB/s\n", time, (offset - file_info->offset) / (time * 1000));
 		printf("true\n");
-		rpc_disconnect(rpc);
-		return 0;
-	}
-
-	if(offset == 0)
-		printf("Total Upload Size : %ld Byte\n", file_info->file_size);
-
-	if(file_info->offset != offset) {
-		lseek(file_info->fd, offset, SEEK_SET);
-		file_info->offset = offset;
-	}
-
-	size = read(file_info->fd, ubuf, size > (int32_t)(file_info->file_size - file_info->offset) ? (int32_t)(file_info->file_size - file_info->offset) : size);
-
-	if(size < 0) {
-		printf("\nFile Read Error\n");
-		fflush(stdout);
-		buf = NULL;
-
-		rpc_disconnect(rpc);
-		return -1;
 	}
-
-	file_info->offset += size;
-	*buf = ubuf;
-
-	printf(".");
 	fflush(stdout);
 
-	return size;
+	munmap(file_info->file, file_info->file_size);
+	close(file_info->fd);
+	free(file_info);
+
+	rpc_disconnect(rpc);
 }
 
 static int upload(int argc, char** argv) {
-	if(argc < 3 || argc > 4) {
+	if(argc < 3 || argc > 6) {
 		help();
 		return -1;
 	}
@@ -105,8 +92,8 @@ static int upload(int argc, char** argv) {
 		return -3;
 	}
 
-	if(argc == 4) {
-		if(!is_uint32(argv[3])) {
+	for(int i = 3; i < argc; i++) {
+		if(!is_uint64(argv[i])) {
 			help();
 			return -4;
 		}
@@ -129,22 +116,46 @@ static int upload(int argc, char** argv) {
 
 	file_info->file_size = lseek(file_info->fd, 0, SEEK_END);
 	lseek(file_info->fd, 0, SEEK_SET);
-	file_info->offset = 0;
 
-	if(argc == 4) {
-		uint32_t size = parse_uint32(argv[3]);
+	if(argc >= 4) {
+		uint64_t size = parse_uint64(argv[3]);
 		if(size > file_info->file_size) {
 			printf("File size is smaller than paramter\n");
+			close(file_info->fd);
+			free(file_info);
 			return -7;
 		}
 		file_info->file_size = size;
 	}
 
+	if(argc >= 5)
+		file_info->offset = parse_uint64(argv[4]);
+
+	uint32_t window = 0;
+	if(argc >= 6)
+		window = parse_uint64(argv[5]);
+
+	if(file_info->offset >= file_info->file_size) {
+		printf("Nothing to upload\n");
+		close(file_info->fd);
+		free(file_info);
+		return -8;
+	}
+
+	file_info->file = mmap(NULL, file_info->file_size, PROT_READ, MAP_PRIVATE, file_info->fd, 0);
+	if(file_info->file == MAP_FAILED) {
+		close(file_info->fd);
+		free(file_info);
+		return -9;
+	}
+
+	printf("Total Upload Size : %ld Byte\n", file_info->file_size - file_info->offset);
+
 	struct timeval tv;
 	gettimeofday(&tv, NULL);
 	file_info->current_time = tv.tv_sec * 1000 * 1000 + tv.tv_usec;
 
-	rpc_storage_upload(rpc, vmid, callback_storage_upload, file_info);
+	rpc_storage_bulk_upload(rpc, vmid, file_info->offset, file_info->file_size - file_info->offset, window, map_storage_upload, callback_storage_upload, file_info);
 
 	return 0;
 }
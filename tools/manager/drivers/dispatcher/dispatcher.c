@@ -27,6 +27,15 @@ struct dispatcher_work {
 	dispatcher_work_fn_t	fn;
 	void*			data;
 	struct net_device*	dev;
+
+	/*
+	 * Frames received in a NAPI poll, delivered to VNICs at once. The rx
+	 * handler runs in softirq of any CPU, so the burst is locked.
+	 */
+	spinlock_t		burst_lock;
+	struct sk_buff*		burst[NICDEV_BURST_SIZE];
+	NICDevFrame		frames[NICDEV_BURST_SIZE];
+	int			burst_count;
 };
 
 static spinlock_t work_lock;
@@ -49,20 +58,31 @@ static struct dispatcher_work* alloc_dispatcher_work(dispatcher_work_fn_t fn,
 	work->fn = fn;
 	work->data = data;
 	work->dev = dev;
+	spin_lock_init(&work->burst_lock);
+	work->burst_count = 0;
 
 	return work;
 }
 
-static struct dispatcher_work* dispatcher_work_by_netdev(struct net_device *dev)
+static void free_dispatcher_work(struct dispatcher_work *work)
 {
-	struct dispatcher_work *pos;
+	int i;
 
-	list_for_each_entry(pos, &work_list, node) {
-		if (dev == pos->dev)
-			return pos;
-	}
+	for (i = 0; i < work->burst_count; i++)
+		kfree_skb(work->burst[i]);
 
-	return NULL;
+	kfree(work);
+}
+
+/*
+ * The work is the rx_handler_data of the net_device, caller holds rtnl_lock
+ */
+static struct dispatcher_work* dispatcher_work_by_netdev(struct net_device *dev)
+{
+	if (rtnl_dereference(dev->rx_handler) != dispatcher_handle_frame)
+		return NULL;
+
+	return rtnl_dereference(dev->rx_handler_data);
 }
 
 static inline void dispatcher_work_enqueue(struct dispatcher_work *work)
@@ -80,7 +100,7 @@ static inline void dispatcher_work_enqueue(struct dispatcher_work *work)
 
 	rtnl_lock();
 	if (netdev_rx_handler_register(dev,
-			dispatcher_handle_frame, work->data) < 0)
+			dispatcher_handle_frame, work) < 0)
 		printk("Failed to register rx_handler\n");
 	else
 		printk("Register net_device handler %s %p\n", dev->name, dev);
@@ -135,7 +155,7 @@ static inline void dispatcher_work_queue_flush(void)
 		list_del(&pos->node);
 		spin_unlock_irq(&work_lock);
 
-		kfree(pos);
+		free_dispatcher_work(pos);
 	}
 }
 
@@ -200,6 +220,36 @@ static void dispatcherd_stop(void)
 	}
 }
 
+/*
+ * Copy held frames to VNICs, publishing each VNIC's queue once, then give the
+ * buffers back to the driver. Caller holds burst_lock.
+ */
+static void __dispatcher_rx_flush(struct dispatcher_work *work)
+{
+	int i;
+
+	if (!work->burst_count)
+		return;
+
+	nicdev_rx_burst(work->data, work->frames, work->burst_count);
+
+	for (i = 0; i < work->burst_count; i++)
+		consume_skb(work->burst[i]);
+
+	work->burst_count = 0;
+}
+
+/*
+ * Called by the daemon with interrupts disabled, so softirq doesn't run on
+ * this CPU while the lock is held, or by the rx handler in softirq.
+ */
+static void dispatcher_rx_flush(struct dispatcher_work *work)
+{
+	spin_lock(&work->burst_lock);
+	__dispatcher_rx_flush(work);
+	spin_unlock(&work->burst_lock);
+}
+
 static inline struct task_struct* manager_task(pid_t pid)
 {
 	return pid_task(find_vpid(pid), PIDTYPE_PID);
@@ -223,14 +273,39 @@ rx_handler_result_t dispatcher_handle_frame(struct sk_buff** pskb)
 
 	struct ethhdr *eth = (struct ethhdr*)skb_mac_header(skb);
 	skb_linearize(skb);
-	NICDevice* nic_device = rcu_dereference(skb->dev->rx_handler_data);
-	BUG_ON(!nic_device);
+	struct dispatcher_work *work = rcu_dereference(skb->dev->rx_handler_data);
+	BUG_ON(!work);
+	NICDevice* nic_device = work->data;
+
+	// Tags are already stripped into skb by hardware or __netif_receive_skb_core
+	NICDevFrame frame;
+	frame.data = eth;
+	frame.size = ETH_HLEN + skb->len;
+	frame.tci = skb_vlan_tag_present(skb) ? skb_vlan_tag_get(skb) : 0;
+	frame.time = latency_now();
+
+	// Multicast frames are passed to the host stack as well, deliver them now
+	if (!nicdev_rx_classify(nic_device, &frame)) {
+		// Frames held go first to keep the order on the wire
+		dispatcher_rx_flush(work);
+
+		if (nicdev_rx_vlan(nic_device, frame.tci, eth, frame.size) == NICDEV_PROCESS_COMPLETE) {
+			consume_skb(skb);
+			return RX_HANDLER_CONSUMED;
+		}
 
-	int res = nicdev_rx(nic_device, eth, ETH_HLEN + skb->len);
-	if(res == NICDEV_PROCESS_COMPLETE)
-		return RX_HANDLER_CONSUMED;
-	else
 		return RX_HANDLER_PASS;
+	}
+
+	// Hold the skb until the end of the poll
+	spin_lock(&work->burst_lock);
+	work->frames[work->burst_count] = frame;
+	work->burst[work->burst_count++] = skb;
+	if (work->burst_count == NICDEV_BURST_SIZE)
+		__dispatcher_rx_flush(work);
+	spin_unlock(&work->burst_lock);
+
+	return RX_HANDLER_CONSUMED;
 }
 
 static int dispatcher_open(struct inode *inode, struct file *f)
@@ -263,13 +338,27 @@ static struct sk_buff* convert_to_skb(struct net_device* dev, Packet* packet)
 {
 	void* buf = packet->buffer + packet->start;
 	unsigned int len = packet->end - packet->start;
+	struct vlan_ethhdr* veth = buf;
+
+	// Let the hardware insert the tag
+	bool hw_vlan = len >= VLAN_ETH_HLEN &&
+			veth->h_vlan_proto == htons(ETH_P_8021Q) &&
+			(dev->features & NETIF_F_HW_VLAN_CTAG_TX);
 
-	struct sk_buff* skb = netdev_alloc_skb_ip_align(dev, len);
+	struct sk_buff* skb = netdev_alloc_skb_ip_align(dev, hw_vlan ? len - VLAN_HLEN : len);
 	if (unlikely(!skb))
 		return NULL;
 
-	skb_put(skb, len);
-	memcpy(skb->data, buf, len);
+	if (hw_vlan) {
+		skb_put(skb, len - VLAN_HLEN);
+		memcpy(skb->data, buf, 2 * ETH_ALEN);
+		memcpy(skb->data + 2 * ETH_ALEN, buf + 2 * ETH_ALEN + VLAN_HLEN,
+				len - 2 * ETH_ALEN - VLAN_HLEN);
+		__vlan_hwaccel_put_tag(skb, htons(ETH_P_8021Q), ntohs(veth->h_vlan_TCI));
+	} else {
+		skb_put(skb, len);
+		memcpy(skb->data, buf, len);
+	}
 
 	printk("NIC free in convert to skb\n");
 
@@ -310,36 +399,36 @@ static bool packet_process(Packet* packet, void* context)
 	return true;
 }
 
-static inline void dispatcher_tx(struct net_device *dev)
+static inline void dispatcher_tx(struct dispatcher_work *work)
 {
-	NICDevice* nic_device = rcu_dereference(dev->rx_handler_data);
-	BUG_ON(!nic_device);
-
 	//TODO map_iterator
-	nicdev_tx(nic_device, packet_process, dev);
+	nicdev_tx(work->data, packet_process, work->dev);
 }
 
-static inline void dispatcher_rx(struct net_device *dev)
+static inline void dispatcher_rx(struct dispatcher_work *work)
 {
+	struct net_device *dev = work->dev;
+
 	if (!netif_running(dev))
 		return;
 
 	struct napi_struct *napi;
 	list_for_each_entry(napi, &dev->napi_list, dev_list) {
 		if (!test_bit(NAPI_STATE_SCHED, &napi->state))
-			return;
+			continue;
 
-		napi->poll(napi, 1);
+		napi->poll(napi, NICDEV_BURST_SIZE);
 	}
+
+	dispatcher_rx_flush(work);
 }
 
 static void dispatcher_worker(void* data)
 {
 	struct dispatcher_work *work = data;
-	struct net_device *dev = work->dev;
 
-	dispatcher_rx(dev);
-	dispatcher_tx(dev);
+	dispatcher_rx(work);
+	dispatcher_tx(work);
 }
 
 static void* mm_virt_remap(struct mm_struct *mm, void* virt_addr, unsigned long size)
@@ -367,6 +456,37 @@ static void mm_virt_unmap(void* addr)
 	iounmap(addr);
 }
 
+/*
+ * Program VLAN filter of the hardware to receive the VNIC's VLAN
+ */
+static void dispatcher_vlan_add(VNIC* vnic)
+{
+	struct net_device *dev;
+
+	if (!vnic->vlan)
+		return;
+
+	rtnl_lock();
+	dev = __dev_get_by_name(&init_net, vnic->parent);
+	if (dev && vlan_vid_add(dev, htons(ETH_P_8021Q), vnic->vlan) < 0)
+		printk("Failed to add VLAN %d to %s\n", vnic->vlan, vnic->parent);
+	rtnl_unlock();
+}
+
+static void dispatcher_vlan_del(VNIC* vnic)
+{
+	struct net_device *dev;
+
+	if (!vnic->vlan)
+		return;
+
+	rtnl_lock();
+	dev = __dev_get_by_name(&init_net, vnic->parent);
+	if (dev)
+		vlan_vid_del(dev, htons(ETH_P_8021Q), vnic->vlan);
+	rtnl_unlock();
+}
+
 static long dispatcher_ioctl(struct file *f, unsigned int ioctl,
 		unsigned long arg)
 {
@@ -420,7 +540,9 @@ static long dispatcher_ioctl(struct file *f, unsigned int ioctl,
 				return -EINVAL;
 			}
 
+			rtnl_lock();
 			work = dispatcher_work_by_netdev(dev);
+			rtnl_unlock();
 			if (!work) {
 				printk("Failed to find work associated with %s\n", nic_device->name);
 				return -ENOMEM;
@@ -431,7 +553,7 @@ static long dispatcher_ioctl(struct file *f, unsigned int ioctl,
 			nicdev_unregister(nic_device->name);
 
 			kfree(work->data);
-			kfree(work);
+			free_dispatcher_work(work);
 
 			return 0;
 
@@ -445,6 +567,9 @@ static long dispatcher_ioctl(struct file *f, unsigned int ioctl,
 				return -EFAULT;
 			}
 
+			// Captures are not shared with the user-space manager
+			vnic->rx_capture = vnic->tx_capture = NULL;
+
 			nic_device = nicdev_get(vnic->parent);
 			if(!nic_device) {
 				printk("Invalid parent device name: %s\n", vnic->parent);
@@ -467,6 +592,8 @@ static long dispatcher_ioctl(struct file *f, unsigned int ioctl,
 				return -EFAULT;
 			}
 
+			dispatcher_vlan_add(vnic);
+
 			return 0;
 
 		case DISPATCHER_DESTROY_VNIC:
@@ -481,6 +608,7 @@ static long dispatcher_ioctl(struct file *f, unsigned int ioctl,
 			if(!vnic)
 				return -EFAULT;
 
+			dispatcher_vlan_del(vnic);
 			mm_virt_unmap(vnic->nic);
 			kfree(vnic);
 			return 0;
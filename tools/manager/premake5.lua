@@ -28,7 +28,7 @@ workspace "Penguin"
         files { "src/**.h", "src/**.c", "src/**.asm" }
         includedirs { "../../include", "../../include/ipv4" }
         libdirs { "." }
-        links { "umpn", "rt", "vnic" }
+        links { "umpn", "rt", "vnic", "z" }
 
         -- Make version header
         prebuildcommands {
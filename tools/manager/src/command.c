@@ -16,6 +16,7 @@
 #include "dispatcher.h"
 #include "version.h"
 #include "manager.h"
+#include "persist.h"
 #include "gmalloc.h"
 
 bool cmd_sync;
@@ -804,6 +805,7 @@ static int cmd_create(int argc, char** argv, void(*callback)(char* result, int e
 			nic->input_bandwidth = 1000000000;	/* 1 GB */
 			nic->output_bandwidth = 1000000000;	/* 1 GB */
 			nic->pool_size = 0x400000;		/* 4 MB */
+			nic->vlan = 0;
 			for( ; i < argc; i++) {
 				if(strcmp(argv[i], "mac:") == 0) {
 					i++;
@@ -890,6 +892,13 @@ static int cmd_create(int argc, char** argv, void(*callback)(char* result, int e
 						return -1;
 					}
 					nic->pool_size = parse_uint32(argv[i]);
+				} else if(strcmp(argv[i], "vlan:") == 0) {
+					i++;
+					if(!is_uint16(argv[i]) || parse_uint16(argv[i]) > 0xfff) {
+						printf("vlan must be 0 ~ 4095\n");
+						return -1;
+					}
+					nic->vlan = parse_uint16(argv[i]);
 				} else {
 					i--;
 					break;
@@ -916,6 +925,7 @@ static int cmd_create(int argc, char** argv, void(*callback)(char* result, int e
 		nic->input_bandwidth = 1000000000;	/* 1 GB */
 		nic->output_bandwidth = 1000000000;	/* 1 GB */
 		nic->pool_size = 0x400000;		/* 4 MB */
+		nic->vlan = 0;
 		vm->nic_count = 1;
 	}
 
@@ -923,6 +933,7 @@ static int cmd_create(int argc, char** argv, void(*callback)(char* result, int e
 	if(vmid == 0) {
 		callback("false", -1);
 	} else {
+		persist_vm_save(vmid, vm);
 		sprintf(cmd_result, "%d", vmid);
 		printf("%d\n", vmid);
 		callback(cmd_result, 0);
@@ -949,8 +960,10 @@ static int cmd_vm_destroy(int argc, char** argv, void(*callback)(char* result, i
 	uint32_t vmid = parse_uint32(argv[1]);
 	bool ret = vm_destroy(vmid);
 
-	if(ret)
+	if(ret) {
+		persist_vm_remove(vmid);
 		callback("true", 0);
+	}
 	else
 		callback("false", -1);
 
@@ -1013,9 +1026,20 @@ static int cmd_upload(int argc, char** argv, void(*callback)(char* result, int e
 	return 0;
 }
 
+typedef struct {
+	uint32_t	vmid;
+	int		status;
+	bool		is_persisted;	// Status is persisted once it's changed
+	void(*callback)(char* result, int exit_status);
+} StatusData;
+
 static void status_setted(bool result, void* context) {
-	void(*callback)(char* result, int exit_status) = context;
-	callback(result ? "true" : "false", 0);
+	StatusData* data = context;
+	if(result && data->is_persisted)
+		persist_vm_status(data->vmid, data->status);
+
+	data->callback(result ? "true" : "false", 0);
+	free(data);
 }
 
 static int cmd_status_set(int argc, char** argv, void(*callback)(char* result, int exit_status)) {
@@ -1042,8 +1066,19 @@ static int cmd_status_set(int argc, char** argv, void(*callback)(char* result, i
 		return -1;
 	}
 
+	StatusData* data = malloc(sizeof(StatusData));
+	if(!data) {
+		callback("false", -1);
+		return -1;
+	}
+
+	data->vmid = vmid;
+	data->status = status;
+	data->is_persisted = persist_vm_status_prepare(vmid, status);
+	data->callback = callback;
+
 	cmd_sync = true;
-	vm_status_set(vmid, status, status_setted, callback);
+	vm_status_set(vmid, status, status_setted, data);
 
 	return 0;
 }
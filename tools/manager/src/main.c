@@ -15,6 +15,7 @@
 #include "icc.h"
 #include "mapping.h"
 #include "shared.h"
+#include "mp.h"
 #include "gmalloc.h"
 #include "vm.h"
 #include "manager.h"
@@ -31,6 +32,7 @@
 #include "popcorn.h"
 #include "netlink.h"
 #include "dispatcher.h"
+#include "persist.h"
 #include "driver/nicdev.h"
 
 static bool idle0_event() {
@@ -344,6 +346,7 @@ static NICDevice* nicdev_create(NICInfo* info) {
 	if(!nic_device)
 		return NULL;
 
+	memset(nic_device, 0, sizeof(NICDevice));
 	nic_device->mac = info->mac;
 	strcpy(nic_device->name, info->name);
 
@@ -519,6 +522,10 @@ int main(int argc, char** argv) {
 	printf("\nInitializing NICs...\n");
 	nicdev_init();
 
+	printf("\nRestoring VMs...\n");
+	if(persist_init(PERSIST_PATH))
+		printf("\t%d VMs restored\n", persist_restore());
+
 	printf("\nInitializing RPC manager...\n");
 	manager_init();
 
@@ -529,8 +536,10 @@ int main(int argc, char** argv) {
 
 	mp_sync(2);
 
+	// Manager core polls without idling, only its events are counted
+	CoreCounters* counters = &shared->core_counters[mp_apic_id()];
 	while(1)
-		event_loop();
+		counters->events += event_loop();
 
 	return 0;
 error:
@@ -18,8 +18,11 @@
  */
 //#include <net/ether.h>
 #include <util/list.h>
+#include <util/map.h>
 #include <util/ring.h>
 #include <util/event.h>
+#include <util/log.h>
+#include <timer.h>
 //#undef BYTE_ORDER
 //#include <lwip/tcp.h>
 #include <control/rpc.h>
@@ -27,6 +30,7 @@
 #include "mp.h"
 //#include "shell.h"
 #include "vm.h"
+#include "persist.h"
 //#include "stdio.h"
 
 #include "manager.h"
@@ -156,6 +160,8 @@ static List* actives;	/* rpc */
 // Handlers
 static void vm_create_handler(RPC* rpc, VMSpec* vm, void* context, void(*callback)(RPC* rpc, uint32_t id)) {
 	uint32_t id = vm_create(vm);
+	if(id)
+		persist_vm_save(id, vm);
 	callback(rpc, id);
 }
 
@@ -171,6 +177,8 @@ static void vm_set_handler(RPC* rpc, VMSpec* vm, void* context, void(*callback)(
 
 static void vm_destroy_handler(RPC* rpc, uint32_t vmid, void* context, void(*callback)(RPC* rpc, bool result)) {
 	bool result = vm_destroy(vmid);
+	if(result)
+		persist_vm_remove(vmid);
 	callback(rpc, result);
 }
 
@@ -185,16 +193,132 @@ static void status_get_handler(RPC* rpc, uint32_t vmid, void* context, void(*cal
 	callback(rpc, status);
 }
 
+static void latency_get_handler(RPC* rpc, uint32_t vmid, int size, void* context, void(*callback)(RPC* rpc, VMLatency* latencies, int size)) {
+	VMLatency* latencies = malloc(sizeof(VMLatency) * size);
+	if(!latencies) {
+		callback(rpc, NULL, 0);
+		return;
+	}
+
+	size = vm_latency(vmid, latencies, size);
+	callback(rpc, latencies, size < 0 ? 0 : size);
+	free(latencies);
+}
+
+#define TELEMETRY_TICK	100000	// Subscriptions are checked every 100ms
+
+typedef struct {
+	RPC*		rpc;
+	uint32_t	request_id;
+	uint32_t	interval;	// ms
+	uint64_t	next;		// us
+	int		nic_size;
+	void(*callback)(RPC* rpc, VMTelemetry* telemetry, VMCoreTelemetry* cores, int core_count, VMNICTelemetry* nics, int nic_count);
+} Subscription;
+
+static List* subscriptions;
+
+static void telemetry_handler(RPC* rpc, uint32_t interval, int nic_size, void* context, void(*callback)(RPC* rpc, VMTelemetry* telemetry, VMCoreTelemetry* cores, int core_count, VMNICTelemetry* nics, int nic_count)) {
+	// A subscription is cancelled by its ID
+	ListIterator iter;
+	list_iterator_init(&iter, subscriptions);
+	while(list_iterator_has_next(&iter)) {
+		Subscription* s = list_iterator_next(&iter);
+		if(s->rpc == rpc && s->request_id == rpc->request_id) {
+			list_iterator_remove(&iter);
+			free(s);
+		}
+	}
+
+	if(interval == 0)
+		return;
+
+	Subscription* s = malloc(sizeof(Subscription));
+	if(!s)
+		return;
+
+	s->rpc = rpc;
+	s->request_id = rpc->request_id;
+	s->interval = interval;
+	s->next = 0;
+	s->nic_size = nic_size;
+	s->callback = callback;
+
+	if(!list_add(subscriptions, s))
+		free(s);
+}
+
+static bool telemetry_timer(void* context) {
+	if(list_is_empty(subscriptions))
+		return true;
+
+	VMTelemetry telemetry;
+	VMCoreTelemetry cores[RPC_TELEMETRY_MAX_CORES];
+	VMNICTelemetry* nics = NULL;
+	int core_count = 0;
+	int nic_count = 0;
+	int nic_size = -1;
+
+	// Sampled once for every subscriber of the tick, as many NICs as the
+	// largest request
+	uint64_t time = timer_us();
+	ListIterator iter;
+	list_iterator_init(&iter, subscriptions);
+	while(list_iterator_has_next(&iter)) {
+		Subscription* s = list_iterator_next(&iter);
+		if(list_index_of(actives, s->rpc, NULL) < 0 || rpc_is_closed(s->rpc)) {
+			list_iterator_remove(&iter);
+			free(s);
+			continue;
+		}
+
+		if(s->next <= time && s->nic_size > nic_size)
+			nic_size = s->nic_size;
+	}
+
+	if(nic_size < 0)
+		return true;
+
+	vm_telemetry(&telemetry);
+	core_count = vm_telemetry_cores(cores, RPC_TELEMETRY_MAX_CORES);
+	nics = nic_size > 0 ? malloc(sizeof(VMNICTelemetry) * nic_size) : NULL;
+	if(nics)
+		nic_count = vm_telemetry_nics(nics, nic_size);
+
+	list_iterator_init(&iter, subscriptions);
+	while(list_iterator_has_next(&iter)) {
+		Subscription* s = list_iterator_next(&iter);
+		if(s->next > time)
+			continue;
+		s->next = time + (uint64_t)s->interval * 1000;
+
+		s->rpc->request_id = s->request_id;
+		s->callback(s->rpc, &telemetry, cores, core_count, nics, nic_count < s->nic_size ? nic_count : s->nic_size);
+	}
+
+	free(nics);
+
+	return true;
+}
+
 typedef struct {
 	RPC* rpc;
 //	struct tcp_pcb*	pcb;
+	uint32_t request_id;
+	uint32_t vmid;
+	VMStatus status;
+	bool is_persisted;	// Status is persisted once it's changed
 	void(*callback)(RPC* rpc, bool result);
 } Data;
 
 static void status_setted(bool result, void* context) {
 	Data* data = context;
 
+	if(result && data->is_persisted)
+		persist_vm_status(data->vmid, data->status);
+
 //	if(list_index_of(clients, data->pcb, NULL) >= 0) {
+		data->rpc->request_id = data->request_id;
 		data->callback(data->rpc, result);
 //	}
 	free(data);
@@ -204,11 +328,103 @@ static void status_set_handler(RPC* rpc, uint32_t vmid, VMStatus status, void* c
 	Data* data = malloc(sizeof(Data));
 	data->rpc = rpc;
 	//data->pcb = context;
+	data->request_id = rpc->request_id;
+	data->vmid = vmid;
+	data->status = status;
+	data->is_persisted = persist_vm_status_prepare(vmid, status);
 	data->callback = callback;
 
 	vm_status_set(vmid, status, status_setted, data);
 }
 
+static void vm_create_batch_handler(RPC* rpc, VMSpec** vms, int count, void* context, void(*callback)(RPC* rpc, uint32_t* ids, int count)) {
+	uint32_t ids[RPC_MAX_BATCH];
+	for(int i = 0; i < count; i++) {
+		ids[i] = vms[i] ? vm_create(vms[i]) : 0;
+		if(ids[i])
+			persist_vm_save(ids[i], vms[i]);
+	}
+
+	callback(rpc, ids, count);
+}
+
+typedef struct _BatchData BatchData;
+
+typedef struct {
+	BatchData*	batch;
+	int		index;
+	uint32_t	vmid;
+	bool		is_persisted;	// Status is persisted once it's changed
+} BatchItem;
+
+struct _BatchData {
+	RPC*		rpc;
+	uint32_t	request_id;
+	void(*callback)(RPC* rpc, bool* results, int count);
+	int		count;
+	VMStatus	status;
+	int		pending;	// VMs which have not changed their status yet, and the batch itself
+	bool		results[RPC_MAX_BATCH];
+	BatchItem	items[RPC_MAX_BATCH];
+};
+
+static void batch_done(BatchData* data) {
+	if(--data->pending > 0)
+		return;
+
+	data->rpc->request_id = data->request_id;
+	data->callback(data->rpc, data->results, data->count);
+	free(data);
+}
+
+static void status_batch_setted(bool result, void* context) {
+	BatchItem* item = context;
+	item->batch->results[item->index] = result;
+
+	if(result && item->is_persisted)
+		persist_vm_status(item->vmid, item->batch->status);
+
+	batch_done(item->batch);
+}
+
+static void status_set_batch_handler(RPC* rpc, uint32_t* vmids, int count, VMStatus status, void* context, void(*callback)(RPC* rpc, bool* results, int count)) {
+	BatchData* data = malloc(sizeof(BatchData));
+	if(!data) {
+		bool results[RPC_MAX_BATCH] = { false, };
+		callback(rpc, results, count);
+		return;
+	}
+
+	data->rpc = rpc;
+	data->request_id = rpc->request_id;
+	data->callback = callback;
+	data->count = count;
+	data->status = status;
+	data->pending = count + 1;
+
+	// Every VM is changed at once, the batch is answered when the slowest is done
+	for(int i = 0; i < count; i++) {
+		data->items[i].batch = data;
+		data->items[i].index = i;
+		data->items[i].vmid = vmids[i];
+		data->items[i].is_persisted = persist_vm_status_prepare(vmids[i], status);
+		vm_status_set(vmids[i], status, status_batch_setted, &data->items[i]);
+	}
+
+	batch_done(data);
+}
+
+static void vm_destroy_batch_handler(RPC* rpc, uint32_t* vmids, int count, void* context, void(*callback)(RPC* rpc, bool* results, int count)) {
+	bool results[RPC_MAX_BATCH];
+	for(int i = 0; i < count; i++) {
+		results[i] = vm_destroy(vmids[i]);
+		if(results[i])
+			persist_vm_remove(vmids[i]);
+	}
+
+	callback(rpc, results, count);
+}
+
 static void storage_download_handler(RPC* rpc, uint32_t vmid, uint64_t download_size, uint32_t offset, int32_t size, void* context, void(*callback)(RPC* rpc, void* buf, int32_t size)) {
 	if(size < 0) {
 		callback(rpc, NULL, size);
@@ -257,6 +473,11 @@ static void storage_upload_handler(RPC* rpc, uint32_t vmid, uint32_t offset, voi
 	}
 }
 
+static int32_t storage_bulk_handler(RPC* rpc, uint32_t vmid, uint64_t offset, void** buf, int32_t size, void* context) {
+	// Frames are sent from and received into the storage blocks
+	return vm_storage_read(vmid, buf, offset, size);
+}
+
 static void stdio_handler(RPC* rpc, uint32_t id, uint8_t thread_id, int fd, char* str, uint16_t size, void* context, void(*callback)(RPC* rpc, uint16_t size)) {
 	ssize_t len = vm_stdio(id, thread_id, fd, str, size);
 	callback(rpc, len >= 0 ? len : 0);
@@ -269,6 +490,36 @@ static void storage_md5_handler(RPC* rpc, uint32_t id, uint64_t size, void* cont
 	//callback(rpc, ret, md5sum);
 }
 
+static void storage_digest_handler(RPC* rpc, uint32_t id, uint32_t index, int count, void* context, void(*callback)(RPC* rpc, uint32_t index, uint32_t* digests, int count)) {
+	uint32_t (*digests)[4] = count > 0 ? malloc(sizeof(uint32_t) * 4 * count) : NULL;
+	if(!digests) {
+		callback(rpc, index, NULL, -1);
+		return;
+	}
+
+	count = vm_storage_digests(id, index, digests, count);
+	callback(rpc, index, (uint32_t*)digests, count);
+	free(digests);
+}
+
+static void storage_block_handler(RPC* rpc, uint32_t id, uint32_t index, uint8_t encoding, void* buf, int32_t size, void* context, void(*callback)(RPC* rpc, uint32_t index, int32_t status)) {
+	void* block;
+	if(vm_storage_read(id, &block, (size_t)index * VM_STORAGE_SIZE_ALIGN, VM_STORAGE_SIZE_ALIGN) != VM_STORAGE_SIZE_ALIGN) {
+		callback(rpc, index, -1);
+		return;
+	}
+
+	if(encoding == RPC_STORAGE_BLOCK_RAW && size <= VM_STORAGE_SIZE_ALIGN) {
+		memcpy(block, buf, size);
+		memset(block + size, 0, VM_STORAGE_SIZE_ALIGN - size);
+		callback(rpc, index, 0);
+	} else if(encoding == RPC_STORAGE_BLOCK_DEFLATE) {
+		callback(rpc, index, vm_storage_inflate(block, VM_STORAGE_SIZE_ALIGN, buf, size) < 0 ? -1 : 0);
+	} else {
+		callback(rpc, index, -1);
+	}
+}
+
 /*// PCB utility*/
 /*static int pcb_read(RPC* rpc, void* buf, int size) {*/
 	/*RPCData* data = (RPCData*)rpc->data;*/
@@ -330,10 +581,18 @@ static bool manager_accept_loop(void* rpc) {
 	rpc_vm_list_handler(crpc, vm_list_handler, NULL);
 	rpc_status_get_handler(crpc, status_get_handler, NULL);
 	rpc_status_set_handler(crpc, status_set_handler, NULL); //pcb);
+	rpc_vm_create_batch_handler(crpc, vm_create_batch_handler, NULL);
+	rpc_status_set_batch_handler(crpc, status_set_batch_handler, NULL);
+	rpc_vm_destroy_batch_handler(crpc, vm_destroy_batch_handler, NULL);
+	rpc_telemetry_handler(crpc, telemetry_handler, NULL);
 	rpc_storage_download_handler(crpc, storage_download_handler, NULL);
 	rpc_storage_upload_handler(crpc, storage_upload_handler, NULL);
+	rpc_storage_bulk_handler(crpc, storage_bulk_handler, NULL);
 	rpc_stdio_handler(crpc, stdio_handler, NULL);
 	rpc_storage_md5_handler(crpc, storage_md5_handler, NULL);
+	rpc_storage_digest_handler(crpc, storage_digest_handler, NULL);
+	rpc_storage_block_handler(crpc, storage_block_handler, NULL);
+	rpc_latency_get_handler(crpc, latency_get_handler, NULL);
 
 	if(list_index_of(actives, crpc, NULL) < 0)
 		list_add(actives, crpc);
@@ -344,22 +603,105 @@ static bool manager_accept_loop(void* rpc) {
 	return true;
 }
 
-static void stdio_callback(uint32_t vmid, int thread_id, int fd, char* buffer, volatile size_t* head, volatile size_t* tail, size_t size) {
+static List* log_clients;	/* rpc which is sent the log formats */
+static Map* stdio_droppeds;	/* rpc: StdioDropped[VM_STDIO_MAX_BATCH] */
+
+/*
+ * Log formats registered before the client is connected, in messages of
+ * whole registrations
+ */
+static void log_formats_send(RPC* rpc) {
+	VMStdio formats[MP_MAX_CORE_COUNT];
+	int count = vm_log_formats(formats, MP_MAX_CORE_COUNT);
+	for(int i = 0; i < count; i++) {
+		size_t offset = 0;
+		while(offset < formats[i].size) {
+			size_t len = 0;
+			while(offset + len < formats[i].size) {
+				LogRecord* record = (LogRecord*)(formats[i].str + offset + len);
+				if(len + record->size > VM_STDIO_BATCH_SIZE)
+					break;
+				len += record->size;
+			}
+
+			VMStdio piece = formats[i];
+			piece.str = formats[i].str + offset;
+			piece.size = len;
+			if(rpc_stdio_batch(rpc, &piece, 1) <= 0) {
+				rpc_loop(rpc);
+				if(rpc_stdio_batch(rpc, &piece, 1) <= 0)
+					return;
+			}
+
+			if(piece.size != len)
+				return;
+
+			rpc_loop(rpc);
+			offset += len;
+		}
+	}
+}
+
+/*
+ * Bytes of a stream which a client could not take, reported in dropped of the
+ * next chunk of the stream sent to the client
+ */
+typedef struct {
+	uint32_t	vmid;
+	uint8_t		thread_id;
+	uint8_t		fd;
+	uint32_t	dropped;
+} StdioDropped;
+
+static StdioDropped* stdio_dropped_find(StdioDropped* droppeds, VMStdio* record) {
+	for(int i = 0; i < VM_STDIO_MAX_BATCH; i++) {
+		StdioDropped* dropped = &droppeds[i];
+		if(dropped->dropped && dropped->vmid == record->vmid &&
+				dropped->thread_id == record->thread_id && dropped->fd == record->fd)
+			return dropped;
+	}
+
+	return NULL;
+}
+
+static void stdio_dropped_add(StdioDropped* droppeds, VMStdio* record, uint32_t size) {
+	if(!droppeds || !size)
+		return;
+
+	StdioDropped* dropped = stdio_dropped_find(droppeds, record);
+	for(int i = 0; !dropped && i < VM_STDIO_MAX_BATCH; i++) {
+		if(!droppeds[i].dropped) {
+			dropped = &droppeds[i];
+			dropped->vmid = record->vmid;
+			dropped->thread_id = record->thread_id;
+			dropped->fd = record->fd;
+		}
+	}
+
+	if(dropped)
+		dropped->dropped += size;
+}
+
+static void stdio_dropped_take(StdioDropped* droppeds, VMStdio* record) {
+	if(!droppeds)
+		return;
+
+	StdioDropped* dropped = stdio_dropped_find(droppeds, record);
+	if(dropped) {
+		record->dropped += dropped->dropped;
+		dropped->dropped = 0;
+	}
+}
+
+static void stdio_callback(VMStdio* records, int count) {
 	fflush(stdout);
 	ListIterator iter;
 	list_iterator_init(&iter, actives);
-	size_t len0, len1, len2;
-	bool wrapped;
-
-	if(*head <= *tail) {
-		wrapped = false;
 
-		len0 = *tail - *head;
-	} else {
-		wrapped = true;
-
-		len1 = size - *head;
-		len2 = *tail;
+	bool is_log = false;
+	for(int i = 0; i < count; i++) {
+		if(records[i].fd == VM_STDIO_LOG)
+			is_log = true;
 	}
 
 	while(list_iterator_has_next(&iter)) {
@@ -369,30 +711,52 @@ static void stdio_callback(uint32_t vmid, int thread_id, int fd, char* buffer, v
 		 */
 		RPC* rpc = list_iterator_next(&iter);
 
-		if(wrapped) {
-			/*
-			 *write(STDOUT_FILENO, buffer + *head, len1);
-			 *write(STDOUT_FILENO, buffer, len2);
-			 */
-
-			rpc_stdio(rpc, vmid, thread_id, fd, buffer + *head, len1, NULL, NULL);
-			rpc_stdio(rpc, vmid, thread_id, fd, buffer, len2, NULL, NULL);
-
-		} else {
-			/*
-			 *write(STDOUT_FILENO, buffer + *head, len0);
-			 */
+		// Log records are not readable without their formats
+		if(is_log && list_index_of(log_clients, rpc, NULL) < 0) {
+			log_formats_send(rpc);
+			list_add(log_clients, rpc);
+		}
 
-			rpc_stdio(rpc, vmid, thread_id, fd, buffer + *head, len0, NULL, NULL);
+		StdioDropped* droppeds = map_get(stdio_droppeds, rpc);
+		if(!droppeds) {
+			droppeds = calloc(VM_STDIO_MAX_BATCH, sizeof(StdioDropped));
+			if(droppeds && !map_put(stdio_droppeds, rpc, droppeds)) {
+				free(droppeds);
+				droppeds = NULL;
+			}
 		}
 
-		rpc_loop(rpc);
-	}
+		// Cut chunks are not shared with the other clients
+		VMStdio batch[VM_STDIO_MAX_BATCH];
+		memcpy(batch, records, sizeof(VMStdio) * count);
+		for(int i = 0; i < count; i++)
+			stdio_dropped_take(droppeds, &batch[i]);
+
+		// The rest is sent once flushed, or dropped if the client is still busy
+		int sent = 0;
+		for(int retry = 0; retry < 2 && sent < count; retry++) {
+			int written = rpc_stdio_batch(rpc, batch + sent, count - sent);
+			if(written < 0)
+				break;
+
+			rpc_loop(rpc);
+			sent += written;
+			if(written == 0)
+				continue;
+
+			// The rest of a cut chunk is sent as a chunk of its own
+			VMStdio* last = &batch[sent - 1];
+			char* end = records[sent - 1].str + records[sent - 1].size;
+			if(last->str + last->size < end) {
+				last->str += last->size;
+				last->size = end - last->str;
+				last->dropped = 0;
+				sent--;
+			}
+		}
 
-	if(wrapped) {
-		*head = (*head + len1 + len2) % size;
-	} else {
-		*head += len0;
+		for(int i = sent; i < count; i++)
+			stdio_dropped_add(droppeds, &batch[i], batch[i].size + batch[i].dropped);
 	}
 }
 
@@ -437,6 +801,17 @@ static bool manager_server_open() {
 	if(actives == NULL)
 		actives = list_create(NULL);
 
+	if(log_clients == NULL)
+		log_clients = list_create(NULL);
+
+	if(stdio_droppeds == NULL)
+		stdio_droppeds = map_create(4, map_uint64_hash, map_uint64_equals, NULL);
+
+	if(subscriptions == NULL) {
+		subscriptions = list_create(NULL);
+		event_timer_add(telemetry_timer, NULL, TELEMETRY_TICK, TELEMETRY_TICK);
+	}
+
 	event_idle_add(manager_accept_loop, (void*)rpc);
 
 	return true;
@@ -493,8 +868,11 @@ static bool manager_loop(void* context) {
 			RPC* rpc = list_iterator_next(&iter);
 			if(!rpc_is_closed(rpc))
 				rpc_loop(rpc);
-			else
+			else {
 				list_remove_data(actives, rpc);
+				list_remove_data(log_clients, rpc);
+				free(map_remove(stdio_droppeds, rpc));
+			}
 		}
 	}
 
@@ -0,0 +1,567 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <linux/limits.h>
+#include <util/map.h>
+#include <util/event.h>
+#include "vm.h"
+
+#include "persist.h"
+
+typedef struct {
+	uint32_t	magic;
+	uint16_t	version;
+	int16_t		status;		///< VMStatus requested last
+	uint32_t	id;
+	uint32_t	size;		///< Bytes of the file
+	uint32_t	core_size;
+	uint32_t	memory_size;
+	uint32_t	storage_size;
+	uint16_t	nic_count;
+	uint16_t	argc;
+	// NICRecord nics[nic_count]
+	// uint16_t length and characters of argv[argc]
+} __attribute__((packed)) Header;
+
+typedef struct {
+	uint64_t	mac;
+	char		dev[MAX_NIC_NAME_LEN];
+	uint16_t	budget;
+	uint32_t	input_buffer_size;
+	uint32_t	output_buffer_size;
+	uint32_t	slow_input_buffer_size;
+	uint32_t	slow_output_buffer_size;
+	uint8_t		padding_head;
+	uint8_t		padding_tail;
+	uint64_t	input_bandwidth;
+	uint64_t	output_bandwidth;
+	uint32_t	pool_size;
+	uint16_t	vlan;
+} __attribute__((packed)) NICRecord;
+
+// Digests of the blocks which are in the image
+typedef struct {
+	uint32_t	count;
+	uint32_t	digests[0][4];
+} Digests;
+
+static char dir[PATH_MAX];
+static bool is_enabled;
+static Map* images;	/* vmid: Digests */
+
+static uint32_t starts[MAX_VM_COUNT];
+static int start_count;
+
+static void path_get(char* path, uint32_t vmid, const char* ext) {
+	snprintf(path, PATH_MAX, "%s/%u.%s", dir, vmid, ext);
+}
+
+static bool write_all(int fd, const void* buf, size_t size, off_t offset) {
+	while(size > 0) {
+		ssize_t len = pwrite(fd, buf, size, offset);
+		if(len < 0 && errno == EINTR)
+			continue;
+		if(len <= 0)
+			return false;
+
+		buf += len;
+		size -= len;
+		offset += len;
+	}
+
+	return true;
+}
+
+static ssize_t read_all(int fd, void* buf, size_t size, off_t offset) {
+	size_t idx = 0;
+	while(idx < size) {
+		ssize_t len = pread(fd, buf + idx, size - idx, offset + idx);
+		if(len < 0 && errno == EINTR)
+			continue;
+		if(len < 0)
+			return -1;
+		if(len == 0)
+			break;
+
+		idx += len;
+	}
+
+	return idx;
+}
+
+// Make renames in the directory durable
+static bool dir_sync() {
+	int fd = open(dir, O_RDONLY | O_DIRECTORY);
+	if(fd < 0)
+		return false;
+
+	bool result = fsync(fd) == 0;
+	close(fd);
+
+	return result;
+}
+
+// The file is replaced at once, it's never seen half written after a crash
+static bool file_write(const char* path, const void* buf, size_t size) {
+	char tmp[PATH_MAX];
+	snprintf(tmp, PATH_MAX, "%s.tmp", path);
+
+	int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if(fd < 0)
+		return false;
+
+	if(!write_all(fd, buf, size, 0) || fsync(fd) < 0) {
+		close(fd);
+		unlink(tmp);
+		return false;
+	}
+	close(fd);
+
+	if(rename(tmp, path) < 0) {
+		unlink(tmp);
+		return false;
+	}
+
+	return dir_sync();
+}
+
+static void* file_read(const char* path, size_t* size) {
+	int fd = open(path, O_RDONLY);
+	if(fd < 0)
+		return NULL;
+
+	struct stat st;
+	if(fstat(fd, &st) < 0 || st.st_size <= 0 || st.st_size > 0x1000000) {
+		close(fd);
+		return NULL;
+	}
+
+	void* buf = malloc(st.st_size);
+	if(!buf) {
+		close(fd);
+		return NULL;
+	}
+
+	if(read_all(fd, buf, st.st_size, 0) != st.st_size) {
+		free(buf);
+		close(fd);
+		return NULL;
+	}
+	close(fd);
+
+	*size = st.st_size;
+	return buf;
+}
+
+static void images_remove(uint32_t vmid) {
+	Digests* digests = map_remove(images, (void*)(uint64_t)vmid);
+	free(digests);
+}
+
+bool persist_init(const char* path) {
+	if(mkdir(path, 0700) < 0 && errno != EEXIST) {
+		printf("\tCannot create %s: %s\n", path, strerror(errno));
+		return false;
+	}
+
+	struct stat st;
+	if(stat(path, &st) < 0 || !S_ISDIR(st.st_mode) || access(path, R_OK | W_OK | X_OK) < 0) {
+		printf("\tCannot use %s\n", path);
+		return false;
+	}
+
+	images = map_create(MAX_VM_COUNT, map_uint64_hash, map_uint64_equals, NULL);
+	if(!images)
+		return false;
+
+	strncpy(dir, path, PATH_MAX - 1);
+	is_enabled = true;
+	printf("\tVM registry: %s\n", dir);
+
+	return true;
+}
+
+bool persist_vm_save(uint32_t vmid, VMSpec* vm_spec) {
+	if(!is_enabled)
+		return false;
+
+	VM* vm = vm_get(vmid);
+	if(!vm)
+		return false;
+
+	size_t size = sizeof(Header) + sizeof(NICRecord) * vm_spec->nic_count;
+	for(int i = 0; i < vm_spec->argc; i++)
+		size += sizeof(uint16_t) + strlen(vm_spec->argv[i]);
+
+	uint8_t* buf = malloc(size);
+	if(!buf)
+		return false;
+
+	Header* header = (Header*)buf;
+	header->magic = PERSIST_MAGIC;
+	header->version = PERSIST_VERSION;
+	header->status = VM_STATUS_STOP;
+	header->id = vmid;
+	header->size = size;
+	header->core_size = vm_spec->core_size;
+	header->memory_size = vm_spec->memory_size;
+	header->storage_size = vm_spec->storage_size;
+	header->nic_count = vm_spec->nic_count;
+	header->argc = vm_spec->argc;
+
+	// MACs which are generated are kept, the VM is restored as it is
+	NICRecord* nics = (NICRecord*)(buf + sizeof(Header));
+	for(int i = 0; i < vm_spec->nic_count; i++) {
+		NICSpec* nic = &vm_spec->nics[i];
+		memset(&nics[i], 0, sizeof(NICRecord));
+		nics[i].mac = i < vm->nic_count ? vm->nics[i]->mac : nic->mac;
+		strncpy(nics[i].dev, nic->dev, MAX_NIC_NAME_LEN - 1);
+		nics[i].budget = nic->budget;
+		nics[i].input_buffer_size = nic->input_buffer_size;
+		nics[i].output_buffer_size = nic->output_buffer_size;
+		nics[i].slow_input_buffer_size = nic->slow_input_buffer_size;
+		nics[i].slow_output_buffer_size = nic->slow_output_buffer_size;
+		nics[i].padding_head = nic->padding_head;
+		nics[i].padding_tail = nic->padding_tail;
+		nics[i].input_bandwidth = nic->input_bandwidth;
+		nics[i].output_bandwidth = nic->output_bandwidth;
+		nics[i].pool_size = nic->pool_size;
+		nics[i].vlan = nic->vlan;
+	}
+
+	uint8_t* p = (uint8_t*)&nics[vm_spec->nic_count];
+	for(int i = 0; i < vm_spec->argc; i++) {
+		uint16_t len = strlen(vm_spec->argv[i]);
+		memcpy(p, &len, sizeof(uint16_t));
+		memcpy(p + sizeof(uint16_t), vm_spec->argv[i], len);
+		p += sizeof(uint16_t) + len;
+	}
+
+	// Storage of the ID which was used before is stale
+	char path[PATH_MAX];
+	path_get(path, vmid, "img");
+	unlink(path);
+	path_get(path, vmid, "md5");
+	unlink(path);
+	images_remove(vmid);
+
+	path_get(path, vmid, "vm");
+	bool result = file_write(path, buf, size);
+	free(buf);
+
+	if(!result)
+		printf("Manager: Cannot persist VM[%d]: %s\n", vmid, strerror(errno));
+
+	return result;
+}
+
+bool persist_vm_remove(uint32_t vmid) {
+	if(!is_enabled)
+		return false;
+
+	char path[PATH_MAX];
+	path_get(path, vmid, "vm");
+	bool result = unlink(path) == 0;
+	path_get(path, vmid, "img");
+	unlink(path);
+	path_get(path, vmid, "md5");
+	unlink(path);
+	images_remove(vmid);
+
+	return result;
+}
+
+static bool is_zero(void* block, size_t size) {
+	uint64_t* p = block;
+	for(size_t i = 0; i < size / sizeof(uint64_t); i++) {
+		if(p[i])
+			return false;
+	}
+
+	return true;
+}
+
+int persist_storage_save(uint32_t vmid) {
+	if(!is_enabled)
+		return 0;
+
+	VM* vm = vm_get(vmid);
+	if(!vm)
+		return -1;
+
+	uint32_t count = vm->storage.count;
+	Digests* digests = malloc(sizeof(Digests) + sizeof(uint32_t) * 4 * count);
+	if(!digests)
+		return -2;
+
+	int digest_count = vm_storage_digests(vmid, 0, digests->digests, count);
+	if(digest_count < 0) {
+		free(digests);
+		return -1;
+	}
+	digests->count = digest_count;
+	Digests* old = map_get(images, (void*)(uint64_t)vmid);
+
+	char path[PATH_MAX];
+	path_get(path, vmid, "img");
+	int fd = open(path, O_WRONLY | O_CREAT, 0600);
+	if(fd < 0 || ftruncate(fd, (off_t)count * VM_STORAGE_SIZE_ALIGN) < 0) {
+		if(fd >= 0)
+			close(fd);
+		free(digests);
+		return -3;
+	}
+
+	// Only the blocks which changed are written, the rest of the image is a hole
+	int written = 0;
+	for(uint32_t i = 0; i < digests->count; i++) {
+		bool is_persisted = old && i < old->count;
+		if(is_persisted && !memcmp(old->digests[i], digests->digests[i], sizeof(uint32_t) * 4))
+			continue;
+
+		if(!is_persisted && is_zero(vm->storage.blocks[i], VM_STORAGE_SIZE_ALIGN))
+			continue;
+
+		if(!write_all(fd, vm->storage.blocks[i], VM_STORAGE_SIZE_ALIGN, (off_t)i * VM_STORAGE_SIZE_ALIGN)) {
+			close(fd);
+			free(digests);
+			return -4;
+		}
+		written++;
+	}
+
+	if(fdatasync(fd) < 0) {
+		close(fd);
+		free(digests);
+		return -5;
+	}
+	close(fd);
+
+	// Digests are written after the image, a block is never trusted before it's on the disk
+	path_get(path, vmid, "md5");
+	if(!file_write(path, digests->digests, sizeof(uint32_t) * 4 * digests->count)) {
+		free(digests);
+		return -6;
+	}
+
+	images_remove(vmid);
+	map_put(images, (void*)(uint64_t)vmid, digests);
+
+	return written;
+}
+
+bool persist_vm_status_prepare(uint32_t vmid, VMStatus status) {
+	if(!is_enabled)
+		return false;
+
+	if(status == VM_STATUS_START && persist_storage_save(vmid) < 0) {
+		printf("Manager: Cannot persist storage of VM[%d]\n", vmid);
+		return false;
+	}
+
+	return true;
+}
+
+bool persist_vm_status(uint32_t vmid, VMStatus status) {
+	if(!is_enabled)
+		return false;
+
+	char path[PATH_MAX];
+	path_get(path, vmid, "vm");
+	int fd = open(path, O_WRONLY);
+	if(fd < 0)
+		return false;
+
+	int16_t status2 = status;
+	bool result = write_all(fd, &status2, sizeof(int16_t), offsetof(Header, status)) && fdatasync(fd) == 0;
+	close(fd);
+
+	return result;
+}
+
+// Parse a registry file into vm_spec, whose arrays are given by the caller
+static bool spec_parse(uint8_t* buf, size_t size, Header** header, VMSpec* vm_spec, char** argv) {
+	if(size < sizeof(Header))
+		return false;
+
+	Header* h = (Header*)buf;
+	if(h->magic != PERSIST_MAGIC || h->version != PERSIST_VERSION || h->size != size)
+		return false;
+
+	if(h->nic_count > VM_MAX_NIC_COUNT || h->argc > VM_MAX_ARGC)
+		return false;
+
+	if(size < sizeof(Header) + sizeof(NICRecord) * h->nic_count)
+		return false;
+
+	vm_spec->id = h->id;
+	vm_spec->core_size = h->core_size;
+	vm_spec->memory_size = h->memory_size;
+	vm_spec->storage_size = h->storage_size;
+	vm_spec->nic_count = h->nic_count;
+	vm_spec->argc = h->argc;
+	vm_spec->argv = argv;
+
+	NICRecord* nics = (NICRecord*)(buf + sizeof(Header));
+	for(int i = 0; i < h->nic_count; i++) {
+		NICSpec* nic = &vm_spec->nics[i];
+		nics[i].dev[MAX_NIC_NAME_LEN - 1] = '\0';
+		nic->mac = nics[i].mac;
+		nic->dev = nics[i].dev;
+		nic->budget = nics[i].budget;
+		nic->input_buffer_size = nics[i].input_buffer_size;
+		nic->output_buffer_size = nics[i].output_buffer_size;
+		nic->slow_input_buffer_size = nics[i].slow_input_buffer_size;
+		nic->slow_output_buffer_size = nics[i].slow_output_buffer_size;
+		nic->padding_head = nics[i].padding_head;
+		nic->padding_tail = nics[i].padding_tail;
+		nic->input_bandwidth = nics[i].input_bandwidth;
+		nic->output_bandwidth = nics[i].output_bandwidth;
+		nic->pool_size = nics[i].pool_size;
+		nic->vlan = nics[i].vlan;
+	}
+
+	// Arguments are null terminated in place, over the length of the next one
+	uint8_t* p = (uint8_t*)&nics[h->nic_count];
+	uint8_t* end = buf + size;
+	for(int i = 0; i < h->argc; i++) {
+		uint16_t len;
+		if(p + sizeof(uint16_t) > end)
+			return false;
+		memcpy(&len, p, sizeof(uint16_t));
+		if(p + sizeof(uint16_t) + len > end)
+			return false;
+
+		memmove(p, p + sizeof(uint16_t), len);
+		p[len] = '\0';
+		argv[i] = (char*)p;
+		p += sizeof(uint16_t) + len;
+	}
+
+	*header = h;
+	return true;
+}
+
+// Storage is streamed from the image straight into the blocks of the VM
+static bool storage_load(uint32_t vmid) {
+	VM* vm = vm_get(vmid);
+	if(!vm)
+		return false;
+
+	char path[PATH_MAX];
+	path_get(path, vmid, "img");
+	int fd = open(path, O_RDONLY);
+	if(fd < 0) {
+		vm_storage_clear(vmid);
+		return errno == ENOENT;
+	}
+
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+	for(uint32_t i = 0; i < vm->storage.count; i++) {
+		ssize_t len = read_all(fd, vm->storage.blocks[i], VM_STORAGE_SIZE_ALIGN, (off_t)i * VM_STORAGE_SIZE_ALIGN);
+		if(len < 0) {
+			close(fd);
+			return false;
+		}
+
+		if(len < VM_STORAGE_SIZE_ALIGN)
+			memset(vm->storage.blocks[i] + len, 0, VM_STORAGE_SIZE_ALIGN - len);
+	}
+	close(fd);
+
+	// Digests of the image, to write only the blocks changed later
+	size_t size;
+	path_get(path, vmid, "md5");
+	uint32_t (*digests)[4] = file_read(path, &size);
+	if(digests) {
+		uint32_t count = size / (sizeof(uint32_t) * 4);
+		Digests* image = malloc(sizeof(Digests) + sizeof(uint32_t) * 4 * count);
+		if(image) {
+			image->count = count;
+			memcpy(image->digests, digests, sizeof(uint32_t) * 4 * count);
+			map_put(images, (void*)(uint64_t)vmid, image);
+		}
+		free(digests);
+	}
+
+	return true;
+}
+
+static void started(bool result, void* context) {
+	uint32_t vmid = (uint32_t)(uint64_t)context;
+	if(!result)
+		printf("Manager: Cannot start restored VM[%d]\n", vmid);
+}
+
+// Every VM is started at once on the first loop, when the cores are up
+static bool autostart(void* context) {
+	for(int i = 0; i < start_count; i++)
+		vm_status_set(starts[i], VM_STATUS_START, started, (void*)(uint64_t)starts[i]);
+	start_count = 0;
+
+	return false;
+}
+
+int persist_restore() {
+	if(!is_enabled)
+		return 0;
+
+	DIR* d = opendir(dir);
+	if(!d)
+		return 0;
+
+	int count = 0;
+	struct dirent* entry;
+	while((entry = readdir(d))) {
+		char* ext = strrchr(entry->d_name, '.');
+		if(!ext || strcmp(ext, ".vm"))
+			continue;
+
+		char path[PATH_MAX];
+		snprintf(path, PATH_MAX, "%s/%s", dir, entry->d_name);
+
+		size_t size;
+		uint8_t* buf = file_read(path, &size);
+		if(!buf)
+			continue;
+
+		Header* header;
+		VMSpec vm_spec;
+		NICSpec nics[VM_MAX_NIC_COUNT];
+		char* argv[VM_MAX_ARGC];
+		vm_spec.nics = nics;
+		if(!spec_parse(buf, size, &header, &vm_spec, argv) || header->id != strtoul(entry->d_name, NULL, 10)) {
+			printf("\tBroken VM registry: %s\n", path);
+			free(buf);
+			continue;
+		}
+
+		uint32_t vmid = vm_create_id(&vm_spec, header->id);
+		if(!vmid) {
+			printf("\tCannot restore VM[%d]\n", header->id);
+			free(buf);
+			continue;
+		}
+
+		if(!storage_load(vmid))
+			printf("\tCannot read storage of VM[%d]: %s\n", vmid, strerror(errno));
+
+		if(header->status == VM_STATUS_START && start_count < MAX_VM_COUNT)
+			starts[start_count++] = vmid;
+
+		free(buf);
+		count++;
+	}
+	closedir(d);
+
+	if(start_count > 0)
+		event_busy_add(autostart, NULL);
+
+	return count;
+}
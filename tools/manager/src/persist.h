@@ -0,0 +1,71 @@
+#ifndef __PERSIST_H__
+#define __PERSIST_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <control/vmspec.h>
+
+/**
+ * @file
+ * Persistent VM registry and storage images on a local disk, so VMs survive
+ * a restart of the host without being created and uploaded again over RPC.
+ * A VM has three files in the directory: <vmid>.vm for its spec and status,
+ * <vmid>.img for its storage and <vmid>.md5 for the digests of the blocks in
+ * the image.
+ */
+
+#define PERSIST_PATH		"/var/lib/packetngin"
+#define PERSIST_MAGIC		0x4d564e50	///< "PNVM"
+#define PERSIST_VERSION		1
+
+/**
+ * Open the directory of the registry, which is created if it's not there.
+ *
+ * @return false if the directory is not usable, nothing is persisted then
+ */
+bool persist_init(const char* path);
+
+/**
+ * Create the VMs of the registry with their IDs, and read their images into
+ * the storage. VMs which were started are started once the event loop runs,
+ * all at once.
+ *
+ * @return count of the VMs restored
+ */
+int persist_restore();
+
+/**
+ * Register a VM which has been created, with the MACs given to its NICs.
+ */
+bool persist_vm_save(uint32_t vmid, VMSpec* vm_spec);
+
+/**
+ * Remove a destroyed VM from the registry.
+ */
+bool persist_vm_remove(uint32_t vmid);
+
+/**
+ * Write the blocks of the storage which changed since they were persisted.
+ * Images are uploaded before a VM is started, so it's called then.
+ *
+ * @return count of the blocks written, negative on I/O error
+ */
+int persist_storage_save(uint32_t vmid);
+
+/**
+ * Called before the status of a VM is changed. The storage is written when
+ * the VM is to be started, before the VM changes it.
+ *
+ * @return false if the status is not to be persisted as the storage is not
+ */
+bool persist_vm_status_prepare(uint32_t vmid, VMStatus status);
+
+/**
+ * Keep the status of a VM once it's changed, a VM which is started is
+ * started again when it's restored.
+ *
+ * @return false if the status is not persisted
+ */
+bool persist_vm_status(uint32_t vmid, VMStatus status);
+
+#endif /* __PERSIST_H__ */
@@ -0,0 +1,123 @@
+#ifndef __IO_H__
+#define __IO_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <net/if.h>
+
+/**
+ * @file
+ * Pluggable I/O backends which move Ethernet frames between Linux network
+ * interfaces and the user-mode PacketNgin. Every queue of a port is an fd
+ * which can be polled by epoll, and frames are read and written in bursts.
+ */
+
+#define IO_MAX_QUEUES		8	///< Maximum number of queues of a port
+#define IO_BURST		64	///< Maximum number of frames in an rx or tx call
+#define IO_FRAME_SIZE		2048	///< Maximum frame size
+
+typedef struct _IOPort IOPort;
+typedef struct _IOQueue IOQueue;
+
+/**
+ * A frame to be transmitted
+ */
+typedef struct {
+	uint8_t*	buf;
+	uint32_t	size;
+} IOFrame;
+
+/**
+ * Frame received callback, buf is valid only in the callback.
+ */
+typedef void (*IOReceived)(IOQueue* queue, uint8_t* buf, uint32_t size, void* context);
+
+typedef struct {
+	const char*	name;
+
+	/**
+	 * Open fds of the queues and bind them to port->name.
+	 */
+	bool		(*open)(IOPort* port);
+	void		(*close)(IOPort* port);
+
+	/**
+	 * Receive at most budget frames from a queue without blocking.
+	 *
+	 * @return number of frames received
+	 */
+	int		(*rx)(IOQueue* queue, IOReceived received, void* context, int budget);
+
+	/**
+	 * Transmit frames to a queue without blocking, frames are not freed.
+	 *
+	 * @return number of frames transmitted
+	 */
+	int		(*tx)(IOQueue* queue, IOFrame* frames, int count);
+} IOBackend;
+
+struct _IOQueue {
+	IOPort*		port;
+	int		index;
+	int		fd;
+	void*		priv;		///< Backend state of the queue
+
+	uint64_t	rx_packets;
+	uint64_t	tx_packets;
+	uint64_t	tx_drop_packets;
+};
+
+struct _IOPort {
+	char			name[IFNAMSIZ];
+	uint64_t		mac;
+	int			index;		///< Port number of the user
+	const IOBackend*	backend;
+
+	int			queue_count;
+	IOQueue			queues[IO_MAX_QUEUES];
+	int			tx_next;	///< Queue of the next burst
+};
+
+/**
+ * TAP device, queues are opened with IFF_MULTI_QUEUE when there is more than one.
+ */
+extern const IOBackend io_tun;
+
+/**
+ * AF_PACKET socket with a TPACKET_V3 rx ring mmapped, queues are a fanout group.
+ */
+extern const IOBackend io_packet;
+
+/**
+ * Find a backend by name, "tun" or "packet".
+ *
+ * @return backend or NULL
+ */
+const IOBackend* io_backend(const char* name);
+
+/**
+ * Open a port and bring the interface up.
+ *
+ * @param backend I/O backend
+ * @param name interface name, a TAP device is created if it doesn't exist
+ * @param queue_count number of queues (1 ~ IO_MAX_QUEUES)
+ *
+ * @return port or NULL
+ */
+IOPort* io_port_create(const IOBackend* backend, const char* name, int queue_count);
+void io_port_destroy(IOPort* port);
+
+/**
+ * Register queues of a port to epoll, event.data.ptr is the IOQueue.
+ */
+bool io_port_poll(IOPort* port, int epfd);
+void io_port_unpoll(IOPort* port, int epfd);
+
+/**
+ * Transmit frames spreading them over the queues of a port.
+ *
+ * @return number of frames transmitted
+ */
+int io_port_tx(IOPort* port, IOFrame* frames, int count);
+
+#endif /* __IO_H__ */
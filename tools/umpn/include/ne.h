@@ -2,7 +2,7 @@
 #define __NE_PORT_H__
 
 #include "node.h"
-#include "tun.h"
+#include "io.h"
 
 typedef struct _NEPort NEPort;
 
@@ -14,11 +14,19 @@ struct _NEPort {
 	void	(*send)(Node* this, Packet* packet);
 	
 //	NI*		ni;
-	TunInterface* ti;
+	IOPort*	port;
 	void	(*received)(NEPort* this, Packet* packet);
 };
 
-Group* ne_create(int port_count); 
+/**
+ * Create ports of the network emulator.
+ *
+ * @param port_count number of ports
+ * @param backend I/O backend of the ports
+ * @param queue_count number of queues of each port
+ * @param ifnames interfaces of the ports, TAP devices are created for NULL names
+ */
+Group* ne_create(int port_count, const IOBackend* backend, int queue_count, char** ifnames);
 bool ne_destroy(Group* ne);
 
 #endif /* __NE_PORT_H__ */
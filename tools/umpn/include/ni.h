@@ -34,6 +34,7 @@ typedef struct {
 } NI;
 
 extern uint64_t ni_mac;
+extern __thread int ni_port;	///< Port of the frames being processed by the thread
 
 void ni_init0();
 
@@ -0,0 +1,159 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <sys/epoll.h>
+#include "io.h"
+
+static const IOBackend* backends[] = {
+	&io_tun,
+	&io_packet,
+	NULL
+};
+
+const IOBackend* io_backend(const char* name) {
+	for(int i = 0; backends[i]; i++) {
+		if(!strcmp(backends[i]->name, name))
+			return backends[i];
+	}
+
+	return NULL;
+}
+
+static int get_ctl_fd(void) {
+	int s_errno;
+	int fd;
+
+	fd = socket(PF_INET, SOCK_DGRAM, 0);
+	if(fd >= 0)
+		return fd;
+	s_errno = errno;
+	fd = socket(PF_PACKET, SOCK_DGRAM, 0);
+	if(fd >= 0)
+		return fd;
+	fd = socket(PF_INET6, SOCK_DGRAM, 0);
+	if(fd >= 0)
+		return fd;
+	errno = s_errno;
+	perror("Cannot create control socket");
+
+	return -1;
+}
+
+/*
+ * Set the interface up and get the MAC address
+ */
+static bool io_port_up(IOPort* port) {
+	struct ifreq ifr;
+	int fd = get_ctl_fd();
+	if(fd < 0)
+		return false;
+
+	memset(&ifr, 0, sizeof(ifr));
+	memcpy(ifr.ifr_name, port->name, IFNAMSIZ);
+
+	if(ioctl(fd, SIOCGIFFLAGS, &ifr) < 0) {
+		perror("ioctl(SIOCGIFFLAGS)");
+		goto error;
+	}
+
+	if(!(ifr.ifr_flags & IFF_UP)) {
+		ifr.ifr_flags |= IFF_UP;
+		if(ioctl(fd, SIOCSIFFLAGS, &ifr) < 0) {
+			perror("ioctl(SIOCSIFFLAGS)");
+			goto error;
+		}
+	}
+
+	if(ioctl(fd, SIOCGIFHWADDR, &ifr) < 0) {
+		perror("ioctl(SIOCGIFHWADDR)");
+		goto error;
+	}
+
+	uint8_t* mac = (uint8_t*)ifr.ifr_hwaddr.sa_data;
+	port->mac = 0;
+	for(int i = 0; i < 6; i++)
+		port->mac = port->mac << 8 | mac[i];
+
+	close(fd);
+	return true;
+
+error:
+	close(fd);
+	return false;
+}
+
+IOPort* io_port_create(const IOBackend* backend, const char* name, int queue_count) {
+	if(queue_count < 1 || queue_count > IO_MAX_QUEUES)
+		return NULL;
+
+	IOPort* port = malloc(sizeof(IOPort));
+	if(!port)
+		return NULL;
+
+	memset(port, 0, sizeof(IOPort));
+	strncpy(port->name, name, IFNAMSIZ - 1);
+	port->backend = backend;
+	port->queue_count = queue_count;
+	for(int i = 0; i < queue_count; i++) {
+		port->queues[i].port = port;
+		port->queues[i].index = i;
+		port->queues[i].fd = -1;
+	}
+
+	if(!backend->open(port)) {
+		free(port);
+		return NULL;
+	}
+
+	if(!io_port_up(port)) {
+		backend->close(port);
+		free(port);
+		return NULL;
+	}
+
+	return port;
+}
+
+void io_port_destroy(IOPort* port) {
+	port->backend->close(port);
+	free(port);
+}
+
+bool io_port_poll(IOPort* port, int epfd) {
+	for(int i = 0; i < port->queue_count; i++) {
+		struct epoll_event event = {
+			.events = EPOLLIN,
+			.data.ptr = &port->queues[i]
+		};
+
+		if(epoll_ctl(epfd, EPOLL_CTL_ADD, port->queues[i].fd, &event) < 0) {
+			perror("epoll_ctl");
+			while(i--)
+				epoll_ctl(epfd, EPOLL_CTL_DEL, port->queues[i].fd, NULL);
+
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void io_port_unpoll(IOPort* port, int epfd) {
+	for(int i = 0; i < port->queue_count; i++)
+		epoll_ctl(epfd, EPOLL_CTL_DEL, port->queues[i].fd, NULL);
+}
+
+int io_port_tx(IOPort* port, IOFrame* frames, int count) {
+	IOQueue* queue = &port->queues[port->tx_next];
+	port->tx_next = (port->tx_next + 1) % port->queue_count;
+
+	int sent = port->backend->tx(queue, frames, count);
+	queue->tx_packets += sent;
+	queue->tx_drop_packets += count - sent;
+
+	return sent;
+}
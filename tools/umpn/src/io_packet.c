@@ -0,0 +1,209 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <arpa/inet.h>
+#include <linux/if_packet.h>
+#include <linux/if_ether.h>
+#include "io.h"
+
+/*
+ * AF_PACKET socket with a TPACKET_V3 rx ring. The kernel fills blocks of
+ * frames in the mmapped ring and wakes up the poller once per block, so a
+ * burst is read without any syscall. Frames are transmitted by sendmmsg.
+ * Queues of a port are sockets in a fanout group hashed by flow.
+ */
+
+#define PACKET_BLOCK_SIZE	(1 << 20)
+#define PACKET_BLOCK_COUNT	16
+#define PACKET_BLOCK_TIMEOUT	1	///< Retire a block which is not full after 1 ms
+
+typedef struct {
+	uint8_t*		ring;
+	int			block;		///< Block being read
+	uint32_t		remaining;	///< Frames not read in the block
+	struct tpacket3_hdr*	hdr;		///< Next frame in the block
+} PacketQueue;
+
+static void packet_close(IOPort* port) {
+	for(int i = 0; i < port->queue_count; i++) {
+		IOQueue* queue = &port->queues[i];
+		PacketQueue* pq = queue->priv;
+		if(pq) {
+			if(pq->ring != MAP_FAILED)
+				munmap(pq->ring, PACKET_BLOCK_SIZE * PACKET_BLOCK_COUNT);
+
+			free(pq);
+		}
+
+		if(queue->fd >= 0)
+			close(queue->fd);
+
+		queue->fd = -1;
+		queue->priv = NULL;
+	}
+}
+
+static bool packet_open(IOPort* port) {
+	int ifindex = if_nametoindex(port->name);
+	if(!ifindex) {
+		printf("Cannot find interface %s\n", port->name);
+		return false;
+	}
+
+	for(int i = 0; i < port->queue_count; i++) {
+		IOQueue* queue = &port->queues[i];
+
+		PacketQueue* pq = malloc(sizeof(PacketQueue));
+		if(!pq)
+			goto error;
+
+		memset(pq, 0, sizeof(PacketQueue));
+		pq->ring = MAP_FAILED;
+		queue->priv = pq;
+
+		queue->fd = socket(AF_PACKET, SOCK_RAW | SOCK_NONBLOCK, htons(ETH_P_ALL));
+		if(queue->fd < 0) {
+			perror("socket(AF_PACKET)");
+			goto error;
+		}
+
+		int version = TPACKET_V3;
+		if(setsockopt(queue->fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0) {
+			perror("setsockopt(PACKET_VERSION)");
+			goto error;
+		}
+
+		struct tpacket_req3 req = {
+			.tp_block_size		= PACKET_BLOCK_SIZE,
+			.tp_block_nr		= PACKET_BLOCK_COUNT,
+			.tp_frame_size		= IO_FRAME_SIZE,
+			.tp_frame_nr		= PACKET_BLOCK_SIZE / IO_FRAME_SIZE * PACKET_BLOCK_COUNT,
+			.tp_retire_blk_tov	= PACKET_BLOCK_TIMEOUT,
+		};
+		if(setsockopt(queue->fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0) {
+			perror("setsockopt(PACKET_RX_RING)");
+			goto error;
+		}
+
+		pq->ring = mmap(NULL, PACKET_BLOCK_SIZE * PACKET_BLOCK_COUNT, PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_LOCKED | MAP_POPULATE, queue->fd, 0);
+		if(pq->ring == MAP_FAILED) {
+			perror("mmap(PACKET_RX_RING)");
+			goto error;
+		}
+
+		// Transmitted frames don't go through the qdisc
+		int bypass = 1;
+		setsockopt(queue->fd, SOL_PACKET, PACKET_QDISC_BYPASS, &bypass, sizeof(bypass));
+
+		struct sockaddr_ll addr = {
+			.sll_family	= AF_PACKET,
+			.sll_protocol	= htons(ETH_P_ALL),
+			.sll_ifindex	= ifindex,
+		};
+		if(bind(queue->fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+			perror("bind(AF_PACKET)");
+			goto error;
+		}
+
+		if(port->queue_count > 1) {
+			int fanout = (ifindex & 0xffff) | PACKET_FANOUT_HASH << 16;
+			if(setsockopt(queue->fd, SOL_PACKET, PACKET_FANOUT, &fanout, sizeof(fanout)) < 0) {
+				perror("setsockopt(PACKET_FANOUT)");
+				goto error;
+			}
+		}
+	}
+
+	return true;
+
+error:
+	packet_close(port);
+	return false;
+}
+
+static int packet_rx(IOQueue* queue, IOReceived received, void* context, int budget) {
+	PacketQueue* pq = queue->priv;
+	int count = 0;
+
+	while(count < budget) {
+		struct tpacket_block_desc* block = (void*)(pq->ring + pq->block * PACKET_BLOCK_SIZE);
+
+		if(!pq->remaining) {
+			if(!(block->hdr.bh1.block_status & TP_STATUS_USER))
+				break;
+
+			// Frames are read after the status
+			__sync_synchronize();
+			pq->remaining = block->hdr.bh1.num_pkts;
+			pq->hdr = (void*)((uint8_t*)block + block->hdr.bh1.offset_to_first_pkt);
+		}
+
+		if(pq->remaining) {
+			struct tpacket3_hdr* hdr = pq->hdr;
+			struct sockaddr_ll* sll = (void*)((uint8_t*)hdr + TPACKET_ALIGN(sizeof(struct tpacket3_hdr)));
+
+			// Frames transmitted by the interface are seen by ETH_P_ALL sockets as well
+			if(sll->sll_pkttype != PACKET_OUTGOING) {
+				received(queue, (uint8_t*)hdr + hdr->tp_mac, hdr->tp_snaplen, context);
+				count++;
+			}
+
+			pq->hdr = (void*)((uint8_t*)hdr + hdr->tp_next_offset);
+			pq->remaining--;
+		}
+
+		if(!pq->remaining) {
+			// Give the block back to the kernel
+			__sync_synchronize();
+			block->hdr.bh1.block_status = TP_STATUS_KERNEL;
+			pq->block = (pq->block + 1) % PACKET_BLOCK_COUNT;
+		}
+	}
+
+	queue->rx_packets += count;
+
+	return count;
+}
+
+static int packet_tx(IOQueue* queue, IOFrame* frames, int count) {
+	struct mmsghdr msgs[IO_BURST];
+	struct iovec iovs[IO_BURST];
+	int sent = 0;
+
+	while(sent < count) {
+		int burst = count - sent < IO_BURST ? count - sent : IO_BURST;
+
+		for(int i = 0; i < burst; i++) {
+			iovs[i].iov_base = frames[sent + i].buf;
+			iovs[i].iov_len = frames[sent + i].size;
+
+			memset(&msgs[i], 0, sizeof(struct mmsghdr));
+			msgs[i].msg_hdr.msg_iov = &iovs[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+		}
+
+		int ret = sendmmsg(queue->fd, msgs, burst, MSG_DONTWAIT);
+		if(ret <= 0)
+			break;
+
+		sent += ret;
+		if(ret < burst)
+			break;
+	}
+
+	return sent;
+}
+
+const IOBackend io_packet = {
+	.name	= "packet",
+	.open	= packet_open,
+	.close	= packet_close,
+	.rx	= packet_rx,
+	.tx	= packet_tx,
+};
@@ -0,0 +1,105 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <linux/if_tun.h>
+#include "io.h"
+
+/*
+ * TAP device. A multi-queue TAP device has an fd per queue and the kernel
+ * spreads flows over them, so each queue can be read by its own thread.
+ * There is no batched read syscall for TAP, a burst is read until EAGAIN.
+ */
+
+typedef struct {
+	uint8_t	buffer[IO_FRAME_SIZE];
+} TunQueue;
+
+static void tun_close(IOPort* port) {
+	for(int i = 0; i < port->queue_count; i++) {
+		IOQueue* queue = &port->queues[i];
+		if(queue->fd >= 0)
+			close(queue->fd);
+
+		free(queue->priv);
+		queue->fd = -1;
+		queue->priv = NULL;
+	}
+}
+
+static bool tun_open(IOPort* port) {
+	struct ifreq ifr;
+
+	for(int i = 0; i < port->queue_count; i++) {
+		IOQueue* queue = &port->queues[i];
+
+		queue->fd = open("/dev/net/tun", O_RDWR | O_NONBLOCK);
+		if(queue->fd < 0) {
+			perror("Clone device open");
+			goto error;
+		}
+
+		memset(&ifr, 0, sizeof(ifr));
+		ifr.ifr_flags = IFF_TAP | IFF_NO_PI;
+		if(port->queue_count > 1)
+			ifr.ifr_flags |= IFF_MULTI_QUEUE;
+		memcpy(ifr.ifr_name, port->name, IFNAMSIZ);
+
+		if(ioctl(queue->fd, TUNSETIFF, (void*)&ifr) < 0)
+			goto error;
+
+		// The kernel names the device if port->name is a template like tap%d
+		memcpy(port->name, ifr.ifr_name, IFNAMSIZ);
+
+		queue->priv = malloc(sizeof(TunQueue));
+		if(!queue->priv)
+			goto error;
+	}
+
+	return true;
+
+error:
+	tun_close(port);
+	return false;
+}
+
+static int tun_rx(IOQueue* queue, IOReceived received, void* context, int budget) {
+	TunQueue* tq = queue->priv;
+	int count = 0;
+
+	while(count < budget) {
+		ssize_t size = read(queue->fd, tq->buffer, IO_FRAME_SIZE);
+		if(size <= 0)
+			break;
+
+		received(queue, tq->buffer, size, context);
+		count++;
+	}
+
+	queue->rx_packets += count;
+
+	return count;
+}
+
+static int tun_tx(IOQueue* queue, IOFrame* frames, int count) {
+	int i;
+
+	for(i = 0; i < count; i++) {
+		// A TAP device takes a whole frame in a write or nothing
+		if(write(queue->fd, frames[i].buf, frames[i].size) < 0)
+			break;
+	}
+
+	return i;
+}
+
+const IOBackend io_tun = {
+	.name	= "tun",
+	.open	= tun_open,
+	.close	= tun_close,
+	.rx	= tun_rx,
+	.tx	= tun_tx,
+};
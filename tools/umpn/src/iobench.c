@@ -0,0 +1,217 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <signal.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include "io.h"
+
+/*
+ * Loopback benchmark of I/O backends. Frames are transmitted to one port and
+ * received from the other, e.g. both ends of a veth pair (see iobench-veth).
+ * Each rx queue is polled by its own thread.
+ */
+
+static volatile bool is_continue = true;
+static IOPort* tx_port;
+static IOPort* rx_port;
+static uint32_t frame_size = 64;
+
+static uint64_t now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+static void* tx_thread(void* data) {
+	static uint8_t buffer[IO_BURST][IO_FRAME_SIZE];
+	IOFrame frames[IO_BURST];
+
+	// Broadcast IPv4 frames of different flows so they are spread over queues.
+	// The source is not the port's address, a bridge would drop it
+	for(int i = 0; i < IO_BURST; i++) {
+		uint8_t* frame = buffer[i];
+		memset(frame, 0xff, 6);
+		memcpy(frame + 6, (uint8_t[]){ 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 }, 6);
+		frame[12] = 0x08;
+		frame[13] = 0x00;
+
+		uint8_t* ip = frame + 14;
+		ip[0] = 0x45;
+		ip[2] = (frame_size - 14) >> 8;
+		ip[3] = (frame_size - 14) & 0xff;
+		ip[8] = 64;
+		ip[9] = 17;
+		memcpy(ip + 12, (uint8_t[]){ 10, 0, 0, i }, 4);
+		memcpy(ip + 16, (uint8_t[]){ 10, 0, 1, 1 }, 4);
+
+		uint32_t sum = 0;
+		for(int j = 0; j < 20; j += 2)
+			sum += ip[j] << 8 | ip[j + 1];
+		sum = (sum & 0xffff) + (sum >> 16);
+		sum = ~((sum & 0xffff) + (sum >> 16));
+		ip[10] = sum >> 8;
+		ip[11] = sum & 0xff;
+
+		frames[i].buf = frame;
+		frames[i].size = frame_size;
+	}
+
+	while(is_continue) {
+		if(io_port_tx(tx_port, frames, IO_BURST) < IO_BURST)
+			sched_yield();
+	}
+
+	return NULL;
+}
+
+static void received(IOQueue* queue, uint8_t* buf, uint32_t size, void* context) {
+}
+
+static void* rx_thread(void* data) {
+	IOQueue* queue = data;
+	struct epoll_event event;
+
+	int epfd = epoll_create1(0);
+	if(epfd < 0) {
+		perror("epoll_create1");
+		return NULL;
+	}
+
+	event.events = EPOLLIN;
+	event.data.ptr = queue;
+	if(epoll_ctl(epfd, EPOLL_CTL_ADD, queue->fd, &event) < 0) {
+		perror("epoll_ctl");
+		close(epfd);
+		return NULL;
+	}
+
+	while(is_continue) {
+		// Drain the queue and sleep only when it is empty
+		if(queue->port->backend->rx(queue, received, NULL, IO_BURST) == IO_BURST)
+			continue;
+
+		epoll_wait(epfd, &event, 1, 100);
+	}
+
+	close(epfd);
+	return NULL;
+}
+
+static uint64_t rx_packets(void) {
+	uint64_t packets = 0;
+	for(int i = 0; i < rx_port->queue_count; i++)
+		packets += rx_port->queues[i].rx_packets;
+
+	return packets;
+}
+
+static uint64_t tx_packets(void) {
+	uint64_t packets = 0;
+	for(int i = 0; i < tx_port->queue_count; i++)
+		packets += tx_port->queues[i].tx_packets;
+
+	return packets;
+}
+
+static void stop(int signo) {
+	is_continue = false;
+}
+
+static void usage(const char* name) {
+	printf("Usage: %s [-b tun|packet] [-q queues] [-s frame size] [-d seconds] tx_ifname rx_ifname\n", name);
+}
+
+int main(int argc, char** argv) {
+	const IOBackend* backend = &io_packet;
+	int queue_count = 1;
+	int duration = 10;
+	int opt;
+
+	while((opt = getopt(argc, argv, "b:q:s:d:h")) != -1) {
+		switch(opt) {
+			case 'b':
+				backend = io_backend(optarg);
+				if(!backend) {
+					printf("Unknown backend: %s\n", optarg);
+					return 1;
+				}
+				break;
+			case 'q':
+				queue_count = atoi(optarg);
+				break;
+			case 's':
+				frame_size = atoi(optarg);
+				if(frame_size < 60 || frame_size > IO_FRAME_SIZE) {
+					printf("Frame size must be 60 ~ %d\n", IO_FRAME_SIZE);
+					return 1;
+				}
+				break;
+			case 'd':
+				duration = atoi(optarg);
+				break;
+			default:
+				usage(argv[0]);
+				return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	if(argc - optind != 2) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	tx_port = io_port_create(backend, argv[optind], queue_count);
+	rx_port = io_port_create(backend, argv[optind + 1], queue_count);
+	if(!tx_port || !rx_port) {
+		printf("Cannot open %s and %s with %s backend\n", argv[optind], argv[optind + 1], backend->name);
+		return 1;
+	}
+
+	signal(SIGINT, stop);
+
+	pthread_t rx_threads[IO_MAX_QUEUES];
+	pthread_t tx;
+	for(int i = 0; i < rx_port->queue_count; i++)
+		pthread_create(&rx_threads[i], NULL, rx_thread, &rx_port->queues[i]);
+	pthread_create(&tx, NULL, tx_thread, NULL);
+
+	printf("%s: %s -> %s, %d queues, %u bytes\n", backend->name, tx_port->name, rx_port->name,
+			queue_count, frame_size);
+
+	uint64_t start = now();
+	uint64_t last_time = start;
+	uint64_t last_rx = 0;
+	uint64_t last_tx = 0;
+	for(int i = 0; i < duration && is_continue; i++) {
+		sleep(1);
+
+		uint64_t time = now();
+		uint64_t rx = rx_packets();
+		uint64_t tx = tx_packets();
+		double sec = (time - last_time) / 1e9;
+		printf("tx %8.3f Mpps  rx %8.3f Mpps  %8.1f Mbps\n",
+				(tx - last_tx) / sec / 1e6, (rx - last_rx) / sec / 1e6,
+				(rx - last_rx) * frame_size * 8 / sec / 1e6);
+
+		last_time = time;
+		last_rx = rx;
+		last_tx = tx;
+	}
+
+	is_continue = false;
+	pthread_join(tx, NULL);
+	for(int i = 0; i < rx_port->queue_count; i++)
+		pthread_join(rx_threads[i], NULL);
+
+	double sec = (now() - start) / 1e9;
+	printf("total: tx %lu rx %lu, %.3f Mpps\n", tx_packets(), rx_packets(), rx_packets() / sec / 1e6);
+
+	io_port_destroy(tx_port);
+	io_port_destroy(rx_port);
+
+	return 0;
+}
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -7,23 +8,28 @@
 #include <errno.h>
 #include <malloc.h>
 #include <signal.h>
+#include <sched.h>
+#include <pthread.h>
 #include <tlsf.h>
 #include <sys/time.h>
 #include <sys/mman.h>
 #include <sys/wait.h>
+#include <sys/epoll.h>
 #include <util/cmd.h>
 #include <util/list.h>
 #include <util/types.h>
 #include <util/map.h>
 #include <gmalloc.h>
+#include <lock.h>
 #include <control/vmspec.h>
 #include "node.h"
 #include "ne.h"
+#include "io.h"
 
 #include "vm.h"
 
 #define MAX_LINE_SIZE 	2048
-#define BUFFER_SIZE 	2048	
+#define MAX_EVENTS	64
 
 #define ALIGN 			16 // TODO
 
@@ -31,11 +37,19 @@ VM* vm;
 
 static bool is_continue = true;
 
-static List* fd_list; 
 Group* ne;
-fd_set in_put, out_put;
 
-uint8_t buffer[BUFFER_SIZE];
+static int epfd;
+static const IOBackend* io_backend_type = &io_tun;
+static int io_queue_count = 1;
+static char* io_ifnames[VM_MAX_NIC_COUNT];
+
+// Threads mode runs the VM as pinned threads with a poller per queue
+static bool is_threads;
+static pthread_t app_threads[MAX_PROCESS_COUNT];
+static pthread_t pollers[MAX_PROCESS_COUNT];
+static volatile bool is_polling;
+static uint8_t volatile ni_lock;	// NI buffers are shared by pollers
 
 extern int main(int argc, char** argv);
 extern void destroy();
@@ -182,13 +196,20 @@ static int cmd_vm_create(int argc, char** argv, void(*callback)(char* result, in
 	
 	memset(_vm->argv, 0, sizeof(char*) * vmspec->argc);
 
-	ne = ne_create(_vm->nic_count);
+	if(is_threads && (_vm->process_size > MAX_PROCESS_COUNT || _vm->process_size > IO_MAX_QUEUES)) {
+		printf("process must be less than %d in threads mode\n", IO_MAX_QUEUES + 1);
+		goto error;
+	}
+
+	// Every thread has its own queue of each port in threads mode
+	ne = ne_create(_vm->nic_count, io_backend_type,
+			is_threads ? _vm->process_size : io_queue_count, io_ifnames);
 	if(ne == NULL)
 		goto error;
 
 	for(int i = 0; i < _vm->nic_count; i++) {
 		uint64_t attrs[] = {
-			NI_MAC, ((NEPort*)ne->nodes[i])->ti->mac,
+			NI_MAC, ((NEPort*)ne->nodes[i])->port->mac,
 			NI_DEV, i,
 			NI_INPUT_BUFFER_SIZE, vmspec->nics[i].input_buffer_size,
 			NI_OUTPUT_BUFFER_SIZE, vmspec->nics[i].output_buffer_size,
@@ -290,15 +311,242 @@ static int cmd_vm_destroy(int argc, char** argv, void(*callback)(char* result, i
 	return 0;
 }
 
+/*
+ * Signal handlers only set flags. An app thread stops or pauses at its next
+ * NI call, where it doesn't hold ni_lock or NI buffers.
+ */
+static volatile sig_atomic_t is_stopping;
+
 static void sigterm() {
-	destroy();
-	extern int __thread_id;
+	is_stopping = true;
+}
 
-	if(__thread_id == 0)
-		gdestroy();
+static __thread bool is_app;		// App thread or process, pollers are not
+static __thread int ni_lock_depth;	// Pollers call NI functions holding ni_lock
+
+static void app_yield() {
+	extern __thread int __thread_id;
+
+	if(!is_app)
+		return;
+
+	if(is_stopping) {
+		destroy();
+		printf("thread %d exit\n", __thread_id);
+
+		// The main thread destroys globals after every thread is joined
+		if(is_threads)
+			pthread_exit(NULL);
+
+		if(__thread_id == 0)
+			gdestroy();
+
+		exit(0);
+	}
+
+	while(is_threads && vm->status == VM_STATUS_PAUSE)
+		usleep(1000);
+}
+
+static void ni_enter() {
+	if(ni_lock_depth++ == 0)
+		lock_lock(&ni_lock);
+}
+
+static void ni_exit() {
+	if(--ni_lock_depth == 0) {
+		lock_unlock(&ni_lock);
+		app_yield();
+	}
+}
+
+/*
+ * NI functions of the SDK are wrapped by the linker (see Makefile), so app
+ * threads access NI buffers under ni_lock like pollers do.
+ */
+Packet* __real_ni_alloc(NetworkInterface* ni, uint16_t size);
+void __real_ni_free(Packet* packet);
+bool __real_ni_has_input(NetworkInterface* ni);
+Packet* __real_ni_input(NetworkInterface* ni);
+bool __real_ni_output(NetworkInterface* ni, Packet* packet);
+
+Packet* __wrap_ni_alloc(NetworkInterface* ni, uint16_t size) {
+	ni_enter();
+	Packet* packet = __real_ni_alloc(ni, size);
+	ni_exit();
+
+	return packet;
+}
+
+void __wrap_ni_free(Packet* packet) {
+	ni_enter();
+	__real_ni_free(packet);
+	ni_exit();
+}
+
+bool __wrap_ni_has_input(NetworkInterface* ni) {
+	ni_enter();
+	bool result = __real_ni_has_input(ni);
+	ni_exit();
+
+	return result;
+}
+
+Packet* __wrap_ni_input(NetworkInterface* ni) {
+	ni_enter();
+	Packet* packet = __real_ni_input(ni);
+	ni_exit();
+
+	return packet;
+}
+
+bool __wrap_ni_output(NetworkInterface* ni, Packet* packet) {
+	ni_enter();
+	bool result = __real_ni_output(ni, packet);
+	ni_exit();
+
+	return result;
+}
+
+static void input(IOQueue* queue, uint8_t* buf, uint32_t size, void* context) {
+	ni_port = queue->port->index;
+
+	ni_enter();
+	ni_process_input(buf, size, NULL, 0);
+	ni_exit();
+}
+
+/*
+ * Transmit a burst of output packets of a port, to the queue or spreading
+ * them over the queues if queue is NULL
+ */
+static void output(IOPort* port, IOQueue* queue) {
+	Packet* packets[IO_BURST];
+	IOFrame frames[IO_BURST];
+	int count;
+
+	ni_port = port->index;
+
+	ni_enter();
+	for(count = 0; count < IO_BURST; count++) {
+		Packet* packet = ni_process_output();
+		if(!packet)
+			break;
+
+		packets[count] = packet;
+		frames[count].buf = packet->buffer + packet->start;
+		frames[count].size = packet->end - packet->start;
+	}
+	ni_exit();
+
+	if(count == 0)
+		return;
+
+	if(queue) {
+		int sent = port->backend->tx(queue, frames, count);
+		queue->tx_packets += sent;
+		queue->tx_drop_packets += count - sent;
+	} else {
+		io_port_tx(port, frames, count);
+	}
+
+	ni_enter();
+	for(int i = 0; i < count; i++)
+		ni_free(packets[i]);
+	ni_exit();
+}
+
+/*
+ * Poller of a queue of every port in threads mode
+ */
+static void* poller(void* data) {
+	int index = (int)(int64_t)data;
+	struct epoll_event events[MAX_EVENTS];
+
+	int fd = epoll_create1(0);
+	if(fd < 0)
+		return NULL;
+
+	for(int i = 0; i < ne->node_count; i++) {
+		IOQueue* queue = &((NEPort*)ne->nodes[i])->port->queues[index];
+		struct epoll_event event = { .events = EPOLLIN, .data.ptr = queue };
+		epoll_ctl(fd, EPOLL_CTL_ADD, queue->fd, &event);
+	}
+
+	while(is_polling) {
+		int count = epoll_wait(fd, events, MAX_EVENTS, 0);
+		for(int i = 0; i < count; i++) {
+			IOQueue* queue = events[i].data.ptr;
+			queue->port->backend->rx(queue, input, NULL, IO_BURST);
+		}
+
+		for(int i = 0; i < ne->node_count; i++) {
+			IOPort* port = ((NEPort*)ne->nodes[i])->port;
+			output(port, &port->queues[index]);
+		}
+	}
+
+	close(fd);
+	return NULL;
+}
+
+static void* app_thread(void* data) {
+	extern __thread int __thread_id;
+	__thread_id = (int)(int64_t)data;
+	is_app = true;
+
+	net_app_main(vm->argc, vm->argv);
+
+	return NULL;
+}
+
+static int vm_start_threads() {
+	extern int __nis_count;
+	extern NetworkInterface* __nis[];
+	extern int __thread_count;
+
+	extern uint8_t volatile* __barrior_lock;
+	extern uint32_t volatile* __barrior;
+
+	__nis_count = vm->nic_count;
+	for(int j = 0; j < vm->nic_count; j++) {
+		__nis[j] = vm->nics[j]->ni;
+	}
+	__thread_count = vm->process_size;
+	__barrior_lock = barrior_lock;
+	__barrior = barrior;
+
+	// Signal to stop app threads, SIGTERM is left for the process
+	is_stopping = false;
+	signal(SIGUSR2, sigterm);
+
+	is_polling = true;
+	for(int i = 0; i < vm->process_size; i++) {
+		if(pthread_create(&pollers[i], NULL, poller, (void*)(int64_t)i)) {
+			is_polling = false;
+			while(i--)
+				pthread_join(pollers[i], NULL);
+
+			return -4;
+		}
+	}
+
+	// Thread i runs on CPU i like cores of a PacketNgin VM
+	long cpu_count = sysconf(_SC_NPROCESSORS_ONLN);
+	for(int i = 0; i < vm->process_size; i++) {
+		pthread_attr_t attr;
+		cpu_set_t cpus;
 
-	printf("thread %d exit\n", __thread_id);
-	exit(0);
+		pthread_attr_init(&attr);
+		CPU_ZERO(&cpus);
+		CPU_SET(i % cpu_count, &cpus);
+		pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), &cpus);
+
+		pthread_create(&app_threads[i], &attr, app_thread, (void*)(int64_t)i);
+		pthread_attr_destroy(&attr);
+	}
+
+	return 0;
 }
 
 static int cmd_vm_start(int argc, char** argv, void(*callback)(char* result, int exit_status)) {
@@ -309,26 +557,38 @@ static int cmd_vm_start(int argc, char** argv, void(*callback)(char* result, int
 	if(vm->status != VM_STATUS_STOP)
 		return -2;
 
-	for(int i = 0; i < ne->node_count; i++) {
-		list_add(fd_list, (void*)(int64_t)(((NEPort*)ne->nodes[i])->ti->fd)); // tun fd
-	}
-
-	//set
-	for(int i = 0; i < list_size(fd_list); i++) {
-		FD_SET((int)(int64_t)list_get(fd_list, i), &in_put);
-		FD_SET((int)(int64_t)list_get(fd_list, i), &out_put);
-	}
+	for(int i = 0; i < ne->node_count; i++)
+		((NEPort*)ne->nodes[i])->port->index = i;
 
 	bzero((void*)barrior_lock, sizeof(uint8_t volatile));
 	bzero((void*)barrior, sizeof(uint32_t volatile));
 
+	if(is_threads) {
+		int ret = vm_start_threads();
+		if(ret < 0)
+			return ret;
+
+		vm->status = VM_STATUS_START;
+
+		return 0;
+	}
+
+	for(int i = 0; i < ne->node_count; i++) {
+		if(!io_port_poll(((NEPort*)ne->nodes[i])->port, epfd)) {
+			while(i--)
+				io_port_unpoll(((NEPort*)ne->nodes[i])->port, epfd);
+
+			return -3;
+		}
+	}
+
 	for(int i = 0; i < vm->process_size; i++) {
 		int pid = fork();
 
 		if(pid == 0) {
 			extern int __nis_count;
 			extern NetworkInterface* __nis[];
-			extern int __thread_id;
+			extern __thread int __thread_id;
 			extern int __thread_count;
 
 			extern uint8_t volatile* __barrior_lock;
@@ -343,6 +603,7 @@ static int cmd_vm_start(int argc, char** argv, void(*callback)(char* result, int
 			__barrior_lock = barrior_lock;
 			__barrior = barrior;
 
+			is_app = true;
 			signal(SIGTERM, sigterm);
 			net_app_main(vm->argc, vm->argv);
 
@@ -361,22 +622,32 @@ static int cmd_vm_stop(int argc, char** argv, void(*callback)(char* result, int
 	if(vm->status != VM_STATUS_START)
 		return -1;
 
+	if(is_threads) {
+		for(int i = 0; i < vm->process_size; i++)
+			pthread_kill(app_threads[i], SIGUSR2);
+
+		for(int i = 0; i < vm->process_size; i++)
+			pthread_join(app_threads[i], NULL);
+
+		is_polling = false;
+		for(int i = 0; i < vm->process_size; i++)
+			pthread_join(pollers[i], NULL);
+
+		// Every thread has destroyed its own, globals are destroyed once
+		gdestroy();
+
+		vm->status = VM_STATUS_STOP;
+
+		return 0;
+	}
+
 	for(int i = 0; i < vm->process_size; i++) {
 		kill(vm->pids[i], SIGTERM);
 		while(!(waitpid(vm->pids[i], NULL, WNOHANG) == vm->pids[i]));
 	}
 
-	FD_ZERO(&in_put);
-	FD_SET(STDIN_FILENO, &in_put);
-	FD_ZERO(&out_put);
-
-	ListIterator iter;
-	list_iterator_init(&iter, fd_list);
-
-	while(list_iterator_has_next(&iter)) {
-		list_iterator_next(&iter);
-		list_iterator_remove(&iter);
-	}
+	for(int i = 0; i < ne->node_count; i++)
+		io_port_unpoll(((NEPort*)ne->nodes[i])->port, epfd);
 
 	vm->status = VM_STATUS_STOP;
 
@@ -389,7 +660,8 @@ static int cmd_vm_pause(int argc, char** argv, void(*callback)(char* result, int
 
 	vm->status = VM_STATUS_PAUSE;
 
-	for(int i = 0; i < vm->process_size; i++) {
+	// App threads wait in their next NI call until resumed
+	for(int i = 0; i < vm->process_size && !is_threads; i++) {
 		kill(vm->pids[i], SIGSTOP);
 	}
 
@@ -402,7 +674,8 @@ static int cmd_vm_resume(int argc, char** argv, void(*callback)(char* result, in
 
 	vm->status = VM_STATUS_START;
 
-	for(int i = 0; i < vm->process_size; i++) {
+	// Paused threads return from their NI call by themselves
+	for(int i = 0; i < vm->process_size && !is_threads; i++) {
 		kill(vm->pids[i], SIGCONT);
 	}
 
@@ -545,8 +818,51 @@ static void get_cmd_line(int fd) {
 	eod = 0;
 }
 
+static void usage(const char* name) {
+	printf("Usage: %s [-t] [-b tun|packet] [-q queues] [-i ifname]...\n", name);
+	printf("  -t  run the VM as threads pinned to CPUs with a poller per queue\n");
+	printf("  -b  I/O backend, tun creates TAP devices and packet binds to -i interfaces\n");
+	printf("  -q  number of queues of each port\n");
+	printf("  -i  interface of the next NIC\n");
+}
+
 #undef main
 int main(int _argc, char** _argv) { 
+	int io_ifname_count = 0;
+	int opt;
+
+	while((opt = getopt(_argc, _argv, "tb:q:i:h")) != -1) {
+		switch(opt) {
+			case 't':
+				is_threads = true;
+				break;
+			case 'b':
+				io_backend_type = io_backend(optarg);
+				if(!io_backend_type) {
+					printf("Unknown I/O backend: %s\n", optarg);
+					return -1;
+				}
+				break;
+			case 'q':
+				io_queue_count = atoi(optarg);
+				if(io_queue_count < 1 || io_queue_count > IO_MAX_QUEUES) {
+					printf("Number of queues must be 1 ~ %d\n", IO_MAX_QUEUES);
+					return -1;
+				}
+				break;
+			case 'i':
+				if(io_ifname_count >= VM_MAX_NIC_COUNT) {
+					printf("Too many interfaces\n");
+					return -1;
+				}
+				io_ifnames[io_ifname_count++] = optarg;
+				break;
+			default:
+				usage(_argv[0]);
+				return opt == 'h' ? 0 : -1;
+		}
+	}
+
 	cmd_init();
 	ni_init0();
 
@@ -560,65 +876,45 @@ int main(int _argc, char** _argv) {
 	barrior_lock = gmalloc(sizeof(uint8_t volatile));
 	barrior = gmalloc(sizeof(uint32_t volatile));
 
-	fd_list = list_create(NULL);
+	epfd = epoll_create1(0);
+	if(epfd < 0)
+		return -1;
 
-	int fd, ret;
-	FD_ZERO(&in_put);
-	FD_ZERO(&out_put);
-	FD_SET(STDIN_FILENO, &in_put);
-	
-	fd_set temp_in, temp_out;
+	struct epoll_event event = { .events = EPOLLIN, .data.ptr = NULL };
+	if(epoll_ctl(epfd, EPOLL_CTL_ADD, STDIN_FILENO, &event) < 0)
+		return -1;
+
+	struct epoll_event events[MAX_EVENTS];
 
 	printf("> ");
 	fflush(stdout);
 	while(is_continue) {
-		temp_in = in_put;
-		temp_out = out_put;
+		// Output is polled while the VM is running, so don't sleep
+		bool is_running = !is_threads && vm && vm->status == VM_STATUS_START;
+		int count = epoll_wait(epfd, events, MAX_EVENTS, is_running ? 0 : -1);
 
-		fd = (int)(int64_t)list_get_last(fd_list);
-		ret = select(fd + 1, &temp_in, &temp_out, 0, 0);
+		if(count < 0) {
+			if(errno == EINTR)
+				continue;
 
-		if(ret == -1) {
 			printf("selector error \n");
 
 			return -1;
-		} else if(ret == 0) {
-			// select time over
-		} else {
-			if(FD_ISSET(STDIN_FILENO, &temp_in)) {
+		}
+
+		for(int i = 0; i < count; i++) {
+			IOQueue* queue = events[i].data.ptr;
+			if(!queue) {
 				get_cmd_line(STDIN_FILENO);
+				continue;
 			}
 
-			for(int i = 0; i < list_size(fd_list); i++) {
-				int fd_temp = (int)(int64_t)list_get(fd_list, i);
-
-				if(FD_ISSET(fd_temp, &temp_in)) {
-					extern int ni_port;
-					ni_port = i;
-					int size = read(fd_temp, buffer, BUFFER_SIZE); 
-					ni_process_input(buffer, size, NULL, 0);
-				}
-			}
+			queue->port->backend->rx(queue, input, NULL, IO_BURST);
+		}
 
-			for(int i = 0; i< list_size(fd_list); i++) {
-				int fd_temp = (int)(int64_t)list_get(fd_list, i);
-
-				if(FD_ISSET(fd_temp, &temp_out)) {
-					extern int ni_port;
-					ni_port = i;
-					Packet* packet = ni_process_output();
-
-					if(packet != NULL) {
-						int seek = 0;
-						int len = packet->end - packet->start;
-						while((seek += write(fd_temp, packet->buffer + packet->start + seek, len - seek))) {
-							if(len == seek)
-								break;
-						}
-						ni_free(packet);
-					}
-				}
-			}
+		if(is_running) {
+			for(int i = 0; i < ne->node_count; i++)
+				output(((NEPort*)ne->nodes[i])->port, NULL);
 		}
 	}
 
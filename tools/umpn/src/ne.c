@@ -3,22 +3,20 @@
 #include <unistd.h>
 #include "ne.h"
 
+#define NE_MAX_TAP_COUNT	100
+
 static void send(Node* this, Packet* packet) {
-	printf("NE send to %s\n", ((NEPort*)this)->ti->name);
+	IOPort* port = ((NEPort*)this)->port;
+	printf("NE send to %s\n", port->name);
 
-	if(((NEPort*)this)->ti) {
-		int len = packet->end - packet->start;
-		int seek = 0;
-		while(seek += write(((NEPort*)this)->ti->fd, packet->buffer + packet->start + seek, len - seek))
-			if(len == seek)
-				break;
-	}
+	IOFrame frame = { packet->buffer + packet->start, packet->end - packet->start };
+	io_port_tx(port, &frame, 1);
 	
 	//free(packet);
 }
 
 static void received(NEPort* this, Packet* packet) { 
-	printf("NE received from %s\n", ((NEPort*)this)->ti->name);
+	printf("NE received from %s\n", this->port->name);
 	if(this->out) {
 		this->out->send(this->out, packet);
 	} else {
@@ -27,7 +25,7 @@ static void received(NEPort* this, Packet* packet) {
 	}
 }
 
-Group* ne_create(int port_count) { 
+Group* ne_create(int port_count, const IOBackend* backend, int queue_count, char** ifnames) { 
 	Group* ne = (Group*)malloc(sizeof(Group));
 	if(!ne) {
 		printf("NE create malloc error\n");
@@ -58,11 +56,21 @@ Group* ne_create(int port_count) {
 		// mapping port to tap interface
 		ne_port->type = NODE_TYPE_NE_PORT;
 
-		char name[16];
-		sprintf(name, "tap%d", k + 100);
-		while(!(ne_port->ti = tun_create(name, IFF_TAP | IFF_NO_PI))) {
-			k++;
-			sprintf(name, "tap%d", k + 100);
+		if(ifnames[i]) {
+			ne_port->port = io_port_create(backend, ifnames[i], queue_count);
+		} else if(backend == &io_tun) {
+			char name[IFNAMSIZ];
+			for(; !ne_port->port && k < NE_MAX_TAP_COUNT; k++) {
+				sprintf(name, "tap%d", k + 100);
+				ne_port->port = io_port_create(backend, name, queue_count);
+			}
+		}
+
+		if(!ne_port->port) {
+			printf("NE port %d cannot be opened by %s backend\n", i, backend->name);
+			free(ne_port);
+			ne_destroy(ne);
+			return NULL;
 		}
 
 		ne_port->send = send;
@@ -79,12 +87,12 @@ Group* ne_create(int port_count) {
 }
 
 bool ne_destroy(Group* ne) {
-	for(int i = 0; ne->nodes[i] != NULL; i++) {
-		tun_destroy(((NEPort*)ne->nodes[i])->ti);
+	for(int i = 0; i < ne->node_count && ne->nodes[i] != NULL; i++) {
+		io_port_destroy(((NEPort*)ne->nodes[i])->port);
 		free(ne->nodes[i]);
 		ne->nodes[i] = NULL;
-		i++;
 	}
+	free(ne->nodes);
 	free(ne);
 	
 	printf("Network Emulator destroyed\n");
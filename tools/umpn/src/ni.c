@@ -15,9 +15,16 @@
 
 #define ALIGN	16
 
+#define NI_MAX_PORT_COUNT	16
+#define NI_MAX_PORT_NI_COUNT	16
+
 Map* nis;
 
-int ni_port;	// Current I/O port
+// NIs of each port, pollers don't look up every NI of the VM
+static NI* port_nis[NI_MAX_PORT_COUNT][NI_MAX_PORT_NI_COUNT];
+static int port_ni_counts[NI_MAX_PORT_COUNT];
+
+__thread int ni_port;	// Current I/O port of the poller thread
 
 uint64_t ni_mac;
 uint64_t ni_rx;
@@ -249,8 +256,16 @@ NI* ni_create(uint64_t* attrs) {
 	// Config
 	ni->ni->config = map_create(8, NULL, NULL, ni->pool);
 	
+	if(ni->port < 0 || ni->port >= NI_MAX_PORT_COUNT ||
+			port_ni_counts[ni->port] >= NI_MAX_PORT_NI_COUNT) {
+		errno = 5;
+		tlsf_free(ni);
+		return NULL;
+	}
+
 	// Register the ni
 	map_put(nis, (void*)ni->mac, ni);
+	port_nis[ni->port][port_ni_counts[ni->port]++] = ni;
 	
 	return ni;
 }
@@ -258,6 +273,16 @@ NI* ni_create(uint64_t* attrs) {
 void ni_destroy(NI* ni) {
 	// Unregister the ni
 	map_remove(nis, (void*)ni->mac);
+
+	NI** _nis = port_nis[ni->port];
+	int* count = &port_ni_counts[ni->port];
+	for(int i = 0; i < *count; i++) {
+		if(_nis[i] == ni) {
+			memmove(&_nis[i], &_nis[i + 1], sizeof(NI*) * (*count - i - 1));
+			(*count)--;
+			break;
+		}
+	}
 	
 	// Free pools
 	ListIterator iter;
@@ -631,16 +656,9 @@ dropped:
 	}
 	
 	if(dmac & ETHER_MULTICAST) {
-		MapIterator iter;
-		map_iterator_init(&iter, nis);
-		while(map_iterator_has_next(&iter)) {
-			MapEntry* entry = map_iterator_next(&iter);
-			NI* ni = entry->data;
-			if(ni->port == ni_port) {
-				if(input(ni)) {
-					ni_rx++;
-				}
-			}
+		for(int i = 0; i < port_ni_counts[ni_port]; i++) {
+			if(input(port_nis[ni_port][i]))
+				ni_rx++;
 		}
 	} else {
 		NI* ni = map_get(nis, (void*)dmac);
@@ -654,13 +672,8 @@ dropped:
 Packet* ni_process_output() {
 	//uint64_t time = cpu_tsc();
 	
-	MapIterator iter;
-	map_iterator_init(&iter, nis);
-	while(map_iterator_has_next(&iter)) {
-		MapEntry* entry = map_iterator_next(&iter);
-		NI* ni = entry->data;
-		if(ni->port != ni_port)
-			continue;
+	for(int i = 0; i < port_ni_counts[ni_port]; i++) {
+		NI* ni = port_nis[ni_port][i];
 		
 		/*
 		if(ni->output_closed - ni->output_wait_grace > time) {